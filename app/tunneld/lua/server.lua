@@ -1,5 +1,6 @@
 local net = require('net')
 local rpc = require('app/rpc')
+local mux = require('app/mux')
 
 local exports = {}
 
@@ -38,16 +39,16 @@ exports.tunnel = function(port, key)
         connection.id = key
         tunnelServer.connections[key] = connection
 
-        local buffer
+        local buffer = {} -- 绑定远端连接前收到的数据
  
         -- 设置这个客户端连接的远端连接
         function connection:setRemoteConnection(remoteConnection)
             console.log('set remote tunnel connection')
             self.remoteConnection = remoteConnection
 
-            if (buffer) and (remoteConnection) then
-                remoteConnection:write(buffer)
-                buffer = nil
+            if (#buffer > 0) and (remoteConnection) then
+                remoteConnection:write(table.concat(buffer))
+                buffer = {}
             end
         end
 
@@ -61,36 +62,17 @@ exports.tunnel = function(port, key)
             end
         end
 
+        -- 绑定远端连接后, 数据由 net.relay 直接转发, 不再触发 'data' 事件
         local function onData(chunk)
-            console.log('on tunnel client data', #chunk)
-
-            if (connection.remoteConnection) then
-                -- 转发客户端发送的数据给远端连接
-                local address = connection.remoteConnection:address()
-                console.log('remote', address.port)
-
-                if (buffer) then
-                    connection.remoteConnection:write(buffer)
-                    buffer = nil
-                end
-
-                connection.remoteConnection:write(chunk)
-
-            else
-                -- 缓存客户端发送的数据
-                console.log('data: remote connection is null')
-                if (buffer) then
-                    buffer = buffer .. chunk
-                else
-                    buffer = chunk
-                end
-            end
+            -- 缓存客户端发送的数据
+            console.log('data: remote connection is null')
+            buffer[#buffer + 1] = chunk
         end
         
         local function onEnd()
             -- 关闭这个连接相关的远端连接
             if (connection.remoteConnection) then
-                connection.remoteConnection:close()
+                connection.remoteConnection:destroy()
                 connection.remoteConnection = nil
             end
 
@@ -98,6 +80,17 @@ exports.tunnel = function(port, key)
             tunnelSessions[key] = nil
         end
 
+        connection.release = onEnd
+
+        -- 前端设备支持多路复用时, 直接在多路复用连接上打开一个新的流
+        local muxSession = tunnelServer.muxSession
+        if (muxSession) then
+            local stream = muxSession:open(key)
+            stream:on('close', onEnd)
+            mux.bridge(connection, stream)
+            return
+        end
+
         createRequest()
 
         connection:on("data", onData)
@@ -114,6 +107,11 @@ exports.tunnel = function(port, key)
     tunnelServer:on("close", function(error)
         console.log("tunnel server close (error, key)", error, key, tunnelServer.connections)
         tunnelServers[key] = nil
+
+        if (tunnelServer.muxSession) then
+            tunnelServer.muxSession:destroy()
+            tunnelServer.muxSession = nil
+        end
     end)
 
     console.log('create a new tunnel server (port, key)', port, key)
@@ -124,6 +122,36 @@ exports.tunnel = function(port, key)
     return tunnelServer
 end
 
+-- ----------------------------------------------------------------------------
+-- relay
+
+local relayStats = { tunnels = 0, active = 0, bytes = 0 }
+
+-- 绑定前端设备的隧道连接和客户端连接, 之后两个连接之间的数据由 C 层直接转发
+local function startRelay(connection, proxyConnection)
+    connection:setRemoteConnection(proxyConnection)
+    proxyConnection:setRemoteConnection(connection)
+
+    relayStats.tunnels = relayStats.tunnels + 1
+    relayStats.active = relayStats.active + 1
+
+    local relay = net.relay(connection, proxyConnection, function(err, stats)
+        console.log('relay end (error, stats)', err, stats)
+        relayStats.active = relayStats.active - 1
+        if (stats) then
+            relayStats.bytes = relayStats.bytes + stats.forward.bytes + stats.backward.bytes
+        end
+
+        connection.relay = nil
+        proxyConnection.relay = nil
+        connection.release()
+        proxyConnection.release()
+    end)
+
+    connection.relay = relay
+    proxyConnection.relay = relay
+end
+
 -- ----------------------------------------------------------------------------
 -- server
 
@@ -168,8 +196,35 @@ local function onServerConnection(connection)
             connection.tunnelServer = tunnelServer
         end
 
+        -- 第 4 行表示服务器支持多路复用, 旧的客户端会忽略它
         connection.lastPingTime = Date.now()
-        connection:write('pong\n' .. tunnelServer.publicPort .. '\n' .. tunnelServer.token .. '\n\n')
+        connection:write('pong\n' .. tunnelServer.publicPort .. '\n' .. tunnelServer.token .. '\nmux\n\n')
+    end
+
+    -- 这是一个多路复用连接, 之后这个连接上只传输二进制帧
+    local function onMuxMessage(lines)
+        local tunnelServer = tunnelServers[lines[2]]
+        if (not tunnelServer) or (connection.remoteConnection) then
+            return
+        end
+
+        if (tunnelServer.muxSession) then
+            tunnelServer.muxSession:destroy()
+        end
+
+        connection:write('mux\n\n')
+
+        local session = mux.createSession(connection, { isServer = true, buffer = buffer })
+        buffer = nil
+
+        connection.muxSession = session
+        tunnelServer.muxSession = session
+
+        session:on('close', function()
+            if (tunnelServer.muxSession == session) then
+                tunnelServer.muxSession = nil
+            end
+        end)
     end
 
     -- 这是一个 tunnel 连接，需要绑定到相关的客户端连接
@@ -189,8 +244,7 @@ local function onServerConnection(connection)
         end
 
         console.log('create a proxy connection', proxyConnection:address().port)
-        connection:setRemoteConnection(proxyConnection)
-        proxyConnection:setRemoteConnection(connection)
+        startRelay(connection, proxyConnection)
     end
 
     local function onMessage(message)
@@ -205,14 +259,16 @@ local function onServerConnection(connection)
 
         elseif (type == 'tunnel') then
             onTunnelMessage(lines)
+
+        elseif (type == 'mux') then
+            onMuxMessage(lines)
         end
     end
 
     local function onData(chunk)
         -- console.log('data', chunk)
 
-        if (connection.remoteConnection) then
-            connection.remoteConnection:write(chunk)
+        if (connection.muxSession) then
             return
         end
 
@@ -222,7 +278,8 @@ local function onServerConnection(connection)
             buffer = chunk
         end
         
-        while (buffer and #buffer > 0) do
+        -- 绑定远端连接后, 剩余的数据在 setRemoteConnection 中转发
+        while (buffer and #buffer > 0) and (not connection.remoteConnection) do
             local position = string.find(buffer, '\n\n')
             if (not position) then
                 break
@@ -238,7 +295,7 @@ local function onServerConnection(connection)
     local function onEnd(error)
         console.log('on server connection end', error)
         if (connection.remoteConnection) then
-            connection.remoteConnection:close()
+            connection.remoteConnection:destroy()
             connection.remoteConnection = nil
         end
 
@@ -250,6 +307,8 @@ local function onServerConnection(connection)
         mainServer.connections[key] = nil
     end
 
+    connection.release = onEnd
+
     connection:on("data", onData)
     connection:on('end', onEnd)
 end
@@ -294,7 +353,8 @@ function exports.rpc()
                 table.insert(status.server.connections, {
                     id = connection.id,
                     server = connection.tunnelServer ~= nil,
-                    remote = remoteId
+                    remote = remoteId,
+                    relay = connection.relay and connection.relay:stats()
                 })
             end
         end
@@ -306,6 +366,7 @@ function exports.rpc()
             table.insert(status.tunnelServers, {
                 id = tunnelServer.key,
                 publicPort = tunnelServer.publicPort,
+                mux = tunnelServer.muxSession ~= nil,
                 connections = connections
             })
 
@@ -326,6 +387,8 @@ function exports.rpc()
             })
         end
 
+        status.relay = relayStats
+
         return status
     end
 
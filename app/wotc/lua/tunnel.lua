@@ -1,9 +1,14 @@
 local net = require('net')
+local mux = require('app/mux')
 
 local exports = {}
 
 local PORT = 8877
 
+-- 多路复用连接失败后等待多长时间再重试 (毫秒), 每次失败加倍
+local MUX_RETRY_MIN = 10 * 1000
+local MUX_RETRY_MAX = 10 * 60 * 1000
+
 -- ----------------------------------------------------------------------------
 -- Tunnel client
 -- 用于和云服务器建议 TCP/IP 隧道，充许外网的客户端访问本地的服务
@@ -116,6 +121,81 @@ exports.createSession = function(serverPort, serverAddress, localPort, localAddr
     return localClient
 end
 
+-- 创建多路复用连接, 之后所有的隧道会话都通过这个连接传输
+-- 连接失败或者服务器拒绝时 callback 的参数为 nil, 仍然使用每个会话一个连接的方式
+-- @param {String} token 隧道服务器返回的 token
+exports.createMuxSession = function(serverPort, serverAddress, token, localPort, localAddress, callback)
+    local socket = net.Socket:new()
+    local buffer = ''
+    local timeoutTimer = nil
+
+    local function onFinish(session)
+        if (timeoutTimer) then
+            clearTimeout(timeoutTimer)
+            timeoutTimer = nil
+        end
+
+        if (callback) then
+            callback(session)
+            callback = nil
+        end
+    end
+
+    -- 服务器发送的每一个流对应一个本地连接
+    local function onStream(stream, sessionId)
+        console.log('on mux stream', sessionId)
+
+        local localClient = net.Socket:new()
+        localClient:on("error", function(error)
+            console.log("local client error", error)
+            stream:destroy()
+        end)
+
+        localClient:connect(localPort, localAddress, function()
+            mux.bridge(localClient, stream)
+        end)
+    end
+
+    -- 等待服务器的确认消息, 之后的数据都是二进制帧
+    local function onData(chunk)
+        buffer = buffer .. chunk
+
+        local position = string.find(buffer, '\n\n')
+        if (not position) then
+            return
+        end
+
+        socket:removeListener('data', onData)
+
+        if (string.sub(buffer, 1, position - 1) ~= 'mux') then
+            socket:destroy()
+            return onFinish(nil)
+        end
+
+        local session = mux.createSession(socket, { buffer = string.sub(buffer, position + 2) })
+        session:on('stream', onStream)
+        onFinish(session)
+    end
+
+    socket:on("error", function(error)
+        console.log("mux client error", error)
+        onFinish(nil)
+    end)
+
+    socket:connect(serverPort, serverAddress, function()
+        socket:on("data", onData)
+        socket:write("mux\n" .. token .. "\n\n")
+    end)
+
+    timeoutTimer = setTimeout(5000, function()
+        timeoutTimer = nil
+        socket:destroy()
+        onFinish(nil)
+    end)
+
+    return socket
+end
+
 -- 创建一个新的隧道客户端
 -- @param {Number} serverPort 隧道服务器端口
 -- @param {String} serverAddress 隧道服务器地址
@@ -136,7 +216,8 @@ exports.createClient = function(serverPort, serverAddress, localPort, localAddre
 			
         end
         
-        client:write("ping\n\n", onWrite)
+        -- 第 2 行表示客户端支持多路复用
+        client:write("ping\nmux\n\n", onWrite)
     end
 
     local function onRequestMessage(lines)
@@ -154,12 +235,44 @@ exports.createClient = function(serverPort, serverAddress, localPort, localAddre
         return connection
     end
 
+    local function startMuxSession()
+        client.muxConnecting = true
+        exports.createMuxSession(serverPort, serverAddress, client.token, localPort, localAddress, function(session)
+            client.muxConnecting = false
+            client.muxSession = session
+            if (not session) then
+                -- 服务器已经声明支持多路复用, 失败可能只是暂时的, 等待一段时间后
+                -- 在之后的 pong 消息中重试
+                local delay = client.muxRetryDelay or MUX_RETRY_MIN
+                client.muxRetryDelay = math.min(delay * 2, MUX_RETRY_MAX)
+                client.muxRetryTimer = setTimeout(delay, function()
+                    client.muxRetryTimer = nil
+                end)
+                return
+            end
+
+            client.muxRetryDelay = nil
+
+            session:on('close', function()
+                if (client.muxSession == session) then
+                    client.muxSession = nil
+                end
+            end)
+        end)
+    end
+
     local function onPongMessage(lines)
         local port = lines[2]
         local token = lines[3]
         client.port = port
         client.token = token
 
+        -- 服务器支持多路复用
+        if (lines[4] == 'mux') and (not client.muxSession) and
+            (not client.muxConnecting) and (not client.muxRetryTimer) then
+            startMuxSession()
+        end
+
         if (callback) then
             callback(port, token)
         end
@@ -273,6 +386,16 @@ exports.stop = function()
 
         client.connections = {}
         client:close()
+
+        if (client.muxSession) then
+            client.muxSession:destroy()
+            client.muxSession = nil
+        end
+
+        if (client.muxRetryTimer) then
+            clearTimeout(client.muxRetryTimer)
+            client.muxRetryTimer = nil
+        end
     end
 end
 
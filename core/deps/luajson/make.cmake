@@ -7,6 +7,7 @@ set(LUAJSONDIR ${CMAKE_CURRENT_LIST_DIR})
 
 include_directories(
   ${LUAJSONDIR}/src/
+  ${LUAJSONDIR}/../luautils/src/
 )
 
 set(SOURCES
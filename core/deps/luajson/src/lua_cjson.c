@@ -42,9 +42,22 @@
 #include <limits.h>
 #include <lua.h>
 #include <lauxlib.h>
+#include <stdint.h>
 
 #include "strbuf.h"
 #include "fpconv.h"
+#include "buffer.h"
+
+/* String escaping and whitespace/string scanning check 16 bytes at a time
+ * with SSE2 or NEON when available. Define CJSON_NO_SIMD to force the
+ * portable 8 byte (SWAR) and byte-at-a-time paths. */
+#if !defined(CJSON_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <emmintrin.h>
+#define CJSON_SIMD_SSE2
+#elif !defined(CJSON_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CJSON_SIMD_NEON
+#endif
 
 #ifndef CJSON_MODNAME
 #define CJSON_MODNAME   "cjson"
@@ -79,6 +92,10 @@ int strncasecmp(const char *s1, const char *s2, register int n);
 #define DEFAULT_DECODE_INVALID_NUMBERS 1
 #define DEFAULT_ENCODE_KEEP_BUFFER 1
 #define DEFAULT_ENCODE_NUMBER_PRECISION 14
+#define DEFAULT_ENCODE_SORT_KEYS 0
+
+/* Longest indent string accepted by encode(), same as JSON.stringify() */
+#define CJSON_MAX_INDENT 10
 
 #ifdef DISABLE_INVALID_NUMBERS
 #undef DEFAULT_DECODE_INVALID_NUMBERS
@@ -135,6 +152,14 @@ typedef struct {
     int encode_invalid_numbers;     /* 2 => Encode as "null" */
     int encode_number_precision;
     int encode_keep_buffer;
+    int encode_sort_keys;
+
+    /* Pretty printing, set by each encode() call */
+    char encode_indent[CJSON_MAX_INDENT + 1];
+    int encode_indent_len;
+
+    /* Stack of json_key_t used to sort the keys of nested objects */
+    strbuf_t sort_buf;
 
     int decode_invalid_numbers;
     int decode_max_depth;
@@ -143,6 +168,7 @@ typedef struct {
 typedef struct {
     const char *data;
     const char *ptr;
+    const char *end;  /* NUL terminator at the end of data */
     strbuf_t *tmp;    /* Temporary storage for strings */
     json_config_t *cfg;
     int current_depth;
@@ -154,9 +180,11 @@ typedef struct {
     union {
         const char *string;
         double number;
+        lua_Integer integer;
         int boolean;
     } value;
     int string_len;
+    int is_integer;   /* T_NUMBER stored in value.integer */
 } json_token_t;
 
 static const char *char2escape[256] = {
@@ -198,6 +226,193 @@ static const char *char2escape[256] = {
     NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
 };
 
+/* ===== SCANNING ===== */
+
+/* Each helper returns a pointer to the first byte in [p, end) that needs
+ * attention, or end. Vector loads never read past end. */
+
+#define JSON_SWAR_ONES  0x0101010101010101ULL
+#define JSON_SWAR_HIGHS 0x8080808080808080ULL
+
+/* Non-zero when any byte of x equals c */
+static inline uint64_t json_swar_eq(uint64_t x, unsigned char c)
+{
+    uint64_t y = x ^ (JSON_SWAR_ONES * c);
+    return (y - JSON_SWAR_ONES) & ~y & JSON_SWAR_HIGHS;
+}
+
+/* Non-zero when any byte of x is less than c (c <= 0x80) */
+static inline uint64_t json_swar_lt(uint64_t x, unsigned char c)
+{
+    return (x - JSON_SWAR_ONES * c) & ~x & JSON_SWAR_HIGHS;
+}
+
+#if defined(CJSON_SIMD_SSE2) || defined(CJSON_SIMD_NEON)
+#define CJSON_SIMD
+
+#if defined(CJSON_SIMD_SSE2)
+typedef __m128i json_vec_t;
+
+/* Bits per byte in the mask returned by json_vec_mask() */
+#define JSON_VEC_SHIFT 0
+#define JSON_VEC_FULL  0xffffULL
+
+static inline json_vec_t json_vec_load(const char *p)
+{
+    return _mm_loadu_si128((const __m128i *)p);
+}
+
+static inline json_vec_t json_vec_eq(json_vec_t v, unsigned char c)
+{
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8((char)c));
+}
+
+/* Unsigned v <= c */
+static inline json_vec_t json_vec_le(json_vec_t v, unsigned char c)
+{
+    __m128i limit = _mm_set1_epi8((char)c);
+    return _mm_cmpeq_epi8(_mm_max_epu8(v, limit), limit);
+}
+
+static inline json_vec_t json_vec_or(json_vec_t a, json_vec_t b)
+{
+    return _mm_or_si128(a, b);
+}
+
+static inline uint64_t json_vec_mask(json_vec_t m)
+{
+    return (unsigned int)_mm_movemask_epi8(m);
+}
+#else
+typedef uint8x16_t json_vec_t;
+
+#define JSON_VEC_SHIFT 2
+#define JSON_VEC_FULL  0xffffffffffffffffULL
+
+static inline json_vec_t json_vec_load(const char *p)
+{
+    return vld1q_u8((const uint8_t *)p);
+}
+
+static inline json_vec_t json_vec_eq(json_vec_t v, unsigned char c)
+{
+    return vceqq_u8(v, vdupq_n_u8(c));
+}
+
+static inline json_vec_t json_vec_le(json_vec_t v, unsigned char c)
+{
+    return vcleq_u8(v, vdupq_n_u8(c));
+}
+
+static inline json_vec_t json_vec_or(json_vec_t a, json_vec_t b)
+{
+    return vorrq_u8(a, b);
+}
+
+/* 4 bits per byte, see "shift right and narrow" */
+static inline uint64_t json_vec_mask(json_vec_t m)
+{
+    uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(m), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+#endif
+
+/* Index of the first byte flagged in a non-zero mask */
+static inline int json_vec_first(uint64_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (int)index >> JSON_VEC_SHIFT;
+#else
+    return __builtin_ctzll(mask) >> JSON_VEC_SHIFT;
+#endif
+}
+#endif /* CJSON_SIMD_SSE2 || CJSON_SIMD_NEON */
+
+/* Find the first byte which must be escaped by json_append_string() */
+static const char *json_scan_escape(const char *p, const char *end)
+{
+#ifdef CJSON_SIMD
+    for (; p + 16 <= end; p += 16) {
+        json_vec_t v = json_vec_load(p);
+        json_vec_t m = json_vec_or(
+            json_vec_or(json_vec_le(v, 0x1f), json_vec_eq(v, '"')),
+            json_vec_or(json_vec_or(json_vec_eq(v, '\\'), json_vec_eq(v, '/')),
+                        json_vec_eq(v, 0x7f)));
+        uint64_t mask = json_vec_mask(m);
+        if (mask)
+            return p + json_vec_first(mask);
+    }
+#endif
+    for (; p + 8 <= end; p += 8) {
+        uint64_t x;
+        memcpy(&x, p, 8);
+        if (json_swar_lt(x, 0x20) | json_swar_eq(x, '"') |
+            json_swar_eq(x, '\\') | json_swar_eq(x, '/') |
+            json_swar_eq(x, 0x7f))
+            break;
+    }
+    for (; p < end; p++) {
+        if (char2escape[(unsigned char)*p])
+            break;
+    }
+    return p;
+}
+
+/* Find the end of a run of plain string characters: '"', '\\' or '\0' */
+static const char *json_scan_string(const char *p, const char *end)
+{
+#ifdef CJSON_SIMD
+    for (; p + 16 <= end; p += 16) {
+        json_vec_t v = json_vec_load(p);
+        json_vec_t m = json_vec_or(
+            json_vec_or(json_vec_eq(v, '"'), json_vec_eq(v, '\\')),
+            json_vec_eq(v, 0));
+        uint64_t mask = json_vec_mask(m);
+        if (mask)
+            return p + json_vec_first(mask);
+    }
+#endif
+    for (; p + 8 <= end; p += 8) {
+        uint64_t x;
+        memcpy(&x, p, 8);
+        if (json_swar_eq(x, '"') | json_swar_eq(x, '\\') | json_swar_eq(x, 0))
+            break;
+    }
+    for (; p < end; p++) {
+        if (*p == '"' || *p == '\\' || *p == '\0')
+            break;
+    }
+    return p;
+}
+
+/* Skip JSON whitespace */
+static const char *json_scan_whitespace(const char *p, const char *end)
+{
+#ifdef CJSON_SIMD
+    /* Most runs are short (pretty printed output), so check a single
+     * byte before paying for a vector load */
+    if (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+        return p;
+
+    for (; p + 16 <= end; p += 16) {
+        json_vec_t v = json_vec_load(p);
+        json_vec_t m = json_vec_or(
+            json_vec_or(json_vec_eq(v, ' '), json_vec_eq(v, '\t')),
+            json_vec_or(json_vec_eq(v, '\n'), json_vec_eq(v, '\r')));
+        uint64_t mask = json_vec_mask(m);
+        if (mask != JSON_VEC_FULL)
+            return p + json_vec_first(~mask);
+    }
+#endif
+    for (; p < end; p++) {
+        if (*p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+            break;
+    }
+    return p;
+}
+
 /* ===== CONFIGURATION ===== */
 
 static json_config_t *json_fetch_config(lua_State *l)
@@ -312,6 +527,15 @@ static int json_cfg_encode_number_precision(lua_State *l)
 }
 
 /* Configures JSON encoding buffer persistence */
+/* Configures whether object keys are sorted. encode() with an indent
+ * always sorts keys */
+static int json_cfg_encode_sort_keys(lua_State *l)
+{
+    json_config_t *cfg = json_arg_init(l, 1);
+
+    return json_enum_option(l, 1, &cfg->encode_sort_keys, NULL, 1);
+}
+
 static int json_cfg_encode_keep_buffer(lua_State *l)
 {
     json_config_t *cfg = json_arg_init(l, 1);
@@ -372,8 +596,10 @@ static int json_destroy_config(lua_State *l)
     json_config_t *cfg;
 
     cfg = (json_config_t *)lua_touserdata(l, 1);
-    if (cfg)
+    if (cfg) {
         strbuf_free(&cfg->encode_buf);
+        strbuf_free(&cfg->sort_buf);
+    }
     cfg = NULL;
 
     return 0;
@@ -401,6 +627,9 @@ static void json_create_config(lua_State *l)
     cfg->decode_invalid_numbers = DEFAULT_DECODE_INVALID_NUMBERS;
     cfg->encode_keep_buffer = DEFAULT_ENCODE_KEEP_BUFFER;
     cfg->encode_number_precision = DEFAULT_ENCODE_NUMBER_PRECISION;
+    cfg->encode_sort_keys = DEFAULT_ENCODE_SORT_KEYS;
+    cfg->encode_indent_len = 0;
+    strbuf_init(&cfg->sort_buf, 0);
 
 #if DEFAULT_ENCODE_KEEP_BUFFER > 0
     strbuf_init(&cfg->encode_buf, 0);
@@ -473,10 +702,12 @@ static void json_append_string(lua_State *l, strbuf_t *json, int lindex)
 {
     const char *escstr;
     const char *str;
+    const char *end;
+    const char *run;
     size_t len;
-    size_t i;
 
     str = lua_tolstring(l, lindex, &len);
+    end = str + len;
 
     /* Worst case is len * 6 (all unicode escapes).
      * This buffer is reused constantly for small strings
@@ -485,12 +716,19 @@ static void json_append_string(lua_State *l, strbuf_t *json, int lindex)
     strbuf_ensure_empty_length(json, len * 6 + 2);
 
     strbuf_append_char_unsafe(json, '\"');
-    for (i = 0; i < len; i++) {
-        escstr = char2escape[(unsigned char)str[i]];
-        if (escstr)
-            strbuf_append_string(json, escstr);
-        else
-            strbuf_append_char_unsafe(json, str[i]);
+    while (str < end) {
+        /* Copy the characters which don't need escaping in one go */
+        run = json_scan_escape(str, end);
+        if (run > str) {
+            strbuf_append_mem_unsafe(json, str, run - str);
+            str = run;
+            if (str == end)
+                break;
+        }
+
+        /* Escapes are either "\\x" or "\\uXXXX" */
+        escstr = char2escape[(unsigned char)*str++];
+        strbuf_append_mem_unsafe(json, escstr, escstr[1] == 'u' ? 6 : 2);
     }
     strbuf_append_char_unsafe(json, '\"');
 }
@@ -568,6 +806,17 @@ static void json_check_encode_depth(lua_State *l, json_config_t *cfg,
 static void json_append_data(lua_State *l, json_config_t *cfg,
                              int current_depth, strbuf_t *json);
 
+/* Start a new line indented to depth (pretty printing only) */
+static void json_append_newline(json_config_t *cfg, strbuf_t *json, int depth)
+{
+    int i;
+
+    strbuf_ensure_empty_length(json, 1 + depth * cfg->encode_indent_len);
+    strbuf_append_char_unsafe(json, '\n');
+    for (i = 0; i < depth; i++)
+        strbuf_append_mem_unsafe(json, cfg->encode_indent, cfg->encode_indent_len);
+}
+
 /* json_append_array args:
  * - lua_State
  * - JSON strbuf
@@ -586,20 +835,65 @@ static void json_append_array(lua_State *l, json_config_t *cfg, int current_dept
         else
             comma = 1;
 
+        if (cfg->encode_indent_len)
+            json_append_newline(cfg, json, current_depth);
+
         lua_rawgeti(l, -1, i);
         json_append_data(l, cfg, current_depth, json);
         lua_pop(l, 1);
     }
 
+    if (cfg->encode_indent_len)
+        json_append_newline(cfg, json, current_depth - 1);
+
     strbuf_append_char(json, ']');
 }
 
+/* Format an integer without going through a double, so that values
+ * beyond 2^53 (and beyond the number precision) are kept exact */
+static int json_format_integer(char *buf, lua_Integer value)
+{
+    char digits[24];
+    unsigned long long n;
+    int len = 0;
+    int i = 0;
+
+    if (value < 0) {
+        buf[len++] = '-';
+        n = 0ULL - (unsigned long long)value;
+    } else {
+        n = (unsigned long long)value;
+    }
+
+    do {
+        digits[i++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+
+    while (i > 0)
+        buf[len++] = digits[--i];
+
+    return len;
+}
+
 static void json_append_number(lua_State *l, json_config_t *cfg,
                                strbuf_t *json, int lindex)
 {
-    double num = lua_tonumber(l, lindex);
+    double num;
     int len;
 
+#if LUA_VERSION_NUM >= 503
+    if (lua_isinteger(l, lindex)) {
+        strbuf_ensure_empty_length(json, 24);
+        len = json_format_integer(strbuf_empty_ptr(json),
+                                  lua_tointeger(l, lindex));
+        strbuf_extend_length(json, len);
+        return;
+    }
+#endif
+
+    num = lua_tonumber(l, lindex);
+
     if (cfg->encode_invalid_numbers == 0) {
         /* Prevent encoding invalid numbers */
         if (isinf(num) || isnan(num))
@@ -632,10 +926,33 @@ static void json_append_number(lua_State *l, json_config_t *cfg,
     strbuf_extend_length(json, len);
 }
 
+/* Append the object key at lindex and the following ':' */
+static void json_append_key(lua_State *l, json_config_t *cfg,
+                            strbuf_t *json, int lindex)
+{
+    int keytype = lua_type(l, lindex);
+
+    if (keytype == LUA_TNUMBER) {
+        strbuf_append_char(json, '"');
+        json_append_number(l, cfg, json, lindex);
+        strbuf_append_mem(json, "\":", 2);
+    } else if (keytype == LUA_TSTRING) {
+        json_append_string(l, json, lindex);
+        strbuf_append_char(json, ':');
+    } else {
+        json_encode_exception(l, cfg, json, lindex,
+                              "table key must be a number or string");
+        /* never returns */
+    }
+
+    if (cfg->encode_indent_len)
+        strbuf_append_char(json, ' ');
+}
+
 static void json_append_object(lua_State *l, json_config_t *cfg,
                                int current_depth, strbuf_t *json)
 {
-    int comma, keytype;
+    int comma;
 
     /* Object */
     strbuf_append_char(json, '{');
@@ -650,27 +967,126 @@ static void json_append_object(lua_State *l, json_config_t *cfg,
             comma = 1;
 
         /* table, key, value */
-        keytype = lua_type(l, -2);
-        if (keytype == LUA_TNUMBER) {
-            strbuf_append_char(json, '"');
-            json_append_number(l, cfg, json, -2);
-            strbuf_append_mem(json, "\":", 2);
-        } else if (keytype == LUA_TSTRING) {
-            json_append_string(l, json, -2);
-            strbuf_append_char(json, ':');
+        json_append_key(l, cfg, json, -2);
+
+        /* table, key, value */
+        json_append_data(l, cfg, current_depth, json);
+        lua_pop(l, 1);
+        /* table, key */
+    }
+
+    strbuf_append_char(json, '}');
+}
+
+typedef struct {
+    const char *str;    /* String key, anchored by the table */
+    size_t len;
+    int is_integer;     /* Number key, formatted into number */
+    lua_Integer integer;
+    lua_Number number;
+    char text[32];      /* String form of a number key */
+} json_key_t;
+
+static int json_compare_keys(const void *a, const void *b)
+{
+    const json_key_t *ka = (const json_key_t *)a;
+    const json_key_t *kb = (const json_key_t *)b;
+    const char *sa = ka->str ? ka->str : ka->text;
+    const char *sb = kb->str ? kb->str : kb->text;
+    int ret;
+
+    ret = memcmp(sa, sb, ka->len < kb->len ? ka->len : kb->len);
+    if (ret)
+        return ret;
+
+    return (ka->len > kb->len) - (ka->len < kb->len);
+}
+
+/* Same as json_append_object(), but keys are in byte order. Number keys
+ * are ordered by their string form, like tostring(). This is the only
+ * object writer that handles indentation, so pretty output is sorted.
+ *
+ * The keys are collected on cfg->sort_buf (a stack shared with nested
+ * objects, which may reallocate it) instead of a Lua table per object */
+static void json_append_object_sorted(lua_State *l, json_config_t *cfg,
+                                      int current_depth, strbuf_t *json)
+{
+    strbuf_t *sort_buf = &cfg->sort_buf;
+    int base = strbuf_length(sort_buf);
+    json_key_t *key;
+    int count, i;
+
+    /* Collect the keys */
+    count = 0;
+    lua_pushnil(l);
+    while (lua_next(l, -2) != 0) {
+        /* table, key, value */
+        strbuf_ensure_empty_length(sort_buf, sizeof(*key));
+        key = (json_key_t *)strbuf_empty_ptr(sort_buf);
+
+        if (lua_type(l, -2) == LUA_TSTRING) {
+            key->str = lua_tolstring(l, -2, &key->len);
+        } else if (lua_type(l, -2) == LUA_TNUMBER) {
+            key->str = NULL;
+#if LUA_VERSION_NUM >= 503
+            key->is_integer = lua_isinteger(l, -2);
+#else
+            key->is_integer = 0;
+#endif
+            if (key->is_integer) {
+                key->integer = lua_tointeger(l, -2);
+                key->len = json_format_integer(key->text, key->integer);
+            } else {
+                key->number = lua_tonumber(l, -2);
+                key->len = snprintf(key->text, sizeof(key->text), "%.14g", key->number);
+            }
         } else {
             json_encode_exception(l, cfg, json, -2,
                                   "table key must be a number or string");
             /* never returns */
         }
 
-        /* table, key, value */
-        json_append_data(l, cfg, current_depth, json);
+        strbuf_extend_length(sort_buf, sizeof(*key));
+        count++;
         lua_pop(l, 1);
+    }
+
+    qsort(sort_buf->buf + base, count, sizeof(*key), json_compare_keys);
+
+    strbuf_append_char(json, '{');
+
+    for (i = 0; i < count; i++) {
+        if (i > 0)
+            strbuf_append_char(json, ',');
+
+        if (cfg->encode_indent_len)
+            json_append_newline(cfg, json, current_depth);
+
+        /* Nested objects may have moved sort_buf */
+        key = (json_key_t *)(sort_buf->buf + base) + i;
+        if (key->str)
+            lua_pushlstring(l, key->str, key->len);
+        else if (key->is_integer)
+            lua_pushinteger(l, key->integer);
+        else
+            lua_pushnumber(l, key->number);
+
         /* table, key */
+        json_append_key(l, cfg, json, -1);
+
+        /* table, value */
+        lua_rawget(l, -2);
+        json_append_data(l, cfg, current_depth, json);
+        lua_pop(l, 1);
     }
 
+    if (count && cfg->encode_indent_len)
+        json_append_newline(cfg, json, current_depth - 1);
+
     strbuf_append_char(json, '}');
+
+    /* Pop this object's keys */
+    sort_buf->length = base;
 }
 
 /* Serialise Lua data into JSON string. */
@@ -698,6 +1114,8 @@ static void json_append_data(lua_State *l, json_config_t *cfg,
         len = lua_array_length(l, cfg, json);
         if (len > 0)
             json_append_array(l, cfg, current_depth, json, len);
+        else if (cfg->encode_sort_keys || cfg->encode_indent_len)
+            json_append_object_sorted(l, cfg, current_depth, json);
         else
             json_append_object(l, cfg, current_depth, json);
         break;
@@ -717,19 +1135,17 @@ static void json_append_data(lua_State *l, json_config_t *cfg,
     }
 }
 
-static int json_encode(lua_State *l)
+/* Encode the value on the top of the Lua stack.
+ * Returns the shared buffer, or local_encode_buf when encode_keep_buffer
+ * is disabled (must be freed by the caller) */
+static strbuf_t *json_encode_value(lua_State *l, json_config_t *cfg,
+                                   strbuf_t *local_encode_buf)
 {
-    json_config_t *cfg = json_fetch_config(l);
-    strbuf_t local_encode_buf;
     strbuf_t *encode_buf;
-    char *json;
-    int len;
-
-    luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
 
     if (!cfg->encode_keep_buffer) {
         /* Use private buffer */
-        encode_buf = &local_encode_buf;
+        encode_buf = local_encode_buf;
         strbuf_init(encode_buf, 0);
     } else {
         /* Reuse existing buffer */
@@ -737,7 +1153,59 @@ static int json_encode(lua_State *l)
         strbuf_reset(encode_buf);
     }
 
+    strbuf_reset(&cfg->sort_buf);
     json_append_data(l, cfg, 0, encode_buf);
+    return encode_buf;
+}
+
+/* Set the indent used by the next encode: a string (up to 10 characters)
+ * or a number of spaces. nil, 0 or "" select compact output */
+static void json_set_indent(lua_State *l, json_config_t *cfg, int index)
+{
+    const char *indent;
+    lua_Integer spaces;
+    size_t len;
+
+    cfg->encode_indent_len = 0;
+
+    if (lua_isnoneornil(l, index))
+        return;
+
+    if (lua_type(l, index) == LUA_TNUMBER) {
+        spaces = luaL_checkinteger(l, index);
+        if (spaces < 0)
+            spaces = 0;
+        else if (spaces > CJSON_MAX_INDENT)
+            spaces = CJSON_MAX_INDENT;
+        len = (size_t)spaces;
+        memset(cfg->encode_indent, ' ', len);
+    } else {
+        indent = luaL_checklstring(l, index, &len);
+        if (len > CJSON_MAX_INDENT)
+            len = CJSON_MAX_INDENT;
+        memcpy(cfg->encode_indent, indent, len);
+    }
+
+    cfg->encode_indent_len = (int)len;
+}
+
+/* encode(value [, indent])
+ * With an indent the output is pretty printed and object keys are sorted */
+static int json_encode(lua_State *l)
+{
+    json_config_t *cfg = json_fetch_config(l);
+    strbuf_t local_encode_buf;
+    strbuf_t *encode_buf;
+    char *json;
+    int len;
+
+    luaL_argcheck(l, lua_gettop(l) >= 1, 1, "expected 1 argument");
+    luaL_argcheck(l, lua_gettop(l) <= 2, 3, "found too many arguments");
+
+    json_set_indent(l, cfg, 2);
+    lua_settop(l, 1);
+
+    encode_buf = json_encode_value(l, cfg, &local_encode_buf);
     json = strbuf_string(encode_buf, &len);
 
     lua_pushlstring(l, json, len);
@@ -748,6 +1216,44 @@ static int json_encode(lua_State *l)
     return 1;
 }
 
+/* encode_buffer(value, buffer)
+ * Append the JSON text of value to a luv_buffer_t (at its limit) without
+ * creating an intermediate Lua string.
+ * Returns the number of bytes written. */
+static int json_encode_buffer(lua_State *l)
+{
+    json_config_t *cfg = json_fetch_config(l);
+    strbuf_t local_encode_buf;
+    strbuf_t *encode_buf;
+    luv_buffer_t *buffer;
+    char *json;
+    int len;
+
+    luaL_argcheck(l, lua_gettop(l) == 2, 2, "expected 2 arguments");
+    buffer = (luv_buffer_t *)luaL_checkudata(l, 2, LUV_BUFFER);
+
+    cfg->encode_indent_len = 0;
+    lua_pushvalue(l, 1);
+    encode_buf = json_encode_value(l, cfg, &local_encode_buf);
+    json = strbuf_string(encode_buf, &len);
+
+    if (!buffer->data || len > buffer->length + 1 - buffer->limit) {
+        if (!cfg->encode_keep_buffer)
+            strbuf_free(encode_buf);
+        return luaL_error(l, "Cannot serialise into buffer: %d bytes required, %d available",
+                          len, buffer->data ? buffer->length + 1 - buffer->limit : 0);
+    }
+
+    memcpy(buffer->data + buffer->limit - 1, json, len);
+    buffer->limit += len;
+
+    if (!cfg->encode_keep_buffer)
+        strbuf_free(encode_buf);
+
+    lua_pushinteger(l, len);
+    return 1;
+}
+
 /* ===== DECODING ===== */
 
 static void json_process_value(lua_State *l, json_parse_t *json,
@@ -902,6 +1408,7 @@ static void json_set_token_error(json_token_t *token, json_parse_t *json,
 static void json_next_string_token(json_parse_t *json, json_token_t *token)
 {
     char *escape2char = json->cfg->escape2char;
+    const char *run;
     char ch;
 
     /* Caller must ensure a string is next */
@@ -916,40 +1423,46 @@ static void json_next_string_token(json_parse_t *json, json_token_t *token)
      */
     strbuf_reset(json->tmp);
 
-    while ((ch = *json->ptr) != '"') {
+    while (1) {
+        /* Copy plain characters up to the next quote/escape in one go */
+        run = json_scan_string(json->ptr, json->end);
+        if (run > json->ptr) {
+            strbuf_append_mem_unsafe(json->tmp, json->ptr, run - json->ptr);
+            json->ptr = run;
+        }
+
+        ch = *json->ptr;
+        if (ch == '"')
+            break;
+
         if (!ch) {
             /* Premature end of the string */
             json_set_token_error(token, json, "unexpected end of string");
             return;
         }
 
-        /* Handle escapes */
-        if (ch == '\\') {
-            /* Fetch escape character */
-            ch = *(json->ptr + 1);
-
-            /* Translate escape code and append to tmp string */
-            ch = escape2char[(unsigned char)ch];
-            if (ch == 'u') {
-                if (json_append_unicode_escape(json) == 0)
-                    continue;
+        /* Handle escapes: fetch escape character */
+        ch = *(json->ptr + 1);
 
-                json_set_token_error(token, json,
-                                     "invalid unicode escape code");
-                return;
-            }
-            if (!ch) {
-                json_set_token_error(token, json, "invalid escape code");
-                return;
-            }
+        /* Translate escape code and append to tmp string */
+        ch = escape2char[(unsigned char)ch];
+        if (ch == 'u') {
+            if (json_append_unicode_escape(json) == 0)
+                continue;
 
-            /* Skip '\' */
-            json->ptr++;
+            json_set_token_error(token, json,
+                                 "invalid unicode escape code");
+            return;
+        }
+        if (!ch) {
+            json_set_token_error(token, json, "invalid escape code");
+            return;
         }
-        /* Append normal character or translated single character
+
+        /* Append translated single character, skip '\' and the code.
          * Unicode escapes are handled above */
         strbuf_append_char_unsafe(json->tmp, ch);
-        json->ptr++;
+        json->ptr += 2;
     }
     json->ptr++;    /* Eat final quote (") */
 
@@ -1010,11 +1523,51 @@ static int json_is_invalid_number(json_parse_t *json)
     return 0;
 }
 
+/* Fast path for plain integers which fit in 64 bits, which are the common
+ * case and don't need strtod(). Returns 0 to fall back to strtod(). */
+static int json_next_integer_token(json_parse_t *json, json_token_t *token)
+{
+    const char *p = json->ptr;
+    unsigned long long value = 0;
+    int negative = 0;
+    int digits = 0;
+
+    if (*p == '-') {
+        negative = 1;
+        p++;
+    }
+
+    /* 19 digits can't overflow an unsigned 64 bit value */
+    for (; '0' <= *p && *p <= '9'; p++) {
+        if (++digits > 19)
+            return 0;
+        value = value * 10 + (*p - '0');
+    }
+
+    if (value > (unsigned long long)LLONG_MAX + negative)
+        return 0;
+
+    /* Leave fractions, exponents, hex, inf/nan etc to strtod() */
+    if (digits == 0 || *p == '.' || (*p | 0x20) == 'e' || (*p | 0x20) == 'x' ||
+        (*p | 0x20) == 'i' || (*p | 0x20) == 'n')
+        return 0;
+
+    token->type = T_NUMBER;
+    token->is_integer = 1;
+    token->value.integer = negative ? (lua_Integer)(0ULL - value) : (lua_Integer)value;
+    json->ptr = p;
+    return 1;
+}
+
 static void json_next_number_token(json_parse_t *json, json_token_t *token)
 {
     char *endptr;
 
+    if (json_next_integer_token(json, token))
+        return;
+
     token->type = T_NUMBER;
+    token->is_integer = 0;
     token->value.number = fpconv_strtod(json->ptr, &endptr);
     if (json->ptr == endptr)
         json_set_token_error(token, json, "invalid number");
@@ -1039,7 +1592,7 @@ static void json_next_token(json_parse_t *json, json_token_t *token)
         token->type = ch2token[ch];
         if (token->type != T_WHITESPACE)
             break;
-        json->ptr++;
+        json->ptr = json_scan_whitespace(json->ptr + 1, json->end);
     }
 
     /* Store location of new token. Required when throwing errors
@@ -1246,8 +1799,14 @@ static void json_process_value(lua_State *l, json_parse_t *json,
         lua_pushlstring(l, token->value.string, token->string_len);
         break;;
     case T_NUMBER:
+        if (token->is_integer) {
+            lua_pushinteger(l, token->value.integer);
+            break;
+        }
+
         // add by chengzhen
-        if (token->value.number == (int)token->value.number) {
+        if (token->value.number >= INT_MIN && token->value.number <= INT_MAX &&
+            token->value.number == (int)token->value.number) {
             lua_pushinteger(l, token->value.number);
         } else {
             lua_pushnumber(l, token->value.number);
@@ -1273,16 +1832,17 @@ static void json_process_value(lua_State *l, json_parse_t *json,
     }
 }
 
-static int json_decode(lua_State *l)
+/* Decode the JSON text data[0..len) and push the value.
+ * data[len] must be a NUL terminator. Raises a Lua error on invalid input. */
+static void json_decode_data(lua_State *l, json_config_t *cfg,
+                             const char *data, size_t json_len)
 {
     json_parse_t json;
     json_token_t token;
-    size_t json_len;
-
-    luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
 
-    json.cfg = json_fetch_config(l);
-    json.data = luaL_checklstring(l, 1, &json_len);
+    json.cfg = cfg;
+    json.data = data;
+    json.end = data + json_len;
     json.current_depth = 0;
     json.ptr = json.data;
 
@@ -1309,6 +1869,272 @@ static int json_decode(lua_State *l)
         json_throw_parse_error(l, &json, "the end", &token);
 
     strbuf_free(json.tmp);
+}
+
+static int json_decode(lua_State *l)
+{
+    json_config_t *cfg;
+    const char *data;
+    size_t json_len;
+
+    luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
+
+    cfg = json_fetch_config(l);
+    data = luaL_checklstring(l, 1, &json_len);
+    json_decode_data(l, cfg, data, json_len);
+
+    return 1;
+}
+
+/* ===== STREAM DECODING ===== */
+
+/* An incremental decoder for a sequence of JSON values (such as a large
+ * request body, or newline delimited JSON) which arrives in chunks.
+ *
+ * Chunks are buffered and scanned once to find where each top level value
+ * ends; completed values are then decoded with json_decode_data(). */
+
+#define CJSON_DECODER   "cjson.decoder"
+
+typedef struct {
+    json_config_t *cfg;
+    strbuf_t buf;       /* Input which has not been decoded yet */
+    int scanned;        /* Bytes of buf which have been scanned */
+    int depth;          /* Nesting depth of the current value */
+    int in_string;      /* Inside a string */
+    int escape;         /* Previous character was a '\' inside a string */
+    int in_scalar;      /* Inside a top level number or literal */
+    int failed;         /* A previous value failed to decode */
+    int count;          /* Values decoded by the current call */
+} json_decoder_t;
+
+static json_decoder_t *json_check_decoder(lua_State *l)
+{
+    json_decoder_t *decoder = (json_decoder_t *)luaL_checkudata(l, 1, CJSON_DECODER);
+
+    if (!decoder->cfg)
+        luaL_error(l, "JSON decoder is closed");
+    if (decoder->failed)
+        luaL_error(l, "JSON decoder failed on a previous error");
+
+    return decoder;
+}
+
+/* Decode buf[start..end) and append the value to the table at values */
+static void json_decoder_push(lua_State *l, json_decoder_t *decoder,
+                              int values, int start, int end)
+{
+    char *data = decoder->buf.buf;
+    char saved = data[end];
+
+    /* json_decode_data() relies on a NUL terminator. The decoder
+     * can't be used again if it throws an error here */
+    decoder->failed = 1;
+    data[end] = '\0';
+    json_decode_data(l, decoder->cfg, data + start, end - start);
+    data[end] = saved;
+    decoder->failed = 0;
+
+    lua_rawseti(l, values, ++decoder->count);
+}
+
+/* Scan the buffered input, decode all completed values into the table at
+ * values and drop them from the buffer */
+static void json_decoder_scan(lua_State *l, json_decoder_t *decoder, int values)
+{
+    char *data = decoder->buf.buf;
+    int len = strbuf_length(&decoder->buf);
+    int start = 0;      /* Start of the current value */
+    int i = decoder->scanned;
+    const char *p;
+    char ch;
+
+    while (i < len) {
+        ch = data[i];
+
+        if (decoder->in_string) {
+            if (decoder->escape) {
+                decoder->escape = 0;
+                i++;
+                continue;
+            }
+
+            p = json_scan_string(data + i, data + len);
+            i = p - data;
+            if (i >= len)
+                break;
+
+            if (*p == '\\') {
+                decoder->escape = 1;
+            } else if (*p == '"') {
+                decoder->in_string = 0;
+                if (decoder->depth == 0) {
+                    json_decoder_push(l, decoder, values, start, i + 1);
+                    start = i + 1;
+                }
+            }
+            i++;
+            continue;
+        }
+
+        if (decoder->in_scalar) {
+            switch (ch) {
+            case ' ': case '\t': case '\n': case '\r':
+            case '{': case '}': case '[': case ']':
+            case ',': case ':': case '"':
+                /* End of the scalar, rescan the delimiter */
+                decoder->in_scalar = 0;
+                json_decoder_push(l, decoder, values, start, i);
+                start = i;
+                break;
+            default:
+                i++;
+            }
+            continue;
+        }
+
+        switch (ch) {
+        case ' ': case '\t': case '\n': case '\r':
+            p = json_scan_whitespace(data + i, data + len);
+            i = p - data;
+            if (decoder->depth == 0)
+                start = i;
+            break;
+        case '"':
+            decoder->in_string = 1;
+            i++;
+            break;
+        case '{': case '[':
+            if (++decoder->depth > decoder->cfg->decode_max_depth)
+                luaL_error(l, "Found too many nested data structures (%d) at character %d",
+                           decoder->depth, i + 1);
+            i++;
+            break;
+        case '}': case ']':
+            i++;
+            if (decoder->depth == 0) {
+                /* Unbalanced, let the parser report it */
+                decoder->in_scalar = 1;
+            } else if (--decoder->depth == 0) {
+                json_decoder_push(l, decoder, values, start, i);
+                start = i;
+            }
+            break;
+        default:
+            if (decoder->depth == 0)
+                decoder->in_scalar = 1;
+            i++;
+        }
+    }
+
+    /* Keep only the incomplete value */
+    if (start > 0) {
+        memmove(data, data + start, len - start);
+        decoder->buf.length = len - start;
+    }
+    decoder->scanned = i - start;
+}
+
+/* decoder:write(chunk)
+ * Returns a table of the values completed by this chunk (may be empty) */
+static int json_decoder_write(lua_State *l)
+{
+    json_decoder_t *decoder = json_check_decoder(l);
+    const char *chunk;
+    size_t len;
+
+    chunk = luaL_checklstring(l, 2, &len);
+
+    /* Keep room for the NUL terminator used by json_decoder_push() */
+    strbuf_ensure_empty_length(&decoder->buf, (int)len + 1);
+    strbuf_append_mem_unsafe(&decoder->buf, chunk, (int)len);
+
+    lua_newtable(l);
+    decoder->count = 0;
+    json_decoder_scan(l, decoder, lua_gettop(l));
+
+    return 1;
+}
+
+/* decoder:finish()
+ * Decode the remaining input. Raises an error if it ends inside a value.
+ * Returns a table of the remaining values (may be empty) */
+static int json_decoder_finish(lua_State *l)
+{
+    json_decoder_t *decoder = json_check_decoder(l);
+    int len = strbuf_length(&decoder->buf);
+
+    lua_newtable(l);
+    decoder->count = 0;
+
+    if (decoder->depth > 0 || decoder->in_string)
+        luaL_error(l, "Expected the end of a value but found the end of the JSON stream");
+
+    if (decoder->in_scalar) {
+        strbuf_ensure_empty_length(&decoder->buf, 1);
+        json_decoder_push(l, decoder, lua_gettop(l), 0, len);
+        decoder->in_scalar = 0;
+    }
+
+    strbuf_reset(&decoder->buf);
+    decoder->scanned = 0;
+
+    return 1;
+}
+
+static int json_decoder_gc(lua_State *l)
+{
+    json_decoder_t *decoder = (json_decoder_t *)luaL_checkudata(l, 1, CJSON_DECODER);
+
+    if (decoder->cfg) {
+        strbuf_free(&decoder->buf);
+        decoder->cfg = NULL;
+    }
+
+    return 0;
+}
+
+/* decoder()
+ * Create a stream decoder using the configuration of this cjson instance */
+static int json_decoder_new(lua_State *l)
+{
+    luaL_Reg methods[] = {
+        { "write", json_decoder_write },
+        { "finish", json_decoder_finish },
+        { "close", json_decoder_gc },
+        { NULL, NULL }
+    };
+    json_config_t *cfg = json_fetch_config(l);
+    json_decoder_t *decoder;
+    int i;
+
+    decoder = (json_decoder_t *)lua_newuserdata(l, sizeof(*decoder));
+    memset(decoder, 0, sizeof(*decoder));
+    strbuf_init(&decoder->buf, 0);
+    decoder->cfg = cfg;
+
+    if (luaL_newmetatable(l, CJSON_DECODER)) {
+        lua_pushcfunction(l, json_decoder_gc);
+        lua_setfield(l, -2, "__gc");
+        lua_newtable(l);
+        for (i = 0; methods[i].name; i++) {
+            lua_pushcfunction(l, methods[i].func);
+            lua_setfield(l, -2, methods[i].name);
+        }
+        lua_setfield(l, -2, "__index");
+    }
+    lua_setmetatable(l, -2);
+
+    /* Keep the configuration alive as long as the decoder */
+#if LUA_VERSION_NUM >= 502
+    lua_pushvalue(l, lua_upvalueindex(1));
+    lua_setuservalue(l, -2);
+#else
+    lua_newtable(l);
+    lua_pushvalue(l, lua_upvalueindex(1));
+    lua_rawseti(l, -2, 1);
+    lua_setfenv(l, -2);
+#endif
 
     return 1;
 }
@@ -1340,15 +2166,16 @@ static void luaL_setfuncs (lua_State *l, const luaL_Reg *reg, int nup)
  * Convert and return thrown errors as: nil, "error message" */
 static int json_protect_conversion(lua_State *l)
 {
+    int nargs = lua_gettop(l);
     int err;
 
     /* Deliberately throw an error for invalid arguments */
-    luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
+    luaL_argcheck(l, nargs >= 1, 1, "expected 1 argument");
 
     /* pcall() the function stored as upvalue(1) */
     lua_pushvalue(l, lua_upvalueindex(1));
     lua_insert(l, 1);
-    err = lua_pcall(l, 1, 1, 0);
+    err = lua_pcall(l, nargs, 1, 0);
     if (!err)
         return 1;
 
@@ -1370,11 +2197,14 @@ static int lua_cjson_new(lua_State *l)
         { "decode", json_decode },
         { "decode_invalid_numbers", json_cfg_decode_invalid_numbers },
         { "decode_max_depth", json_cfg_decode_max_depth },
+        { "decoder", json_decoder_new },
         { "encode", json_encode },
+        { "encode_buffer", json_encode_buffer },
         { "encode_invalid_numbers", json_cfg_encode_invalid_numbers },
         { "encode_keep_buffer", json_cfg_encode_keep_buffer },
         { "encode_max_depth", json_cfg_encode_max_depth },
         { "encode_number_precision", json_cfg_encode_number_precision },
+        { "encode_sort_keys", json_cfg_encode_sort_keys },
         { "encode_sparse_array", json_cfg_encode_sparse_array },
         { "new", lua_cjson_new },
         { NULL, NULL }
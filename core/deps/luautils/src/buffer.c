@@ -94,10 +94,19 @@ static int buffer_init(luv_buffer_t* buffer, int length)
 	buffer->time_useconds 	= 0;
 	buffer->type 	 		= LUV_BUFFER_FLAG;
 	buffer->lock 			= NULL;
+	buffer->block 			= NULL;
 
 	if (length > 0) {
-		buffer->data = malloc(length + 2);
-		buffer->length = length;
+		luv_buffer_block_t* block = malloc(sizeof(luv_buffer_block_t) + length + 2);
+		if (block == NULL) {
+			return 0;
+		}
+
+		uv_mutex_init(&block->lock);
+		block->refs 	= 1;
+		buffer->block 	= block;
+		buffer->data 	= (char*)(block + 1);
+		buffer->length 	= length;
 	}
 
 	buffer->lock = malloc(sizeof(uv_mutex_t));
@@ -106,6 +115,26 @@ static int buffer_init(luv_buffer_t* buffer, int length)
 	return 1;
 }
 
+static void buffer_block_ref(luv_buffer_block_t* block)
+{
+	uv_mutex_lock(&block->lock);
+	block->refs++;
+	uv_mutex_unlock(&block->lock);
+}
+
+// 最后一个引用这个内存块的 buffer 关闭时才释放
+static void buffer_block_unref(luv_buffer_block_t* block)
+{
+	uv_mutex_lock(&block->lock);
+	int refs = --block->refs;
+	uv_mutex_unlock(&block->lock);
+
+	if (refs <= 0) {
+		uv_mutex_destroy(&block->lock);
+		free(block);
+	}
+}
+
 static int buffer_lock(luv_buffer_t* buffer)
 {
 	if (buffer && buffer->lock) {
@@ -128,24 +157,31 @@ static int buffer_unlock(luv_buffer_t* buffer)
 
 static int buffer_close(luv_buffer_t* buffer)
 {
-	if (buffer && buffer->data) {
-		free(buffer->data);
+	if (buffer == NULL) {
+		return 0;
+	}
+
+	uv_mutex_t* lock = buffer->lock;
+	buffer->lock = NULL;
+
+	if (lock) {
+		uv_mutex_destroy(lock);
+		free(lock);
+	}
+
+	if (buffer->data) {
+		if (buffer->block) {
+			buffer_block_unref(buffer->block);
+		}
 
 		//printf("ppp_buffer_free: %d\r\n", buffer->length);
 
+		buffer->block 	 = NULL;
 		buffer->data 	 = NULL;
 		buffer->length 	 = 0;
 		buffer->position = 1;
 		buffer->limit 	 = 1;
 
-		uv_mutex_t* lock = buffer->lock;
-		buffer->lock = NULL;
-
-		if (lock) {
-			uv_mutex_destroy(lock);
-			free(lock);
-		}
-
 		return 1;
 	}
 
@@ -219,6 +255,40 @@ static char* buffer_get_data(luv_buffer_t* buffer, int offset)
 	return buffer->data + (buffer->position - 1) + (offset - 1);
 }
 
+// 创建一个和 source 共享内存的 buffer, 不复制数据
+// @param offset 开始位置, 从 1 开始, 相对于 source 的 position
+// @param length 长度
+// @return 成功返回 1, 越界返回 0, source 没有内存块 (已关闭) 返回 -1
+static int buffer_slice(luv_buffer_t* buffer, luv_buffer_t* source, int offset, int length)
+{
+	if (!buffer_init(buffer, 0)) {
+		return 0;
+	}
+
+	if (source->block == NULL) {
+		return -1;
+	}
+
+	int size = buffer_get_size(source);
+	if (offset < 1 || length < 0 || (offset - 1 + length) > size) {
+		return 0;
+	}
+
+	if (length == 0) {
+		return 1;
+	}
+
+	buffer_block_ref(source->block);
+
+	buffer->block 	 = source->block;
+	buffer->data 	 = buffer_get_data(source, offset);
+	buffer->length 	 = length;
+	buffer->position = 1;
+	buffer->limit 	 = length + 1;
+
+	return 1;
+}
+
 static int buffer_index_of(luv_buffer_t* buffer, const char* data, int size, int offset)
 {
 	char* destBuffer = buffer_get_data(buffer, offset);
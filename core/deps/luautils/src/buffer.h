@@ -7,6 +7,13 @@
 
 #define LUV_BUFFER "luv_buffer_t"
 
+/* 缓存区的内存块, 由所有共享这块内存的 buffer (比如 slice) 引用计数,
+   这些 buffer 可能在不同的线程中使用, 所以 refs 由内存块自己的锁保护 */
+typedef struct luv_buffer_block_s {
+	uv_mutex_t lock;
+	int refs;
+} luv_buffer_block_t;
+
 typedef struct luv_buffer_s {
 	int   type;
 	char* data;
@@ -17,6 +24,7 @@ typedef struct luv_buffer_s {
 	int   time_seconds;
 	int   time_useconds;
 	uv_mutex_t* lock;		/* lock */
+	luv_buffer_block_t* block; /* shared memory block, data points into it */
 
 } luv_buffer_t;
 
@@ -170,6 +170,151 @@ static int luv_buffer_get_bytes(lua_State* L)
 	return 1;
 }
 
+// 返回 offset 开始的 size 个字节, 越界时抛出错误
+static unsigned char* luv_buffer_check_range(lua_State* L, luv_buffer_t* buffer, lua_Integer offset, int size)
+{
+	int total = buffer_get_size(buffer);
+	if (offset < 1 || (offset - 1 + size) > total) {
+		luaL_error(L, "Index out of range");
+		return NULL;
+	}
+
+	return (unsigned char*)buffer_get_data(buffer, offset);
+}
+
+static uint64_t luv_buffer_load(const unsigned char* data, int size, int littleEndian)
+{
+	uint64_t value = 0;
+	int i;
+	if (littleEndian) {
+		for (i = size - 1; i >= 0; i--) {
+			value = (value << 8) | data[i];
+		}
+
+	} else {
+		for (i = 0; i < size; i++) {
+			value = (value << 8) | data[i];
+		}
+	}
+
+	return value;
+}
+
+static void luv_buffer_store(unsigned char* data, uint64_t value, int size, int littleEndian)
+{
+	int i;
+	if (littleEndian) {
+		for (i = 0; i < size; i++) {
+			data[i] = (unsigned char)value;
+			value >>= 8;
+		}
+
+	} else {
+		for (i = size - 1; i >= 0; i--) {
+			data[i] = (unsigned char)value;
+			value >>= 8;
+		}
+	}
+}
+
+// get_int(offset, size, littleEndian, signed)
+// 读取 size (1 到 8) 个字节的整数
+static int luv_buffer_get_int(lua_State* L)
+{
+	luv_buffer_t* buffer 	= luv_buffer_check(L, 1);
+	lua_Integer offset 		= luaL_checkinteger(L, 2);
+	lua_Integer size 		= luaL_optinteger(L, 3, 1);
+	int littleEndian 		= lua_toboolean(L, 4);
+	int isSigned 			= lua_toboolean(L, 5);
+
+	luaL_argcheck(L, size >= 1 && size <= 8, 3, "size must be 1 to 8");
+	unsigned char* data = luv_buffer_check_range(L, buffer, offset, (int)size);
+
+	uint64_t value = luv_buffer_load(data, (int)size, littleEndian);
+	if (isSigned && size < 8) {
+		uint64_t sign = (uint64_t)1 << (size * 8 - 1);
+		if (value & sign) {
+			value |= ~((sign << 1) - 1);
+		}
+	}
+
+	lua_pushinteger(L, (lua_Integer)value);
+	return 1;
+}
+
+// put_int(offset, value, size, littleEndian)
+static int luv_buffer_put_int(lua_State* L)
+{
+	luv_buffer_t* buffer 	= luv_buffer_check(L, 1);
+	lua_Integer offset 		= luaL_checkinteger(L, 2);
+	lua_Integer value 		= luaL_checkinteger(L, 3);
+	lua_Integer size 		= luaL_optinteger(L, 4, 1);
+	int littleEndian 		= lua_toboolean(L, 5);
+
+	luaL_argcheck(L, size >= 1 && size <= 8, 4, "size must be 1 to 8");
+	unsigned char* data = luv_buffer_check_range(L, buffer, offset, (int)size);
+
+	luv_buffer_store(data, (uint64_t)value, (int)size, littleEndian);
+	lua_pushinteger(L, size);
+	return 1;
+}
+
+// get_float(offset, size, littleEndian), size 为 4 或 8
+static int luv_buffer_get_float(lua_State* L)
+{
+	luv_buffer_t* buffer 	= luv_buffer_check(L, 1);
+	lua_Integer offset 		= luaL_checkinteger(L, 2);
+	lua_Integer size 		= luaL_optinteger(L, 3, 8);
+	int littleEndian 		= lua_toboolean(L, 4);
+
+	luaL_argcheck(L, size == 4 || size == 8, 3, "size must be 4 or 8");
+	unsigned char* data = luv_buffer_check_range(L, buffer, offset, (int)size);
+
+	uint64_t bits = luv_buffer_load(data, (int)size, littleEndian);
+	if (size == 4) {
+		uint32_t bits32 = (uint32_t)bits;
+		float value;
+		memcpy(&value, &bits32, sizeof(value));
+		lua_pushnumber(L, value);
+
+	} else {
+		double value;
+		memcpy(&value, &bits, sizeof(value));
+		lua_pushnumber(L, value);
+	}
+
+	return 1;
+}
+
+// put_float(offset, value, size, littleEndian)
+static int luv_buffer_put_float(lua_State* L)
+{
+	luv_buffer_t* buffer 	= luv_buffer_check(L, 1);
+	lua_Integer offset 		= luaL_checkinteger(L, 2);
+	lua_Number number 		= luaL_checknumber(L, 3);
+	lua_Integer size 		= luaL_optinteger(L, 4, 8);
+	int littleEndian 		= lua_toboolean(L, 5);
+
+	luaL_argcheck(L, size == 4 || size == 8, 4, "size must be 4 or 8");
+	unsigned char* data = luv_buffer_check_range(L, buffer, offset, (int)size);
+
+	uint64_t bits = 0;
+	if (size == 4) {
+		float value = (float)number;
+		uint32_t bits32;
+		memcpy(&bits32, &value, sizeof(bits32));
+		bits = bits32;
+
+	} else {
+		double value = (double)number;
+		memcpy(&bits, &value, sizeof(bits));
+	}
+
+	luv_buffer_store(data, bits, (int)size, littleEndian);
+	lua_pushinteger(L, size);
+	return 1;
+}
+
 static int luv_buffer_length(lua_State* L)
 {
 	int ret = 0;
@@ -276,6 +421,29 @@ static int luv_buffer_put_bytes(lua_State* L)
 	return 1;
 }
 
+// slice(offset, length)
+// 返回一个和这个 buffer 共享内存的新 buffer, 不会复制数据
+static int luv_buffer_slice(lua_State* L)
+{
+	luv_buffer_t* source = luv_buffer_check(L, 1);
+	lua_Integer offset 	 = luaL_optinteger(L, 2, 1);
+	lua_Integer length 	 = luaL_optinteger(L, 3, buffer_get_size(source) - offset + 1);
+
+	luv_buffer_t* buffer = lua_newuserdata(L, sizeof(*buffer));
+	luaL_getmetatable(L, LUV_BUFFER);
+	lua_setmetatable(L, -2);
+
+	int ret = buffer_slice(buffer, source, (int)offset, (int)length);
+	if (ret < 0) {
+		return luaL_error(L, "Buffer has no data (closed or empty)");
+
+	} else if (ret == 0) {
+		return luaL_error(L, "Index out of range");
+	}
+
+	return 1;
+}
+
 static int luv_buffer_skip(lua_State* L)
 {
 	luv_buffer_t* buffer = luv_buffer_check(L, 1);
@@ -365,6 +533,8 @@ static const luaL_Reg luv_buffer_functions[] = {
 	{ "flags",			luv_buffer_flags },	
 	{ "get_byte",		luv_buffer_get_byte },
 	{ "get_bytes",		luv_buffer_get_bytes },
+	{ "get_float",		luv_buffer_get_float },
+	{ "get_int",		luv_buffer_get_int },
 	{ "index_of",		luv_buffer_index_of },	
 	{ "last_index_of",	luv_buffer_last_index_of },	
 	{ "length",			luv_buffer_length },
@@ -373,8 +543,11 @@ static const luaL_Reg luv_buffer_functions[] = {
 	{ "position",		luv_buffer_position },
 	{ "put_byte",		luv_buffer_put_byte },
 	{ "put_bytes",		luv_buffer_put_bytes },
+	{ "put_float",		luv_buffer_put_float },
+	{ "put_int",		luv_buffer_put_int },
 	{ "size",			luv_buffer_size },
 	{ "skip",			luv_buffer_skip },	
+	{ "slice",			luv_buffer_slice },
 	{ "time_seconds",	luv_buffer_time_seconds },	
 	{ "time_useconds",	luv_buffer_time_useconds },	
 	{ "to_string",		luv_buffer_to_string },
@@ -82,6 +82,9 @@ static void luv_close_cb(uv_handle_t* handle) {
   luv_unref_handle(L, data);
 }
 
+/* relay.c */
+static void luv_relay_close(uv_handle_t* handle);
+
 static int luv_close(lua_State* L) {
   uv_handle_t* handle = luv_check_handle(L, 1);
   if (uv_is_closing(handle)) {
@@ -90,6 +93,10 @@ static int luv_close(lua_State* L) {
   if (!lua_isnoneornil(L, 2)) {
     luv_check_callback(L, (luv_handle_t*)handle->data, LUV_CLOSED, 2);
   }
+  luv_relay_close(handle);
+  if (uv_is_closing(handle)) {
+    return 0; /* closed by the relay callback */
+  }
   uv_close(handle, luv_close_cb);
   return 0;
 }
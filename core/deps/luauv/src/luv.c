@@ -36,6 +36,7 @@
 #include "signal.c"
 #include "process.c"
 #include "stream.c"
+#include "relay.c"
 #include "tcp.c"
 #include "pipe.c"
 #include "tty.c"
@@ -135,6 +136,9 @@ static const luaL_Reg luv_functions[] = {
   {"is_writable", luv_is_writable},
   {"stream_set_blocking", luv_stream_set_blocking},
 
+  // relay.c
+  {"relay", luv_relay},
+
   // tcp.c
   {"new_tcp", luv_new_tcp},
   {"tcp_open", luv_tcp_open},
@@ -670,6 +674,7 @@ LUALIB_API int luaopen_luv (lua_State* L) {
   luv_handle_init(L);
   luv_thread_init(L);
   luv_work_init(L);
+  luv_relay_init(L);
 
   luv_constants(L);
   lua_setfield(L, -2, "constants");
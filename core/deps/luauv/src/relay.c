@@ -0,0 +1,425 @@
+/*
+ *  Copyright 2016 The Node.lua Authors. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ */
+#include "luv.h"
+
+/*
+ * Stream to stream relay.
+ *
+ * Every buffer read from one stream is handed to uv_write on the other
+ * stream as is, so the data never enters the Lua VM. Reading from a source
+ * stops while the write queue of its target is above the high water mark and
+ * starts again once it drains below the low water mark.
+ */
+
+#define LUV_RELAY_HIGH_WATER (64 * 1024)
+#define LUV_RELAY_LOW_WATER  (16 * 1024)
+
+typedef struct luv_relay_s luv_relay_t;
+
+/* One direction of a relay */
+typedef struct {
+  luv_relay_t* relay;
+  uv_stream_t* source;
+  uv_stream_t* target;
+  int paused;                 /* source stopped because target is full */
+  int ended;                  /* source reached EOF */
+  int shutdown;               /* target has been shut down */
+  uint64_t bytes;             /* bytes written to target */
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t pauses;
+  uint64_t latency_total;     /* read to write completion, in ns */
+  uint64_t latency_max;
+} luv_relay_pipe_t;
+
+struct luv_relay_s {
+  luv_ctx_t* ctx;
+  luv_relay_pipe_t pipes[2];
+  int active;
+  int refs;                   /* Lua object, pending requests and active */
+  int callback_ref;
+  int handle_refs[2];         /* keep the handles alive while relaying */
+  uint64_t start_time;
+  uint64_t end_time;
+};
+
+/* Stored in `luv_handle_t.extra`, freed together with the handle */
+typedef struct {
+  luv_relay_pipe_t* pipe;     /* NULL once the relay has finished */
+} luv_relay_link_t;
+
+typedef struct {
+  uv_write_t req;
+  luv_relay_pipe_t* pipe;
+  uv_buf_t buf;
+  uint64_t time;
+} luv_relay_write_t;
+
+typedef struct {
+  uv_shutdown_t req;
+  luv_relay_pipe_t* pipe;
+} luv_relay_shutdown_t;
+
+static void luv_relay_read_cb(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf);
+
+static luv_relay_pipe_t* luv_relay_get_pipe(uv_stream_t* handle) {
+  luv_handle_t* data = (luv_handle_t*)handle->data;
+  luv_relay_link_t* link = data ? (luv_relay_link_t*)data->extra : NULL;
+  return link ? link->pipe : NULL;
+}
+
+static void luv_relay_unref(luv_relay_t* relay) {
+  if (--relay->refs == 0) {
+    free(relay);
+  }
+}
+
+static void luv_relay_finish(luv_relay_t* relay, int status) {
+  lua_State* L = relay->ctx->L;
+  int i;
+
+  if (!relay->active) {
+    return;
+  }
+
+  relay->active = 0;
+  relay->end_time = uv_hrtime();
+
+  for (i = 0; i < 2; i++) {
+    uv_stream_t* source = relay->pipes[i].source;
+    luv_handle_t* data = (luv_handle_t*)source->data;
+    if (!uv_is_closing((uv_handle_t*)source)) {
+      uv_read_stop(source);
+    }
+
+    if (data && data->extra) {
+      ((luv_relay_link_t*)data->extra)->pipe = NULL;
+    }
+  }
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, relay->callback_ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, relay->callback_ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, relay->handle_refs[0]);
+  luaL_unref(L, LUA_REGISTRYINDEX, relay->handle_refs[1]);
+  relay->callback_ref = LUA_NOREF;
+
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+  }
+  else {
+    luv_status(L, status);
+    relay->ctx->pcall(L, 1, 0, 0);
+  }
+
+  luv_relay_unref(relay);
+}
+
+static void luv_relay_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+  (void)handle;
+  buf->base = (char*)malloc(suggested_size);
+  assert(buf->base);
+  buf->len = suggested_size;
+}
+
+static void luv_relay_shutdown_cb(uv_shutdown_t* req, int status) {
+  luv_relay_shutdown_t* shutdown = (luv_relay_shutdown_t*)req;
+  luv_relay_pipe_t* pipe = shutdown->pipe;
+  luv_relay_t* relay = pipe->relay;
+  free(shutdown);
+
+  pipe->shutdown = 1;
+  if (status < 0) {
+    luv_relay_finish(relay, status);
+  }
+  else if (relay->pipes[0].shutdown && relay->pipes[1].shutdown) {
+    luv_relay_finish(relay, 0);
+  }
+
+  luv_relay_unref(relay);
+}
+
+static void luv_relay_write_cb(uv_write_t* req, int status) {
+  luv_relay_write_t* write = (luv_relay_write_t*)req;
+  luv_relay_pipe_t* pipe = write->pipe;
+  luv_relay_t* relay = pipe->relay;
+  uint64_t latency = uv_hrtime() - write->time;
+
+  free(write->buf.base);
+
+  if (status < 0) {
+    free(write);
+    luv_relay_finish(relay, status);
+    luv_relay_unref(relay);
+    return;
+  }
+
+  pipe->bytes += write->buf.len;
+  pipe->writes++;
+  pipe->latency_total += latency;
+  if (latency > pipe->latency_max) {
+    pipe->latency_max = latency;
+  }
+  free(write);
+
+  if (relay->active && pipe->paused && !pipe->ended
+      && pipe->target->write_queue_size <= LUV_RELAY_LOW_WATER) {
+    int ret = uv_read_start(pipe->source, luv_relay_alloc_cb, luv_relay_read_cb);
+    if (ret < 0) {
+      luv_relay_finish(relay, ret);
+    }
+    pipe->paused = 0;
+  }
+
+  luv_relay_unref(relay);
+}
+
+static void luv_relay_read_cb(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf) {
+  luv_relay_pipe_t* pipe = luv_relay_get_pipe(handle);
+  luv_relay_t* relay;
+  int ret;
+
+  if (!pipe) {
+    free(buf->base);
+    return;
+  }
+
+  relay = pipe->relay;
+
+  if (nread > 0) {
+    luv_relay_write_t* write = (luv_relay_write_t*)malloc(sizeof(*write));
+    assert(write);
+    write->pipe = pipe;
+    write->buf = uv_buf_init(buf->base, (unsigned int)nread);
+    write->time = uv_hrtime();
+    pipe->reads++;
+
+    ret = uv_write(&write->req, pipe->target, &write->buf, 1, luv_relay_write_cb);
+    if (ret < 0) {
+      free(buf->base);
+      free(write);
+      luv_relay_finish(relay, ret);
+      return;
+    }
+
+    relay->refs++;
+    if (pipe->target->write_queue_size > LUV_RELAY_HIGH_WATER) {
+      uv_read_stop(handle);
+      pipe->paused = 1;
+      pipe->pauses++;
+    }
+    return;
+  }
+
+  free(buf->base);
+  if (nread == 0) return;
+
+  if (nread == UV_EOF) {
+    /* Half close: the target is shut down after its queued writes */
+    luv_relay_shutdown_t* shutdown = (luv_relay_shutdown_t*)malloc(sizeof(*shutdown));
+    assert(shutdown);
+    shutdown->pipe = pipe;
+
+    pipe->ended = 1;
+    uv_read_stop(handle);
+
+    ret = uv_shutdown(&shutdown->req, pipe->target, luv_relay_shutdown_cb);
+    if (ret < 0) {
+      free(shutdown);
+      luv_relay_finish(relay, ret);
+      return;
+    }
+
+    relay->refs++;
+    return;
+  }
+
+  luv_relay_finish(relay, (int)nread);
+}
+
+/* Called by uv.close(): a relay can not outlive one of its streams */
+static void luv_relay_close(uv_handle_t* handle) {
+  luv_relay_pipe_t* pipe;
+
+  switch (handle->type) {
+    case UV_TCP:
+    case UV_NAMED_PIPE:
+    case UV_TTY:
+      break;
+    default:
+      return;
+  }
+
+  pipe = luv_relay_get_pipe((uv_stream_t*)handle);
+  if (pipe) {
+    luv_relay_finish(pipe->relay, UV_ECANCELED);
+  }
+}
+
+static luv_relay_t* luv_check_relay(lua_State* L, int index) {
+  luv_relay_t** udata = (luv_relay_t**)luaL_checkudata(L, index, "uv_relay");
+  return *udata;
+}
+
+static int luv_relay(lua_State* L) {
+  luv_ctx_t* ctx = luv_context(L);
+  uv_stream_t* a = luv_check_stream(L, 1);
+  uv_stream_t* b = luv_check_stream(L, 2);
+  luv_relay_t** udata;
+  luv_relay_t* relay;
+  int i, ret;
+
+  if (a == b) {
+    return luaL_argerror(L, 2, "can not relay a stream to itself");
+  }
+  if (luv_relay_get_pipe(a) || luv_relay_get_pipe(b)) {
+    return luaL_error(L, "stream is already relayed");
+  }
+  if (!lua_isnoneornil(L, 3)) {
+    luv_check_callable(L, 3);
+  }
+
+  relay = (luv_relay_t*)malloc(sizeof(*relay));
+  if (!relay) return luaL_error(L, "Can't allocate relay");
+  memset(relay, 0, sizeof(*relay));
+
+  relay->ctx = ctx;
+  relay->refs = 2;
+  relay->active = 1;
+  relay->start_time = uv_hrtime();
+
+  relay->pipes[0].source = a;
+  relay->pipes[0].target = b;
+  relay->pipes[1].source = b;
+  relay->pipes[1].target = a;
+
+  lua_pushvalue(L, 3);
+  relay->callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_pushvalue(L, 1);
+  relay->handle_refs[0] = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_pushvalue(L, 2);
+  relay->handle_refs[1] = luaL_ref(L, LUA_REGISTRYINDEX);
+
+  udata = (luv_relay_t**)lua_newuserdata(L, sizeof(*udata));
+  *udata = relay;
+  luaL_getmetatable(L, "uv_relay");
+  lua_setmetatable(L, -2);
+
+  for (i = 0; i < 2; i++) {
+    luv_relay_pipe_t* pipe = &relay->pipes[i];
+    luv_handle_t* data = (luv_handle_t*)pipe->source->data;
+    if (!data->extra) {
+      data->extra = malloc(sizeof(luv_relay_link_t));
+      assert(data->extra);
+    }
+
+    pipe->relay = relay;
+    ((luv_relay_link_t*)data->extra)->pipe = pipe;
+  }
+
+  for (i = 0; i < 2; i++) {
+    luv_relay_pipe_t* pipe = &relay->pipes[i];
+    uv_read_stop(pipe->source);
+    ret = uv_read_start(pipe->source, luv_relay_alloc_cb, luv_relay_read_cb);
+    if (ret < 0) {
+      luv_relay_finish(relay, ret);
+      lua_pop(L, 1);
+      return luv_error(L, ret);
+    }
+  }
+
+  return 1;
+}
+
+static int luv_relay_stop(lua_State* L) {
+  luv_relay_t* relay = luv_check_relay(L, 1);
+  luv_relay_finish(relay, UV_ECANCELED);
+  return 0;
+}
+
+static void luv_relay_push_pipe(lua_State* L, luv_relay_pipe_t* pipe) {
+  lua_createtable(L, 0, 6);
+  lua_pushinteger(L, (lua_Integer)pipe->bytes);
+  lua_setfield(L, -2, "bytes");
+  lua_pushinteger(L, (lua_Integer)pipe->reads);
+  lua_setfield(L, -2, "reads");
+  lua_pushinteger(L, (lua_Integer)pipe->writes);
+  lua_setfield(L, -2, "writes");
+  lua_pushinteger(L, (lua_Integer)pipe->pauses);
+  lua_setfield(L, -2, "pauses");
+  /* latencies in microseconds */
+  lua_pushinteger(L, (lua_Integer)(pipe->writes ? pipe->latency_total / pipe->writes / 1000 : 0));
+  lua_setfield(L, -2, "latency_avg");
+  lua_pushinteger(L, (lua_Integer)(pipe->latency_max / 1000));
+  lua_setfield(L, -2, "latency_max");
+}
+
+static int luv_relay_stats(lua_State* L) {
+  luv_relay_t* relay = luv_check_relay(L, 1);
+  uint64_t end = relay->active ? uv_hrtime() : relay->end_time;
+
+  lua_createtable(L, 0, 4);
+  lua_pushboolean(L, relay->active);
+  lua_setfield(L, -2, "active");
+  lua_pushinteger(L, (lua_Integer)((end - relay->start_time) / 1000000));
+  lua_setfield(L, -2, "uptime");
+  luv_relay_push_pipe(L, &relay->pipes[0]);
+  lua_setfield(L, -2, "forward");
+  luv_relay_push_pipe(L, &relay->pipes[1]);
+  lua_setfield(L, -2, "backward");
+  return 1;
+}
+
+static int luv_relay_is_active(lua_State* L) {
+  luv_relay_t* relay = luv_check_relay(L, 1);
+  lua_pushboolean(L, relay->active);
+  return 1;
+}
+
+static int luv_relay_tostring(lua_State* L) {
+  luv_relay_t* relay = luv_check_relay(L, 1);
+  lua_pushfstring(L, "uv_relay_t: %p", relay);
+  return 1;
+}
+
+/* The relay keeps running when the Lua object is collected */
+static int luv_relay_gc(lua_State* L) {
+  luv_relay_t** udata = (luv_relay_t**)luaL_checkudata(L, 1, "uv_relay");
+  if (*udata) {
+    luv_relay_unref(*udata);
+    *udata = NULL;
+  }
+  return 0;
+}
+
+static const luaL_Reg luv_relay_methods[] = {
+  {"stop", luv_relay_stop},
+  {"stats", luv_relay_stats},
+  {"is_active", luv_relay_is_active},
+  {NULL, NULL}
+};
+
+static void luv_relay_init(lua_State* L) {
+  luaL_newmetatable(L, "uv_relay");
+  lua_pushcfunction(L, luv_relay_tostring);
+  lua_setfield(L, -2, "__tostring");
+  lua_pushcfunction(L, luv_relay_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_newtable(L);
+  luaL_setfuncs(L, luv_relay_methods, 0);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+}
@@ -88,6 +88,38 @@ static int luv_tcp_simultaneous_accepts(lua_State* L) {
   return 1;
 }
 
+// Enable SO_REUSEPORT before bind, so that several loops (threads) can
+// listen on the same port and let the kernel balance incoming connections.
+// libuv creates the socket lazily in uv_tcp_bind(), so create it here.
+static int luv_tcp_reuseport(uv_tcp_t* handle, int family) {
+#if defined(SO_REUSEPORT) && !defined(_WIN32)
+  uv_os_fd_t fd;
+  int yes = 1;
+  int ret = uv_fileno((uv_handle_t*)handle, &fd);
+  if (ret == UV_EBADF) {
+    fd = socket(family, SOCK_STREAM, 0);
+    if (fd < 0) return uv_translate_sys_error(errno);
+
+    ret = uv_tcp_open(handle, fd);
+    if (ret < 0) {
+      close(fd);
+      return ret;
+    }
+  } else if (ret < 0) {
+    return ret;
+  }
+
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes))) {
+    return uv_translate_sys_error(errno);
+  }
+  return 0;
+#else
+  (void)handle;
+  (void)family;
+  return UV_ENOTSUP;
+#endif
+}
+
 static int luv_tcp_bind(lua_State* L) {
   uv_tcp_t* handle = luv_check_tcp(L, 1);
   const char* host = luaL_checkstring(L, 2);
@@ -103,6 +135,13 @@ static int luv_tcp_bind(lua_State* L) {
     lua_getfield(L, 4, "ipv6only");
     if (lua_toboolean(L, -1)) flags |= UV_TCP_IPV6ONLY;
     lua_pop(L, 1);
+
+    lua_getfield(L, 4, "reuseport");
+    if (lua_toboolean(L, -1)) {
+      ret = luv_tcp_reuseport(handle, addr.ss_family);
+      if (ret < 0) return luv_error(L, ret);
+    }
+    lua_pop(L, 1);
   }
   ret = uv_tcp_bind(handle, (struct sockaddr*)&addr, flags);
   if (ret < 0) return luv_error(L, ret);
@@ -30,6 +30,10 @@ typedef struct {
 
 #define MZ_READER_NAME "miniz_reader"
 #define MZ_WRITER_NAME "miniz_writer"
+#define MZ_DEFLATOR_NAME "miniz_deflator"
+#define MZ_INFLATOR_NAME "miniz_inflator"
+
+#define MZ_STREAM_CHUNK_SIZE (16 * 1024)
 
 ///////////////////////////////////////////////////////////////////////////////
 // reader
@@ -274,6 +278,177 @@ static int lmz_writer_gc(lua_State *L) {
 	return 0;
 }
 
+static int lmz_crc32(lua_State* L) {
+	size_t in_len;
+	const char* in_buf = luaL_checklstring(L, 1, &in_len);
+	mz_ulong crc = (mz_ulong)luaL_optinteger(L, 2, MZ_CRC32_INIT);
+
+	crc = mz_crc32(crc, (const unsigned char*)in_buf, in_len);
+	lua_pushinteger(L, (lua_Integer)crc);
+	return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// deflator
+
+// 流式压缩, 内存占用只有固定大小的 tdefl_compressor (包含 32K 的窗口)
+typedef struct {
+	tdefl_compressor* compressor;
+	int finished;
+} lmz_deflator_t;
+
+static int lmz_deflator_init(lua_State *L) {
+	int flags = luaL_optinteger(L, 1, 0);
+
+	lmz_deflator_t* deflator = lua_newuserdata(L, sizeof(*deflator));
+	deflator->compressor = NULL;
+	deflator->finished = 0;
+	luaL_getmetatable(L, MZ_DEFLATOR_NAME);
+	lua_setmetatable(L, -2);
+
+	deflator->compressor = malloc(sizeof(tdefl_compressor));
+	if (deflator->compressor == NULL) {
+		return luaL_error(L, "Out of memory");
+	}
+
+	if (tdefl_init(deflator->compressor, NULL, NULL, flags) != TDEFL_STATUS_OKAY) {
+		return luaL_error(L, "Problem initializing deflator");
+	}
+	return 1;
+}
+
+// deflator:deflate(data, [flush]) 压缩一块数据并返回已经生成的压缩数据
+// flush: 0 (不刷新), 2 (TDEFL_SYNC_FLUSH), 3 (TDEFL_FULL_FLUSH), 4 (TDEFL_FINISH)
+static int lmz_deflator_deflate(lua_State *L) {
+	lmz_deflator_t* deflator = luaL_checkudata(L, 1, MZ_DEFLATOR_NAME);
+	size_t in_len;
+	const char* in_buf = luaL_optlstring(L, 2, "", &in_len);
+	tdefl_flush flush = (tdefl_flush)luaL_optinteger(L, 3, TDEFL_NO_FLUSH);
+	size_t in_ofs = 0;
+	luaL_Buffer buffer;
+
+	if (deflator->compressor == NULL || deflator->finished) {
+		return luaL_error(L, "Deflator is closed");
+	}
+
+	luaL_buffinit(L, &buffer);
+	for (;;) {
+		size_t in_bytes  = in_len - in_ofs;
+		size_t out_bytes = MZ_STREAM_CHUNK_SIZE;
+		char* out_buf = luaL_prepbuffsize(&buffer, out_bytes);
+
+		tdefl_status status = tdefl_compress(deflator->compressor,
+			in_buf + in_ofs, &in_bytes, out_buf, &out_bytes, flush);
+		in_ofs += in_bytes;
+		luaL_addsize(&buffer, out_bytes);
+
+		if (status < 0) {
+			return luaL_error(L, "Deflate failed (%d)", status);
+
+		} else if (status == TDEFL_STATUS_DONE) {
+			deflator->finished = 1;
+			break;
+
+		} else if (in_ofs >= in_len && out_bytes < MZ_STREAM_CHUNK_SIZE) {
+			break;
+		}
+	}
+
+	luaL_pushresult(&buffer);
+	return 1;
+}
+
+static int lmz_deflator_close(lua_State *L) {
+	lmz_deflator_t* deflator = luaL_checkudata(L, 1, MZ_DEFLATOR_NAME);
+	if (deflator->compressor) {
+		free(deflator->compressor);
+		deflator->compressor = NULL;
+	}
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// inflator
+
+// 流式解压, 使用 32K 的循环字典作为输出缓存区
+typedef struct {
+	tinfl_decompressor decompressor;
+	mz_uint8 dict[TINFL_LZ_DICT_SIZE];
+	size_t dict_ofs;
+	int flags;
+	int finished;
+} lmz_inflator_t;
+
+static int lmz_inflator_init(lua_State *L) {
+	int flags = luaL_optinteger(L, 1, 0);
+
+	lmz_inflator_t* inflator = lua_newuserdata(L, sizeof(*inflator));
+	tinfl_init(&(inflator->decompressor));
+	inflator->dict_ofs = 0;
+	inflator->flags = flags & (TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32);
+	inflator->finished = 0;
+	luaL_getmetatable(L, MZ_INFLATOR_NAME);
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+// inflator:inflate(data) 解压一块数据
+// 返回解压后的数据, 是否已经结束, 以及结束后剩下的没有使用的输入数据的长度
+// (包括 tinfl 预读到位缓存中的字节, 可能有一部分属于之前的输入)
+static int lmz_inflator_inflate(lua_State *L) {
+	lmz_inflator_t* inflator = luaL_checkudata(L, 1, MZ_INFLATOR_NAME);
+	size_t in_len;
+	const char* in_buf = luaL_optlstring(L, 2, "", &in_len);
+	size_t in_ofs = 0;
+	size_t unused = 0;
+	luaL_Buffer buffer;
+
+	if (inflator->finished) {
+		lua_pushliteral(L, "");
+		lua_pushboolean(L, 1);
+		lua_pushinteger(L, in_len);
+		return 3;
+	}
+
+	luaL_buffinit(L, &buffer);
+	for (;;) {
+		size_t in_bytes  = in_len - in_ofs;
+		size_t out_bytes = TINFL_LZ_DICT_SIZE - inflator->dict_ofs;
+		mz_uint8* out_buf = inflator->dict + inflator->dict_ofs;
+
+		tinfl_status status = tinfl_decompress(&(inflator->decompressor),
+			(const mz_uint8*)in_buf + in_ofs, &in_bytes,
+			inflator->dict, out_buf, &out_bytes,
+			inflator->flags | TINFL_FLAG_HAS_MORE_INPUT);
+		in_ofs += in_bytes;
+
+		if (out_bytes > 0) {
+			luaL_addlstring(&buffer, (const char*)out_buf, out_bytes);
+		}
+		inflator->dict_ofs = (inflator->dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+
+		if (status < 0) {
+			luaL_pushresult(&buffer);
+			lua_pushnil(L);
+			lua_pushfstring(L, "Inflate failed (%d)", status);
+			return 2;
+
+		} else if (status == TINFL_STATUS_DONE) {
+			inflator->finished = 1;
+			unused = inflator->decompressor.m_num_bits >> 3;
+			break;
+
+		} else if (status == TINFL_STATUS_NEEDS_MORE_INPUT) {
+			break;
+		}
+	}
+
+	luaL_pushresult(&buffer);
+	lua_pushboolean(L, inflator->finished);
+	lua_pushinteger(L, in_len - in_ofs + unused);
+	return 3;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // methods
 
@@ -323,11 +498,25 @@ static const luaL_Reg lminiz_write_m[] = {
   {NULL, NULL}
 };
 
+static const luaL_Reg lminiz_deflator_m[] = {
+  {"close",			lmz_deflator_close},
+  {"deflate",		lmz_deflator_deflate},
+  {NULL, NULL}
+};
+
+static const luaL_Reg lminiz_inflator_m[] = {
+  {"inflate",		lmz_inflator_inflate},
+  {NULL, NULL}
+};
+
 static const luaL_Reg lminiz_f[] = {
   {"new_reader",	lmz_reader_init},
   {"new_writer",	lmz_writer_init},
   {"inflate",		lmz_inflate},
   {"deflate",		lmz_deflate},
+  {"crc32",			lmz_crc32},
+  {"new_deflator",	lmz_deflator_init},
+  {"new_inflator",	lmz_inflator_init},
   {NULL, NULL}
 };
 
@@ -358,6 +547,22 @@ LUALIB_API int luaopen_miniz(lua_State *L) {
 	lua_setfield(L, -2, "__gc");
 	lua_pop(L, 1);
 
+	// deflator
+	luaL_newmetatable(L, MZ_DEFLATOR_NAME);
+	luaL_newlib(L, lminiz_deflator_m);
+	lua_setfield(L, -2, "__index");
+
+	// gc
+	lua_pushcfunction(L, lmz_deflator_close);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+
+	// inflator
+	luaL_newmetatable(L, MZ_INFLATOR_NAME);
+	luaL_newlib(L, lminiz_inflator_m);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
 	// z
 	luaL_newlib(L, lminiz_f);
 
@@ -29,23 +29,11 @@ local exports = { meta = meta }
 
 -------------------------------------------------------------------------------
 
-local function _compliment8(value)
-    return (value < 0x80) and value or (-0x100 + value)
-end
-
-local function _compliment16(value)
-    return (value < 0x8000) and value or (-0x10000 + value)
-end
-
-local function _compliment32(value)
-    return (value < 0x80000000) and value or (-0x100000000 + value)
-end
-
-
 -------------------------------------------------------------------------------
 -- Buffer 是一个直接处理二进制数据的类
 -- @param size Number 分配一个新的大小是 size 的缓存区.
 -- @param str String 分配一个新的 buffer，其中包含着给定的 str 字符串
+-- @param buffer userdata 使用一个 lutils buffer (比如 slice 返回的和其他 buffer 共享内存的视图)
 --
 
 local Buffer = core.Object:extend()
@@ -68,6 +56,9 @@ function Buffer:initialize(param)
         self.buffer:limit(#param + 1)
         self.buffer:put_bytes(1, param, 1, #param)
 
+    elseif (type(param) == "userdata") then
+        self.buffer = param
+
     else
         error("Input must be a string or number")
     end
@@ -92,7 +83,7 @@ function Buffer.meta:__ipairs()
     return function()
         if index < self:size() then
             index = index + 1
-            return index, self.buffer.get_byte(index)
+            return index, self.buffer:get_byte(index)
         end
     end
 end
@@ -254,53 +245,80 @@ function Buffer:putBytes(data, offset, length)
 end
 
 function Buffer:read(offset)
-    return _compliment8(self[offset])
+    return self.buffer:get_int(offset, 1, false, true)
 end
 
 function Buffer:readInt8(offset)
-    return _compliment8(self[offset])
+    return self.buffer:get_int(offset, 1, false, true)
 end
 
 function Buffer:readInt16BE(offset)
-    return _compliment16(self:readUInt16BE(offset))
+    return self.buffer:get_int(offset, 2, false, true)
 end
 
 function Buffer:readInt16LE(offset)
-    return _compliment16(self:readUInt16LE(offset))
+    return self.buffer:get_int(offset, 2, true, true)
 end
 
 function Buffer:readInt32BE(offset)
-    return _compliment32(self:readUInt32BE(offset))
+    return self.buffer:get_int(offset, 4, false, true)
 end
 
 function Buffer:readInt32LE(offset)
-    return _compliment32(self:readUInt32LE(offset))
+    return self.buffer:get_int(offset, 4, true, true)
+end
+
+function Buffer:readInt64BE(offset)
+    return self.buffer:get_int(offset, 8, false, true)
+end
+
+function Buffer:readInt64LE(offset)
+    return self.buffer:get_int(offset, 8, true, true)
 end
 
 function Buffer:readUInt8(offset)
-    return self[offset]
+    return self.buffer:get_int(offset, 1)
 end
 
 function Buffer:readUInt16BE(offset)
-    return (self[offset] << 8) + self[offset + 1]
+    return self.buffer:get_int(offset, 2, false)
 end
 
 function Buffer:readUInt16LE(offset)
-    return (self[offset + 1] << 8) + self[offset]
+    return self.buffer:get_int(offset, 2, true)
 end
 
 function Buffer:readUInt32BE(offset)
-    return self[offset] * 0x1000000 +
-    (self[offset + 1] << 16) +
-    (self[offset + 2] << 8) +
-    self[offset + 3]
+    return self.buffer:get_int(offset, 4, false)
 end
 
 function Buffer:readUInt32LE(offset)
-    return self[offset + 3] * 0x1000000 +
-    (self[offset + 2] << 16) +
-    (self[offset + 1] << 8) +
-    self[offset]
+    return self.buffer:get_int(offset, 4, true)
+end
+
+-- Lua 的整数是 64 位有符号数, 大于 0x7FFFFFFFFFFFFFFF 的值会变为负数
+function Buffer:readUInt64BE(offset)
+    return self.buffer:get_int(offset, 8, false)
+end
+
+function Buffer:readUInt64LE(offset)
+    return self.buffer:get_int(offset, 8, true)
+end
+
+function Buffer:readFloatBE(offset)
+    return self.buffer:get_float(offset, 4, false)
+end
+
+function Buffer:readFloatLE(offset)
+    return self.buffer:get_float(offset, 4, true)
+end
+
+function Buffer:readDoubleBE(offset)
+    return self.buffer:get_float(offset, 8, false)
+end
+
+function Buffer:readDoubleLE(offset)
+    return self.buffer:get_float(offset, 8, true)
 end
 
 function Buffer:size()
@@ -315,8 +333,28 @@ function Buffer:skip(size)
     return self.buffer:skip(size)
 end
 
+-- 返回一个和这个 buffer 共享内存的新 Buffer, 不会复制数据, 修改其中一个会影响另一个
+-- @param startPos 开始位置, 默认为 1
+-- @param endPos 结束位置 (包含), 默认为 size
 function Buffer:slice(startPos, endPos)
-    -- TODO:
+    local size = self:size()
+    startPos = tonumber(startPos) or 1
+    endPos = tonumber(endPos) or size
+
+    if (startPos < 1) then
+        startPos = 1
+    end
+
+    if (endPos > size) then
+        endPos = size
+    end
+
+    local length = endPos - startPos + 1
+    if (length < 0) then
+        length = 0
+    end
+
+    return Buffer:new(self.buffer:slice(startPos, length))
 end
 
 function Buffer:toString(offset, endPos)
@@ -352,59 +390,75 @@ function Buffer:write(data, offset, length, sourceStart)
 end
 
 function Buffer:writeInt8(value, offset)
-    return self.buffer:put_byte(offset, value)
+    return self.buffer:put_int(offset, value, 1)
 end
 
 function Buffer:writeUInt8(value, offset)
-    return self.buffer:put_byte(offset, value)
+    return self.buffer:put_int(offset, value, 1)
 end
 
 function Buffer:writeInt16BE(value, offset)
-    self.buffer:put_byte(offset,     value >> 8)
-    self.buffer:put_byte(offset + 1, value)
+    return self.buffer:put_int(offset, value, 2, false)
 end
 
 function Buffer:writeInt16LE(value, offset)
-    self.buffer:put_byte(offset + 1, value >> 8)
-    self.buffer:put_byte(offset,     value)
+    return self.buffer:put_int(offset, value, 2, true)
 end
 
 function Buffer:writeUInt16BE(value, offset)
-    self.buffer:put_byte(offset,     value >> 8)
-    self.buffer:put_byte(offset + 1, value)
+    return self.buffer:put_int(offset, value, 2, false)
 end
 
 function Buffer:writeUInt16LE(value, offset)
-    self.buffer:put_byte(offset + 1, value >> 8)
-    self.buffer:put_byte(offset,     value)
+    return self.buffer:put_int(offset, value, 2, true)
 end
 
 function Buffer:writeInt32BE(value, offset)
-    self.buffer:put_byte(offset,     value >> 24)
-    self.buffer:put_byte(offset + 1, value >> 16)
-    self.buffer:put_byte(offset + 2, value >> 8)
-    self.buffer:put_byte(offset + 3, value)
+    return self.buffer:put_int(offset, value, 4, false)
 end
 
 function Buffer:writeInt32LE(value, offset)
-    self.buffer:put_byte(offset + 3, value >> 24)
-    self.buffer:put_byte(offset + 2, value >> 16)
-    self.buffer:put_byte(offset + 1, value >> 8)
-    self.buffer:put_byte(offset,     value)
+    return self.buffer:put_int(offset, value, 4, true)
 end
 
 function Buffer:writeUInt32BE(value, offset)
-    self.buffer:put_byte(offset,     value >> 24)
-    self.buffer:put_byte(offset + 1, value >> 16)
-    self.buffer:put_byte(offset + 2, value >> 8)
-    self.buffer:put_byte(offset + 3, value)
+    return self.buffer:put_int(offset, value, 4, false)
 end
 
 function Buffer:writeUInt32LE(value, offset)
-    self.buffer:put_byte(offset + 3, value >> 24)
-    self.buffer:put_byte(offset + 2, value >> 16)
-    self.buffer:put_byte(offset + 1, value >> 8)
-    self.buffer:put_byte(offset,     value)
+    return self.buffer:put_int(offset, value, 4, true)
+end
+
+function Buffer:writeInt64BE(value, offset)
+    return self.buffer:put_int(offset, value, 8, false)
+end
+
+function Buffer:writeInt64LE(value, offset)
+    return self.buffer:put_int(offset, value, 8, true)
+end
+
+function Buffer:writeUInt64BE(value, offset)
+    return self.buffer:put_int(offset, value, 8, false)
+end
+
+function Buffer:writeUInt64LE(value, offset)
+    return self.buffer:put_int(offset, value, 8, true)
+end
+
+function Buffer:writeFloatBE(value, offset)
+    return self.buffer:put_float(offset, value, 4, false)
+end
+
+function Buffer:writeFloatLE(value, offset)
+    return self.buffer:put_float(offset, value, 4, true)
+end
+
+function Buffer:writeDoubleBE(value, offset)
+    return self.buffer:put_float(offset, value, 8, false)
+end
+
+function Buffer:writeDoubleLE(value, offset)
+    return self.buffer:put_float(offset, value, 8, true)
 end
 
 ---------------------------------------------------------------
@@ -447,15 +501,31 @@ function Buffer.from(array)
     return buffer
 end
 
-function Buffer.concat(list)
+-- 合并多个 Buffer, 直接在 C 中复制数据, 不会产生中间字符串
+function Buffer.concat(list, totalLength)
     local total = 0
     for _, item in ipairs(list) do
         total = total + item:size()
     end
 
+    if (totalLength) and (totalLength < total) then
+        total = totalLength
+    end
+
     local newBuffer = Buffer:new(total)
+    newBuffer:limit(total + 1)
+
+    local position = 1
     for _, item in ipairs(list) do
-        newBuffer:putBytes(item:toString())
+        local size = item:size()
+        if (position + size - 1 > total) then
+            size = total - position + 1
+        end
+
+        if (size > 0) then
+            newBuffer.buffer:copy(position, item.buffer, 1, size)
+            position = position + size
+        end
     end
 
     return newBuffer
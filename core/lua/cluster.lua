@@ -0,0 +1,423 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+
+--- lnode cluster
+-- 在多个线程中运行同一个服务, 每个工作线程有自己的事件循环和 Lua 虚拟机,
+-- 通过 SO_REUSEPORT 侦听同一个端口, 由内核把新连接分配给各个线程.
+--
+-- 工作线程之间不共享任何状态, 主线程和工作线程之间通过本地管道 (IPC) 交换
+-- JSON 消息, 工作线程定时向主线程报告统计信息.
+
+local meta = { }
+meta.name        = "lnode/cluster"
+meta.version     = "1.0.0"
+meta.license     = "Apache 2"
+meta.description = "multi-thread cluster module for lnode"
+meta.tags        = { "lnode", "cluster", "thread", "reuseport" }
+
+local core   = require('core')
+local json   = require('json')
+local net    = require('net')
+local path   = require('path')
+local thread = require('thread')
+local timer  = require('timer')
+local uv     = require('luv')
+
+local exports = core.Emitter:new()
+exports.meta = meta
+
+exports.isMaster = true
+exports.isWorker = false
+exports.workers  = {} -- 主线程: 所有工作线程
+exports.worker   = nil -- 工作线程: 当前工作线程
+
+exports.settings = {
+    reportInterval = 1000 -- 工作线程报告统计信息的间隔 (毫秒)
+}
+
+-------------------------------------------------------------------------------
+-- IPC
+
+local function getIpcPath()
+    if (os.platform() == 'win32') then
+        return '\\\\.\\pipe\\lnode-cluster-' .. process.pid
+    end
+
+    return path.join(os.tmpdir, 'lnode-cluster-' .. process.pid .. '.sock')
+end
+
+-- 每个消息为一行 JSON
+local function sendMessage(socket, message)
+    socket:write(json.stringify(message) .. '\n')
+end
+
+local function readMessages(socket, onMessage)
+    local buffer = ''
+
+    socket:on('data', function(chunk)
+        buffer = buffer .. chunk
+
+        while true do
+            local position = string.find(buffer, '\n', 1, true)
+            if (not position) then
+                break
+            end
+
+            local message = json.parse(string.sub(buffer, 1, position - 1))
+            buffer = string.sub(buffer, position + 1)
+
+            if (type(message) == 'table') then
+                onMessage(message)
+            end
+        end
+    end)
+end
+
+-------------------------------------------------------------------------------
+-- Worker
+
+local Worker = core.Emitter:extend()
+exports.Worker = Worker
+
+function Worker:initialize(id)
+    self.id     = id
+    self.state  = 'starting'    -- starting, online, stopping, exit
+    self.stats  = {}
+    self._queue = {}
+end
+
+-- 发送一个消息给对方 (主线程或工作线程), 对方会收到 'message' 事件
+function Worker:send(data)
+    self:_send({ type = 'message', data = data })
+end
+
+-- 请求工作线程停止, 工作线程会关闭通过 cluster.listen 侦听的服务器
+function Worker:stop()
+    if (self.state == 'exit') then
+        return
+    end
+
+    self.state = 'stopping'
+    self:_send({ type = 'stop' })
+end
+
+function Worker:_send(message)
+    if (self.socket) then
+        sendMessage(self.socket, message)
+    elseif (self._queue) then
+        table.insert(self._queue, message)
+    end
+end
+
+function Worker:_setSocket(socket)
+    self.socket = socket
+
+    local queue = self._queue
+    self._queue = nil
+    for _, message in ipairs(queue) do
+        sendMessage(socket, message)
+    end
+end
+
+-------------------------------------------------------------------------------
+-- master
+
+local ipcServer = nil
+local nextWorkerId = 1
+
+local function onWorkerExit(worker)
+    if (worker.state == 'exit') then
+        return
+    end
+
+    worker.state = 'exit'
+    worker.socket = nil
+    exports.workers[worker.id] = nil
+
+    worker:emit('exit')
+    exports:emit('exit', worker)
+
+    if (next(exports.workers) == nil) and (ipcServer) then
+        ipcServer:close()
+        ipcServer = nil
+    end
+end
+
+local function onWorkerMessage(worker, message)
+    local type = message.type
+    if (type == 'stats') then
+        worker.stats = message.stats or {}
+        exports:emit('stats', worker, worker.stats)
+
+    elseif (type == 'message') then
+        worker:emit('message', message.data)
+        exports:emit('message', worker, message.data)
+    end
+end
+
+local function onIpcConnection(socket)
+    local worker = nil
+
+    readMessages(socket, function(message)
+        if (worker) then
+            return onWorkerMessage(worker, message)
+        end
+
+        -- 第一个消息用来标识这是哪一个工作线程
+        worker = exports.workers[tonumber(message.id)]
+        if (message.type ~= 'online') or (not worker) then
+            socket:destroy()
+            return
+        end
+
+        worker:_setSocket(socket)
+        if (worker.state == 'starting') then
+            worker.state = 'online'
+        end
+
+        worker:emit('online')
+        exports:emit('online', worker)
+    end)
+
+    local function onClose()
+        socket:destroy()
+        if (worker) then
+            onWorkerExit(worker)
+        end
+    end
+
+    socket:on('end', onClose)
+    socket:on('error', onClose)
+    socket:on('close', onClose)
+end
+
+local function startIpcServer()
+    if (ipcServer) then
+        return ipcServer.path
+    end
+
+    local ipcPath = getIpcPath()
+    if (os.platform() ~= 'win32') then
+        os.remove(ipcPath)
+    end
+
+    ipcServer = net.createServer(onIpcConnection)
+    ipcServer.path = ipcPath
+    ipcServer:on('error', function(err)
+        exports:emit('error', err)
+    end)
+
+    ipcServer:listen(ipcPath)
+    return ipcPath
+end
+
+-- 工作线程的入口, 这个函数会被 string.dump, 所以不能使用任何 upvalue
+local function workerEntry(id, ipcPath, dumped, ...)
+    require('cluster')._startWorker(id, ipcPath, dumped, ...)
+end
+
+-- 启动工作线程
+-- @param {number|object} options 工作线程数量, 或者:
+--  - workers {number} 工作线程数量, 默认为 CPU 核数
+-- @param {function|string} main 工作线程的主函数 (或 string.dump 后的代码),
+--  调用参数为 (worker, ...). 这个函数会在新的虚拟机中运行, 所以不能使用 upvalue,
+--  需要的模块要在函数内 require
+-- @return {Worker[]} 新启动的工作线程
+function exports.fork(options, main, ...)
+    if (not exports.isMaster) then
+        error('cluster.fork() can only be called in the master thread')
+    end
+
+    if (type(options) ~= 'table') then
+        options = { workers = tonumber(options) }
+    end
+
+    local count = options.workers or #os.cpus()
+    if (count < 1) then
+        count = 1
+    end
+
+    local dumped = main
+    if (type(main) == 'function') then
+        dumped = string.dump(main)
+    end
+
+    local ipcPath = startIpcServer()
+    local workers = {}
+
+    for i = 1, count do
+        local id = nextWorkerId
+        nextWorkerId = nextWorkerId + 1
+
+        local worker = Worker:new(id)
+        exports.workers[id] = worker
+        worker.thread = thread.start(workerEntry, id, ipcPath, dumped, ...)
+
+        table.insert(workers, worker)
+        exports:emit('fork', worker)
+    end
+
+    return workers
+end
+
+-- 发送消息给所有工作线程
+function exports.broadcast(data)
+    for _, worker in pairs(exports.workers) do
+        worker:send(data)
+    end
+end
+
+-- 停止所有工作线程
+function exports.stop()
+    for _, worker in pairs(exports.workers) do
+        worker:stop()
+    end
+end
+
+-- 返回所有工作线程最近一次报告的统计信息和合计
+function exports.getStats()
+    local result = { workers = {}, connections = 0, active = 0 }
+
+    for id, worker in pairs(exports.workers) do
+        local stats = worker.stats
+        result.workers[id] = stats
+        result.connections = result.connections + (stats.connections or 0)
+        result.active = result.active + (stats.active or 0)
+    end
+
+    return result
+end
+
+-------------------------------------------------------------------------------
+-- worker
+
+local servers = {}
+local reportTimer = nil
+
+local function reportStats()
+    local worker = exports.worker
+    local stats = worker.stats
+
+    stats.uptime = uv.now() - worker.startTime
+    stats.memory = math.floor(collectgarbage('count'))
+    worker:_send({ type = 'stats', stats = stats })
+end
+
+local function stopWorker()
+    local worker = exports.worker
+    if (worker.state == 'stopping') then
+        return
+    end
+
+    worker.state = 'stopping'
+    exports:emit('stop')
+
+    for server in pairs(servers) do
+        server:close()
+    end
+    servers = {}
+
+    if (reportTimer) then
+        timer.clearInterval(reportTimer)
+        reportTimer = nil
+    end
+
+    -- 发送最后一次统计信息后关闭 IPC 连接, 没有其他活动的句柄后线程会退出
+    reportStats()
+
+    local socket = worker.socket
+    if (socket) then
+        socket:close(function()
+            socket:destroy()
+        end)
+    end
+end
+
+function exports._startWorker(id, ipcPath, dumped, ...)
+    exports.isMaster = false
+    exports.isWorker = true
+
+    -- 线程参数中的数字都会变为浮点数
+    id = math.tointeger(id) or id
+
+    local worker = Worker:new(id)
+    worker.startTime = uv.now()
+    worker.stats = { connections = 0, active = 0 }
+    worker.state = 'online'
+    exports.worker = worker
+
+    -- 主线程只能通过 stop 消息停止工作线程
+    function worker:stop()
+        stopWorker()
+    end
+
+    local socket = net.Socket:new()
+    socket:on('error', function(err)
+        console.log('cluster: ipc error', err)
+    end)
+
+    socket:connect(ipcPath, function()
+        readMessages(socket, function(message)
+            if (message.type == 'stop') then
+                stopWorker()
+
+            elseif (message.type == 'message') then
+                worker:emit('message', message.data)
+                exports:emit('message', message.data)
+            end
+        end)
+
+        sendMessage(socket, { type = 'online', id = id })
+        worker:_setSocket(socket)
+    end)
+
+    reportTimer = timer.setInterval(exports.settings.reportInterval, reportStats)
+    uv.unref(reportTimer)
+
+    local main, err = load(dumped)
+    if (not main) then
+        error(err)
+    end
+
+    main(worker, ...)
+end
+
+-- 在工作线程中侦听指定的端口, 所有工作线程都可以侦听同一个端口
+-- 服务器的连接数会记录在 worker.stats 中, 收到 stop 消息时服务器会被关闭
+-- @param {net.Server} server 如 http.createServer() 返回的服务器
+function exports.listen(server, port, host, callback)
+    server.reusePort = true
+
+    if (exports.isWorker) then
+        local stats = exports.worker.stats
+        servers[server] = true
+
+        server:on('connection', function(connection)
+            stats.connections = stats.connections + 1
+            stats.active = stats.active + 1
+
+            connection:once('close', function()
+                stats.active = stats.active - 1
+            end)
+        end)
+    end
+
+    return server:listen(port, host, callback)
+end
+
+return exports
@@ -28,7 +28,7 @@ meta.author      = { name = "Tim Caswell" }
 local exports = { meta = meta }
 
 local uv  = require('luv')
-local util = require('util')
+local path = require('path')
 
 local dump, color, colorize
 
@@ -38,6 +38,16 @@ local defaultTheme  = nil
 
 local stdout, stdin, stderr
 
+-- 日志级别, 低于当前级别的输出会在格式化之前直接忽略
+local levels = { debug = 1, info = 2, warn = 3, error = 4, none = 5 }
+
+local LEVEL_DEBUG   = levels.debug
+local LEVEL_INFO    = levels.info
+local LEVEL_WARN    = levels.warn
+local LEVEL_ERROR   = levels.error
+
+local currentLevel  = LEVEL_DEBUG
+
 -------------------------------------------------------------------------------
 
 local themes = {}
@@ -209,7 +219,31 @@ end
 
 -------------------------------------------------------------------------------
 
+local function dumpString(value)
+    if value:match("'") and not value:match('"') then
+        --return dquote .. value:gsub('[%c\\\128-\255]',  stringEscape) .. dquote2
+        return dquote .. value:gsub('[%c\\]',  stringEscape) .. dquote2
+
+    else
+        --return quote .. value:gsub("[%c\\'\128-\255]", stringEscape) .. quote2
+        return quote .. value:gsub("[%c\\']", stringEscape) .. quote2
+    end
+end
+
 function exports.dump(value, recurse, nocolor)
+    -- 不是 table 时不需要创建下面的这些闭包
+    local valueType = type(value)
+    if (valueType ~= 'table') then
+        local text
+        if (valueType == 'string') then
+            text = dumpString(value)
+        else
+            text = colorize(valueType, tostring(value))
+        end
+
+        return nocolor and exports.strip(text) or text
+    end
+
     local seen   = { }
     local output = { }
     local offset = 0
@@ -224,18 +258,7 @@ function exports.dump(value, recurse, nocolor)
     end
 
     local _process_string = function (localValue)
-        if localValue:match("'") and not localValue:match('"') then
-            _write(dquote)
-            --_write(localValue:gsub('[%c\\\128-\255]',  stringEscape))
-            _write(localValue:gsub('[%c\\]',  stringEscape))
-            _write(dquote2)
-
-        else
-            _write(quote)
-            --_write(localValue:gsub("[%c\\'\128-\255]", stringEscape))
-            _write(localValue:gsub("[%c\\']", stringEscape))
-            _write(quote2)
-        end
+        _write(dumpString(localValue))
     end
 
     local _process_table = function (localValue)
@@ -349,7 +372,64 @@ end
 
 dump = exports.dump
 
-function exports.printr(...)
+-------------------------------------------------------------------------------
+-- 输出
+-- 每条消息只调用一次 uv.write, 终端或管道可以写入时 libuv 会立即写入, 否则
+-- 数据留在写队列中, 不会阻塞事件循环.
+-- print 和 console.write 的输出总是写入队列, 不会丢弃; console.log 等诊断信息
+-- 在写队列中的数据超过 maxQueueSize 时被丢弃并计数, 队列清空后输出丢弃的数量.
+
+exports.maxQueueSize = 1024 * 1024
+exports.dropped = 0
+
+local outputQueueSize = 0
+local outputUnreported = 0
+
+local function reportDropped()
+    local count = outputUnreported
+    outputUnreported = 0
+    return '... ' .. count .. ' messages dropped\n'
+end
+
+local function onOutputWritten(size)
+    outputQueueSize = outputQueueSize - size
+
+    -- 后面没有新的输出时, 也要报告丢弃的消息
+    if (outputQueueSize == 0) and (outputUnreported > 0) then
+        local data = reportDropped()
+        outputQueueSize = #data
+        uv.write(stdout, data, function()
+            onOutputWritten(#data)
+        end)
+    end
+end
+
+-- 写入到标准输出
+-- @param {boolean} droppable 写队列已满时是否丢弃这个输出
+-- @return {boolean} 输出被丢弃时返回 false
+local function writeOutput(data, droppable)
+    if (droppable) and (outputQueueSize + #data > exports.maxQueueSize) then
+        exports.dropped = exports.dropped + 1
+        outputUnreported = outputUnreported + 1
+        return false
+    end
+
+    if (outputUnreported > 0) and (droppable) then
+        data = reportDropped() .. data
+    end
+
+    local size = #data
+    outputQueueSize = outputQueueSize + size
+    uv.write(stdout, data, function()
+        onOutputWritten(size)
+    end)
+
+    return true
+end
+
+exports.writeOutput = writeOutput
+
+local function formatArguments(...)
     local n = select('#', ...)
     local arguments = { ... }
 
@@ -357,8 +437,11 @@ function exports.printr(...)
         arguments[i] = dump(arguments[i])
     end
 
-    uv.write(stdout, table.concat(arguments, "\t"))
-    uv.write(stdout, "\n")
+    return table.concat(arguments, "\t", 1, n)
+end
+
+function exports.printr(...)
+    writeOutput(formatArguments(...) .. "\n")
 end
 
 function exports.printBuffer(text, limit)
@@ -433,41 +516,100 @@ end
 function exports.write(...)
     local n = select('#', ...)
     local arguments = { ... }
+    local output = {}
     for i = 1, n do
         local value = arguments[i]
         if (value ~= nil) then
-            uv.write(stdout, tostring(value))
+            output[#output + 1] = tostring(value)
         end
     end
+
+    writeOutput(table.concat(output))
 end
 
 -------------------------------------------------------------------------------
 
-function exports.getFileLine()
-    local file, line = util.filename(4)
-    local path = require('path')
-    file = path.basename(file) or ''
-    return file .. ':' .. (line or 0)
+-- 是否在 log, info 等输出中显示调用的文件名和行号
+exports.fileLine = true
+
+-- 函数 => 所在源文件的文件名
+local sourceNames = setmetatable({}, { __mode = 'k' })
+
+-- 返回调用者的文件名和行号, 文件名按函数缓存
+-- @param level {number} 调用栈的层次, 默认为调用 console.log 等方法的函数
+function exports.getFileLine(level)
+    local info = debug.getinfo(level or 3, 'fl')
+    if (not info) then
+        return ':0'
+    end
+
+    local func = info.func
+    local name = sourceNames[func]
+    if (not name) then
+        local source = debug.getinfo(func, 'S').source or ''
+        if (source:startsWith("@")) then
+            source = source:sub(2)
+        end
+
+        name = path.basename(source) or ''
+        sourceNames[func] = name
+    end
+
+    return name .. ':' .. (info.currentline or 0)
+end
+
+-- 设置日志级别: 'debug', 'info', 'warn', 'error' 或 'none'
+function exports.setLevel(level)
+    currentLevel = levels[level] or tonumber(level) or LEVEL_DEBUG
+end
+
+function exports.getLevel()
+    for name, value in pairs(levels) do
+        if (value == currentLevel) then
+            return name
+        end
+    end
+end
+
+local function printMessage(colorName, prefix, ...)
+    local header = prefix
+    if (exports.fileLine) then
+        header = header .. exports.getFileLine(4)
+    end
+
+    writeOutput(colorize(colorName, header) .. "\n" .. formatArguments(...) .. "\n", true)
 end
 
 function exports.log(message, ...)
-    print(colorize("sep", '- ' .. exports.getFileLine()))
-    exports.printr(message, ...)
+    if (currentLevel > LEVEL_DEBUG) then
+        return
+    end
+
+    printMessage("sep", '- ', message, ...)
 end
 
 function exports.error(message, ...)
-    print(colorize("err", 'Error: ' .. exports.getFileLine()))
-    exports.printr(message, ...)
+    if (currentLevel > LEVEL_ERROR) then
+        return
+    end
+
+    printMessage("err", 'Error: ', message, ...)
 end
 
 function exports.info(message, ...)
-    print(colorize("quotes", 'Info: ' .. exports.getFileLine()))
-    exports.printr(message, ...)
+    if (currentLevel > LEVEL_INFO) then
+        return
+    end
+
+    printMessage("quotes", 'Info: ', message, ...)
 end
 
 function exports.warn(message, ...)
-    print(colorize("number", 'Warn: ' .. exports.getFileLine()))
-    exports.printr(message, ...)
+    if (currentLevel > LEVEL_WARN) then
+        return
+    end
+
+    printMessage("number", 'Warn: ', message, ...)
 end
 
 -------------------------------------------------------------------------------
@@ -489,8 +631,7 @@ local function initConsoleStream()
             arguments[i] = tostring(arguments[i])
         end
 
-        uv.write(stdout, table.concat(arguments, "\t"))
-        uv.write(stdout, "\n")
+        writeOutput(table.concat(arguments, "\t", 1, n) .. "\n")
     end
 
     local _initStream = function(fd, mode)
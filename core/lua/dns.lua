@@ -22,13 +22,14 @@ limitations under the License.
 
 local meta = {}
 meta.name        = "lnode/dns"
-meta.version     = "1.0.1"
+meta.version     = "1.1.0"
 meta.license     = "Apache 2"
 meta.description = "Node-style dns module for lnode"
 meta.tags        = { "lnode", "dns" }
 
 local exports = { meta = meta }
 
+local uv    = require('luv')
 local dgram = require('dgram')
 local fs    = require('fs')
 local net   = require('net')
@@ -681,36 +682,318 @@ end
 
 exports.query = query
 
+-------------------------------------------------------------------------------
+-- cache
+
+-- Resolved answers are cached by (name, type) for their TTL. Expired entries
+-- are still served for `staleTtl` seconds while a single background query
+-- refreshes them, and concurrent lookups of the same key share one query.
+local CACHE_OPTIONS = {
+    maxTtl      = 300,  -- upper bound for a positive answer, in seconds
+    defaultTtl  = 60,   -- used when the source reports no TTL (getaddrinfo)
+    negativeTtl = 5,    -- how long a failed lookup is remembered
+    staleTtl    = 30,   -- how long an expired answer may still be served
+    maxEntries  = 256
+}
+
+local cacheEntries  = {}
+local cachePending  = {}
+local cacheSize     = 0
+local cacheStats    = { hits = 0, misses = 0, stale = 0, coalesced = 0 }
+
+local function _cacheSweep(now)
+    for key, entry in pairs(cacheEntries) do
+        if (now >= entry.expires + CACHE_OPTIONS.staleTtl * 1000) then
+            cacheEntries[key] = nil
+            cacheSize = cacheSize - 1
+        end
+    end
+
+    -- Still full of live entries: drop arbitrary ones
+    while (cacheSize >= CACHE_OPTIONS.maxEntries) do
+        local key = next(cacheEntries)
+        cacheEntries[key] = nil
+        cacheSize = cacheSize - 1
+    end
+end
+
+local function _cacheStore(key, err, value, ttl)
+    if (not ttl) or (ttl <= 0) or (CACHE_OPTIONS.maxTtl <= 0) then
+        return
+    end
+
+    local entry = cacheEntries[key]
+    if (not entry) then
+        local now = uv.now()
+        if (cacheSize >= CACHE_OPTIONS.maxEntries) then
+            _cacheSweep(now)
+        end
+
+        entry = {}
+        cacheEntries[key] = entry
+        cacheSize = cacheSize + 1
+    end
+
+    entry.err     = err
+    entry.value   = value
+    entry.expires = uv.now() + ttl * 1000
+end
+
+-- Run `resolver` for `key` unless an answer is cached or already in flight.
+-- `resolver(callback)` must call `callback(err, value, ttl)` exactly once.
+-- Cached answers are delivered with setImmediate, so `callback` never runs
+-- before `_cacheResolve` returns.
+local function _cacheResolve(key, resolver, callback)
+    local entry = cacheEntries[key]
+    local now = uv.now()
+    local stale = false
+
+    if entry then
+        if (now < entry.expires) then
+            cacheStats.hits = cacheStats.hits + 1
+            return timer.setImmediate(callback, entry.err, entry.value)
+
+        elseif (not entry.err) and (now < entry.expires + CACHE_OPTIONS.staleTtl * 1000) then
+            cacheStats.stale = cacheStats.stale + 1
+            stale = true
+            timer.setImmediate(callback, nil, entry.value)
+        end
+    end
+
+    local pending = cachePending[key]
+    if pending then
+        if (not stale) then
+            cacheStats.coalesced = cacheStats.coalesced + 1
+            pending[#pending + 1] = callback
+        end
+        return
+    end
+
+    pending = {}
+    if (not stale) then
+        cacheStats.misses = cacheStats.misses + 1
+        pending[1] = callback
+    end
+    cachePending[key] = pending
+
+    resolver(function(err, value, ttl)
+        cachePending[key] = nil
+
+        if err then
+            -- Keep serving a stale answer if the refresh failed
+            local current = cacheEntries[key]
+            if (not current) or current.err or (uv.now() >= current.expires + CACHE_OPTIONS.staleTtl * 1000) then
+                _cacheStore(key, err, nil, CACHE_OPTIONS.negativeTtl)
+            end
+        else
+            _cacheStore(key, nil, value, math.min(ttl or CACHE_OPTIONS.defaultTtl, CACHE_OPTIONS.maxTtl))
+        end
+
+        for i = 1, #pending do
+            pending[i](err, value)
+        end
+    end)
+end
+
+local function _cachedQuery(name, qtype, callback)
+    local key = qtype .. ':' .. name
+    return _cacheResolve(key, function(done)
+        query(SERVERS, name, exports.CLASS_IN, qtype, function(err, answers)
+            if err then
+                return done(err)
+            end
+
+            local ttl = nil
+            for _, answer in ipairs(answers) do
+                if answer.ttl and ((not ttl) or answer.ttl < ttl) then
+                    ttl = answer.ttl
+                end
+            end
+
+            done(nil, answers, ttl)
+        end)
+    end, callback)
+end
+
+local function _getAddressFamily(address)
+    if address:match('^%d+%.%d+%.%d+%.%d+$') then
+        return 4
+
+    elseif address:find(':', 1, true) then
+        return 6
+    end
+end
+
+--[[
+Resolves a hostname into the first found address with the system resolver
+(`uv.getaddrinfo`), caching the result.
+
+- hostname {string}
+- options {number|object} the address family (4 or 6), or
+  - family {number} 4 or 6
+  - all {boolean} return all addresses as `{ address, family }` tables
+- callback {function} `callback(err, address, family)`, or
+  `callback(err, addresses)` when `options.all` is set
+--]]
+function exports.lookup(hostname, options, callback)
+    if type(options) == 'function' then
+        callback = options
+        options  = nil
+    end
+
+    if type(options) == 'number' then
+        options = { family = options }
+    end
+
+    options = options or {}
+
+    local family = options.family
+    if (family ~= 4) and (family ~= 6) then
+        family = nil
+    end
+
+    local _onResolve = function(err, addresses)
+        if err then
+            return callback(err)
+
+        elseif options.all then
+            return callback(nil, addresses)
+        end
+
+        local result = addresses[1]
+        callback(nil, result.address, result.family)
+    end
+
+    hostname = hostname or 'localhost'
+
+    -- Address literals need no lookup
+    local literal = _getAddressFamily(hostname)
+    if literal and ((not family) or (family == literal)) then
+        return timer.setImmediate(_onResolve, nil, { { address = hostname, family = literal } })
+    end
+
+    local key = 'lookup' .. (family or 0) .. ':' .. hostname
+    _cacheResolve(key, function(done)
+        local hints = { socktype = "stream" }
+        if (family == 4) then
+            hints.family = 'inet'
+
+        elseif (family == 6) then
+            hints.family = 'inet6'
+        end
+
+        uv.getaddrinfo(hostname, nil, hints, function(err, res)
+            if err then
+                return done(err)
+
+            elseif (not res) or (not res[1]) then
+                return done('Invalid host address: ' .. tostring(hostname))
+            end
+
+            local addresses = {}
+            for _, info in ipairs(res) do
+                addresses[#addresses + 1] = {
+                    address = info.addr,
+                    family  = (info.family == 'inet6') and 6 or 4
+                }
+            end
+
+            done(nil, addresses)
+        end)
+    end, _onResolve)
+end
+
+--[[
+Resolves a port number or a service name (such as `'http'`) into a port
+number. Service names are looked up with `uv.getaddrinfo` and cached.
+
+- port {number|string}
+- callback {function} `callback(err, port)`
+--]]
+function exports.lookupPort(port, callback)
+    local number = tonumber(port)
+    if number then
+        return timer.setImmediate(callback, nil, number)
+
+    elseif (type(port) ~= 'string') or (port == '') then
+        return timer.setImmediate(callback, 'Invalid port: ' .. tostring(port))
+    end
+
+    _cacheResolve('service:' .. port, function(done)
+        uv.getaddrinfo(nil, port, { socktype = "stream" }, function(err, res)
+            if err then
+                return done(err)
+            end
+
+            local info = res and res[1]
+            if (not info) or (not info.port) then
+                return done('Invalid port: ' .. port)
+            end
+
+            done(nil, info.port)
+        end)
+    end, callback)
+end
+
 function exports.resolve4(name, callback)
-    return query(SERVERS, name, exports.CLASS_IN, exports.TYPE_A, callback)
+    return _cachedQuery(name, exports.TYPE_A, callback)
 end
 
 function exports.resolve6(name, callback)
-    return query(SERVERS, name, exports.CLASS_IN, exports.TYPE_AAAA, callback)
+    return _cachedQuery(name, exports.TYPE_AAAA, callback)
 end
 
 function exports.resolveSrv(name, callback)
-    return query(SERVERS, name, exports.CLASS_IN, exports.TYPE_SRV, callback)
+    return _cachedQuery(name, exports.TYPE_SRV, callback)
 end
 
 function exports.resolveMx(name, callback)
-    return query(SERVERS, name, exports.CLASS_IN, exports.TYPE_MX, callback)
+    return _cachedQuery(name, exports.TYPE_MX, callback)
 end
 
 function exports.resolveNs(name, callback)
-    return query(SERVERS, name, exports.CLASS_IN, exports.TYPE_NS, callback)
+    return _cachedQuery(name, exports.TYPE_NS, callback)
 end
 
 function exports.resolveCname(name, callback)
-    return query(SERVERS, name, exports.CLASS_IN, exports.TYPE_CNAME, callback)
+    return _cachedQuery(name, exports.TYPE_CNAME, callback)
 end
 
 function exports.resolveTxt(name, callback)
-    return query(SERVERS, name, exports.CLASS_IN, exports.TYPE_TXT, callback)
+    return _cachedQuery(name, exports.TYPE_TXT, callback)
+end
+
+-- Drops all cached answers; in-flight lookups still complete
+function exports.clearCache()
+    cacheEntries = {}
+    cacheSize = 0
+end
+
+-- Returns the cache counters: hits, misses, stale, coalesced and size
+function exports.getCacheStats()
+    return {
+        hits      = cacheStats.hits,
+        misses    = cacheStats.misses,
+        stale     = cacheStats.stale,
+        coalesced = cacheStats.coalesced,
+        size      = cacheSize
+    }
+end
+
+-- Changes the cache TTLs (in seconds) and size; a `maxTtl` of 0 disables caching
+function exports.setCacheOptions(options)
+    for key, value in pairs(options or {}) do
+        if CACHE_OPTIONS[key] ~= nil then
+            CACHE_OPTIONS[key] = value
+        end
+    end
+
+    exports.clearCache()
 end
 
 function exports.setServers(servers)
     SERVERS = servers
+    exports.clearCache()
 end
 
 function exports.setTimeout(timeout)
@@ -723,6 +1006,7 @@ end
 
 function exports.setDefaultServers()
     SERVERS = DEFAULT_SERVERS
+    exports.clearCache()
 end
 
 function exports.loadResolver(options)
@@ -765,6 +1049,7 @@ function exports.loadResolver(options)
     end
 
     SERVERS = servers
+    exports.clearCache()
 
     return servers
 end
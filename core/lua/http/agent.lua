@@ -0,0 +1,302 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+
+local meta = { }
+meta.name        = "lnode/http/agent"
+meta.version     = "1.0.0"
+meta.license     = "Apache 2"
+meta.description = "HTTP client connection pooling agent"
+meta.tags        = { "lnode", "http", "agent", "keep-alive" }
+
+local core  = require('core')
+local net   = require('net')
+local uv    = require('luv')
+
+-------------------------------------------------------------------------------
+-- Agent
+-- 管理 HTTP 客户端的连接, 同一个主机的请求会复用已经建立的连接 (keep-alive).
+--
+-- 每个主机 (host:port) 有一个空闲连接池, 同时最多使用 maxSockets 个连接,
+-- 超过时新的请求会排队, 直到有连接被释放.
+
+local exports = { meta = meta }
+
+local Agent = core.Emitter:extend()
+exports.Agent = Agent
+
+-- @param {object} options
+--  - keepAlive {boolean} 是否复用连接, 默认为 true
+--  - maxSockets {number} 每个主机最多同时使用的连接数, 默认为 8
+--  - maxFreeSockets {number} 每个主机最多保留的空闲连接数, 默认为 4
+--  - timeout {number} 空闲连接的超时时间 (毫秒), 默认为 15000
+--  - createConnection {function} function(options) 创建新的连接
+--  - connectEvent {string} 连接建立后 socket 发出的事件, 默认为 'connect'
+function Agent:initialize(options)
+    options = options or {}
+
+    self.keepAlive      = options.keepAlive ~= false
+    self.maxSockets     = options.maxSockets or 8
+    self.maxFreeSockets = options.maxFreeSockets or 4
+    self.timeout        = options.timeout or 15000
+    self.connectEvent   = options.connectEvent or 'connect'
+
+    if (options.createConnection) then
+        self.createConnection = options.createConnection
+    end
+
+    self.sockets     = {} -- 正在使用的连接
+    self.freeSockets = {} -- 空闲的连接
+    self.requests    = {} -- 等待连接的请求
+
+    self.stats = { created = 0, reused = 0, queued = 0, closed = 0 }
+end
+
+function Agent:createConnection(options)
+    return net.createConnection(options.port, options.host)
+end
+
+function Agent:getName(options)
+    return (options.host or 'localhost') .. ':' .. tostring(options.port or '')
+end
+
+local function removeItem(list, item)
+    if (not list) then
+        return false
+    end
+
+    for i = 1, #list do
+        if (list[i] == item) then
+            table.remove(list, i)
+            return true
+        end
+    end
+
+    return false
+end
+
+local function getList(lists, name)
+    local list = lists[name]
+    if (not list) then
+        list = {}
+        lists[name] = list
+    end
+
+    return list
+end
+
+-- 为请求分配一个连接, 连接可用时会调用 `request:onSocket(socket, connectEvent)`,
+-- 复用的连接 connectEvent 为 nil
+function Agent:addRequest(request, options)
+    local name = self:getName(options)
+    request._agentName = name
+
+    -- 先让事件循环处理一次 I/O, 已被服务器关闭的空闲连接会从连接池中删除
+    local freeSockets = self.freeSockets[name]
+    if (freeSockets) and (#freeSockets > 0) and (not request._agentDeferred) then
+        request._agentDeferred = true
+        setImmediate(function()
+            if (not request.destroyed) then
+                self:addRequest(request, options)
+            end
+        end)
+        return
+    end
+
+    -- 优先使用空闲的连接, 后进先出, 最近使用的连接更可能还没有被服务器关闭
+    while (freeSockets) and (#freeSockets > 0) do
+        local socket = table.remove(freeSockets)
+        if (not socket.destroyed) then
+            self:_useSocket(socket, name)
+            self.stats.reused = self.stats.reused + 1
+            return request:onSocket(socket)
+        end
+    end
+
+    local sockets = getList(self.sockets, name)
+    if (#sockets < self.maxSockets) then
+        local socket = self:_createSocket(options, name)
+        return request:onSocket(socket, self.connectEvent)
+    end
+
+    -- 排队等待其他请求释放连接
+    self.stats.queued = self.stats.queued + 1
+    table.insert(getList(self.requests, name), { request = request, options = options })
+end
+
+-- 请求结束后释放连接
+-- @param {boolean} keepAlive 这个连接能否被复用
+function Agent:releaseSocket(socket, name, keepAlive)
+    if (not removeItem(self.sockets[name], socket)) then
+        return
+    end
+
+    if (not keepAlive) or (not self.keepAlive) or (socket.destroyed) then
+        socket:destroy()
+        self:_processQueue(name)
+        return
+    end
+
+    -- 直接交给下一个排队的请求
+    local queue = self.requests[name]
+    if (queue) and (#queue > 0) then
+        local item = table.remove(queue, 1)
+        table.insert(self.sockets[name], socket)
+        self.stats.reused = self.stats.reused + 1
+        return item.request:onSocket(socket)
+    end
+
+    local freeSockets = getList(self.freeSockets, name)
+    if (#freeSockets >= self.maxFreeSockets) then
+        socket:destroy()
+        return
+    end
+
+    table.insert(freeSockets, socket)
+
+    -- 空闲的连接不会阻止进程退出
+    local idleTimer = socket._agentIdleTimer
+    uv.timer_start(idleTimer, self.timeout, 0, socket._agentOnIdleTimeout)
+    uv.unref(socket._handle)
+    socket:resume()
+end
+
+-- 取消一个还在排队的请求
+function Agent:removeRequest(request)
+    local queue = self.requests[request._agentName]
+    if (not queue) then
+        return
+    end
+
+    for i = 1, #queue do
+        if (queue[i].request == request) then
+            table.remove(queue, i)
+            return
+        end
+    end
+end
+
+-- 关闭所有连接
+function Agent:destroy()
+    for _, lists in ipairs({ self.sockets, self.freeSockets }) do
+        for _, sockets in pairs(lists) do
+            for _, socket in ipairs(sockets) do
+                socket:destroy()
+            end
+        end
+    end
+
+    self.sockets = {}
+    self.freeSockets = {}
+    self.requests = {}
+end
+
+-- 返回当前的连接数和统计信息
+function Agent:getStats()
+    local stats = { active = 0, free = 0, pending = 0 }
+    for key, value in pairs(self.stats) do
+        stats[key] = value
+    end
+
+    for _, sockets in pairs(self.sockets) do
+        stats.active = stats.active + #sockets
+    end
+
+    for _, sockets in pairs(self.freeSockets) do
+        stats.free = stats.free + #sockets
+    end
+
+    for _, requests in pairs(self.requests) do
+        stats.pending = stats.pending + #requests
+    end
+
+    return stats
+end
+
+function Agent:_createSocket(options, name)
+    local socket = self:createConnection(options)
+    self.stats.created = self.stats.created + 1
+
+    local idleTimer = uv.new_timer()
+    uv.unref(idleTimer)
+    socket._agentIdleTimer = idleTimer
+
+    -- 连接关闭或出错时从连接池中删除
+    local function onClose()
+        local removed = removeItem(self.sockets[name], socket)
+        removeItem(self.freeSockets[name], socket)
+
+        if (not uv.is_closing(idleTimer)) then
+            uv.close(idleTimer)
+            self.stats.closed = self.stats.closed + 1
+        end
+
+        if (not socket.destroyed) then
+            socket:destroy()
+        end
+
+        if (removed) then
+            self:_processQueue(name)
+        end
+    end
+
+    -- 空闲的连接被服务器关闭, 或者超时
+    local function onIdleClose()
+        if (removeItem(self.freeSockets[name], socket)) then
+            socket:destroy()
+        end
+    end
+
+    socket._agentOnIdleTimeout = onIdleClose
+
+    socket:on('close', onClose)
+    socket:on('end', onIdleClose)
+    socket:on('error', onIdleClose)
+
+    table.insert(getList(self.sockets, name), socket)
+    return socket
+end
+
+function Agent:_useSocket(socket, name)
+    uv.timer_stop(socket._agentIdleTimer)
+    uv.ref(socket._handle)
+    table.insert(getList(self.sockets, name), socket)
+end
+
+-- 有连接被关闭, 为排队的请求创建新的连接
+function Agent:_processQueue(name)
+    local queue = self.requests[name]
+    if (not queue) or (#queue == 0) then
+        return
+    end
+
+    local sockets = getList(self.sockets, name)
+    if (#sockets >= self.maxSockets) then
+        return
+    end
+
+    local item = table.remove(queue, 1)
+    local socket = self:_createSocket(item.options, name)
+    item.request:onSocket(socket, self.connectEvent)
+end
+
+-------------------------------------------------------------------------------
+-- exports
+
+exports.globalAgent = Agent:new()
+
+return exports
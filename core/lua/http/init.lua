@@ -30,11 +30,16 @@ local net   = require('net')
 local url   = require('url')
 local utils = require('util')
 local codec = require('http/codec')
+local agent = require('http/agent')
+local zlib  = require('zlib')
 
 local Writable = require('stream').Writable
 
 exports.STATUS_CODES = codec.STATUS_CODES
 
+exports.Agent       = agent.Agent
+exports.globalAgent = agent.globalAgent
+
 -- Provide a nice case insensitive interface to headers.
 -- Pulled from https://github.com/creationix/weblit/blob/master/libs/weblit-app.lua
 local headerMeta = {
@@ -157,6 +162,44 @@ function ServerResponse:removeHeader(name)
     self.headers[name] = nil
 end
 
+-- 使用指定的编码边发送边压缩消息体, 必须在发送头之前调用
+-- 压缩后的长度是未知的, 所以会删除 Content-Length 并使用 chunked 编码
+-- @param {string} encoding 'gzip' 或 'deflate'
+-- @param {object} options 可选, 和 zlib.createGzip 的相同, 比如 level
+-- @return {boolean} 不支持这个编码时返回 false
+function ServerResponse:setCompression(encoding, options)
+    assert(not self.headersSent, "headers already sent")
+
+    local compressor
+    if (encoding == 'gzip') then
+        compressor = zlib.createGzip(options)
+
+    elseif (encoding == 'deflate') then
+        compressor = zlib.createDeflate(options)
+
+    else
+        return false
+    end
+
+    self.compressor = compressor
+    self.headers['Content-Encoding'] = encoding
+    self.headers['Content-Length'] = nil
+    return true
+end
+
+-- 立即发送已经压缩的数据, 用于需要对方马上收到的流式应答
+function ServerResponse:flush()
+    local compressor = self.compressor
+    if (not compressor) or (not self.hasBody) then
+        return
+    end
+
+    local data = compressor:flushSync()
+    if (#data > 0) then
+        self.socket:write(self.encoder(data))
+    end
+end
+
 function ServerResponse:flushHeaders()
     if self.headersSent then
         return
@@ -167,6 +210,10 @@ function ServerResponse:flushHeaders()
     local headers = self.headers
     local statusCode = self.statusCode
 
+    if self.compressor then
+        headers['Content-Length'] = nil
+    end
+
     local head = { }
     local sent_date, sent_connection, sent_transfer_encoding, sent_content_length
     for i = 1, #headers do
@@ -234,6 +281,19 @@ function ServerResponse:write(chunk, callback)
         self.hasBody = true
     end
 
+    local compressor = self.compressor
+    if (compressor) and (chunk) then
+        -- 压缩器可能暂时没有输出, 空的 chunk 会被当作消息结束
+        chunk = compressor:transformSync(chunk)
+        if (#chunk == 0) then
+            self:flushHeaders()
+            if (callback) then
+                callback()
+            end
+            return true
+        end
+    end
+
     self:flushHeaders()
     return self.socket:write(self.encoder(chunk), callback)
 end
@@ -243,7 +303,23 @@ function ServerResponse:done(chunk)
         self.hasBody = true
     end
 
+    local compressor = self.compressor
+    if (compressor) then
+        if (self.hasBody) then
+            chunk = compressor:transformSync(chunk or '') .. compressor:finishSync()
+            if (#chunk == 0) then
+                chunk = nil
+            end
+
+        elseif (not self.headersSent) then
+            -- 没有消息体时不需要压缩
+            self.headers['Content-Encoding'] = nil
+            self.compressor = nil
+        end
+    end
+
     self:flushHeaders()
+    self.compressor = nil
     local last = ""
     if chunk then
         last = last .. self.encoder(chunk)
@@ -306,7 +382,8 @@ end
 -------------------------------------------------------------------------------
 -- handleConnection
 
-function exports.handleConnection(socket, onRequest)
+-- @param {net.Server} server 可选, 用于在关闭服务器时关闭空闲的 keep-alive 连接
+function exports.handleConnection(socket, onRequest, server)
 
     local decoder = nil
     local request, response
@@ -342,6 +419,14 @@ function exports.handleConnection(socket, onRequest)
         response = ServerResponse:new(socket)
         response.keepAlive = event.keepAlive
 
+        socket._httpIdle = false
+        response:once('finish', function()
+            socket._httpIdle = true
+            if server and server._httpClosed then
+                socket:destroy()
+            end
+        end)
+
         -- If the request upgrades the protocol then detatch the listeners so http codec is no longer used
         if request.headers.upgrade then
             request.is_upgraded = true
@@ -407,6 +492,15 @@ function exports.handleConnection(socket, onRequest)
     -- --------------------------------------------------------
     -- socket
 
+    if server then
+        local connections = server._httpConnections
+        connections[socket] = true
+        socket._httpIdle = true
+        socket:once('close', function()
+            connections[socket] = nil
+        end)
+    end
+
     socket:once('timeout', _onSocketTimeout)
     socket:setTimeout(120000 )-- set socket timeout
     socket:on('data', _onSocketData)
@@ -415,10 +509,31 @@ function exports.handleConnection(socket, onRequest)
     process:once('exit', _onSocketTimeout)
 end
 
-function exports.createServer(onRequest)
-    return net.createServer(function(socket)
-        return exports.handleConnection(socket, onRequest)
+-- createServer([options], onRequest)
+-- options 和 net.createServer 的相同, 如 { reusePort = true }
+function exports.createServer(options, onRequest)
+    if (type(options) == 'function') then
+        onRequest = options
+        options = {}
+    end
+
+    local server
+    server = net.createServer(options or {}, function(socket)
+        return exports.handleConnection(socket, onRequest, server)
     end)
+
+    -- 关闭服务器时同时关闭空闲的 keep-alive 连接, 其他连接在当前的响应结束后关闭
+    server._httpConnections = {}
+    server:on('close', function()
+        server._httpClosed = true
+        for socket in pairs(server._httpConnections) do
+            if socket._httpIdle then
+                socket:destroy()
+            end
+        end
+    end)
+
+    return server
 end
 
 -------------------------------------------------------------------------------
@@ -478,6 +593,7 @@ function ClientRequest:initialize(options, callback)
     self.port       = options.port or 80
     self.self_sent  = false
     self.connection = connection_found
+    self._onResponse = callback
 
     if (self.host == 'rpc') then
         self.host = nil
@@ -488,21 +604,69 @@ function ClientRequest:initialize(options, callback)
 
     self.encode = codec.encoder()
 
+    -- 指定了 socket 或者 options.agent 为 false 时不使用连接池
+    local agent = options.agent
+    if (agent == nil) then
+        agent = exports.globalAgent
+    end
+
+    if (options.socket) or (not agent) or (not self.host) then
+        local socket = options.socket or net.createConnection(self.port, self.host)
+        self:onSocket(socket, options.connect_emitter or 'connect')
+        return
+    end
+
+    local connectOptions = {}
+    for key, value in pairs(options) do
+        connectOptions[key] = value
+    end
+    connectOptions.host = self.host
+    connectOptions.port = self.port
+
+    self.agent = agent
+    agent:addRequest(self, connectOptions)
+end
+
+-- 绑定请求使用的连接
+-- @param {net.Socket} socket
+-- @param {string} connectEvent 连接建立后发出的事件, 为 nil 表示这是一个已经
+--  建立的连接 (来自连接池)
+function ClientRequest:onSocket(socket, connectEvent)
+    local callback = self._onResponse
     local decoder = nil
-    local buffer = ''
     local response
+    local listeners = {}
+
+    self.socket = socket
 
     local _onFlush = function ()
         response:push()
         response = nil
     end
 
-    local socket = options.socket or net.createConnection(self.port, self.host)
-    local connect_emitter = options.connect_emitter or 'connect'
+    -- 响应已结束, 把连接还给连接池
+    local _releaseSocket = function(keepAlive)
+        local agent = self.agent
+        if (not agent) or (self.socket ~= socket) then
+            return
+        end
 
-    self.socket = socket
-    socket:on('error', function(...) self:emit('error', ...) end)
-    socket:on(connect_emitter, function()
+        for event, listener in pairs(listeners) do
+            socket:removeListener(event, listener)
+        end
+
+        if (not self._writableState.ended) then
+            keepAlive = false
+        end
+
+        self.socket = nil
+        agent:releaseSocket(socket, self._agentName, keepAlive)
+    end
+
+    listeners.error = function(...) self:emit('error', ...) end
+    socket:on('error', listeners.error)
+
+    local _onConnect = function()
         self.connected = true
         self:emit('socket', socket)
 
@@ -514,6 +678,7 @@ function ClientRequest:initialize(options, callback)
             -- Just in case the stream ended and we still had an open response,
             -- end it.
             if response then _onFlush() end
+            _releaseSocket(false)
         end
 
         local _onHeadersEnd = function(event)
@@ -522,6 +687,7 @@ function ClientRequest:initialize(options, callback)
                 if response then _onFlush() end
                 -- Create a new response object
                 response = IncomingMessage:new(event, socket)
+                response.keepAlive = event.keepAlive
                 -- If the request upgrades the protocol then detatch the listeners so http codec is no longer used
                 local is_upgraded
                 if response.headers.upgrade then
@@ -558,7 +724,9 @@ function ClientRequest:initialize(options, callback)
             if #chunk == 0 then
                 -- Empty string in http-decoder means end of body
                 -- End the response stream and remove the response reference.
+                local keepAlive = response.keepAlive
                 _onFlush()
+                _releaseSocket(keepAlive)
             else
                 -- Forward non-empty body chunks to the response stream.
                 if not response:push(chunk) then
@@ -589,14 +757,26 @@ function ClientRequest:initialize(options, callback)
         end
         --]]
 
+        listeners.data = _onSocketData
+        listeners['end'] = _onSocketEnd
         socket:on('data', _onSocketData)
         socket:on('end', _onSocketEnd)
 
         if self.ended then
             self:_done(self.ended.data, self.ended.cb)
         end
+    end
 
-    end)
+    if (connectEvent) then
+        socket:once(connectEvent, _onConnect)
+    else
+        -- 复用的连接, 等调用者注册好事件监听器后再开始
+        setImmediate(function()
+            if (self.socket == socket) and (not socket.destroyed) then
+                _onConnect()
+            end
+        end)
+    end
 end
 
 function ClientRequest:flushHeaders()
@@ -626,6 +806,14 @@ function ClientRequest:write(data, callback)
 end
 
 function ClientRequest:_write(data, callback)
+    -- 连接池可能在下一轮事件循环才分配连接
+    if (not self.socket) then
+        self:once('socket', function()
+            self:_write(data, callback)
+        end)
+        return
+    end
+
     return self.socket:write(data, callback)
 end
 
@@ -639,7 +827,8 @@ end
 
 function ClientRequest:_setConnection()
     if not self.connection then
-        table.insert(self, { 'connection', 'close' })
+        local keepAlive = self.agent and self.agent.keepAlive
+        table.insert(self, { 'Connection', keepAlive and 'keep-alive' or 'close' })
     end
 end
 
@@ -673,15 +862,16 @@ end
 function ClientRequest:destroy()
     if self.socket then
         self.socket:destroy()
-    end
-end
 
-function ClientRequest:abort()
-    if self.socket then
-        self.socket:destroy()
+    elseif self.agent then
+        -- 还在等待连接池分配连接
+        self.destroyed = true
+        self.agent:removeRequest(self)
     end
 end
 
+ClientRequest.abort = ClientRequest.destroy
+
 -------------------------------------------------------------------------------
 -- request
 
@@ -64,6 +64,54 @@ local function _createConnection(...)
     return tls.connect(options, callback)
 end
 
+-- HTTPS 连接池, 同一个主机的请求会复用已经建立的 TLS 连接
+exports.Agent = http.Agent:extend()
+
+function exports.Agent:initialize(options)
+    options = options or {}
+    options.connectEvent = 'secureConnection'
+    http.Agent.initialize(self, options)
+end
+
+function exports.Agent:createConnection(options)
+    return _createConnection(options)
+end
+
+-- 影响 TLS 连接的选项, 这些选项不同的请求不能共用同一个连接,
+-- 比如带客户端证书的连接不能给不带证书的请求使用
+local TLS_OPTIONS = {
+    'ca', 'cert', 'key', 'ciphers', 'secureProtocol', 'secureOptions',
+    'secureContext', 'servername'
+}
+
+local function optionName(value)
+    if (value == nil) then
+        return ''
+
+    elseif (type(value) == 'table') and (#value > 0) then
+        -- 比如多个 CA 证书
+        local names = {}
+        for i = 1, #value do
+            names[i] = tostring(value[i])
+        end
+        return table.concat(names, ',')
+    end
+
+    return tostring(value)
+end
+
+function exports.Agent:getName(options)
+    local names = { http.Agent.getName(self, options) }
+    for _, key in ipairs(TLS_OPTIONS) do
+        names[#names + 1] = optionName(options[key])
+    end
+
+    names[#names + 1] = options.rejectUnauthorized and 'verify' or ''
+    return table.concat(names, ':')
+end
+
+exports.globalAgent = exports.Agent:new()
+
 function exports.createServer(options, onRequest)
     return tls.createServer(options, function (socket)
         return http.handleConnection(socket, onRequest)
@@ -87,7 +135,15 @@ function exports.request(options, callback)
 
     options.connect_emitter = 'secureConnection'
     options.port    = options.port or 443
-    options.socket  = options.socket or _createConnection(options)
+
+    if (options.agent == nil) then
+        options.agent = exports.globalAgent
+    end
+
+    if (not options.agent) then
+        options.socket = options.socket or _createConnection(options)
+    end
+
     return http.request(options, callback)
 end
 
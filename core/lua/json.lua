@@ -16,7 +16,6 @@ limitations under the License.
 
 --]]
 local cjson = require('cjson')
-local util = require('util')
 
 local meta = { }
 meta.name       = "lnode/json"
@@ -30,138 +29,19 @@ local exports = { meta = meta }
 -------------------------------------------------------------------------------
 -- encode
 
-local _encodeTokenTable = {
-	['\\'] = '\\\\',
-	['"'] = '\\"',
-	['\a'] = '\\a',
-	['\b'] = '\\b',
-	['\t'] = '\\t',
-	['\n'] = '\\n',
-	['\v'] = '\\v',
-	['\f'] = '\\f',
-	['\r'] = '\\r'
-}
-
-local _encodeLuaString, _encodeLuaValue, _encodeLuaTable
-
---[[
-The escape function used by querystring.stringify, provided so that it could be
-overridden if necessary.
---]]
-function _encodeLuaString(str)
-    if not str then
-    	return str
-    end
-
-    str = str:gsub('([^%w])', function(c)
-    	return _encodeTokenTable[c] or c
-
-    	--return c
-        --return string.format('%%%02X', string.byte(c))
-    end)
-
-    return str
-end
-
-function _encodeLuaValue(sb, value, indent)
-	if (value == nil) then
-		sb:append("null")
-
-	elseif (type(value) == 'string') then
-		value = _encodeLuaString(value)
-		sb:append('"'):append(value):append('"')
-
-	elseif (type(value) == 'number') then
-		sb:append(value)
-
-	elseif (type(value) == 'boolean') then
-		if (value) then
-			sb:append('true')
-		else
-			sb:append('false')	
-		end
-
-	elseif (type(value) == 'table') then
-		_encodeLuaTable(sb, value, indent)
-			
-	else
-		sb:append("null")
-	end
-end
-
-function _encodeLuaTable(sb, object, indent)
-	if (not indent) then
-		indent = ""
-	end
-
-	local nextIndent = indent .. "  "
-	local sep = ""
-
-	if (#object > 0) then
-		sb:append("[\n")
-		
-		for k,v in ipairs(object) do
-			sb:append(sep)
-			sb:append(nextIndent)
-			_encodeLuaValue(sb, v, nextIndent)
-			sep = ",\n"
-		end
-
-		if (#sep == 0) then
-			sb:append("]\n")
-
-		else
-			sb:append("\n")
-			sb:append(indent)
-			sb:append("]")
-		end
-
-	else
-		local keys = {}
-		for k,v in pairs(object) do
-			table.insert(keys, k)
-		end
-
-		table.sort( keys, function(a, b) return tostring(a) < tostring(b) end)
-	
-		sb:append("{\n")
-		for i = 1, #keys do
-			local k = keys[i]
-			local v = object[k]
-
-			sb:append(sep)
-			sb:append(nextIndent)
-			sb:append('"')
-			sb:append(k)
-			sb:append('":')
-			_encodeLuaValue(sb, v, nextIndent)
-
-			sep = ",\n"
-		end
-		
-		if (#sep == 0) then
-			sb:append("}\n")
-
-		else
-			sb:append("\n")
-			sb:append(indent)
-			sb:append("}")
-		end
-	end
-end
-
+-- 将 Lua 对象编码为 JSON 格式字符串
+-- @param indent {number|string} 缩进的空格数或者缩进字符串, 指定时输出带缩进
+--  和换行的格式, 并且按顺序输出对象的键
 exports.stringify = function(value, test, indent)
     if (type(value) == 'table') and (next(value) == nil) then
         return "[]";
     end
 
-    if (indent) then
-        local sb = util.StringBuffer:new()
-	    _encodeLuaTable(sb, value, "")
-        return sb:toString()
+    if (indent == true) then
+        indent = 2
     end
 
-    local status, ret = pcall(cjson.encode, value)
+    local status, ret = pcall(cjson.encode, value, indent)
     if (status) then
         return ret
     end
@@ -180,6 +60,71 @@ exports.parse = function(data)
     return nil, ret
 end
 
+-- 将 value 编码后直接追加到 buffer 的末尾, 不会创建中间的字符串
+-- @param {Buffer|userdata} buffer Buffer 对象或者 lutils.new_buffer 创建的缓存区
+-- @return {number} 写入的字节数, 失败 (比如缓存区空间不足) 时返回 nil, err
+exports.stringifyTo = function(value, buffer)
+    if (type(buffer) == 'table') then
+        buffer = buffer.buffer
+    end
+
+    if (type(value) == 'table') and (next(value) == nil) then
+        -- 和 stringify 一样, 空 Table 编码为 "[]"
+        local position = buffer:size() + 1
+        if (buffer:expand(2) <= 0) then
+            return nil, 'buffer is full'
+        end
+
+        buffer:put_bytes(position, '[]', 1, 2)
+        return 2
+    end
+
+    local status, ret = pcall(cjson.encode_buffer, value, buffer)
+    if (status) then
+        return ret
+    end
+
+    return nil, ret
+end
+
+-------------------------------------------------------------------------------
+-- decoder
+
+-- 创建一个增量解码器, 用于分块到达的大数据 (比如 HTTP 消息体),
+-- 或者由空白字符分隔的多个 JSON 值 (比如每行一个 JSON 值的日志)
+--
+-- decoder:write(chunk) 返回这个数据块中完整的值的列表, 可能为空
+-- decoder:finish() 返回剩下的值的列表, 数据在值的中间结束时出错
+-- 出错时都返回 nil, err, 之后这个解码器不能再使用
+exports.createDecoder = function()
+    local decoder = cjson.decoder()
+    local self = {}
+
+    function self:write(chunk)
+        local status, ret = pcall(decoder.write, decoder, chunk)
+        if (status) then
+            return ret
+        end
+
+        return nil, ret
+    end
+
+    function self:finish()
+        local status, ret = pcall(decoder.finish, decoder)
+        if (status) then
+            return ret
+        end
+
+        return nil, ret
+    end
+
+    function self:close()
+        decoder:close()
+    end
+
+    return self
+end
+
 exports.encode = exports.stringify
 exports.decode = exports.parse
 exports.null   = cjson.null
@@ -79,13 +79,15 @@ function Socket:address()
     return uv.tcp_getpeername(self._handle)
 end
 
-function Socket:bind(ip, port)
+-- @param {object} flags
+--  - reuseport {boolean} 允许多个线程同时侦听同一个端口
+function Socket:bind(ip, port, flags)
     --console.log(self._handle, ip, port)
     if (self.is_pipe) then
         return self._handle:bind(port)
     end
 
-    return uv.tcp_bind(self._handle, ip, tonumber(port))
+    return uv.tcp_bind(self._handle, ip, tonumber(port), flags)
 end
 
 function Socket:connect(...)
@@ -154,33 +156,49 @@ function Socket:connect(...)
         options.host = '127.0.0.1'
     end
 
-    --console.log(options)
-    uv.getaddrinfo(options.host, options.port, { socktype = "stream" }, function(err, res)
-        timer.active(self)
+    -- Lookups go through the caching resolver in `dns` unless the caller
+    -- provides its own `lookup(host, options, callback)` function
+    local dns = require('dns')
+    local lookup = options.lookup or dns.lookup
+
+    local function onPort(err, port)
         if err then
             return self:destroy(err)
         end
 
-        --console.log(res)
-
-        local rinfo = res[1]
-        if (not rinfo) or (not rinfo.port) then
-            return self:destroy('Invalid host address: ' .. tostring(options.host))
-        end
-        --print('Socket:connect', rinfo.addr, rinfo.port)
-        if self.destroyed then return end
-
-        uv.tcp_connect(self._handle, rinfo.addr, rinfo.port, function(err)
-            --print('Socket:connect', err)
+        --console.log(options)
+        lookup(options.host, { family = options.family }, function(err, address)
+            timer.active(self)
             if err then
                 return self:destroy(err)
             end
-            timer.active(self)
-            self._connecting = false
-            self:emit('connect')
-            if callback then callback() end
+
+            if (not address) then
+                return self:destroy('Invalid host address: ' .. tostring(options.host))
+            end
+            --print('Socket:connect', address, port)
+            if self.destroyed then return end
+
+            uv.tcp_connect(self._handle, address, port, function(err)
+                --print('Socket:connect', err)
+                if err then
+                    return self:destroy(err)
+                end
+                timer.active(self)
+                self._connecting = false
+                self:emit('connect')
+                if callback then callback() end
+            end )
         end )
-    end )
+    end
+
+    -- Service names such as 'http' are resolved into a port number first
+    local port = tonumber(options.port)
+    if port then
+        onPort(nil, port)
+    else
+        dns.lookupPort(options.port, onPort)
+    end
 
     return self
 end
@@ -273,7 +291,7 @@ end
 
 function Socket:pause()
     Duplex.pause(self)
-    if not self._handle then return end
+    if (not self._handle) or self._relay then return end
     self._reading = false
     uv.read_stop(self._handle)
 end
@@ -295,7 +313,10 @@ function Socket:_read(n)
         end
     end
 
-    if self._connecting then
+    if self._relay then
+        return
+
+    elseif self._connecting then
         self:once('connect', util.bind(self._read, self, n))
 
     elseif not self._reading then
@@ -334,6 +355,16 @@ end
 
 function Socket:_write(data, callback)
     if not self._handle then return end
+
+    -- The address lookup may not have finished yet, so `uv.tcp_connect` has
+    -- not been called; hold the data until the socket is connected
+    if self._connecting then
+        self:once('connect', function()
+            self:_write(data, callback)
+        end)
+        return
+    end
+
     uv.write(self._handle, data, function(err)
         if err then
             self:destroy(err)
@@ -364,6 +395,9 @@ function Server:init(options, callback)
     if options.handle then
         self._handle = options.handle
     end
+
+    -- SO_REUSEPORT, see cluster
+    self.reusePort = options.reusePort
 end
 
 function Server:address()
@@ -422,7 +456,7 @@ function Server:listen(port, host, backlog, callback)
     local ret, message, err
 
     serverSocket.is_pipe = self.is_pipe
-    ret, message, err = serverSocket:bind(host, port)
+    ret, message, err = serverSocket:bind(host, port, { reuseport = self.reusePort })
     if (not ret) then
         --console.log(message, err)
         self:emit('error', message, err)
@@ -477,6 +511,47 @@ end
 
 exports.connect = exports.createConnection
 
+--[[
+Relays all data between two connected sockets in native code: the data never
+enters Lua and reading pauses while the other side's write queue is full.
+
+The sockets no longer emit 'data' and their idle timeouts are disabled. When
+both directions have ended, on the first error, or when either socket is
+destroyed, both sockets are destroyed and `callback(err, stats)` is called.
+
+Returns the relay object, call `relay:stats()` for the byte and latency
+counters of the `forward` (a to b) and `backward` (b to a) directions.
+--]]
+function exports.relay(a, b, callback)
+    if (not a._handle) or (not b._handle) then
+        error('Relay requires connected sockets')
+    end
+
+    local relay
+
+    local _onFinish = function(err)
+        a._relay = nil
+        b._relay = nil
+
+        local stats = relay and relay:stats()
+        a:destroy()
+        b:destroy()
+
+        if callback then callback(err, stats) end
+    end
+
+    for _, socket in ipairs({ a, b }) do
+        timer.unenroll(socket)
+        socket._relay = true
+        socket._reading = false
+    end
+
+    relay = uv.relay(a._handle, b._handle, _onFinish)
+    a._relay = relay
+    b._relay = relay
+    return relay
+end
+
 -- callback: 'connection' listener
 function exports.createServer(options, callback)
     local server = Server:new()
@@ -82,7 +82,7 @@ function process.nextTick(...)
         timer = require('timer')
     end
 
-    timer.setImmediate(...)
+    timer.nextTick(...)
 end
 
 function process.kill(pid, signal)
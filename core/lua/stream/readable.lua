@@ -76,7 +76,10 @@ function ReadableState:initialize(options, stream)
 
       self.highWaterMark = options.highWaterMark or defaultHwm -- 水位标记, 用来触发 readable 等事件的临界点
 
-      self.buffer     = { }     -- 这个流的内部缓存区
+      self.buffer     = { }     -- 这个流的内部缓存区, 是一个双端队列, 有效的数据块为 buffer[head..tail]
+      self.head       = 1       -- 第一个数据块的索引
+      self.tail       = 0       -- 最后一个数据块的索引
+      self.offset     = 0       -- 第一个数据块中已经读取了的字节数
       self.length     = 0       -- 这个流的内部缓存的数据的长度
       self.pipes      = nil     --
       self.pipesCount = 0       --
@@ -133,6 +136,8 @@ end
 
 -- 写入指定的数据包到缓存区中
 function _stateWriteToBuffer(state, chunk, addToFront)
+    local list = state.buffer
+
     if state.objectMode then
         state.length = state.length + 1
     else
@@ -140,10 +145,64 @@ function _stateWriteToBuffer(state, chunk, addToFront)
     end
 
     if addToFront then
-        table.insert(state.buffer, 1, chunk)
+        -- 先去掉第一个数据块中已经读取了的部分
+        if state.offset > 0 then
+            list[state.head] = string.sub(list[state.head], state.offset + 1)
+            state.offset = 0
+        end
+
+        state.head = state.head - 1
+        list[state.head] = chunk
+
+    else
+        state.tail = state.tail + 1
+        list[state.tail] = chunk
+    end
+end
+
+-- 移除缓存区中的第一个数据块
+local function _stateShiftBuffer(state)
+    local head = state.head
+    local list = state.buffer
+    local chunk = list[head]
+
+    list[head] = nil
+    state.offset = 0
+
+    if head >= state.tail then
+        -- 队列为空, 重置索引
+        state.head = 1
+        state.tail = 0
     else
-        table.insert(state.buffer, chunk)
+        state.head = head + 1
     end
+
+    return chunk
+end
+
+-- 返回并清空缓存区中所有的数据
+local function _stateClearBuffer(state)
+    local list = state.buffer
+    local ret
+
+    if state.head == state.tail then
+        ret = list[state.head]
+        if state.offset > 0 then
+            ret = string.sub(ret, state.offset + 1)
+        end
+
+    else
+        if state.offset > 0 then
+            list[state.head] = string.sub(list[state.head], state.offset + 1)
+        end
+        ret = table.concat(list, '', state.head, state.tail)
+    end
+
+    state.buffer = {}
+    state.head   = 1
+    state.tail   = 0
+    state.offset = 0
+    return ret
 end
 
 -- 从缓存区中读取 n 个字节的数据, 如果缓存区数据小于 n 则返回所有的数据
@@ -159,11 +218,10 @@ function _stateReadFromBuffer(state, n)
 
     local list    = state.buffer
     local length  = state.length
-    local objectMode = not not state.objectMode
     local ret
 
     -- nothing in the list, definitely empty.
-    if len(list) == 0 then
+    if state.head > state.tail then
         return nil
     end
 
@@ -171,50 +229,60 @@ function _stateReadFromBuffer(state, n)
         -- 缓存为空
         ret = nil
 
-    elseif objectMode then
+    elseif state.objectMode then
         -- 如果是对象模式, 则只返回队列中的第一个元素.
-        ret = table.remove(list, 1)
+        ret = _stateShiftBuffer(state)
 
     elseif (not n) or (n >= length) then
         -- 缓存不足 n 个字节
-        ret = table.concat(list, '')
-        state.buffer = {}
+        ret = _stateClearBuffer(state)
 
     else
         -- read just some of it.
-        if n < len(list[1]) then
-            -- 第一个项目有足够的数据
-            -- just take a part of the first list item.
-            -- slice is the same for buffers and strings.
-            local buf = list[1]
-            ret = string.sub(buf, 1, n)
-            list[1] = string.sub(buf, n + 1, -1)
-
-        elseif n == len(list[1]) then
-            -- 第一个项目刚好有足够的数据
+        local first = list[state.head]
+        local offset = state.offset
+        local available = #first - offset
+
+        if n < available then
+            -- 第一个数据块有足够的数据, 只移动偏移位置, 不用重新切分剩下的数据
+            ret = string.sub(first, offset + 1, offset + n)
+            state.offset = offset + n
+
+        elseif n == available then
+            -- 第一个数据块刚好有足够的数据
             -- first list is a perfect match
-            ret = table.remove(list, 1)
+            if offset > 0 then
+                ret = string.sub(first, offset + 1)
+            else
+                ret = first
+            end
+            _stateShiftBuffer(state)
 
         else
             --[[
             // complex case.
             // we have enough to cover it, but it spans past the first buffer.
             --]]
-
-            -- for better GC efficiency. (http://www.lua.org/pil/11.6.html)
             local tmp = {}
             local c = 0
-            for i = 1, len(list), 1 do
-                if n - c >= len(list[1]) then
-                    -- grab the entire list[1]
-                    c = c + list[1]
-                    table.insert(tmp, table.remove(list, 1))
+            while c < n do
+                local chunk = list[state.head]
+                local start = state.offset
+                local size = #chunk - start
+
+                if n - c >= size then
+                    -- grab the entire chunk
+                    if start > 0 then
+                        chunk = string.sub(chunk, start + 1)
+                    end
+                    tmp[#tmp + 1] = chunk
+                    c = c + size
+                    _stateShiftBuffer(state)
 
                 else
+                    tmp[#tmp + 1] = string.sub(chunk, start + 1, start + n - c)
+                    state.offset = start + n - c
                     c = n
-                    table.insert(tmp, string.sub(list[1], 1, n - c))
-                    list[1] = string.sub(list[1], n + 1, -1)
-                    break
                 end
             end
             ret = table.concat(tmp)
@@ -232,7 +300,7 @@ end
 -- 0: 如果流已结束而且缓存区为空
 -- 0: n == 0
 -- state.length: not n & pause mode
--- #state.buffer[1]: not n & flowing mode
+-- #state.buffer[head] - offset: not n & flowing mode
 -- n: n <= state.length
 -- 0: n > state.length
 -- state.length: 如果流已结束而且缓存区不为空
@@ -257,9 +325,9 @@ function _stateHowMuchToRead(state, n)
     if (n ~= n) or (not n) then
         if state.flowing then
             -- 流模式下只返回一个数据包
-            local buffer = state.buffer[1]
+            local buffer = state.buffer[state.head]
             if (buffer) then
-                return #buffer
+                return #buffer - state.offset
             end
 
             return 0
@@ -148,6 +148,7 @@ function Transform:initialize(options)
     Duplex.initialize(self, options)
 
     self._transformState = TransformState:new(options, self)
+    self._writableState.emitEnd = false
 
     --[[
   // when the writable side finishes, then flush out anything remaining.
@@ -168,7 +169,7 @@ function Transform:initialize(options)
 
     self:once('prefinish', function()
         if type(self._flush) == 'function' then
-            self._flush( function(er)
+            self:_flush( function(er)
                 _done(stream, er)
             end )
 
@@ -73,7 +73,11 @@ function _writeEndWritable(stream, callback)
     end
 
     state.ended = true  -- end ending
-    stream:emit('end')
+
+    -- Transform 流的 'end' 事件表示可读的一端已经结束, 由 Readable 触发
+    if (state.emitEnd) then
+        stream:emit('end')
+    end
 end
 
 local function _writeOnWrite(stream, writev, len, chunk, callback)
@@ -381,6 +385,9 @@ function WritableState:initialize(options, stream)
     -- 这个流已经被终止
     self.ended = false
 
+    -- 结束时是否触发 'end' 事件
+    self.emitEnd = true
+
     -- when 'finish' is emitted
     -- 这个流已经完成
     self.finished = false
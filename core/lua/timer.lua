@@ -77,6 +77,303 @@ Timer.getRepeat = uv.timer_get_repeat
 -- Timer.now
 Timer.now = uv.now
 
+-------------------------------------------------------------------------------
+--- TimerWheel
+
+-- 分层时间轮
+--
+-- setTimeout 和 enroll/active (socket 的空闲超时) 的所有定时项都挂在同一个
+-- uv 定时器上, 不需要为每个定时项创建一个 uv 定时器.
+--
+-- - 分辨率为 1 毫秒, 共 4 层, 每层 64 个槽, 第 n 层每个槽跨越 64^n 毫秒
+-- - 添加和删除都是 O(1); 定时项的到期时间推后时 (比如 socket 又有了数据)
+--   只修改 _wheelWhen, 到期时再检查是否需要重新放入时间轮
+-- - 每个槽是一个双向链表, 同一个槽中的定时项按添加的顺序触发
+-- - uv 定时器只在最近的非空槽到期时才唤醒
+--
+-- 定时项是一个 table, 到期时调用 item:_onTimeout(), 没有这个方法时发出 'timeout' 事件
+
+local WHEEL_BITS   = 6
+local WHEEL_SIZE   = 1 << WHEEL_BITS
+local WHEEL_MASK   = WHEEL_SIZE - 1
+local WHEEL_LEVELS = 4
+local WHEEL_RANGE  = 1 << (WHEEL_BITS * WHEEL_LEVELS)
+
+local function wheel_list_init(list)
+    list._idleNext = list
+    list._idlePrev = list
+    return list
+end
+
+local function wheel_list_append(list, item)
+    local last = list._idlePrev
+    item._idlePrev = last
+    item._idleNext = list
+    last._idleNext = item
+    list._idlePrev = item
+end
+
+local function wheel_list_remove(item)
+    item._idleNext._idlePrev = item._idlePrev
+    item._idlePrev._idleNext = item._idleNext
+    item._idleNext = false
+    item._idlePrev = false
+end
+
+-- setTimeout 的定时项到期
+local function _onTimeout(timeout)
+    local args = timeout._args
+    if args then
+        timeout._callback(table.unpack(args, 1, args.n))
+    else
+        timeout._callback()
+    end
+end
+
+local TimerWheel = Object:extend()
+exports.TimerWheel = TimerWheel
+
+function TimerWheel:initialize()
+    self.current = 0    -- 已经处理完的时间 (毫秒)
+    self.count   = 0    -- 定时项的数量
+    self.counts  = {}   -- 每一层中定时项的数量
+    self.levels  = {}   -- levels[level][slot] 为链表
+    self.wakeAt  = nil  -- uv 定时器下次唤醒的时间
+    self._handle = nil
+
+    for level = 0, WHEEL_LEVELS - 1 do
+        local slots = {}
+        for slot = 0, WHEEL_MASK do
+            slots[slot] = wheel_list_init({})
+        end
+
+        self.levels[level] = slots
+        self.counts[level] = 0
+    end
+end
+
+-- 添加一个定时项, 或修改它的到期时间
+-- @param item 定时项
+-- @param when 到期时间 (uv.now() 的毫秒数)
+function TimerWheel:schedule(item, when)
+    if self.count == 0 then
+        self.current = uv.now()
+        if self._handle then
+            uv.ref(self._handle)
+        end
+    end
+
+    if item._wheelLevel then
+        -- 推后: 等到原来的时间到期时再处理
+        if when >= item._wheelExpires then
+            item._wheelWhen = when
+            return
+        end
+
+        self:cancel(item)
+    end
+
+    item._wheelWhen = when
+    self:_insert(item, when, self.current + 1)
+
+    local expires = item._wheelExpires
+    if (not self.wakeAt) or (expires < self.wakeAt) then
+        self:_start(expires)
+    end
+end
+
+-- 删除一个定时项
+function TimerWheel:cancel(item)
+    local level = item._wheelLevel
+    if not level then
+        return
+    end
+
+    wheel_list_remove(item)
+    item._wheelLevel = false
+    self.counts[level] = self.counts[level] - 1
+    self.count = self.count - 1
+
+    -- 不停止 uv 定时器, 只是不再让它阻止事件循环退出, 到时 _run 会停止它,
+    -- 这样频繁地添加和删除同一个定时项时不需要每次都重启 uv 定时器
+    if self.count == 0 then
+        uv.unref(self._handle)
+    end
+end
+
+-- 把定时项放入对应的槽, 到期时间不早于 first
+function TimerWheel:_insert(item, expires, first)
+    if expires < first then
+        expires = first
+    end
+
+    local current = self.current
+    local delta = expires - current
+    if delta >= WHEEL_RANGE then
+        -- 超出时间轮的范围, 先放在最后, 到时再重新计算
+        expires = current + WHEEL_RANGE - 1
+        delta = WHEEL_RANGE - 1
+    end
+
+    local level = 0
+    while delta >= (1 << (WHEEL_BITS * (level + 1))) do
+        level = level + 1
+    end
+
+    local slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK
+    wheel_list_append(self.levels[level][slot], item)
+
+    item._wheelLevel = level
+    item._wheelExpires = expires
+    self.counts[level] = self.counts[level] + 1
+    self.count = self.count + 1
+end
+
+-- 把高层的槽中的定时项移到低层
+function TimerWheel:_cascade(tick, level)
+    local slot = (tick >> (WHEEL_BITS * level)) & WHEEL_MASK
+    if slot == 0 and level < WHEEL_LEVELS - 1 then
+        self:_cascade(tick, level + 1)
+    end
+
+    local list = self.levels[level][slot]
+    local counts = self.counts
+    local item = list._idleNext
+    while item ~= list do
+        local nextItem = item._idleNext
+        wheel_list_remove(item)
+        counts[level] = counts[level] - 1
+        self.count = self.count - 1
+
+        self:_insert(item, item._wheelExpires, tick)
+        item = nextItem
+    end
+end
+
+-- 调用到期的定时项的回调函数
+local function _dispatch(item)
+    if item._onTimeout then
+        item:_onTimeout()
+
+    elseif item.emit then
+        item:emit('timeout')
+    end
+end
+
+-- 和 uv 的回调函数一样, 打印回调函数抛出的错误后继续执行,
+-- 不能让一个定时项的错误中断时间轮, 否则其他定时项都不会再触发
+local function _onDispatchError(err)
+    io.stderr:write('Uncaught Error: ', debug.traceback(tostring(err), 2), '\n')
+end
+
+-- 触发一个槽中所有到期的定时项
+function TimerWheel:_expire(list)
+    local current = self.current
+    local counts = self.counts
+
+    while list._idleNext ~= list do
+        local item = list._idleNext
+        wheel_list_remove(item)
+        item._wheelLevel = false
+        counts[0] = counts[0] - 1
+        self.count = self.count - 1
+
+        if item._wheelWhen > current then
+            -- 到期时间被推后了
+            self:_insert(item, item._wheelWhen, current + 1)
+
+        else
+            xpcall(_dispatch, _onDispatchError, item)
+        end
+    end
+end
+
+-- 处理到当前时间为止所有的槽
+function TimerWheel:_run()
+    self.wakeAt = nil
+
+    local now = uv.now()
+    local slots = self.levels[0]
+    local counts = self.counts
+
+    while self.current < now and self.count > 0 do
+        local tick = self.current + 1
+
+        -- 第 0 层为空时直接跳到下一次需要移动高层定时项的时间
+        if counts[0] == 0 then
+            local boundary = ((tick >> WHEEL_BITS) + 1) << WHEEL_BITS
+            if (tick & WHEEL_MASK) ~= 0 then
+                tick = math.min(now, boundary)
+            end
+        end
+
+        self.current = tick
+        if (tick & WHEEL_MASK) == 0 then
+            self:_cascade(tick, 1)
+        end
+
+        self:_expire(slots[tick & WHEEL_MASK])
+    end
+
+    if self.count == 0 then
+        self:_stop()
+        return
+    end
+
+    self:_start(self:_nextTick())
+end
+
+-- 返回下一个需要处理的时间
+function TimerWheel:_nextTick()
+    local current = self.current
+    local best = nil
+
+    for level = 0, WHEEL_LEVELS - 1 do
+        if self.counts[level] > 0 then
+            local shift = WHEEL_BITS * level
+            local slots = self.levels[level]
+            local base = (current >> shift) + 1
+
+            for i = 0, WHEEL_MASK do
+                local list = slots[(base + i) & WHEEL_MASK]
+                if list._idleNext ~= list then
+                    local tick = (base + i) << shift
+                    if (not best) or (tick < best) then
+                        best = tick
+                    end
+                    break
+                end
+            end
+        end
+    end
+
+    return best or (current + 1)
+end
+
+function TimerWheel:_start(when)
+    if not self._handle then
+        self._handle = uv.new_timer()
+        self._onRun = function() self:_run() end
+    end
+
+    local delay = when - uv.now()
+    if delay < 0 then
+        delay = 0
+    end
+
+    self.wakeAt = when
+    uv.timer_start(self._handle, delay, 0, self._onRun)
+end
+
+function TimerWheel:_stop()
+    self.wakeAt = nil
+    if self._handle then
+        uv.timer_stop(self._handle)
+    end
+end
+
+exports.wheel = TimerWheel:new()
+
 ------------------------------------------------------------------------------
 
 function exports.sleep(delay, thread)
@@ -98,16 +395,29 @@ It is important to note that your callback will probably not be called in exactl
 delay milliseconds - Node.js makes no guarantees about the exact timing of when
 the callback will fire, nor of the ordering things will fire in. The callback
 will be called as close as possible to the time specified.
+
+setTimeout 不会为每个调用创建 uv 定时器, 而是挂在共享的时间轮上 (见 TimerWheel).
 --]]
 function exports.setTimeout(delay, callback, ...)
-    local timer = uv.new_timer()
-    local args = { ...}
-    uv.timer_start(timer, delay, 0, function()
-        uv.timer_stop(timer)
-        uv.close(timer)
-        callback(table.unpack(args))
-    end )
-    return timer
+    -- 预先创建时间轮使用的字段, 避免 table 多次扩容
+    local timeout = {
+        _callback = callback,
+        _args = (select('#', ...) > 0) and table.pack(...) or false,
+        _onTimeout = _onTimeout,
+        _wheelWhen = 0,
+        _wheelExpires = 0,
+        _wheelLevel = false,
+        _idleNext = false,
+        _idlePrev = false
+    }
+
+    delay = math.floor(tonumber(delay) or 0)
+    if delay < 0 then
+        delay = 0
+    end
+
+    exports.wheel:schedule(timeout, uv.now() + delay)
+    return timeout
 end
 
 --[[
@@ -125,194 +435,283 @@ end
 Stops an interval from triggering.
 --]]
 function exports.clearInterval(timer)
+    if type(timer) == 'table' then
+        return exports.clearTimeout(timer)
+    end
+
     if uv.is_closing(timer) then return end
     uv.timer_stop(timer)
     uv.close(timer)
 end
 
-exports.clearTimeout = exports.clearInterval
+--[[
+Prevents a timeout from triggering.
+--]]
+function exports.clearTimeout(timeout)
+    if type(timeout) ~= 'table' then
+        -- uv 定时器
+        return exports.clearInterval(timeout)
+    end
+
+    exports.wheel:cancel(timeout)
+end
 
 ------------------------------------------------------------------------------
 
-local checker = uv.new_check()
-local idler   = uv.new_idle()
+-- setImmediate 和 nextTick 的回调队列
+--
+-- 每个回调按 | id | 参数个数 | callback | 参数... | 依次保存在同一个数组中,
+-- head 和 tail 为第一个和最后一个元素的位置, 执行完后重新从 1 开始. 每种回调
+-- 使用两个队列交替执行和接收新的回调, 这样数组会被一直重用, 添加和执行回调时
+-- 不需要创建闭包或参数 table.
+
+local function queue_new()
+    return { head = 1, tail = 0 }
+end
+
+local function queue_is_empty(queue)
+    return queue.head > queue.tail
+end
 
-local immediateQueue = { }
+local function queue_push(queue, id, callback, ...)
+    local count = select('#', ...)
+    local tail = queue.tail
 
-local function _onCheck()
-    local queue = immediateQueue
-    immediateQueue = { }
-    for i = 1, #queue do
-        queue[i]()
+    queue[tail + 1] = id
+    queue[tail + 2] = count
+    queue[tail + 3] = callback
+
+    if count == 1 then
+        queue[tail + 4] = ...
+
+    elseif count > 1 then
+        for i = 1, count do
+            queue[tail + 3 + i] = (select(i, ...))
+        end
     end
 
-    -- If the queue is still empty, we processed them all
-    -- Turn the check hooks back off.
-    if #immediateQueue == 0 then
-        if (checker) then
-            checker:stop()
+    queue.tail = tail + 3 + count
+end
+
+-- 执行队列中所有的回调
+local function queue_run(queue, afterEach)
+    while queue.head <= queue.tail do
+        local head = queue.head
+        local count = queue[head + 1]
+        local callback = queue[head + 2]
+        local first = head + 3
+        local stop = first + count
+
+        queue[head] = false
+        queue[head + 2] = false
+
+        -- 先移动 head, 回调抛出错误时不会被再次执行
+        queue.head = stop
+
+        if callback then
+            if count == 0 then
+                callback()
+
+            elseif count == 1 then
+                local arg = queue[first]
+                queue[first] = nil
+                callback(arg)
+
+            else
+                callback(table.unpack(queue, first, stop - 1))
+                for i = first, stop - 1 do
+                    queue[i] = nil
+                end
+            end
         end
 
-        if (idler) then
-            idler:stop()
+        if afterEach then
+            afterEach()
         end
     end
+
+    queue.head = 1
+    queue.tail = 0
 end
 
---[[
-To schedule the "immediate" execution of callback after I/O events callbacks
-and before setTimeout and setInterval . Returns an immediateObject for possible
-use with clearImmediate(). Optionally you can also pass arguments to the callback.
+-- 删除指定 id 的回调
+local function queue_remove(queue, id)
+    local index = queue.head
+    while index <= queue.tail do
+        local count = queue[index + 1]
+        if queue[index] == id then
+            queue[index] = false
+            queue[index + 2] = false
+            for i = index + 3, index + 2 + count do
+                queue[i] = nil
+            end
+            return true
+        end
 
-Callbacks for immediates are queued in the order in which they were created.
-The entire callback queue is processed every event loop iteration. If you queue
-an immediate from inside an executing callback, that immediate won't fire until
-the next event loop iteration.
---]]
-function exports.setImmediate(callback, ...)
-    -- If the queue was empty, the check hooks were disabled.
-    -- Turn them back on.
+        index = index + 3 + count
+    end
+end
 
-    if #immediateQueue == 0 then
-        if (not uv.is_closing(checker)) then
-            checker:start(_onCheck)
+-- 执行 pending 队列中的回调, 执行过程中新添加的回调进入另一个队列, 留到下一次执行
+local function channel_run(channel, afterEach)
+    local queue = channel.running
+    if queue_is_empty(queue) then
+        queue = channel.pending
+        if queue_is_empty(queue) then
+            return
         end
 
-        if (not uv.is_closing(idler)) then
-            idler:start(_onCheck)
-        end
+        channel.pending = channel.running
+        channel.running = queue
     end
 
-    immediateQueue[#immediateQueue + 1] = bind(callback, ...)
+    -- 上一次执行时回调抛出了错误, 先执行剩下的回调
+    queue_run(queue, afterEach)
 end
 
-------------------------------------------------------------------------------
+local function channel_is_empty(channel)
+    return queue_is_empty(channel.pending) and queue_is_empty(channel.running)
+end
 
-local lists = { }
+local checker  = uv.new_check()
+local idler    = uv.new_idle()
+local preparer = uv.new_prepare()
 
-local function list_init(list)
-    list._idleNext = list
-    list._idlePrev = list
+local immediates = { pending = queue_new(), running = queue_new() }
+local immediateId = 0
+
+local ticks = { pending = queue_new(), running = queue_new() }
+
+-- 执行所有的 nextTick 回调, 执行过程中新添加的回调留到下一次执行,
+-- 不断调用 nextTick 时也不会使 I/O 和定时器得不到执行
+local function _runTicks()
+    channel_run(ticks)
 end
 
-local function list_peek(list)
-    if list._idlePrev == list then
-        return nil
-    end
-    return list._idlePrev
+-- 有 setImmediate 或 nextTick 回调时, idle 使事件循环不会在 poll 阶段阻塞
+local function _onIdle()
 end
 
-local function list_remove(item)
-    if item._idleNext then
-        item._idleNext._idlePrev = item._idlePrev
+local function _stopIdle()
+    if channel_is_empty(immediates) and channel_is_empty(ticks) then
+        if (idler) then
+            idler:stop()
+        end
     end
+end
 
-    if item._idlePrev then
-        item._idlePrev._idleNext = item._idleNext
+local function _startIdle()
+    if (not uv.is_closing(idler)) then
+        idler:start(_onIdle)
     end
-
-    item._idleNext = nil
-    item._idlePrev = nil
 end
 
-local function list_append(list, item)
-    list_remove(item)
-    item._idleNext = list._idleNext
-    list._idleNext._idlePrev = item
-    item._idlePrev = list
-    list._idleNext = item
-end
+local function _onPrepare()
+    _runTicks()
 
-local function list_is_empty(list)
-    return list._idleNext == list
+    if channel_is_empty(ticks) then
+        preparer:stop()
+        _stopIdle()
+    end
 end
 
-local list_expiration
-list_expiration = function(timer, msecs)
-    return function()
-        local now = Timer.now()
-        while list_peek(timer) do
-            local elem = list_peek(timer)
-            local diff = now - elem._idleStart;
-            if ((diff + 1) < msecs) == true then
-                timer:start(msecs - diff, 0, list_expiration(timer, msecs))
-                return
-            else
-                list_remove(elem)
-                if elem.emit then
-                    elem:emit('timeout')
-                end
-            end
-        end
+local function _onCheck()
+    _runTicks()
+    channel_run(immediates, _runTicks)
 
-        -- Remove the timer if it wasn't already
-        -- removed by unenroll
-        local list = lists[msecs]
-        if list and list_is_empty(list) then
-            list:stop()
-            list:close()
-            lists[msecs] = nil
+    -- If the queue is still empty, we processed them all
+    -- Turn the check hooks back off.
+    if channel_is_empty(immediates) then
+        if (checker) then
+            checker:stop()
         end
+
+        _stopIdle()
     end
 end
 
-local function list_insert(item, msecs)
-    item._idleStart = Timer.now()
-    item._idleTimeout = msecs
+--[[
+To schedule the "immediate" execution of callback after I/O events callbacks
+and before setTimeout and setInterval . Returns an immediateObject for possible
+use with clearImmediate(). Optionally you can also pass arguments to the callback.
 
-    if msecs < 0 then return end
+Callbacks for immediates are queued in the order in which they were created.
+The entire callback queue is processed every event loop iteration. If you queue
+an immediate from inside an executing callback, that immediate won't fire until
+the next event loop iteration.
 
-    local list
+返回的 immediateObject 是一个整数.
+--]]
+function exports.setImmediate(callback, ...)
+    -- If the queue was empty, the check hooks were disabled.
+    -- Turn them back on.
 
-    if lists[msecs] then
-        list = lists[msecs]
-    else
-        list = Timer:new()
-        list_init(list)
-        list:start(msecs, 0, list_expiration(list, msecs))
-        lists[msecs] = list
+    if channel_is_empty(immediates) then
+        if (not uv.is_closing(checker)) then
+            checker:start(_onCheck)
+        end
+
+        _startIdle()
     end
 
-    list_append(list, item)
+    immediateId = immediateId + 1
+    queue_push(immediates.pending, immediateId, callback, ...)
+    return immediateId
 end
 
-local function list_unenroll(item)
-    list_remove(item)
-    local list = lists[item._idleTimeout]
-    if list and list_is_empty(list) then
-        -- empty list
-        list:stop()
-        list:close()
-        lists[item._idleTimeout] = nil
+--[[
+Stops an immediateObject, as created by setImmediate(), from triggering.
+--]]
+function exports.clearImmediate(immediate)
+    if not queue_remove(immediates.running, immediate) then
+        queue_remove(immediates.pending, immediate)
     end
-    item._idleTimeout = -1
 end
 
-exports.unenroll = list_unenroll
+--[[
+Adds callback to the "next tick queue". Once the current operation on the
+JavaScript stack runs to completion, all callbacks in the next tick queue
+will be called.
 
--- does not start the timer, just initializes the item
-exports.enroll = function(item, msecs)
-    if item._idleNext then
-        list_unenroll(item)
+nextTick 的回调在事件循环进入 poll 阶段 (等待 I/O) 之前执行, 以及在每个
+setImmediate 回调之后执行. 在 nextTick 回调中添加的回调在下一个执行点才执行.
+--]]
+function exports.nextTick(callback, ...)
+    if channel_is_empty(ticks) then
+        if (not uv.is_closing(preparer)) then
+            preparer:start(_onPrepare)
+        end
+
+        _startIdle()
     end
-    item._idleTimeout = msecs
-    list_init(item)
+
+    queue_push(ticks.pending, true, callback, ...)
 end
 
+------------------------------------------------------------------------------
+
 -- call this whenever the item is active (not idle)
+-- 只更新到期时间, 不需要移动它在时间轮中的位置
 exports.active = function(item)
     local msecs = item._idleTimeout
     if msecs and msecs >= 0 then
-        local list = lists[msecs]
-        if not list or list_is_empty(list) then
-            list_insert(item, msecs)
-        else
-            item._idleStart = Timer.now()
-            list_append(lists[msecs], item)
-        end
+        local now = uv.now()
+        item._idleStart = now
+        exports.wheel:schedule(item, now + msecs)
     end
 end
 
+-- does not start the timer, just initializes the item
+exports.enroll = function(item, msecs)
+    exports.wheel:cancel(item)
+    item._idleTimeout = msecs
+end
+
+exports.unenroll = function(item)
+    exports.wheel:cancel(item)
+    item._idleTimeout = -1
+end
+
 exports.now = uv.now
 
 return exports
@@ -63,7 +63,7 @@ local exports = {}
 if type(openssl) == 'table' then
     exports.randomBytes = randomBytesOpenSSL
 
-elseif rng then
+elseif ret and rng then
     exports.randomBytes = randomBytesMbedTLS
 
 else
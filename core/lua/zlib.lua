@@ -31,15 +31,441 @@ local fs    = require('fs')
 local util = require('util')
 local core  = require('core')
 
+local Transform = require('stream').Transform
+
 local Object = core.Object
 
+-------------------------------------------------------------------------------
+-- deflate & gzip
+
+-- 压缩级别对应的 miniz 查找次数 (tdefl flags 的低 12 位)
+local DEFLATE_PROBES = { [0] = 0, 1, 6, 32, 16, 32, 128, 256, 512, 768, 1500 }
+local DEFLATE_GREEDY = 0x04000 -- TDEFL_GREEDY_PARSING_FLAG
+
+local DEFLATE_ZLIB_HEADER = 0x01000 -- TDEFL_WRITE_ZLIB_HEADER
+local INFLATE_ZLIB_HEADER = 0x01    -- TINFL_FLAG_PARSE_ZLIB_HEADER
+
+local GZIP_HEADER = '\x1f\x8b\x08\0\0\0\0\0\0\xff'
+local GZIP_TRAILER_SIZE = 8
+
+-- tdefl 的刷新方式
+exports.Z_NO_FLUSH   = 0
+exports.Z_SYNC_FLUSH = 2
+exports.Z_FULL_FLUSH = 3
+exports.Z_FINISH     = 4
+
+local function getDeflateFlags(level)
+    level = math.floor(tonumber(level) or 6)
+    if (level < 0) or (level > 10) then
+        level = 6
+    end
+
+    local flags = DEFLATE_PROBES[level]
+    if (level <= 3) then
+        flags = flags | DEFLATE_GREEDY
+    end
+
+    return flags
+end
+
+exports.getDeflateFlags = getDeflateFlags
+
+-- 返回 data 的 CRC32 值 (和 gzip 使用的算法相同)
+function exports.crc32(data, crc)
+    return miniz.crc32(data, crc)
+end
+
+-- 使用 raw deflate 格式压缩
+function exports.deflateRawSync(data, level)
+    return miniz.deflate(data, getDeflateFlags(level))
+end
+
+-- 解压 raw deflate 格式的数据
+function exports.inflateRawSync(data)
+    return miniz.inflate(data, 0)
+end
+
+-- 使用 zlib 格式压缩
+function exports.deflateSync(data, level)
+    return miniz.deflate(data, getDeflateFlags(level) | DEFLATE_ZLIB_HEADER)
+end
+
+-- 解压 zlib 格式的数据
+function exports.inflateSync(data)
+    return miniz.inflate(data, INFLATE_ZLIB_HEADER)
+end
+
+-- 使用 gzip 格式压缩
+-- @param {string} data
+-- @param {number} level 压缩级别 0 ~ 9, 默认为 6
+-- @return {string}
+function exports.gzipSync(data, level)
+    local body = miniz.deflate(data, getDeflateFlags(level))
+    local trailer = string.pack('<I4I4', miniz.crc32(data), #data & 0xffffffff)
+    return GZIP_HEADER .. body .. trailer
+end
+
+-- 解析 gzip 头
+-- @return {number} 压缩数据开始的位置, 数据还不完整时返回 nil, 格式错误时返回 false
+local function parseGzipHeader(data)
+    local magic = '\x1f\x8b\x08'
+    if (data:sub(1, 3) ~= magic:sub(1, #data)) then
+        return false
+
+    elseif (#data < 10) then
+        return nil
+    end
+
+    local flags = data:byte(4)
+    local position = 11
+
+    if (flags & 0x04) ~= 0 then -- FEXTRA
+        if (#data < position + 1) then
+            return nil
+        end
+
+        local length = string.unpack('<I2', data, position)
+        position = position + 2 + length
+    end
+
+    if (flags & 0x08) ~= 0 then -- FNAME
+        local last = data:find('\0', position, true)
+        if (not last) then
+            return nil
+        end
+        position = last + 1
+    end
+
+    if (flags & 0x10) ~= 0 then -- FCOMMENT
+        local last = data:find('\0', position, true)
+        if (not last) then
+            return nil
+        end
+        position = last + 1
+    end
+
+    if (flags & 0x02) ~= 0 then -- FHCRC
+        position = position + 2
+    end
+
+    if (position > #data + 1) then
+        return nil
+    end
+
+    return position
+end
+
+-- 解压 gzip 格式的数据
+-- @return {string} 解压后的数据, 格式错误时返回 nil, err
+function exports.gunzipSync(data)
+    local position = (#data >= 18) and parseGzipHeader(data)
+    if (not position) then
+        return nil, 'Invalid gzip header'
+    end
+
+    local result = miniz.inflate(data:sub(position, -9), 0)
+    local crc, size = string.unpack('<I4I4', data, #data - 7)
+    if (not result) or (miniz.crc32(result) ~= crc) or ((#result & 0xffffffff) ~= size) then
+        return nil, 'Invalid gzip data'
+    end
+
+    return result
+end
+
+-------------------------------------------------------------------------------
+-- Zlib
+
+-- 压缩和解压流的基类, 子类实现 transformSync(chunk) 和 finishSync(), 返回输出的数据
+-- 每次只处理一块数据, 内存占用只有 miniz 固定大小的窗口和一块输出数据.
+-- 不需要流的时候 (比如 http 应答) 也可以直接调用这两个方法, 出错时会抛出异常.
+local Zlib = Transform:extend()
+exports.Zlib = Zlib
+
+function Zlib:initialize(options)
+    Transform.initialize(self, options)
+end
+
+function Zlib:_transform(chunk, callback)
+    -- 出错后忽略后面的数据
+    if (self._failed) then
+        return callback()
+    end
+
+    local ok, result = pcall(self.transformSync, self, chunk)
+    if (not ok) then
+        self._failed = true
+        return callback(result)
+    end
+
+    callback(nil, (result ~= '') and result or nil)
+end
+
+function Zlib:_flush(callback)
+    -- 错误已经在 _transform 中报告了, 这里仍然要结束流, 否则 finish/end 不会触发
+    if (self._failed) then
+        return callback()
+    end
+
+    local ok, result = pcall(self.finishSync, self)
+    if (not ok) then
+        self._failed = true
+        return callback(result)
+    end
+
+    if (result ~= '') then
+        self:push(result)
+    end
+
+    callback()
+end
+
+-------------------------------------------------------------------------------
+-- Deflate
+
+-- zlib 格式的压缩流
+-- @param {object} options
+--  - level {number} 压缩级别 0 ~ 9, 默认为 6
+local Deflate = Zlib:extend()
+exports.Deflate = Deflate
+
+function Deflate:initialize(options)
+    options = options or {}
+    Zlib.initialize(self, options)
+
+    local flags = getDeflateFlags(options.level)
+    if (self._zlibHeader ~= false) then
+        flags = flags | DEFLATE_ZLIB_HEADER
+    end
+
+    self._deflator = miniz.new_deflator(flags)
+end
+
+function Deflate:transformSync(chunk)
+    return self._deflator:deflate(chunk, exports.Z_NO_FLUSH)
+end
+
+function Deflate:finishSync()
+    local result = self._deflator:deflate('', exports.Z_FINISH)
+    self._deflator:close()
+    return result
+end
+
+-- 输出目前为止所有输入的数据的压缩结果, 以便对方可以马上解压
+function Deflate:flushSync(mode)
+    return self._deflator:deflate('', mode or exports.Z_SYNC_FLUSH)
+end
+
+-- raw deflate 格式的压缩流
+local DeflateRaw = Deflate:extend()
+exports.DeflateRaw = DeflateRaw
+
+DeflateRaw._zlibHeader = false
+
 -------------------------------------------------------------------------------
 -- Gzip
 
-local Gzip = Object:extend()
+local Gzip = Deflate:extend()
+exports.Gzip = Gzip
+
+Gzip._zlibHeader = false
+
+function Gzip:initialize(options)
+    Deflate.initialize(self, options)
+
+    self._crc = miniz.crc32('')
+    self._size = 0
+    self._headerSent = false
+end
+
+function Gzip:transformSync(chunk)
+    self._crc = miniz.crc32(chunk, self._crc)
+    self._size = self._size + #chunk
+
+    local result = self._deflator:deflate(chunk, exports.Z_NO_FLUSH)
+    if (not self._headerSent) then
+        self._headerSent = true
+        result = GZIP_HEADER .. result
+    end
+
+    return result
+end
+
+function Gzip:flushSync(mode)
+    local result = Deflate.flushSync(self, mode)
+    if (not self._headerSent) then
+        self._headerSent = true
+        result = GZIP_HEADER .. result
+    end
+
+    return result
+end
+
+function Gzip:finishSync()
+    local result = Deflate.finishSync(self)
+    if (not self._headerSent) then
+        self._headerSent = true
+        result = GZIP_HEADER .. result
+    end
+
+    local trailer = string.pack('<I4I4', self._crc, self._size & 0xffffffff)
+    return result .. trailer
+end
+
+-------------------------------------------------------------------------------
+-- Inflate
+
+-- zlib 格式的解压流
+local Inflate = Zlib:extend()
+exports.Inflate = Inflate
+
+Inflate._inflateFlags = INFLATE_ZLIB_HEADER
+
+function Inflate:initialize(options)
+    Zlib.initialize(self, options)
+
+    self._inflator = miniz.new_inflator(self._inflateFlags)
+    self._tail = '' -- 最后输入的几个字节, 用于找回 tinfl 预读的数据
+    self._finished = false
+end
+
+-- 解压一块数据, 压缩数据结束后剩下的数据交给 _onTrailer
+function Inflate:_inflate(chunk)
+    if (self._finished) then
+        self:_onTrailer(chunk)
+        return ''
+    end
+
+    local result, finished, unused = self._inflator:inflate(chunk)
+    if (not result) then
+        error(finished, 0)
+    end
+
+    if (finished) then
+        self._finished = true
+        if (unused > 0) then
+            local data = self._tail .. chunk
+            self:_onTrailer(data:sub(#data - unused + 1))
+        end
+
+    elseif (#chunk >= 16) then
+        self._tail = chunk:sub(-16)
+
+    else
+        self._tail = (self._tail .. chunk):sub(-16)
+    end
+
+    return result
+end
+
+Inflate.transformSync = Inflate._inflate
+
+function Inflate:_onTrailer(data)
+    -- 忽略压缩数据后面多余的数据
+end
+
+function Inflate:finishSync()
+    if (not self._finished) then
+        error('Unexpected end of file', 0)
+    end
+
+    return ''
+end
+
+-- raw deflate 格式的解压流
+local InflateRaw = Inflate:extend()
+exports.InflateRaw = InflateRaw
+
+InflateRaw._inflateFlags = 0
+
+-------------------------------------------------------------------------------
+-- Gunzip
+
+local Gunzip = Inflate:extend()
+exports.Gunzip = Gunzip
+
+Gunzip._inflateFlags = 0
+
+function Gunzip:initialize(options)
+    Inflate.initialize(self, options)
+
+    self._header = '' -- 还没有解析的 gzip 头
+    self._trailer = ''
+    self._crc = miniz.crc32('')
+    self._size = 0
+end
+
+function Gunzip:transformSync(chunk)
+    local header = self._header
+    if (header) then
+        header = header .. chunk
+        local position = parseGzipHeader(header)
+        if (position == false) then
+            error('Invalid gzip header', 0)
+
+        elseif (not position) then
+            self._header = header
+            return ''
+        end
+
+        self._header = nil
+        chunk = header:sub(position)
+    end
+
+    local result = self:_inflate(chunk)
+    if (result ~= '') then
+        self._crc = miniz.crc32(result, self._crc)
+        self._size = self._size + #result
+    end
+
+    return result
+end
+
+function Gunzip:_onTrailer(data)
+    if (#self._trailer < GZIP_TRAILER_SIZE) then
+        self._trailer = (self._trailer .. data):sub(1, GZIP_TRAILER_SIZE)
+    end
+end
+
+function Gunzip:finishSync()
+    Inflate.finishSync(self)
+
+    if (#self._trailer < GZIP_TRAILER_SIZE) then
+        error('Unexpected end of file', 0)
+    end
+
+    local crc, size = string.unpack('<I4I4', self._trailer)
+    if (crc ~= self._crc) or (size ~= (self._size & 0xffffffff)) then
+        error('Invalid gzip data', 0)
+    end
+
+    return ''
+end
+
+-------------------------------------------------------------------------------
+-- factory
+
+function exports.createDeflate(options)
+    return Deflate:new(options)
+end
+
+function exports.createDeflateRaw(options)
+    return DeflateRaw:new(options)
+end
 
 function exports.createGzip(options)
-	return Gzip:new(options)
+    return Gzip:new(options)
+end
+
+function exports.createInflate(options)
+    return Inflate:new(options)
+end
+
+function exports.createInflateRaw(options)
+    return InflateRaw:new(options)
+end
+
+function exports.createGunzip(options)
+    return Gunzip:new(options)
 end
 
 
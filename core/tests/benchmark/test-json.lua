@@ -0,0 +1,85 @@
+local tap 		= require('ext/tap')
+local json 		= require('json')
+local Buffer 	= require('buffer').Buffer
+
+local test = tap.test
+
+local COUNT = 20
+
+-- 2M 左右的类似 API 应答的数据
+local function createData()
+	local list = {}
+	for i = 1, 5000 do
+		list[i] = {
+			id = i,
+			name = 'device-' .. i,
+			online = (i % 2 == 0),
+			value = i * 0.5,
+			path = '/api/v1/devices/' .. i .. '/status',
+			description = string.rep('The quick brown fox jumps over the lazy dog. ', 4),
+			note = 'line 1\nline 2\t"quoted"'
+		}
+	end
+	return { ret = 0, data = list }
+end
+
+local DATA = createData()
+local TEXT = json.stringify(DATA)
+
+local function throughput(name, size, startTime)
+	local span = math.max(os.clock() - startTime, 0.001)
+	print(string.format('%s: %.1f MB/s', name, size / span / (1024 * 1024)))
+end
+
+test("test stringify", function ()
+	local startTime = os.clock()
+	for i = 1, COUNT do
+		assert(json.stringify(DATA))
+	end
+	throughput('stringify', #TEXT * COUNT, startTime)
+end)
+
+test("test stringify indent", function ()
+	local size = #json.stringify(DATA, nil, 2)
+
+	local startTime = os.clock()
+	for i = 1, COUNT do
+		assert(json.stringify(DATA, nil, 2))
+	end
+	throughput('stringify indent', size * COUNT, startTime)
+end)
+
+test("test stringifyTo", function ()
+	local buffer = Buffer:new(#TEXT)
+
+	local startTime = os.clock()
+	for i = 1, COUNT do
+		buffer:limit(1)
+		assert(json.stringifyTo(DATA, buffer) == #TEXT)
+	end
+	throughput('stringifyTo', #TEXT * COUNT, startTime)
+end)
+
+test("test parse", function ()
+	local startTime = os.clock()
+	for i = 1, COUNT do
+		assert(json.parse(TEXT))
+	end
+	throughput('parse', #TEXT * COUNT, startTime)
+end)
+
+test("test createDecoder", function ()
+	local CHUNK_SIZE = 64 * 1024
+
+	local startTime = os.clock()
+	for i = 1, COUNT do
+		local decoder = json.createDecoder()
+		for offset = 1, #TEXT, CHUNK_SIZE do
+			assert(decoder:write(TEXT:sub(offset, offset + CHUNK_SIZE - 1)))
+		end
+		assert(#decoder:finish() == 0)
+	end
+	throughput('createDecoder', #TEXT * COUNT, startTime)
+end)
+
+tap.run()
@@ -0,0 +1,74 @@
+local tap 		= require('ext/tap')
+local Readable  = require('stream').Readable
+
+local test = tap.test
+
+local COUNT = 1000 * 1000
+
+local function createStream()
+	local stream = Readable:new()
+	stream._read = function() end
+	return stream
+end
+
+-- 缓存大量的小数据块, 再一次读取多个或部分数据块
+test("test readable push & read small chunks", function ()
+	local stream = createStream()
+	local state = stream._readableState
+	local chunk = string.rep('a', 16)
+
+	console.time('readable push 1M chunks')
+	for i = 1, COUNT do
+		stream:push(chunk)
+	end
+	console.timeEnd('readable push 1M chunks')
+
+	assert(state.length == COUNT * 16)
+
+	-- 每次读取 10 个字节, 大部分是只读取第一个数据块的一部分
+	console.time('readable read 1M x 10 bytes')
+	local total = 0
+	for i = 1, COUNT do
+		local data = stream:read(10)
+		total = total + #data
+	end
+	console.timeEnd('readable read 1M x 10 bytes')
+
+	-- 每次读取 100 个字节, 跨越多个数据块
+	console.time('readable read 60K x 100 bytes')
+	while state.length >= 100 do
+		local data = stream:read(100)
+		total = total + #data
+	end
+	console.timeEnd('readable read 60K x 100 bytes')
+
+	total = total + #(stream:read() or '')
+	assert(total == COUNT * 16)
+	assert(state.length == 0)
+end)
+
+-- 流动模式下每次返回一个数据块
+test("test readable flowing small chunks", function (expect)
+	local stream = createStream()
+	local chunk = string.rep('a', 16)
+
+	for i = 1, COUNT do
+		stream:push(chunk)
+	end
+	stream:push(nil)
+
+	local total = 0
+	stream:on('data', function(data)
+		total = total + #data
+	end)
+
+	stream:on('end', expect(function()
+		console.timeEnd('readable flowing 1M chunks')
+		assert(total == COUNT * 16)
+	end))
+
+	console.time('readable flowing 1M chunks')
+	stream:resume()
+end)
+
+tap.run()
@@ -0,0 +1,109 @@
+local tap 		= require('ext/tap')
+local timer 	= require('timer')
+local Emitter 	= require('core').Emitter
+
+local test = tap.test
+
+local COUNT = 100 * 1000
+
+-- 大量的定时器在同一个时间轮上
+test("test setTimeout 100K timers", function (expect)
+	local fired = 0
+
+	console.time('setTimeout 100K timers')
+	for i = 1, COUNT do
+		timer.setTimeout(i % 1000, function()
+			fired = fired + 1
+		end)
+	end
+	console.timeEnd('setTimeout 100K timers')
+
+	console.time('setTimeout 100K timers fired')
+	timer.setTimeout(1100, expect(function()
+		console.timeEnd('setTimeout 100K timers fired')
+		assert(fired == COUNT, fired)
+	end))
+end)
+
+-- 模拟大量连接的空闲超时, 每个连接频繁地调用 active
+test("test enroll & active 100K items", function (expect)
+	local items = {}
+	for i = 1, COUNT do
+		local item = Emitter:new()
+		timer.enroll(item, 60 * 1000)
+		items[i] = item
+	end
+
+	console.time('active 100K items x 10')
+	for round = 1, 10 do
+		for i = 1, COUNT do
+			timer.active(items[i])
+		end
+	end
+	console.timeEnd('active 100K items x 10')
+
+	console.time('unenroll 100K items')
+	for i = 1, COUNT do
+		timer.unenroll(items[i])
+	end
+	console.timeEnd('unenroll 100K items')
+
+	assert(timer.wheel.count == 0)
+
+	setImmediate(expect(function() end))
+end)
+
+-- 大部分定时器在到期前被取消
+test("test setTimeout & clearTimeout 100K timers", function ()
+	console.time('setTimeout & clearTimeout 100K timers')
+	for i = 1, COUNT do
+		local timeout = timer.setTimeout(30 * 1000 + i, function() end)
+		timer.clearTimeout(timeout)
+	end
+	console.timeEnd('setTimeout & clearTimeout 100K timers')
+end)
+
+-- setImmediate 和 nextTick 不应该为每个回调创建新的 table 或闭包,
+-- 队列在每一轮之间被重用, 两个队列都用过之后内存不应该再增长
+test("test setImmediate & nextTick 1M callbacks", function (expect)
+	local ROUNDS = 12
+	local count = 0
+	local function callback(a, b)
+		count = count + a + b
+	end
+
+	local round = 0
+	local memory
+
+	local function onRound()
+		round = round + 1
+		if round == 3 then
+			collectgarbage()
+			collectgarbage('stop')
+			memory = collectgarbage('count')
+			console.time('setImmediate & nextTick 1M callbacks')
+		end
+
+		if round > ROUNDS then
+			console.timeEnd('setImmediate & nextTick 1M callbacks')
+			local used = collectgarbage('count') - memory
+			collectgarbage('restart')
+			print('memory (KB)', used)
+
+			assert(count == COUNT * ROUNDS, count)
+			assert(used < 1024, used)
+			return
+		end
+
+		for i = 1, COUNT / 2 do
+			timer.setImmediate(callback, 1, 0)
+			process.nextTick(callback, 0, 1)
+		end
+
+		timer.setImmediate(onRound)
+	end
+
+	timer.setImmediate(expect(onRound))
+end)
+
+tap.run()
@@ -0,0 +1,67 @@
+local tap 		= require('ext/tap')
+local zlib 		= require('zlib')
+
+local test = tap.test
+
+local CHUNK_SIZE = 64 * 1024
+
+-- 8M 左右的类似日志的数据
+local function createData()
+	local lines = {}
+	for i = 1, 80 * 1000 do
+		lines[i] = string.format('2018-01-01 12:00:%02d [info] request %d done in %d ms\n',
+			i % 60, i, (i * 7) % 1000)
+	end
+	return table.concat(lines)
+end
+
+local DATA = createData()
+local GZIP = zlib.gzipSync(DATA)
+
+local function throughput(name, size, startTime)
+	local span = math.max(os.clock() - startTime, 0.001)
+	print(string.format('%s: %.1f MB/s', name, size / span / (1024 * 1024)))
+end
+
+local function runStream(stream, input, callback)
+	local total = 0
+
+	stream:on('data', function(data)
+		total = total + #data
+	end)
+
+	stream:on('end', function()
+		callback(total)
+	end)
+
+	for i = 1, #input, CHUNK_SIZE do
+		stream:write(input:sub(i, i + CHUNK_SIZE - 1))
+	end
+	stream:finish()
+end
+
+test("test gzipSync & gunzipSync", function ()
+	local startTime = os.clock()
+	local result = zlib.gzipSync(DATA)
+	throughput('gzipSync', #DATA, startTime)
+
+	startTime = os.clock()
+	assert(zlib.gunzipSync(result) == DATA)
+	throughput('gunzipSync', #DATA, startTime)
+end)
+
+test("test createGzip & createGunzip", function (expect)
+	local startTime = os.clock()
+	runStream(zlib.createGzip(), DATA, expect(function(total)
+		throughput('createGzip', #DATA, startTime)
+		print(string.format('createGzip: %d -> %d bytes', #DATA, total))
+
+		startTime = os.clock()
+		runStream(zlib.createGunzip(), GZIP, expect(function(total)
+			throughput('createGunzip', #DATA, startTime)
+			assert(total == #DATA)
+		end))
+	end))
+end)
+
+tap.run()
@@ -0,0 +1,182 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local dns   = require("dns")
+local dgram = require("dgram")
+
+local tap = require('ext/tap')
+local test = tap.test
+
+-- A local UDP DNS server which answers every A query with 10.0.0.1, except
+-- for names starting with 'nx.' (NXDOMAIN) and 'short.' (TTL of 1 second).
+local function createStubServer()
+    local server = dgram.createSocket('udp4')
+    server.queries = 0
+
+    server:on('message', function(msg, rinfo)
+        server.queries = server.queries + 1
+
+        -- question: labels terminated by a zero byte, then qtype and qclass
+        local pos = 13
+        local labels = {}
+        while msg:byte(pos) ~= 0 do
+            local len = msg:byte(pos)
+            labels[#labels + 1] = msg:sub(pos + 1, pos + len)
+            pos = pos + len + 1
+        end
+        local name = table.concat(labels, '.')
+        local question = msg:sub(13, pos + 4)
+
+        local response
+        if name:match('^nx%.') then
+            response = msg:sub(1, 2) .. '\129\131\0\1\0\0\0\0\0\0' .. question
+
+        else
+            local ttl = name:match('^short%.') and '\0\0\0\1' or '\0\0\14\16'
+            response = msg:sub(1, 2) .. '\129\128\0\1\0\1\0\0\0\0' .. question
+                .. '\192\12\0\1\0\1' .. ttl .. '\0\4\10\0\0\1'
+        end
+
+        server:send(response, rinfo.port, rinfo.ip)
+    end)
+
+    server:bind(0, '127.0.0.1')
+    dns.setServers({ { host = '127.0.0.1', port = server:address().port } })
+    dns.setTimeout(500)
+    return server
+end
+
+test("coalesce concurrent queries", function(expect)
+    local server = createStubServer()
+    local count = 0
+
+    for i = 1, 5 do
+        dns.resolve4("a.test", expect(function(err, answers)
+            assert(not err, err)
+            assert(answers[1].address == '10.0.0.1')
+            assert(answers[1].ttl == 3600)
+
+            count = count + 1
+            if (count == 5) then
+                assert(server.queries == 1)
+                server:close()
+            end
+        end))
+    end
+end)
+
+test("answer from cache", function(expect)
+    local server = createStubServer()
+
+    dns.resolve4("b.test", expect(function(err, answers)
+        assert(not err, err)
+
+        -- cached answers are still delivered asynchronously
+        local cached = false
+        dns.resolve4("b.test", expect(function(err, answers)
+            assert(not err, err)
+            assert(answers[1].address == '10.0.0.1')
+            assert(server.queries == 1)
+            cached = true
+            server:close()
+        end))
+
+        assert(not cached)
+    end))
+end)
+
+test("negative cache", function(expect)
+    local server = createStubServer()
+
+    dns.resolve4("nx.test", expect(function(err, answers)
+        assert(err)
+        assert(err.code == 3)
+
+        dns.resolve4("nx.test", expect(function(err, answers)
+            assert(err)
+            assert(server.queries == 1)
+            server:close()
+        end))
+    end))
+end)
+
+test("stale while revalidate", function(expect)
+    local server = createStubServer()
+
+    dns.resolve4("short.test", expect(function(err, answers)
+        assert(not err, err)
+
+        setTimeout(1100, expect(function()
+            local stats = dns.getCacheStats()
+
+            dns.resolve4("short.test", expect(function(err, answers)
+                assert(not err, err)
+                assert(answers[1].address == '10.0.0.1')
+            end))
+
+            assert(dns.getCacheStats().stale == stats.stale + 1)
+
+            -- the refresh query runs in the background
+            setTimeout(200, expect(function()
+                assert(server.queries == 2)
+                server:close()
+            end))
+        end))
+    end))
+end)
+
+test("lookup", function(expect)
+    local called = false
+    dns.lookup("127.0.0.1", expect(function(err, address, family)
+        assert(not err, err)
+        assert(address == '127.0.0.1')
+        assert(family == 4)
+        called = true
+    end))
+    assert(not called)
+
+    dns.lookup("localhost", 4, expect(function(err, address, family)
+        assert(not err, err)
+        assert(family == 4)
+
+        local stats = dns.getCacheStats()
+        local hit = false
+        dns.lookup("localhost", { family = 4, all = true }, expect(function(err, addresses)
+            assert(not err, err)
+            assert(addresses[1].address == address)
+            assert(dns.getCacheStats().hits == stats.hits + 1)
+            hit = true
+        end))
+        assert(not hit)
+    end))
+end)
+
+test("lookup port", function(expect, uv)
+    local ports = {}
+    dns.lookupPort(8080, function(err, port) ports[1] = port end)
+    dns.lookupPort('http', function(err, port) ports[2] = port end)
+    dns.lookupPort('no-such-service', function(err, port) ports[3] = err end)
+    assert(#ports == 0)
+
+    uv.run()
+
+    assert(ports[1] == 8080)
+    assert(ports[2] == 80)
+    assert(ports[3])
+end)
+
+tap.run()
@@ -0,0 +1,197 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local http = require('http')
+
+local HOST = "127.0.0.1"
+local PORT = 10083
+
+local tap = require('ext/tap')
+local test = tap.test
+
+local function createServer(expect, count)
+    local server = http.createServer(expect(function(request, response)
+        local body = request.url
+        response:setHeader("Content-Type", "text/plain")
+        response:setHeader("Content-Length", #body)
+        response:finish(body)
+    end, count))
+
+    server:listen(PORT, HOST)
+    return server
+end
+
+local function get(agent, path, callback)
+    local options = { host = HOST, port = PORT, path = path, agent = agent }
+    local request = http.request(options, function(response)
+        local body = {}
+        response:on('data', function(chunk)
+            body[#body + 1] = chunk
+        end)
+
+        response:on('end', function()
+            callback(response, table.concat(body))
+        end)
+    end)
+
+    request:done()
+    return request
+end
+
+test("keep-alive reuses the connection", function(expect)
+    local agent = http.Agent:new()
+    local server = createServer(expect, 3)
+
+    get(agent, '/1', expect(function(response, body)
+        assert(body == '/1')
+        assert(response.keepAlive)
+
+        get(agent, '/2', expect(function(response, body)
+            assert(body == '/2')
+
+            get(agent, '/3', expect(function(response, body)
+                assert(body == '/3')
+
+                local stats = agent:getStats()
+                assert(stats.created == 1)
+                assert(stats.reused == 2)
+                server:close()
+            end))
+        end))
+    end))
+end)
+
+test("max sockets queues requests", function(expect)
+    local agent = http.Agent:new({ maxSockets = 2 })
+    local server = createServer(expect, 6)
+    local count = 0
+
+    for i = 1, 6 do
+        get(agent, '/' .. i, expect(function(response, body)
+            assert(body == '/' .. i)
+
+            count = count + 1
+            if (count == 6) then
+                local stats = agent:getStats()
+                assert(stats.created == 2)
+                assert(stats.queued == 4)
+                server:close()
+            end
+        end))
+    end
+
+    assert(agent:getStats().pending == 4)
+end)
+
+test("closed idle connections are not reused", function(expect)
+    local agent = http.Agent:new()
+    local server = createServer(expect, 1)
+
+    get(agent, '/1', expect(function(response, body)
+        server:close(expect(function()
+            server = createServer(expect, 1)
+
+            get(agent, '/2', expect(function(response, body)
+                assert(body == '/2')
+                assert(agent:getStats().created == 2)
+                server:close()
+            end))
+        end))
+    end))
+end)
+
+test("body written before the agent assigns a socket", function(expect)
+    local agent = http.Agent:new({ maxSockets = 1 })
+
+    local server = http.createServer(expect(function(request, response)
+        local body = {}
+        request:on('data', function(chunk)
+            body[#body + 1] = chunk
+        end)
+
+        request:on('end', function()
+            body = table.concat(body)
+            response:setHeader("Content-Length", #body)
+            response:finish(body)
+        end)
+    end, 2))
+    server:listen(PORT, HOST)
+
+    local count = 0
+    for i = 1, 2 do
+        local data = 'body' .. i
+        local options = {
+            host = HOST, port = PORT, path = '/', method = 'POST', agent = agent,
+            headers = { { 'Content-Length', #data } }
+        }
+
+        -- 第二个请求要等第一个请求完成后才有连接
+        local request = http.request(options, function(response)
+            response:on('data', expect(function(chunk)
+                assert(chunk == data)
+
+                count = count + 1
+                if (count == 2) then
+                    server:close()
+                end
+            end))
+        end)
+
+        -- finish() 会立即写入缓存的数据, 不会等待连接
+        request:write(data)
+        request:finish()
+    end
+end)
+
+test("agent disabled", function(expect)
+    local server = createServer(expect, 1)
+
+    get(false, '/1', expect(function(response, body)
+        assert(body == '/1')
+        assert(not response.keepAlive)
+        server:close()
+    end))
+end)
+
+test("https agent pools by TLS options", function()
+    -- 没有编译 TLS 模块时跳过
+    local ok, https = pcall(require, 'https')
+    if (not ok) then
+        print('https is not available, skipped')
+        return
+    end
+
+    local agent = https.Agent:new()
+
+    local base = { host = HOST, port = 443, servername = 'example.com' }
+    local function name(options)
+        local merged = {}
+        for key, value in pairs(base) do merged[key] = value end
+        for key, value in pairs(options) do merged[key] = value end
+        return agent:getName(merged)
+    end
+
+    assert(name({}) == name({ rejectUnauthorized = false }))
+    assert(name({}) ~= name({ rejectUnauthorized = true }))
+    assert(name({}) ~= name({ cert = 'CERT', key = 'KEY' }))
+    assert(name({ cert = 'CERT', key = 'KEY' }) ~= name({ cert = 'CERT', key = 'KEY2' }))
+    assert(name({ ca = { 'CA1' } }) ~= name({ ca = { 'CA1', 'CA2' } }))
+    assert(name({ ca = { 'CA1' } }) == name({ ca = { 'CA1' } }))
+    assert(name({}) ~= name({ servername = 'other.com' }))
+end)
+
+tap.run()
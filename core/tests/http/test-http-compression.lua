@@ -0,0 +1,104 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local http = require('http')
+local zlib = require('zlib')
+
+local HOST = "127.0.0.1"
+local PORT = process.env.PORT or 10095
+
+local tap = require('ext/tap')
+local test = tap.test
+
+local function get(path, callback)
+    local request = http.request({
+        host = HOST,
+        port = PORT,
+        path = path
+    }, function(response)
+        local chunks = {}
+        response:on('data', function(data)
+            chunks[#chunks + 1] = data
+        end)
+
+        response:on('end', function()
+            callback(response, table.concat(chunks))
+        end)
+    end)
+
+    request:done()
+end
+
+test("http response compression", function(expect)
+    local line = "Hello compression\n"
+
+    local server = http.createServer(function(request, response)
+        response:setHeader("Content-Type", "text/plain")
+
+        if (request.url == '/empty') then
+            response:setCompression('gzip')
+            response:finish()
+            return
+        end
+
+        -- 压缩后会删除 Content-Length
+        response:setHeader("Content-Length", #line * 1000)
+
+        if (request.url == '/gzip') then
+            assert(response:setCompression('gzip'))
+
+        elseif (request.url == '/deflate') then
+            assert(response:setCompression('deflate', { level = 1 }))
+        end
+
+        -- 分成多次写入, 压缩器不是每次都有输出
+        for i = 1, 999 do
+            response:write(line)
+        end
+
+        response:flush()
+        response:finish(line)
+    end)
+
+    server:listen(PORT, HOST, function()
+        get('/gzip', expect(function(response, body)
+            assert(response.headers['Content-Encoding'] == 'gzip')
+            assert(response.headers['Transfer-Encoding'] == 'chunked')
+            assert(response.headers['Content-Length'] == nil)
+            assert(#body < #line * 10)
+            assert(zlib.gunzipSync(body) == line:rep(1000))
+
+            get('/deflate', expect(function(response, body)
+                assert(response.headers['Content-Encoding'] == 'deflate')
+                assert(zlib.inflateSync(body) == line:rep(1000))
+
+                get('/empty', expect(function(response, body)
+                    assert(response.headers['Content-Encoding'] == nil)
+                    assert(body == '')
+
+                    get('/none', expect(function(response, body)
+                        assert(response.headers['Content-Encoding'] == nil)
+                        assert(body == line:rep(1000))
+                        server:close()
+                    end))
+                end))
+            end))
+        end))
+    end)
+end)
+
+tap.run()
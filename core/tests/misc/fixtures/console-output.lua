@@ -0,0 +1,14 @@
+-- 写入大量的输出, 由 test-console.lua 通过一个读取很慢的管道运行
+local count = 40000
+
+console.maxQueueSize = 64 * 1024
+
+local line = string.rep('x', 60)
+for i = 1, count do
+    print(line)
+end
+
+-- 写队列已满, 这些诊断信息会被丢弃
+for i = 1, 10 do
+    console.log(i)
+end
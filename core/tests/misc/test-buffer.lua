@@ -500,4 +500,77 @@ test("buffer test includes", function()
 	assert.equal(buf1:includes('123'), false)
 end)
 
+test("buffer test read/write 64 and float", function()
+	local buf = Buffer.alloc(8)
+
+	buf:writeUInt64BE(0x0102030405060708, 1)
+	assert.equal(buf:readUInt8(1), 0x01)
+	assert.equal(buf:readUInt8(8), 0x08)
+	assert.equal(buf:readUInt64BE(1), 0x0102030405060708)
+	assert.equal(buf:readUInt64LE(1), 0x0807060504030201)
+
+	buf:writeInt64LE(-2, 1)
+	assert.equal(buf:readInt64LE(1), -2)
+	assert.equal(buf:readUInt8(1), 0xFE)
+	assert.equal(buf:readUInt8(8), 0xFF)
+
+	buf:writeFloatBE(1.5, 1)
+	assert.equal(buf:readFloatBE(1), 1.5)
+	assert.equal(buf:toString(1, 4), string.pack('>f', 1.5))
+
+	buf:writeDoubleLE(-0.1, 1)
+	assert.equal(buf:readDoubleLE(1), -0.1)
+	assert.equal(buf:toString(), string.pack('<d', -0.1))
+
+	-- 越界
+	assert(not pcall(buf.readUInt32BE, buf, 6))
+	assert(not pcall(buf.writeUInt16LE, buf, 1, 8))
+	assert(not pcall(buf.readUInt8, buf, 0))
+end)
+
+test("buffer test slice", function()
+	local buf = Buffer.from('abcdefgh')
+
+	local slice = buf:slice(3, 5)
+	assert.equal(slice:size(), 3)
+	assert.equal(slice:toString(), 'cde')
+	assert.equal(slice[1], 0x63)
+
+	-- 共享内存
+	slice[1] = 0x43
+	assert.equal(buf:toString(), 'abCdefgh')
+	buf:writeUInt8(0x44, 4)
+	assert.equal(slice:toString(), 'CDe')
+
+	-- slice 的 slice
+	local sub = slice:slice(2)
+	assert.equal(sub:toString(), 'De')
+
+	-- 父 buffer 被回收后 slice 仍然可用
+	buf = nil
+	slice = nil
+	collectgarbage()
+	collectgarbage()
+	assert.equal(sub:toString(), 'De')
+	assert.equal(sub:readUInt16BE(1), 0x4465)
+
+	local empty = Buffer.from('abc'):slice(3, 2)
+	assert.equal(empty:size(), 0)
+
+	-- 已关闭的 buffer 不能再创建 slice
+	local closed = Buffer.from('abc')
+	closed.buffer:close()
+	assert(not pcall(closed.slice, closed, 1, 0))
+end)
+
+test("buffer test concat slices", function()
+	local buf = Buffer.from('0123456789')
+	local result = Buffer.concat({ buf:slice(1, 3), Buffer.from('-'), buf:slice(8) })
+	assert.equal(result:size(), 7)
+	assert.equal(result:toString(), '012-789')
+
+	result = Buffer.concat({ buf, buf }, 12)
+	assert.equal(result:toString(), '012345678901')
+end)
+
 tap.run()
@@ -39,6 +39,79 @@ test("console.write", function()
 	end)
 end)
 
+test("console.getFileLine", function()
+	local function currentLine()
+		return debug.getinfo(2, 'l').currentline
+	end
+
+	assert(console.getFileLine(2) == 'test-console.lua:' .. currentLine())
+
+	local function getLine()
+		local fileLine = console.getFileLine()
+		return fileLine
+	end
+
+	-- 文件名被缓存后行号仍然是正确的
+	assert(getLine() == 'test-console.lua:' .. currentLine())
+	assert(getLine() == 'test-console.lua:' .. currentLine())
+end)
+
+test("console.setLevel", function()
+	-- 被过滤的输出不会格式化参数
+	local value = setmetatable({}, { __pairs = function()
+		error('should not be formatted')
+	end })
+
+	console.setLevel('error')
+	assert(console.getLevel() == 'error')
+	console.log(value)
+	console.info(value)
+	console.warn(value)
+
+	console.setLevel('none')
+	console.error(value)
+
+	console.setLevel('debug')
+	assert(console.getLevel() == 'debug')
+
+	console.fileLine = false
+	console.log('without file line')
+	console.fileLine = true
+end)
+
+test("console output queue", function(expect, uv)
+	local path = require('path')
+	local util = require('util')
+	local spawn = require('child_process').spawn
+
+	-- 子进程的输出远超 maxQueueSize, 管道在一段时间后才开始读取
+	local childPath = path.join(util.dirname(), 'fixtures', 'console-output.lua')
+	local env = { NODE_LUA_ROOT = os.getenv('NODE_LUA_ROOT') }
+	local child = spawn(process.execPath, { childPath }, { env = env })
+
+	local output = {}
+	setTimeout(500, function()
+		child.stdout:on('data', function(data)
+			output[#output + 1] = data
+		end)
+	end)
+
+	local closed = false
+	child:on('close', function()
+		closed = true
+	end)
+
+	-- 在回调外面检查结果, 断言失败时这个测试才会失败
+	uv.run()
+	assert(closed)
+	output = table.concat(output)
+
+	-- print 的输出不会丢弃, 诊断信息被丢弃后会提示丢弃的数量
+	local _, lines = output:gsub(string.rep('x', 60) .. '\n', '')
+	assert(lines == 40000, lines)
+	assert(output:find('%.%.%. %d+ messages dropped\n$'), output:sub(-100))
+end)
+
 test("console.stdio", function()
 	console.log(console.stdin);
 	console.log(console.stdout);
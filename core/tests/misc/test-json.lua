@@ -128,4 +128,130 @@ test(
 	end
 )
 
+test(
+	"long strings",
+	function()
+		-- 长字符串会分块扫描, 需要转义的字符出现在不同的位置
+		local plain = string.rep("abcdefgh", 100)
+		for i = 1, 40 do
+			local value = plain:sub(1, i) .. '"\\/\n\1\127' .. plain:sub(i)
+			local text = json.stringify(value)
+			assert(text == '"' .. plain:sub(1, i) .. '\\"\\\\\\/\\n\\u0001\\u007f' .. plain:sub(i) .. '"')
+			assert(json.parse(text) == value)
+			assert(json.parse(" \n\t [" .. text .. "]\r\n ")[1] == value)
+		end
+
+		assert(json.parse('"abc\0def"') == nil)
+	end
+)
+
+test(
+	"integers",
+	function()
+		for _, value in ipairs({0, -1, 100, 1 << 40, math.maxinteger, math.mininteger}) do
+			local text = json.stringify(value)
+			assert(text == tostring(value))
+			assert(json.parse(text) == value)
+			assert(math.type(json.parse(text)) == "integer")
+		end
+
+		assert(math.type(json.parse("1.5")) == "float")
+		assert(json.parse("1e3") == 1000)
+		assert(json.parse("-0.25") == -0.25)
+		assert(math.type(json.parse("12345678901234567890")) == "float")
+	end
+)
+
+test(
+	"stringify indent",
+	function()
+		local value = { name = "x", list = {1, {b = 1, a = "\n"}}, empty = {}, [10] = true, [2] = false }
+		local expected = table.concat({
+			'{',
+			'  "10": true,',
+			'  "2": false,',
+			'  "empty": {},',
+			'  "list": [',
+			'    1,',
+			'    {',
+			'      "a": "\\n",',
+			'      "b": 1',
+			'    }',
+			'  ],',
+			'  "name": "x"',
+			'}'
+		}, '\n')
+
+		assert(json.stringify(value, nil, 2) == expected)
+		assert(json.stringify(value, nil, true) == expected)
+		assert(json.stringify(value, nil, '\t') == expected:gsub('  ', '\t'))
+		deepEqual(value.list, json.parse(json.stringify(value, nil, 4)).list)
+
+		assert(json.stringify({1, 2}, nil, 0) == '[1,2]')
+		assert(json.stringify({}, nil, 2) == '[]')
+		assert(json.stringify({[{}] = 1}, nil, 2) == nil)
+
+		-- 不带缩进时也可以按顺序输出对象的键
+		cjson.encode_sort_keys(true)
+		assert(json.stringify(value) == '{"10":true,"2":false,"empty":{},"list":[1,{"a":"\\n","b":1}],"name":"x"}')
+		cjson.encode_sort_keys(false)
+	end
+)
+
+test(
+	"stringifyTo",
+	function()
+		local Buffer = require("buffer").Buffer
+		local buffer = Buffer:new(64)
+
+		assert(json.stringifyTo({a = 1}, buffer) == 7)
+		assert(json.stringifyTo({}, buffer) == 2)
+		assert(buffer:toString() == '{"a":1}[]')
+
+		local ret, err = json.stringifyTo(string.rep("x", 100), buffer)
+		assert(ret == nil and err)
+		assert(buffer:toString() == '{"a":1}[]')
+	end
+)
+
+test(
+	"createDecoder",
+	function()
+		local values = { {a = {1, 2, {b = 'x"}'}}}, 12, 'str\\', true, -3.5, {c = "d"} }
+		local text = ""
+		for _, value in ipairs(values) do
+			text = text .. json.stringify(value) .. "\n"
+		end
+
+		-- 每次只写入几个字节
+		for size = 1, 5 do
+			local decoder = json.createDecoder()
+			local result = {}
+			for i = 1, #text, size do
+				for _, value in ipairs(decoder:write(text:sub(i, i + size - 1))) do
+					result[#result + 1] = value
+				end
+			end
+
+			for _, value in ipairs(decoder:finish()) do
+				result[#result + 1] = value
+			end
+
+			deepEqual(values, result)
+		end
+
+		-- 数据不完整
+		local decoder = json.createDecoder()
+		assert(#decoder:write('{"a":[1,') == 0)
+		local result, err = decoder:finish()
+		assert(result == nil and err)
+
+		-- 无效的值
+		decoder = json.createDecoder()
+		result, err = decoder:write('{"a":x} ')
+		assert(result == nil and err)
+		assert(decoder:write('1') == nil)
+	end
+)
+
 tap.run()
@@ -61,4 +61,154 @@ test("double close", function()
     timer.clearTimeout(t1)
 end)
 
+test("nextTick & setImmediate order", function(expect)
+    local list = {}
+    timer.setImmediate(function(a, b, c)
+        list[#list + 1] = 'immediate' .. a .. b .. tostring(c)
+        process.nextTick(function()
+            list[#list + 1] = 'tick3'
+        end)
+    end, 1, 2, nil)
+
+    timer.setImmediate(expect(function()
+        list[#list + 1] = 'immediate2'
+        assert(table.concat(list, ',') == 'tick1,tick2,immediate12nil,tick3,immediate2', table.concat(list, ','))
+    end))
+
+    process.nextTick(function(arg)
+        list[#list + 1] = arg
+        process.nextTick(function() list[#list + 1] = 'tick2' end)
+    end, 'tick1')
+end)
+
+test("clearImmediate", function(expect)
+    local immediate = timer.setImmediate(function()
+        assert(nil, "Should not get here!")
+    end)
+
+    timer.setImmediate(expect(function() end))
+    clearImmediate(immediate)
+    clearImmediate(immediate)
+end)
+
+test("nextTick does not starve timers", function(expect)
+    local count = 0
+    local stopped = false
+    local function tick()
+        count = count + 1
+        if not stopped then
+            process.nextTick(tick)
+        end
+    end
+    process.nextTick(tick)
+
+    timer.setTimeout(20, expect(function()
+        stopped = true
+        assert(count > 1)
+    end))
+end)
+
+test("timeout order", function(expect)
+    local list = {}
+    local delays = { 30, 5, 100, 5, 70, 0, 300 }
+    for index, delay in ipairs(delays) do
+        timer.setTimeout(delay, function()
+            list[#list + 1] = index
+        end)
+    end
+
+    -- 相同的时间按添加的顺序触发
+    timer.setTimeout(400, expect(function()
+        assert(table.concat(list, ',') == '6,2,4,1,5,3,7', table.concat(list, ','))
+    end))
+end)
+
+test("timeout elapsed time", function(expect)
+    local start = timer.now()
+    timer.setTimeout(150, expect(function()
+        local elapsed = timer.now() - start
+        assert(elapsed >= 150 and elapsed < 250, elapsed)
+    end))
+end)
+
+test("enroll & active", function(expect)
+    local Emitter = require('core').Emitter
+    local item = Emitter:new()
+    local start = timer.now()
+
+    timer.enroll(item, 50)
+    timer.active(item)
+
+    -- 推后到期时间
+    local count = 0
+    local interval
+    interval = timer.setInterval(20, function()
+        count = count + 1
+        timer.active(item)
+        if count == 3 then
+            timer.clearInterval(interval)
+        end
+    end)
+
+    item:on('timeout', expect(function()
+        local elapsed = timer.now() - start
+        assert(elapsed >= 110, elapsed)
+
+        -- 取消后不会再触发
+        timer.active(item)
+        timer.unenroll(item)
+        timer.active(item)
+    end))
+end)
+
+test("timeout callback error", function(expect)
+    local start = timer.now()
+    local fired = {}
+
+    -- 一个回调函数出错后, 其他定时项仍然要按时触发
+    timer.setTimeout(10, function()
+        error('timeout callback error')
+    end)
+
+    timer.setTimeout(10, expect(function()
+        fired[#fired + 1] = 10
+    end))
+
+    timer.setTimeout(200, expect(function()
+        local elapsed = timer.now() - start
+        assert(elapsed >= 200 and elapsed < 300, elapsed)
+        assert(fired[1] == 10)
+    end))
+end)
+
+test("timer wheel", function()
+    local wheel = timer.TimerWheel:new()
+    local fired = {}
+    local function newItem(name)
+        return { _onTimeout = function() fired[#fired + 1] = name end }
+    end
+
+    local a, b, c = newItem('a'), newItem('b'), newItem('c')
+    local now = timer.now()
+    wheel:schedule(a, now + 10)
+    wheel:schedule(b, now + 5000)     -- 第 2 层
+    wheel:schedule(c, now + 300000)   -- 第 3 层
+    assert(wheel.count == 3)
+    assert(wheel.counts[0] == 1 and wheel.counts[2] == 1 and wheel.counts[3] == 1)
+    assert(wheel.wakeAt == a._wheelExpires)
+
+    wheel:cancel(a)
+    wheel:cancel(a)
+    assert(wheel.count == 2)
+
+    -- 提前
+    wheel:schedule(c, now + 20)
+    assert(wheel.count == 2 and wheel.counts[0] == 1)
+
+    wheel:cancel(b)
+    wheel:cancel(c)
+    assert(wheel.count == 0)
+    assert(#fired == 0)
+end)
+
 tap.run()
@@ -5,4 +5,166 @@ test("zlib", function(expect)
 
 end)
 
+test("zlib.gzipSync", function()
+    local zlib = require('zlib')
+
+    assert(zlib.crc32('123456789') == 0xcbf43926)
+    assert(zlib.crc32('') == 0)
+
+    local data = string.rep('hello world ', 1000)
+    for level = 0, 9 do
+        local result = zlib.gzipSync(data, level)
+        assert(result:sub(1, 2) == '\x1f\x8b')
+        assert(zlib.gunzipSync(result) == data, level)
+    end
+
+    local result = zlib.gzipSync(data)
+    assert(#result < #data / 10)
+
+    -- 空数据
+    assert(zlib.gunzipSync(zlib.gzipSync('')) == '')
+
+    -- 损坏的数据
+    local bad = result:sub(1, -9) .. string.pack('<I4I4', 0, #data)
+    assert(zlib.gunzipSync(bad) == nil)
+    assert(zlib.gunzipSync('abc') == nil)
+
+    assert(zlib.inflateRawSync(zlib.deflateRawSync(data, 1)) == data)
+end)
+
+local function runStream(stream, input, size, callback)
+    local chunks = {}
+    stream:on('data', function(data)
+        chunks[#chunks + 1] = data
+    end)
+
+    -- 出错后流仍然会结束, 只回调一次
+    local failed = false
+    stream:on('end', function()
+        if (not failed) then
+            callback(nil, table.concat(chunks))
+        end
+    end)
+
+    stream:on('error', function(err)
+        failed = true
+        callback(err)
+    end)
+
+    for i = 1, #input, size do
+        stream:write(input:sub(i, i + size - 1))
+    end
+    stream:finish()
+end
+
+test("zlib.createGzip & createGunzip", function(expect)
+    local zlib = require('zlib')
+    local data = string.rep('hello stream ', 10000) .. 'end'
+
+    runStream(zlib.createGzip({ level = 1 }), data, 1000, expect(function(err, result)
+        assert(not err)
+        assert(zlib.gunzipSync(result) == data)
+
+        -- 每次只写入很少的数据, 以及 gzip 头和尾被分开
+        for _, size in ipairs({ 1, 7, 4096, #result }) do
+            runStream(zlib.createGunzip(), result, size, expect(function(err, output)
+                assert(not err, err)
+                assert(output == data, size)
+            end))
+        end
+    end))
+
+    runStream(zlib.createGunzip(), zlib.gzipSync(''), 3, expect(function(err, output)
+        assert(output == '')
+    end))
+end)
+
+test("zlib.createDeflate & createInflate", function(expect)
+    local zlib = require('zlib')
+    local data = string.rep('0123456789', 5000)
+
+    runStream(zlib.createDeflate(), data, 333, expect(function(err, result)
+        assert(result:byte(1) == 0x78) -- zlib 头
+
+        runStream(zlib.createInflate(), result, 5, expect(function(err, output)
+            assert(output == data)
+        end))
+    end))
+
+    runStream(zlib.createDeflateRaw(), data, 4096, expect(function(err, result)
+        assert(zlib.inflateRawSync(result) == data)
+
+        runStream(zlib.createInflateRaw(), result, 100, expect(function(err, output)
+            assert(output == data)
+        end))
+    end))
+end)
+
+test("zlib stream errors", function(expect)
+    local zlib = require('zlib')
+    local gzip = zlib.gzipSync(string.rep('abc', 1000))
+
+    runStream(zlib.createGunzip(), 'not a gzip stream', 5, expect(function(err)
+        assert(err and err:find('Invalid gzip header'))
+    end))
+
+    -- 数据不完整
+    runStream(zlib.createGunzip(), gzip:sub(1, -5), 64, expect(function(err)
+        assert(err and err:find('Unexpected end of file'))
+    end))
+
+    -- CRC 错误
+    local bad = gzip:sub(1, -9) .. string.pack('<I4', 0) .. gzip:sub(-4)
+    runStream(zlib.createGunzip(), bad, 64, expect(function(err)
+        assert(err and err:find('Invalid gzip data'))
+    end))
+end)
+
+test("zlib stream ends after an error", function(expect)
+    local zlib = require('zlib')
+    local stream = zlib.createGunzip()
+    local errors = 0
+
+    stream:on('error', function(err)
+        errors = errors + 1
+    end)
+
+    -- 出错后流仍然要结束, 等待它的 pipe 不会一直挂起
+    stream:on('finish', expect(function()
+        assert(errors == 1)
+    end))
+
+    stream:on('end', expect(function()
+        assert(errors == 1)
+    end))
+
+    stream:on('data', function() end)
+    stream:write('not a gzip stream')
+    stream:write('more data')
+    stream:finish()
+end)
+
+test("zlib pipe", function(expect)
+    local fs   = require('fs')
+    local os   = require('os')
+    local path = require('path')
+    local zlib = require('zlib')
+
+    local source = path.join(os.tmpdir, 'test-zlib-source.txt')
+    local target = path.join(os.tmpdir, 'test-zlib-source.txt.gz')
+    local data = string.rep('node.lua zlib pipe test\n', 20000)
+    fs.writeFileSync(source, data)
+
+    local output = fs.createWriteStream(target)
+    output:on('finish', expect(function()
+        local result = fs.readFileSync(target)
+        assert(zlib.gunzipSync(result) == data)
+
+        fs.unlinkSync(source)
+        fs.unlinkSync(target)
+    end))
+
+    fs.createReadStream(source):pipe(zlib.createGzip()):pipe(output)
+end)
+
 tap.run()
@@ -72,4 +72,30 @@ test("net-buffer-write-before-connect", function(expected)
 	end)
 end)
 
+test("net-write-before-lookup", function(expected, uv)
+	local server = net.createServer(function(client)
+		client:on("data", function(chunk)
+			client:write(chunk, function()
+				client:destroy()
+			end)
+		end)
+	end)
+	server:listen(PORT, HOST)
+
+	-- the data is written before the address lookup has finished
+	local received
+	local client = net.Socket:new()
+	client:connect(PORT, HOST)
+	client:write("hello world")
+	client:on("data", function(data)
+		received = data
+		client:destroy()
+		server:close()
+	end)
+
+	uv.run()
+
+	assert(received == "hello world", received)
+end)
+
 tap.run()
@@ -0,0 +1,108 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local net     = require("net")
+local cluster = require("cluster")
+
+local HOST = "127.0.0.1"
+local PORT = 10093
+
+local tap = require("ext/tap")
+local test = tap.test
+
+test("reuseport", function(expect)
+	local server1 = net.createServer({ reusePort = true }, function() end)
+	local server2 = net.createServer({ reusePort = true }, function() end)
+
+	server1:listen(PORT, HOST)
+	server2:listen(PORT, HOST, expect(function()
+		server1:close()
+		server2:close()
+	end))
+end)
+
+test("cluster", function(expect)
+	local WORKERS = 2
+	local CLIENTS = 8
+	local listening = 0
+	local responses = 0
+
+	-- runs in a new thread and VM, so it must not use upvalues
+	local function workerMain(worker, port, host)
+		local net = require('net')
+		local cluster = require('cluster')
+
+		local server = net.createServer(function(connection)
+			connection:on('data', function(data)
+				connection:write(worker.id .. ':' .. data)
+			end)
+
+			connection:on('end', function()
+				connection:destroy()
+			end)
+		end)
+
+		cluster.listen(server, port, host, function()
+			worker:send('listening')
+		end)
+	end
+
+	local function onResponse()
+		responses = responses + 1
+		if (responses == CLIENTS) then
+			cluster.stop()
+		end
+	end
+
+	local function startClients()
+		for i = 1, CLIENTS do
+			local client = net.Socket:new()
+			client:connect(PORT, HOST, function()
+				client:on('data', function(data)
+					assert(data:match('^%d+:hello$'))
+					client:destroy()
+					onResponse()
+				end)
+
+				client:write('hello')
+			end)
+		end
+	end
+
+	cluster:on('message', function(worker, data)
+		if (data == 'listening') then
+			listening = listening + 1
+			if (listening == WORKERS) then
+				startClients()
+			end
+		end
+	end)
+
+	local connections = 0
+	cluster:on('exit', expect(function(worker)
+		connections = connections + worker.stats.connections
+
+		if (next(cluster.workers) == nil) then
+			assert(connections == CLIENTS)
+		end
+	end, WORKERS))
+
+	local workers = cluster.fork(WORKERS, workerMain, PORT, HOST)
+	assert(#workers == WORKERS)
+end)
+
+tap.run()
@@ -37,4 +37,19 @@ test("net-connect-handle-econnerefuesed", function(expected)
 	end)
 end)
 
+test("net-connect-handle-unknown-service", function(expected, uv)
+	-- the port may be a service name, unknown names are rejected
+	local errors = {}
+	local client = net.Socket:new()
+	client:connect({ port = 'no-such-service' })
+	client:on("error", function(err)
+		errors[#errors + 1] = err
+		client:destroy()
+	end)
+
+	uv.run()
+
+	assert(errors[1] == 'EAI_SERVICE', errors[1])
+end)
+
 tap.run()
@@ -0,0 +1,109 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local net = require("net")
+
+local HOST = "127.0.0.1"
+local ECHO_PORT = 10091
+local RELAY_PORT = 10092
+
+local tap = require("ext/tap")
+local test = tap.test
+
+test("relay", function(expect)
+	local chunk = string.rep("0123456789abcdef", 4096) -- 64KB
+	local total = #chunk * 16
+	local received = 0
+	local echoServer, relayServer, client
+
+	echoServer = net.createServer(function(connection)
+		connection:on("data", function(data)
+			connection:write(data)
+		end)
+	end)
+	echoServer:listen(ECHO_PORT, HOST)
+
+	relayServer = net.createServer(function(connection)
+		local upstream = net.Socket:new()
+		upstream:connect(ECHO_PORT, HOST, function()
+			net.relay(connection, upstream, expect(function(err, stats)
+				console.log('relay', err, stats)
+				assert(stats.active == false)
+				assert(stats.forward.bytes == total)
+				assert(stats.backward.bytes == total)
+				assert(stats.forward.writes > 0)
+
+				echoServer:close()
+				relayServer:close()
+			end))
+
+			for i = 1, 16 do
+				client:write(chunk)
+			end
+		end)
+	end)
+	relayServer:listen(RELAY_PORT, HOST)
+
+	client = net.Socket:new()
+	client:connect(RELAY_PORT, HOST, function()
+		client:on("data", function(data)
+			received = received + #data
+			if (received == total) then
+				client:destroy()
+			end
+		end)
+	end)
+end)
+
+test("relay closed from lua", function(expect)
+	local server, echoServer, client
+
+	server = net.createServer(function(connection)
+		local upstream = net.Socket:new()
+		upstream:connect(ECHO_PORT, HOST, function()
+			net.relay(connection, upstream, expect(function(err, stats)
+				assert(err)
+				assert(stats.active == false)
+				assert(connection.destroyed and upstream.destroyed)
+
+				client:destroy()
+				server:close()
+				echoServer:close()
+			end))
+
+			-- 没有数据在转发时关闭其中一个连接
+			setTimeout(20, function()
+				upstream:destroy()
+			end)
+		end)
+	end)
+	server:listen(RELAY_PORT, HOST)
+
+	-- 上游只需要接受连接, 另一端关闭后也关闭
+	echoServer = net.createServer(function(connection)
+		connection:on('end', function()
+			connection:destroy()
+		end)
+		connection:resume()
+	end)
+	echoServer:listen(ECHO_PORT, HOST)
+
+	client = net.Socket:new()
+	client:connect(RELAY_PORT, HOST)
+end)
+
+tap.run()
@@ -398,6 +398,36 @@ test("test readable.unshift", function()
     assert.equal(state.length, 200)
 end)
 
+test("test readable.read partial chunks", function()
+    local stream = ReadStream:new()
+    local state = stream._readableState
+    state.highWaterMark = 1024 * 16
+    stream._read = function() end
+
+    stream:push('abc')
+    stream:push('defg')
+    stream:push('hi')
+    assert.equal(state.length, 9)
+
+    -- 只读取第一个数据块的一部分
+    assert.equal(stream:read(2), 'ab')
+    assert.equal(state.length, 7)
+
+    -- 跨越多个数据块
+    assert.equal(stream:read(4), 'cdef')
+    assert.equal(state.length, 3)
+
+    -- 插入到部分读取了的数据块前面
+    stream:unshift('xy')
+    assert.equal(stream:read(3), 'xyg')
+
+    stream:push('jk')
+    assert.equal(stream:read(1), 'h')
+    assert.equal(stream:read(), 'ijk')
+    assert.equal(state.length, 0)
+    assert(state.head > state.tail)
+end)
+
 test("test readable.read", function()
     local stream = ReadStream:new()
     local state = stream._readableState
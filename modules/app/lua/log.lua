@@ -1,4 +1,7 @@
-local fs = require('fs')
+local fs   = require('fs')
+local uv   = require('luv')
+local core = require('core')
+local path = require('path')
 
 local exports = {}
 
@@ -7,51 +10,395 @@ local LEVEL_INFO  = 1
 local LEVEL_WARN  = 2
 local LEVEL_ERROR = 3
 
--- Redirect log information to the WoT server
--- @param level {number} Log level
--- @param line {number} Line number of the source code
--- @param message {string} Message text
-function exports.log(level, line, ...)
-    local at = os.date('%Y-%m-%d,%H:%M:%S')
+-------------------------------------------------------------------------------
+-- FileLogger
+-- 批量写入的日志文件
+--
+-- 日志先缓存在内存中, 缓存的数据达到 flushSize 或者经过 flushInterval 后
+-- 一次性写入文件. 日志文件一直保持打开, 文件超过 maxSize 后依次重命名为
+-- filename.1 ... filename.N (N 为 maxFiles), 写入, 轮转都是异步依次执行的,
+-- 不会阻塞事件循环. 缓存已满时新的日志会被丢弃并计数.
+
+local FileLogger = core.Emitter:extend()
+exports.FileLogger = FileLogger
+
+-- @param {object} options
+--  - filename {string} 日志文件名
+--  - maxSize {number} 单个日志文件的最大长度, 默认为 64KB
+--  - maxFiles {number} 保留的旧日志文件个数, 默认为 1
+--  - bufferSize {number} 最多缓存的数据长度, 默认为 64KB
+--  - flushSize {number} 缓存的数据达到这个长度后立即写入, 默认为 4KB
+--  - flushInterval {number} 缓存的数据最多延迟多久写入, 默认为 1000ms
+function FileLogger:initialize(options)
+    options = options or {}
+
+    self.filename       = options.filename or '/tmp/log/wotc.log'
+    self.maxSize        = options.maxSize or 64 * 1024
+    self.maxFiles       = math.max(options.maxFiles or 1, 1)
+    self.bufferSize     = options.bufferSize or 64 * 1024
+    self.flushSize      = options.flushSize or 4 * 1024
+    self.flushInterval  = options.flushInterval or 1000
+
+    self.lines      = {}    -- 等待写入的日志
+    self.bytes      = 0     -- 等待写入的数据长度
+    self.dropped    = 0     -- 因为缓存已满而丢弃的日志总数
+    self.unreported = 0     -- 还没有写入到日志文件中的丢弃数
+    self.fileSize   = 0     -- 当前日志文件的长度
+    self.callbacks  = {}    -- 等待所有缓存数据写入完成的回调
+
+    self._onExit = function()
+        self:flushSync()
+    end
+
+    process:on('exit', self._onExit)
+end
+
+-- 添加一行日志
+-- @return {boolean} 缓存已满时返回 false
+function FileLogger:write(line)
+    if (self.closed) then
+        return false
+    end
+
+    if (self.bytes + #line > self.bufferSize) then
+        self.dropped = self.dropped + 1
+        self.unreported = self.unreported + 1
+        return false
+    end
+
+    self.lines[#self.lines + 1] = line
+    self.bytes = self.bytes + #line
+
+    if (self.bytes >= self.flushSize) then
+        self:_flush()
+    else
+        self:_startTimer()
+    end
+
+    return true
+end
+
+-- 立即写入所有缓存的日志
+-- @param {function} callback 所有缓存的日志都写入后调用
+function FileLogger:flush(callback)
+    if (callback) then
+        self.callbacks[#self.callbacks + 1] = callback
+    end
+
+    self:_flush()
+end
+
+-- 同步写入所有缓存的日志, 用于进程退出时
+function FileLogger:flushSync()
+    local lines = self:_takeLines()
+    if (not lines) then
+        return
+    end
+
+    local data = table.concat(lines)
+
+    local fd = self.fd
+    if (not fd) then
+        fd = uv.fs_open(self.filename, 'a', 420)
+        if (not fd) then
+            return
+        end
+        self.fd = fd
+    end
+
+    uv.fs_write(fd, data, -1)
+    self.fileSize = self.fileSize + #data
+end
 
-    -- print to console
-    -- console.log(at, level, line, message, ...)
-    local args = table.pack(...);
-    if (not args) then
+-- 写入所有缓存的日志并关闭日志文件
+function FileLogger:close(callback)
+    if (self.closed) then
+        if (callback) then callback() end
         return
     end
 
-    -- write to file
-    local data = { at, level, line }
+    self.closed = true
+    process:removeListener('exit', self._onExit)
+
+    if (self.timer) then
+        uv.close(self.timer)
+        self.timer = nil
+        self.timerActive = false
+    end
+
+    self:flush(function()
+        local fd = self.fd
+        self.fd = nil
+
+        if (not fd) then
+            if (callback) then callback() end
+            return
+        end
+
+        uv.fs_close(fd, function()
+            if (callback) then callback() end
+        end)
+    end)
+end
+
+-- 返回所有缓存的日志, 以及丢弃日志的提示
+function FileLogger:_takeLines()
+    if (self.bytes == 0) and (self.unreported == 0) then
+        return
+    end
+
+    local lines = self.lines
+    if (self.unreported > 0) then
+        lines[#lines + 1] = exports.format(LEVEL_WARN, 0,
+            'log buffer full, dropped ' .. self.unreported .. ' lines')
+        self.unreported = 0
+    end
+
+    self.lines = {}
+    self.bytes = 0
+    return lines
+end
+
+function FileLogger:_startTimer()
+    if (self.timerActive) then
+        return
+    end
+
+    local timer = self.timer
+    if (not timer) then
+        timer = uv.new_timer()
+        uv.unref(timer) -- 不影响事件循环的退出
+        self.timer = timer
+    end
+
+    self.timerActive = true
+    uv.timer_start(timer, self.flushInterval, 0, function()
+        self.timerActive = false
+        self:_flush()
+    end)
+end
+
+function FileLogger:_onFlushed()
+    local callbacks = self.callbacks
+    self.callbacks = {}
+
+    for _, callback in ipairs(callbacks) do
+        callback()
+    end
+end
+
+function FileLogger:_flush()
+    if (self.writing) then
+        return -- 当前的写入完成后会继续
+    end
+
+    local lines = self:_takeLines()
+    if (not lines) then
+        return self:_onFlushed()
+    end
+
+    if (self.timerActive) then
+        uv.timer_stop(self.timer)
+        self.timerActive = false
+    end
+
+    self.writing = true
 
-    for _, value in ipairs(args) do
+    local function onWrite(err)
+        self.writing = false
+        if (err) then
+            self:emit('error', err)
+        end
+
+        if (self.bytes >= self.flushSize) or (#self.callbacks > 0) then
+            self:_flush()
+
+        elseif (self.bytes > 0) then
+            self:_startTimer()
+        end
+    end
+
+    -- 按 maxSize 分块写入, 当前文件写不下下一行时先切换日志文件
+    local index = 1
+    local function writeNext()
+        if (index > #lines) then
+            return onWrite()
+        end
+
+        if (self.fileSize > 0) and (self.fileSize + #lines[index] > self.maxSize) then
+            return self:_rotate(function(err)
+                if (err) then
+                    return onWrite(err)
+                end
+
+                writeNext()
+            end)
+        end
+
+        -- 当前文件还能容纳的日志行, 至少一行
+        local last = index
+        local size = self.fileSize + #lines[index]
+        while (last < #lines) and (size + #lines[last + 1] <= self.maxSize) do
+            last = last + 1
+            size = size + #lines[last]
+        end
+
+        local data = table.concat(lines, '', index, last)
+        index = last + 1
+
+        uv.fs_write(self.fd, data, -1, function(err)
+            if (err) then
+                return onWrite(err)
+            end
+
+            self.fileSize = self.fileSize + #data
+            writeNext()
+        end)
+    end
+
+    self:_open(function(err)
+        if (err) then
+            return onWrite(err)
+        end
+
+        writeNext()
+    end)
+end
+
+function FileLogger:_open(callback)
+    if (self.fd) then
+        return callback()
+    end
+
+    local filename = self.filename
+    local retried = false
+
+    local function onOpen(err, fd)
+        if (err) and (not retried) and (err:startsWith('ENOENT')) then
+            -- 日志目录还不存在
+            retried = true
+            fs.mkdirpSync(path.dirname(filename))
+            return uv.fs_open(filename, 'a', 420, onOpen)
+
+        elseif (err) then
+            return callback(err)
+        end
+
+        uv.fs_fstat(fd, function(err, statInfo)
+            self.fd = fd
+            self.fileSize = (statInfo and statInfo.size) or 0
+            callback()
+        end)
+    end
+
+    uv.fs_open(filename, 'a', 420, onOpen)
+end
+
+-- 关闭当前的日志文件, 然后依次重命名:
+-- filename.(N-1) => filename.N, ..., filename => filename.1
+function FileLogger:_rotate(callback)
+    local filename = self.filename
+    local fd = self.fd
+    self.fd = nil
+
+    local index = self.maxFiles
+
+    local function renameNext()
+        if (index < 1) then
+            self.fileSize = 0
+            self:emit('rotate')
+            return self:_open(callback)
+        end
+
+        local from = (index == 1) and filename or (filename .. '.' .. (index - 1))
+        local to = filename .. '.' .. index
+        index = index - 1
+
+        -- 不存在的旧日志文件会重命名失败, 可以忽略
+        uv.fs_rename(from, to, function()
+            renameNext()
+        end)
+    end
+
+    uv.fs_close(fd, function()
+        renameNext()
+    end)
+end
+
+-------------------------------------------------------------------------------
+-- exports
+
+-- 是否同时打印到控制台, 默认只有标准输出为终端时才打印
+exports.echo = (uv.guess_handle(1) == 'tty')
+
+-- 默认的日志文件选项, 参考 FileLogger
+exports.options = {}
+
+local lastTime = nil
+local lastDate = nil
+
+-- 格式化一行日志
+function exports.format(level, line, ...)
+    -- 同一秒内的日志使用相同的时间字符串
+    local now = os.time()
+    if (now ~= lastTime) then
+        lastTime = now
+        lastDate = os.date('%Y-%m-%d,%H:%M:%S', now)
+    end
+
+    local data = { lastDate, level, line }
+
+    for _, value in ipairs(table.pack(...)) do
         if (value ~= nil) then
             local valueType = type(value)
             if (valueType == 'boolean') then
                 table.insert(data, value and 'true' or 'false')
             elseif (valueType ~= 'table') then
-                table.insert(data, value)
+                table.insert(data, tostring(value))
             end
         end
     end
 
-    local LOG_MAX_SIZE = 1024 * 64 -- in bytes
-    local logMessage = table.concat(data, ',') .. '\r\n'
-    local filename = "/tmp/log/wotc.log"
-    fs.stat(filename, function(err, stat)
-        if (stat and stat.size > LOG_MAX_SIZE) then
-            console.log(stat.size)
-            os.rename(filename, '/tmp/log/wotc_old.log')
-        end
-        fs.appendFile(filename, logMessage)
-    end)
+    return table.concat(data, ',') .. '\r\n'
+end
 
-    print(table.concat(data, ', '));
+-- 返回默认的日志文件
+function exports.getLogger()
+    local logger = exports.logger
+    if (not logger) or (logger.closed) then
+        logger = FileLogger:new(exports.options)
+        exports.logger = logger
+    end
+
+    return logger
+end
+
+-- 创建一个新的日志文件
+function exports.createLogger(options)
+    return FileLogger:new(options)
+end
+
+-- Redirect log information to the WoT server
+-- @param level {number} Log level
+-- @param line {number} Line number of the source code
+-- @param message {string} Message text
+function exports.log(level, line, ...)
+    local logMessage = exports.format(level, line, ...)
+    exports.getLogger():write(logMessage)
+
+    if (exports.echo) then
+        print(logMessage:sub(1, -3))
+    end
 end
 
 -- Init log module
 -- @param client {Thing} WoT client
-function exports.init(client)
+-- @param options {object} 日志文件选项, 参考 FileLogger
+function exports.init(client, options)
+    if (options) then
+        exports.options = options
+    end
+
     console.error = function (message, ...)
         exports.log(LEVEL_ERROR, console.getFileLine(), message, ...)
     end
@@ -0,0 +1,306 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+
+-------------------------------------------------------------------------------
+-- MessagePack
+-- 一个精简的 MessagePack 编解码实现, 用于 RPC 等进程间通信.
+--
+-- 支持 nil, boolean, 整数, 浮点数, 字符串以及由这些值组成的 Table,
+-- 空 Table 和连续下标 (1..n) 的 Table 编码为数组, 其他 Table 编码为 map.
+-- 字符串总是编码为 str 类型, bin 类型会解码为字符串.
+
+local exports = {}
+
+local MAX_DEPTH = 100
+
+local pack   = string.pack
+local unpack = string.unpack
+
+local encodeValue
+
+local function isArray(value)
+    local count = #value
+    if (count == 0) then
+        return next(value) == nil
+    end
+
+    local total = 0
+    for _ in pairs(value) do
+        total = total + 1
+        if (total > count) then
+            return false
+        end
+    end
+
+    return total == count
+end
+
+local function encodeInteger(buffer, value)
+    if (value >= 0) then
+        if (value < 0x80) then
+            buffer[#buffer + 1] = pack('B', value)
+        elseif (value < 0x100) then
+            buffer[#buffer + 1] = pack('>BB', 0xcc, value)
+        elseif (value < 0x10000) then
+            buffer[#buffer + 1] = pack('>BI2', 0xcd, value)
+        elseif (value < 0x100000000) then
+            buffer[#buffer + 1] = pack('>BI4', 0xce, value)
+        else
+            buffer[#buffer + 1] = pack('>Bi8', 0xcf, value)
+        end
+
+    elseif (value >= -0x20) then
+        buffer[#buffer + 1] = pack('b', value)
+    elseif (value >= -0x80) then
+        buffer[#buffer + 1] = pack('>Bb', 0xd0, value)
+    elseif (value >= -0x8000) then
+        buffer[#buffer + 1] = pack('>Bi2', 0xd1, value)
+    elseif (value >= -0x80000000) then
+        buffer[#buffer + 1] = pack('>Bi4', 0xd2, value)
+    else
+        buffer[#buffer + 1] = pack('>Bi8', 0xd3, value)
+    end
+end
+
+local function encodeString(buffer, value)
+    local length = #value
+    if (length < 32) then
+        buffer[#buffer + 1] = pack('B', 0xa0 | length)
+    elseif (length < 0x100) then
+        buffer[#buffer + 1] = pack('>BB', 0xd9, length)
+    elseif (length < 0x10000) then
+        buffer[#buffer + 1] = pack('>BI2', 0xda, length)
+    else
+        buffer[#buffer + 1] = pack('>BI4', 0xdb, length)
+    end
+
+    buffer[#buffer + 1] = value
+end
+
+local function encodeTable(buffer, value, depth)
+    if (depth > MAX_DEPTH) then
+        error('msgpack: table nested too deeply', 0)
+    end
+
+    if (isArray(value)) then
+        local count = #value
+        if (count < 16) then
+            buffer[#buffer + 1] = pack('B', 0x90 | count)
+        elseif (count < 0x10000) then
+            buffer[#buffer + 1] = pack('>BI2', 0xdc, count)
+        else
+            buffer[#buffer + 1] = pack('>BI4', 0xdd, count)
+        end
+
+        for i = 1, count do
+            encodeValue(buffer, value[i], depth + 1)
+        end
+        return
+    end
+
+    local count = 0
+    for _ in pairs(value) do
+        count = count + 1
+    end
+
+    if (count < 16) then
+        buffer[#buffer + 1] = pack('B', 0x80 | count)
+    elseif (count < 0x10000) then
+        buffer[#buffer + 1] = pack('>BI2', 0xde, count)
+    else
+        buffer[#buffer + 1] = pack('>BI4', 0xdf, count)
+    end
+
+    for key, item in pairs(value) do
+        encodeValue(buffer, key, depth + 1)
+        encodeValue(buffer, item, depth + 1)
+    end
+end
+
+encodeValue = function(buffer, value, depth)
+    local valueType = type(value)
+    if (valueType == 'nil') or (valueType == 'userdata') then
+        -- json.null 等空值
+        buffer[#buffer + 1] = '\xc0'
+
+    elseif (valueType == 'boolean') then
+        buffer[#buffer + 1] = value and '\xc3' or '\xc2'
+
+    elseif (valueType == 'number') then
+        if (math.type(value) == 'integer') then
+            encodeInteger(buffer, value)
+        else
+            buffer[#buffer + 1] = pack('>Bd', 0xcb, value)
+        end
+
+    elseif (valueType == 'string') then
+        encodeString(buffer, value)
+
+    elseif (valueType == 'table') then
+        encodeTable(buffer, value, depth)
+
+    else
+        error('msgpack: cannot encode ' .. valueType, 0)
+    end
+end
+
+-------------------------------------------------------------------------------
+-- decode
+
+local decodeValue
+
+local function checkSize(data, position, length)
+    if (position + length - 1 > #data) then
+        error('msgpack: unexpected end of data', 0)
+    end
+end
+
+local function decodeString(data, position, length)
+    checkSize(data, position, length)
+    return data:sub(position, position + length - 1), position + length
+end
+
+local function decodeArray(data, position, count, depth)
+    local result = {}
+    local value
+    for i = 1, count do
+        value, position = decodeValue(data, position, depth + 1)
+        result[i] = value
+    end
+    return result, position
+end
+
+local function decodeMap(data, position, count, depth)
+    local result = {}
+    local key, value
+    for _ = 1, count do
+        key, position = decodeValue(data, position, depth + 1)
+        value, position = decodeValue(data, position, depth + 1)
+        if (key ~= nil) then
+            result[key] = value
+        end
+    end
+    return result, position
+end
+
+-- 定长格式: 类型字节 => unpack 格式
+local FIXED_FORMATS = {
+    [0xca] = '>f', [0xcb] = '>d',
+    [0xcc] = '>B', [0xcd] = '>I2', [0xce] = '>I4', [0xcf] = '>i8',
+    [0xd0] = '>b', [0xd1] = '>i2', [0xd2] = '>i4', [0xd3] = '>i8'
+}
+
+local FIXED_SIZES = {
+    [0xca] = 4, [0xcb] = 8,
+    [0xcc] = 1, [0xcd] = 2, [0xce] = 4, [0xcf] = 8,
+    [0xd0] = 1, [0xd1] = 2, [0xd2] = 4, [0xd3] = 8
+}
+
+-- 变长格式: 类型字节 => 长度的 unpack 格式, 长度的字节数, 解码函数
+local LENGTH_FORMATS = {
+    [0xc4] = { '>B', 1, decodeString }, [0xc5] = { '>I2', 2, decodeString },
+    [0xc6] = { '>I4', 4, decodeString },
+    [0xd9] = { '>B', 1, decodeString }, [0xda] = { '>I2', 2, decodeString },
+    [0xdb] = { '>I4', 4, decodeString },
+    [0xdc] = { '>I2', 2, decodeArray }, [0xdd] = { '>I4', 4, decodeArray },
+    [0xde] = { '>I2', 2, decodeMap }, [0xdf] = { '>I4', 4, decodeMap }
+}
+
+decodeValue = function(data, position, depth)
+    if (depth > MAX_DEPTH) then
+        error('msgpack: data nested too deeply', 0)
+    end
+
+    checkSize(data, position, 1)
+    local byte = data:byte(position)
+    position = position + 1
+
+    if (byte < 0x80) then
+        return byte, position
+
+    elseif (byte >= 0xe0) then
+        return byte - 0x100, position
+
+    elseif (byte < 0x90) then
+        return decodeMap(data, position, byte & 0x0f, depth)
+
+    elseif (byte < 0xa0) then
+        return decodeArray(data, position, byte & 0x0f, depth)
+
+    elseif (byte < 0xc0) then
+        return decodeString(data, position, byte & 0x1f)
+
+    elseif (byte == 0xc0) then
+        return nil, position
+
+    elseif (byte == 0xc2) then
+        return false, position
+
+    elseif (byte == 0xc3) then
+        return true, position
+    end
+
+    local format = FIXED_FORMATS[byte]
+    if (format) then
+        checkSize(data, position, FIXED_SIZES[byte])
+        return unpack(format, data, position)
+    end
+
+    local lengthFormat = LENGTH_FORMATS[byte]
+    if (lengthFormat) then
+        checkSize(data, position, lengthFormat[2])
+        local length = unpack(lengthFormat[1], data, position)
+        return lengthFormat[3](data, position + lengthFormat[2], length, depth)
+    end
+
+    error(string.format('msgpack: unsupported type 0x%02x', byte), 0)
+end
+
+-------------------------------------------------------------------------------
+-- exports
+
+-- 编码指定的值
+-- @return {string} 编码后的数据, 失败时返回 nil, err
+function exports.encode(value)
+    local buffer = {}
+    local ok, err = pcall(encodeValue, buffer, value, 1)
+    if (not ok) then
+        return nil, err
+    end
+
+    return table.concat(buffer)
+end
+
+-- 解码指定的数据
+-- @param {string} data 要解码的数据
+-- @param {number} position 开始位置, 默认为 1
+-- @return value, nextPosition 失败时返回 nil, err
+function exports.decode(data, position)
+    if (type(data) ~= 'string') then
+        return nil, 'msgpack: invalid data'
+    end
+
+    local ok, value, nextPosition = pcall(decodeValue, data, position or 1, 1)
+    if (not ok) then
+        return nil, value
+    end
+
+    return value, nextPosition
+end
+
+return exports
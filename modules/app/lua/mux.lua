@@ -0,0 +1,414 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local core   = require('core')
+local Duplex = require('stream').Duplex
+
+-------------------------------------------------------------------------------
+-- 多路复用
+-- 在一个 TCP 连接上同时传输多个逻辑流 (stream)
+--
+-- 帧格式 (7 字节头部 + 数据):
+--
+--  | type (1) | stream id (4) | length (2) | payload (length) |
+--
+-- 每个流都有一个接收窗口, 发送方最多只能发送窗口大小的数据, 接收方在应用
+-- 读取数据后通过 WINDOW 帧增加发送方的窗口.
+
+local exports = {}
+
+exports.TYPE_DATA   = 0 -- 数据
+exports.TYPE_OPEN   = 1 -- 打开一个流, 数据为打开参数
+exports.TYPE_CLOSE  = 2 -- 这个方向的数据已发送完 (半关闭)
+exports.TYPE_RESET  = 3 -- 异常关闭
+exports.TYPE_WINDOW = 4 -- 增加发送窗口, 数据为 4 字节增量
+exports.TYPE_PING   = 5
+exports.TYPE_PONG   = 6
+
+exports.HEADER_SIZE     = 7
+exports.MAX_FRAME_SIZE  = 16 * 1024
+exports.INITIAL_WINDOW  = 256 * 1024
+
+local HEADER_FORMAT = '>BI4I2'
+local HEADER_SIZE   = exports.HEADER_SIZE
+
+-- 编码一个帧
+function exports.encode(type, id, payload)
+    payload = payload or ''
+    return string.pack(HEADER_FORMAT, type, id, #payload) .. payload
+end
+
+-------------------------------------------------------------------------------
+-- Stream
+
+local Stream = Duplex:extend()
+exports.Stream = Stream
+
+function Stream:initialize(session, id)
+    Duplex.initialize(self)
+
+    self.id             = id
+    self.session        = session
+    self.sendWindow     = exports.INITIAL_WINDOW
+    self.unackedBytes   = 0   -- 已收到但还没有通知对方的数据长度
+    self.localClosed    = false
+    self.remoteClosed   = false
+
+    self:once('finish', function()
+        self:_closeLocal()
+    end)
+end
+
+function Stream:destroy(err)
+    if (self.destroyed) then
+        return
+    end
+
+    self.destroyed = true
+    self.readable = false
+    self.writable = false
+
+    local session = self.session
+    if (not (self.localClosed and self.remoteClosed)) then
+        session:_send(exports.TYPE_RESET, self.id)
+    end
+
+    self:_onDestroy(err)
+end
+
+-- 对方已关闭这个流的发送方向
+function Stream:_closeRemote()
+    if (self.remoteClosed) then
+        return
+    end
+
+    self.remoteClosed = true
+    self:push(nil)
+    self:_checkClosed()
+end
+
+-- 本地已经写完所有数据
+function Stream:_closeLocal()
+    if (self.localClosed) or (self.destroyed) then
+        return
+    end
+
+    self.localClosed = true
+    self.session:_send(exports.TYPE_CLOSE, self.id)
+    self:_checkClosed()
+end
+
+function Stream:_checkClosed()
+    if (self.localClosed and self.remoteClosed) and (not self.destroyed) then
+        self.destroyed = true
+        self:_onDestroy()
+    end
+end
+
+function Stream:_onDestroy(err)
+    local pending = self._pending
+    self._pending = nil
+
+    self.session.streams[self.id] = nil
+
+    if (pending) then
+        pending.callback(err or 'stream closed')
+    end
+
+    if (err) then
+        self:emit('error', err)
+    end
+
+    self:emit('close')
+end
+
+-- 收到对方发送的数据
+function Stream:_onData(data)
+    if (self.remoteClosed) or (self.destroyed) then
+        return
+    end
+
+    self.unackedBytes = self.unackedBytes + #data
+    if (self:push(data)) then
+        self:_sendWindowUpdate()
+    end
+end
+
+-- 对方增加了发送窗口
+function Stream:_onWindow(increment)
+    self.sendWindow = self.sendWindow + increment
+
+    local pending = self._pending
+    if (pending) then
+        self._pending = nil
+        self:_write(pending.data, pending.callback)
+    end
+end
+
+-- 应用程序已读取了数据, 通知对方可以继续发送
+function Stream:_sendWindowUpdate()
+    local bytes = self.unackedBytes
+    if (bytes < exports.INITIAL_WINDOW / 4) or (self.destroyed) then
+        return
+    end
+
+    self.unackedBytes = 0
+    self.session:_send(exports.TYPE_WINDOW, self.id, string.pack('>I4', bytes))
+end
+
+function Stream:_read(n)
+    self:_sendWindowUpdate()
+end
+
+function Stream:_write(data, callback)
+    if (self.destroyed) then
+        return callback('stream closed')
+    end
+
+    local session = self.session
+    local maxSize = exports.MAX_FRAME_SIZE
+    local offset = 1
+    local size = #data
+
+    while (offset <= size) and (self.sendWindow > 0) do
+        local length = math.min(size - offset + 1, maxSize, self.sendWindow)
+        session:_send(exports.TYPE_DATA, self.id, data:sub(offset, offset + length - 1))
+        self.sendWindow = self.sendWindow - length
+        offset = offset + length
+    end
+
+    if (offset <= size) then
+        -- 窗口已用完, 等待对方的 WINDOW 帧
+        self._pending = { data = data:sub(offset), callback = callback }
+        return
+    end
+
+    callback()
+end
+
+-------------------------------------------------------------------------------
+-- Session
+
+local Session = core.Emitter:extend()
+exports.Session = Session
+
+-- @param {net.Socket} socket 承载多路复用的连接
+-- @param {object} options
+--  - isServer {boolean} 服务端使用偶数流编号, 客户端使用奇数流编号
+--  - buffer {string} 切换到多路复用模式前已经收到的数据
+function Session:initialize(socket, options)
+    options = options or {}
+
+    self.socket     = socket
+    self.streams    = {}
+    self.nextId     = options.isServer and 2 or 1
+    self.buffer     = ''
+    self.position   = 1
+
+    self._onSocketData = function(chunk)
+        self:_onData(chunk)
+    end
+
+    socket:on('data', self._onSocketData)
+    socket:once('end', function()
+        self:destroy()
+    end)
+
+    socket:once('error', function(err)
+        self:destroy(err)
+    end)
+
+    if (options.buffer) and (#options.buffer > 0) then
+        self:_onData(options.buffer)
+    end
+end
+
+-- 打开一个新的流
+-- @param {string} payload 打开参数, 由对方的 'stream' 事件收到
+-- @return {Stream}
+function Session:open(payload)
+    if (self.destroyed) then
+        return nil, 'session closed'
+    end
+
+    local id = self.nextId
+    self.nextId = id + 2
+
+    local stream = Stream:new(self, id)
+    self.streams[id] = stream
+    self:_send(exports.TYPE_OPEN, id, payload)
+    return stream
+end
+
+function Session:ping(data)
+    self:_send(exports.TYPE_PING, 0, data)
+end
+
+function Session:destroy(err)
+    if (self.destroyed) then
+        return
+    end
+
+    self.destroyed = true
+
+    for _, stream in pairs(self.streams) do
+        stream.destroyed = true
+        stream:_onDestroy(err)
+    end
+    self.streams = {}
+
+    self.socket:removeListener('data', self._onSocketData)
+    self.socket:destroy()
+
+    self:emit('close', err)
+end
+
+function Session:_send(type, id, payload)
+    if (self.destroyed) then
+        return
+    end
+
+    self.socket:write(exports.encode(type, id, payload))
+end
+
+function Session:_onFrame(type, id, payload)
+    if (type == exports.TYPE_DATA) then
+        local stream = self.streams[id]
+        if (stream) then
+            stream:_onData(payload)
+        end
+
+    elseif (type == exports.TYPE_OPEN) then
+        if (self.streams[id]) then
+            return
+        end
+
+        local stream = Stream:new(self, id)
+        self.streams[id] = stream
+        self:emit('stream', stream, payload)
+
+    elseif (type == exports.TYPE_CLOSE) then
+        local stream = self.streams[id]
+        if (stream) then
+            stream:_closeRemote()
+        end
+
+    elseif (type == exports.TYPE_RESET) then
+        local stream = self.streams[id]
+        if (stream) and (not stream.destroyed) then
+            stream.destroyed = true
+            stream:_onDestroy('stream reset')
+        end
+
+    elseif (type == exports.TYPE_WINDOW) then
+        local stream = self.streams[id]
+        if (stream) and (#payload >= 4) then
+            stream:_onWindow(string.unpack('>I4', payload))
+        end
+
+    elseif (type == exports.TYPE_PING) then
+        self:_send(exports.TYPE_PONG, id, payload)
+
+    elseif (type == exports.TYPE_PONG) then
+        self:emit('pong', payload)
+    end
+end
+
+function Session:_onData(chunk)
+    local buffer = self.buffer
+    local position = self.position
+    if (position > 1) then
+        buffer = buffer:sub(position)
+        position = 1
+    end
+
+    buffer = buffer .. chunk
+
+    local size = #buffer
+    while (size - position + 1 >= HEADER_SIZE) and (not self.destroyed) do
+        local type, id, length = string.unpack(HEADER_FORMAT, buffer, position)
+        local last = position + HEADER_SIZE + length - 1
+        if (last > size) then
+            break
+        end
+
+        local payload = buffer:sub(position + HEADER_SIZE, last)
+        position = last + 1
+
+        self:_onFrame(type, id, payload)
+    end
+
+    self.buffer = buffer
+    self.position = position
+end
+
+-- 在一个已连接的 socket 上创建多路复用会话
+function exports.createSession(socket, options)
+    return Session:new(socket, options)
+end
+
+-- 在一个 socket 和一个流之间双向转发数据, 任何一方关闭时都会关闭另一方
+-- @param {net.Socket} socket
+-- @param {Stream} stream
+function exports.bridge(socket, stream)
+    local function forward(source, target)
+        source:on('data', function(chunk)
+            if (target:write(chunk) == false) then
+                source:pause()
+                target:once('drain', function()
+                    source:resume()
+                end)
+            end
+        end)
+    end
+
+    forward(socket, stream)
+    forward(stream, socket)
+
+    -- 结束写入时也会发出 'end' 事件, 这里只处理读取方向的结束
+    socket:on('end', function()
+        if (socket._readableState.endEmitted) then
+            stream:close()
+        end
+    end)
+
+    stream:on('end', function()
+        if (stream._readableState.endEmitted) then
+            socket:close(function()
+                socket:destroy()
+            end)
+        end
+    end)
+
+    local function onSocketClose()
+        stream:destroy()
+    end
+
+    -- 正常结束时由上面的 'end' 事件在写完数据后关闭 socket
+    local function onStreamClose()
+        if (not stream.remoteClosed) then
+            socket:destroy()
+        end
+    end
+
+    socket:on('close', onSocketClose)
+    socket:on('error', onSocketClose)
+    stream:on('close', onStreamClose)
+    stream:on('error', onStreamClose)
+end
+
+return exports
@@ -15,12 +15,16 @@ See the License for the specific language governing permissions and
 limitations under the License.
 
 --]]
+local core      = require('core')
 local util 		= require('util')
 local http 		= require('http')
 local json  	= require('json')
 local fs        = require('fs')
+local net       = require('net')
+local uv        = require('luv')
 
 local request 	= require('http/request')
+local msgpack   = require('app/msgpack')
 
 local isWindows = os.platform() == "win32"
 
@@ -49,11 +53,387 @@ function ServerResponse:json(data)
     self:write(content)
 end
 
+-------------------------------------------------------------------------------
+-- 持久连接 (channel)
+--
+-- 客户端和每个 RPC 服务器之间保持一个长连接, 连接建立后首先发送 5 字节的
+-- 协议标识 `MAGIC`, 之后每个请求和应答都是一帧:
+--
+--  | length (4) | encoding (1) | payload (length - 1) |
+--
+-- encoding 为 'J' (JSON) 或 'M' (MessagePack), 应答使用和请求相同的编码.
+-- 请求和应答通过 JSON-RPC 的 id 对应, 客户端不需要等待上一个请求的应答就可以
+-- 发送下一个请求, 服务端也可以不按请求的顺序返回应答.
+--
+-- 服务端根据连接的前几个字节区分持久连接和 HTTP 请求, 所以 HTTP/JSONRPC
+-- 方式仍然可用. 服务端识别出持久连接后也先回复 `MAGIC`, 客户端在超时前没有
+-- 收到 `MAGIC` 时认为服务器只支持 HTTP.
+
+local MAGIC = 'LRPC\1'
+
+local ENCODING_JSON     = 'J'
+local ENCODING_MSGPACK  = 'M'
+
+local MAX_FRAME_SIZE = 16 * 1024 * 1024
+
+-- 等待服务器回复 `MAGIC` 的时间
+local HANDSHAKE_TIMEOUT = 3000
+
+-- 服务器接受了连接, 但没有按持久连接协议应答 (比如只支持 HTTP 的旧版本)
+local CHANNEL_UNSUPPORTED = 'channel not supported'
+
+local ENCODINGS = { json = ENCODING_JSON, msgpack = ENCODING_MSGPACK }
+
+-- 编码一个消息帧
+-- @return {string} 失败时返回 nil, err
+local function encodeFrame(message, encoding)
+    local payload, err
+    if (encoding == ENCODING_MSGPACK) then
+        payload, err = msgpack.encode(message)
+    else
+        encoding = ENCODING_JSON
+        payload, err = json.stringify(message)
+    end
+
+    if (not payload) then
+        return nil, err or 'invalid message'
+    end
+
+    return string.pack('>I4', #payload + 1) .. encoding .. payload
+end
+
+local function decodeFrame(frame)
+    local encoding = frame:sub(1, 1)
+    local payload = frame:sub(2)
+
+    local message
+    if (encoding == ENCODING_MSGPACK) then
+        message = msgpack.decode(payload)
+    elseif (encoding == ENCODING_JSON) then
+        message = json.parse(payload)
+    end
+
+    if (type(message) ~= 'table') then
+        return nil, encoding
+    end
+
+    return message, encoding
+end
+
+-- 从收到的数据中解析出所有完整的帧
+-- @param {object} reader 保存未处理的数据 (buffer, position)
+-- @return {boolean} 数据无效时返回 false
+local function readFrames(reader, chunk, onFrame)
+    local buffer = reader.buffer
+    local position = reader.position
+    if (position > 1) then
+        buffer = buffer:sub(position)
+        position = 1
+    end
+
+    buffer = buffer .. chunk
+
+    local size = #buffer
+    while (size - position + 1 >= 4) do
+        local length = string.unpack('>I4', buffer, position)
+        if (length < 1) or (length > MAX_FRAME_SIZE) then
+            return false
+        end
+
+        local last = position + 4 + length - 1
+        if (last > size) then
+            break
+        end
+
+        local frame = buffer:sub(position + 4, last)
+        position = last + 1
+
+        onFrame(frame)
+    end
+
+    reader.buffer = buffer
+    reader.position = position
+    return true
+end
+
+-------------------------------------------------------------------------------
+-- Channel
+
+local Channel = core.Emitter:extend()
+
+-- @param {string} path 服务器的 unix socket 路径
+-- @param {object} options
+--  - encoding {string} 'json' (默认) 或 'msgpack'
+function Channel:initialize(path, options)
+    options = options or {}
+
+    self.path       = path
+    self.encoding   = ENCODINGS[options.encoding] or ENCODING_JSON
+    self.lastId     = 0
+    self.requests   = {}  -- 等待应答的请求, id => { frame, callback }
+    self.pending    = 0   -- 等待应答的请求数
+    self.established = false -- 是否和服务器握手成功过
+end
+
+-- 调用远程方法, 不用等待之前的调用返回
+function Channel:call(method, params, callback)
+    if (self.destroyed) then
+        return callback('channel closed')
+    end
+
+    local id = self.lastId + 1
+    self.lastId = id
+
+    local body = { jsonrpc = 2.0, method = method, params = params, id = id }
+    local frame, err = encodeFrame(body, self.encoding)
+    if (not frame) then
+        return callback(err)
+    end
+
+    if (not self.socket) then
+        self:_connect()
+
+    elseif (self.pending == 0) and (self.connected) then
+        -- 复用空闲的连接
+        self.reused = true
+    end
+
+    self.requests[id] = { frame = frame, callback = callback }
+    self.pending = self.pending + 1
+    if (self.pending == 1) then
+        self:_ref(true)
+    end
+
+    self:_send(frame)
+end
+
+-- 关闭连接, 所有等待应答的请求都以 err 失败
+function Channel:destroy(err)
+    if (self.destroyed) then
+        return
+    end
+
+    self.destroyed = true
+    self:emit('close', err)
+
+    if (self.socket) then
+        self.socket:destroy()
+    end
+
+    local requests = self.requests
+    self.requests = {}
+    self.pending = 0
+
+    for id, request in pairs(requests) do
+        request.callback(err or 'channel closed')
+    end
+end
+
+function Channel:_send(frame)
+    if (self.connected) then
+        self.socket:write(frame)
+    else
+        self.queue[#self.queue + 1] = frame
+    end
+end
+
+function Channel:_connect()
+    local socket = net.Socket:new()
+    self.socket     = socket
+    self.connected  = false
+    self.reused     = false
+    self.queue      = {}  -- 连接建立前要发送的帧
+    self.reader     = { buffer = '', position = 1 }
+    self.handshaken = false
+
+    socket:setTimeout(HANDSHAKE_TIMEOUT)
+    socket:once('timeout', function()
+        self:_onSocketClose(socket, 'channel timeout')
+    end)
+
+    socket:connect(self.path, function()
+        self.connected = true
+
+        local queue = self.queue
+        self.queue = {}
+        socket:write(MAGIC .. table.concat(queue))
+    end)
+
+    socket:on('data', function(chunk)
+        if (self.socket ~= socket) then
+            return
+        end
+
+        if (not self.handshaken) then
+            chunk = self:_onHandshake(chunk)
+            if (not chunk) then
+                return
+            end
+        end
+
+        local ok = readFrames(self.reader, chunk, function(frame)
+            self:_onFrame(frame)
+        end)
+
+        if (not ok) then
+            self:destroy('invalid frame')
+        end
+    end)
+
+    socket:on('error', function(err)
+        self:_onSocketClose(socket, err)
+    end)
+
+    socket:on('close', function()
+        self:_onSocketClose(socket, 'channel closed')
+    end)
+end
+
+function Channel:_onSocketClose(socket, err)
+    if (self.socket ~= socket) or (self.destroyed) then
+        return
+    end
+
+    -- 连接成功但握手失败
+    if (self.connected) and (not self.established) then
+        return self:destroy(CHANNEL_UNSUPPORTED)
+    end
+
+    if (not self.reused) or (self.pending == 0) then
+        return self:destroy(err)
+    end
+
+    -- 空闲的连接可能已经被服务器关闭, 而这次的请求还没有收到任何应答,
+    -- 重新连接并重发这些请求 (只重试一次)
+    socket:destroy()
+    self:_connect()
+
+    local ids = {}
+    for id in pairs(self.requests) do
+        ids[#ids + 1] = id
+    end
+    table.sort(ids)
+
+    for _, id in ipairs(ids) do
+        self:_send(self.requests[id].frame)
+    end
+
+    self:_ref(true)
+end
+
+-- 检查服务器回复的 `MAGIC`, 返回之后剩下的数据, 还需要更多数据时返回 nil
+function Channel:_onHandshake(chunk)
+    local reader = self.reader
+    local buffer = reader.buffer .. chunk
+    local size = math.min(#buffer, #MAGIC)
+    if (buffer:sub(1, size) ~= MAGIC:sub(1, size)) then
+        reader.buffer = ''
+        self:_onSocketClose(self.socket, CHANNEL_UNSUPPORTED)
+        return
+
+    elseif (#buffer < #MAGIC) then
+        reader.buffer = buffer
+        return
+    end
+
+    reader.buffer = ''
+    self.handshaken = true
+    self.established = true
+    self.socket:setTimeout(0)
+
+    return buffer:sub(#MAGIC + 1)
+end
+
+function Channel:_onFrame(frame)
+    local message = decodeFrame(frame)
+    local id = message and message.id
+    local request = id and self.requests[id]
+    if (not request) then
+        return
+    end
+
+    self.reused = false
+    self.requests[id] = nil
+    self.pending = self.pending - 1
+    if (self.pending == 0) then
+        self:_ref(false)
+    end
+
+    request.callback(message.error, message.result)
+end
+
+-- 没有等待应答的请求时, 空闲的连接不会阻止进程退出
+function Channel:_ref(enable)
+    local handle = self.socket and self.socket._handle
+    if (not handle) or uv.is_closing(handle) then
+        return
+    end
+
+    if (enable) then
+        uv.ref(handle)
+    else
+        uv.unref(handle)
+    end
+end
+
 -------------------------------------------------------------------------------
 -- exports
 
 local exports = {}
 
+exports.Channel = Channel
+
+exports.CHANNEL_UNSUPPORTED = CHANNEL_UNSUPPORTED
+
+-- 'channel' 使用持久连接, 'http' 每次调用都发送一个 HTTP 请求
+exports.transport = 'channel'
+
+-- 持久连接默认的编码方式: 'json' 或 'msgpack'
+exports.encoding = 'json'
+
+local channels = {}
+
+-- 不支持持久连接的服务器, socket path => true
+local httpPeers = {}
+
+local function getSocketPath(name)
+    return BASE_SOCKET_NAME .. name .. ".sock"
+end
+
+-- 返回到指定名称的 RPC 服务器的持久连接, 连接关闭后会自动重新创建
+-- @param name {String} RPC 服务器名称
+-- @param options {object}
+--  - encoding {string} 'json' 或 'msgpack'
+function exports.channel(name, options)
+    options = options or {}
+
+    local path = getSocketPath(name)
+    local channel = channels[path]
+    if (not channel) or (channel.destroyed) then
+        channel = Channel:new(path, { encoding = options.encoding or exports.encoding })
+        channel:once('close', function()
+            if (channels[path] == channel) then
+                channels[path] = nil
+            end
+        end)
+
+        channels[path] = channel
+
+    elseif (options.encoding) then
+        channel.encoding = ENCODINGS[options.encoding] or ENCODING_JSON
+    end
+
+    return channel
+end
+
+-- 关闭所有持久连接
+function exports.close()
+    for _, channel in pairs(channels) do
+        channel:destroy()
+    end
+    channels = {}
+end
+
 -- bind remote methods
 function exports.bind(url, ...)
     local methods = table.pack(...)
@@ -85,27 +465,8 @@ function exports.bind(url, ...)
     return client
 end
 
--- call remote method
--- @param url {String|Number}
--- @param method {String} remote method name
--- @param params {Array} method args
--- @param callback {Function} - function(err, result)
-function exports.call(url, method, params, callback)
-    if (type(params) ~= 'table') then
-        params = { params }
-    end
-
-    -- call(port, method, params, callback)
-    if (tonumber(url) ~= nil) then
-        url = 'http://127.0.0.1:' .. tostring(url)
-
-    elseif (not url:startsWith('http')) then
-        url = 'rpc://rpc' .. BASE_SOCKET_NAME .. url .. ".sock"
-    end
-
-    --console.log(url, method, params)
-    callback = callback or function() end
-
+-- 通过 HTTP/JSONRPC 调用远程方法
+local function httpCall(url, method, params, callback)
     local id = nil
     local body = { jsonrpc = 2.0, method = method, params = params, id = id }
 
@@ -131,6 +492,66 @@ function exports.call(url, method, params, callback)
     end)
 end
 
+-- call remote method
+-- @param url {String|Number}
+-- @param method {String} remote method name
+-- @param params {Array} method args
+-- @param callback {Function} - function(err, result)
+function exports.call(url, method, params, callback)
+    if (type(params) ~= 'table') then
+        params = { params }
+    end
+
+    --console.log(url, method, params)
+    callback = callback or function() end
+
+    -- call(port, method, params, callback)
+    if (tonumber(url) ~= nil) then
+        url = 'http://127.0.0.1:' .. tostring(url)
+
+    elseif (not url:startsWith('http')) then
+        local name = url
+        local path = getSocketPath(name)
+        url = 'rpc://rpc' .. path
+
+        if (exports.transport ~= 'http') and (not httpPeers[path]) then
+            -- 握手失败时改用 HTTP 调用, 并且以后对这个服务器都直接使用 HTTP
+            return exports.channel(name):call(method, params, function(err, result)
+                if (err ~= CHANNEL_UNSUPPORTED) then
+                    return callback(err, result)
+                end
+
+                httpPeers[path] = true
+                httpCall(url, method, params, callback)
+            end)
+        end
+    end
+
+    httpCall(url, method, params, callback)
+end
+
+-- 执行一个 RPC 请求, 返回应答消息
+local function handleRpcMessage(handler, body)
+    local id = body.id
+
+    -- invalid method
+    local method = handler[body.method]
+    if (not method) then
+        return {jsonrpc = 2.0, id = id, error = {
+            code = -32601, message = 'Method not found'}}
+    end
+
+    local ret, result = pcall(method, handler, table.unpack(body.params or {}))
+    if (not ret) then
+        console.log('pcall error: ', result)
+
+        return {jsonrpc = 2.0, id = id, error = {
+            code = -32000, message = result}}
+    end
+
+    return {jsonrpc = 2.0, id = id, result = result}
+end
+
 -- create a IPC server
 -- @param {string} port/name IPC server listen port
 -- @param {function} callback - function(event, data)
@@ -156,26 +577,7 @@ function exports.server(port, handler, callback)
             return
         end
 
-        local id = body.id
-
-        -- invalid method
-        local method = handler[body.method]
-        if (not method) then
-            response:json({jsonrpc = 2.0, id = id, error = {
-                code = -32601, message = 'Method not found'}})
-            return
-        end
-
-        local ret, result = pcall(method, handler, table.unpack(body.params))
-        if (not ret) then
-            response:json({jsonrpc = 2.0, id = id, error = {
-                code = -32000, message = result}})
-
-            console.log('pcall error: ', result)
-            return
-        end
-
-        response:json({jsonrpc = 2.0, id = id, result = result})
+        response:json(handleRpcMessage(handler, body))
     end
 
     local function handleRequest(request, response)
@@ -193,15 +595,81 @@ function exports.server(port, handler, callback)
         end)
     end
 
-    local server = http.createServer(function(request, response)
-        handleRequest(request, response)
-    end)
+    local connections = {}
+
+    -- 处理持久连接上的请求
+    local function handleChannel(socket, data)
+        connections[socket] = true
+        socket:once('close', function()
+            connections[socket] = nil
+        end)
+
+        local reader = { buffer = '', position = 1 }
+        socket:write(MAGIC)
+
+        local function onFrame(frame)
+            local body, encoding = decodeFrame(frame)
+            local message
+            if (not body) then
+                message = {jsonrpc = 2.0, error = {
+                    code = -32700, message = 'Parse error'}}
+            else
+                message = handleRpcMessage(handler, body)
+            end
+
+            local response = encodeFrame(message, encoding)
+                or encodeFrame({jsonrpc = 2.0, id = message.id, error = {
+                    code = -32603, message = 'Internal error'}}, encoding)
+            socket:write(response)
+        end
+
+        local function onData(chunk)
+            if (not readFrames(reader, chunk, onFrame)) then
+                socket:destroy()
+            end
+        end
+
+        socket:on('data', onData)
+        onData(data)
+    end
+
+    -- 根据开始的几个字节判断是持久连接还是 HTTP 请求
+    local function handleConnection(socket)
+        local buffer = ''
+        local onData
+
+        onData = function(chunk)
+            buffer = buffer .. chunk
+
+            local size = math.min(#buffer, #MAGIC)
+            if (buffer:sub(1, size) ~= MAGIC:sub(1, size)) then
+                socket:removeListener('data', onData)
+                http.handleConnection(socket, handleRequest)
+                socket:emit('data', buffer)
+                return
+
+            elseif (#buffer < #MAGIC) then
+                return
+            end
+
+            socket:removeListener('data', onData)
+            handleChannel(socket, buffer:sub(#MAGIC + 1))
+        end
+
+        socket:on('data', onData)
+    end
+
+    local server = net.createServer(handleConnection)
 
     server:on('error', function(err, name)
         callback('error', err, name)
     end)
 
     server:on('close', function()
+        for socket in pairs(connections) do
+            socket:destroy()
+        end
+
         callback('close')
     end)
 
@@ -210,7 +678,7 @@ function exports.server(port, handler, callback)
     end)
 
     if (tonumber(port) == nil) then
-        local filename = BASE_SOCKET_NAME .. port .. ".sock"
+        local filename = getSocketPath(port)
         os.remove(filename)
 
         server:listen(filename)
@@ -0,0 +1,91 @@
+local log   = require('app/log')
+local fs    = require('fs')
+local tap   = require('ext/tap')
+
+local test = tap.test
+
+local dirname = '/tmp/test-app-log'
+local filename = dirname .. '/test.log'
+
+local function cleanup()
+	for _, name in ipairs({ filename, filename .. '.1', filename .. '.2', filename .. '.3' }) do
+		os.remove(name)
+	end
+end
+
+test("log.format", function ()
+	local line = log.format(3, 10, 'message', true, 100, {}, nil)
+	assert(line:endsWith(',3,10,message,true,100\r\n'))
+end)
+
+test("FileLogger batch & rotate", function (expect, uv)
+	cleanup()
+
+	local logger = log.createLogger({
+		filename = filename, maxSize = 1024, maxFiles = 2, flushSize = 256
+	})
+
+	local rotated = 0
+	logger:on('rotate', function()
+		rotated = rotated + 1
+	end)
+
+	local line = string.rep('x', 99) .. '\n'
+	for i = 1, 40 do
+		assert(logger:write(line))
+	end
+
+	-- 写入是异步的, 这时还有数据在缓存中
+	assert(logger.bytes > 0)
+
+	local closed = false
+	logger:close(function()
+		closed = true
+	end)
+
+	-- 在回调外面检查结果, 断言失败时这个测试才会失败
+	uv.run()
+	assert(closed)
+
+	-- 每个文件最多 10 行, 40 行需要切换 3 次
+	assert(rotated == 3, rotated)
+
+	-- 只保留两个旧的日志文件
+	assert(fs.existsSync(filename .. '.1'))
+	assert(fs.existsSync(filename .. '.2'))
+	assert(not fs.existsSync(filename .. '.3'))
+
+	for _, name in ipairs({ filename, filename .. '.1', filename .. '.2' }) do
+		local data = fs.readFileSync(name)
+		assert(#data == 10 * #line, #data)
+	end
+
+	assert(not logger:write(line))
+	cleanup()
+end)
+
+test("FileLogger drop", function (expect)
+	cleanup()
+
+	local logger = log.createLogger({
+		filename = filename, bufferSize = 1000, flushInterval = 10
+	})
+
+	local line = string.rep('x', 99) .. '\n'
+	for i = 1, 15 do
+		logger:write(line)
+	end
+
+	assert(logger.dropped == 5)
+
+	setTimeout(100, expect(function()
+		local data = fs.readFileSync(filename)
+		assert(data:find('dropped 5 lines', 1, true))
+		assert(#data > 10 * #line)
+
+		logger:close()
+		cleanup()
+	end))
+end)
+
+tap.run()
@@ -0,0 +1,131 @@
+local net   = require('net')
+local mux   = require('app/mux')
+local tap   = require('ext/tap')
+
+local test = tap.test
+
+local PORT = 10095
+
+test("mux encode", function ()
+	local frame = mux.encode(mux.TYPE_DATA, 3, 'abc')
+	assert(#frame == mux.HEADER_SIZE + 3)
+
+	local type, id, length = string.unpack('>BI4I2', frame)
+	assert(type == mux.TYPE_DATA)
+	assert(id == 3)
+	assert(length == 3)
+end)
+
+test("mux streams", function (expect)
+	local chunk = string.rep('0123456789abcdef', 4096) -- 64KB
+	local total = #chunk * 8
+	local server, clientSession
+
+	server = net.createServer(function(connection)
+		local session = mux.createSession(connection, { isServer = true })
+
+		session:on('stream', expect(function(stream, payload)
+			assert(payload == 'echo')
+
+			stream:on('data', function(data)
+				stream:write(data)
+			end)
+
+			stream:on('end', function()
+				stream:close()
+			end)
+
+			stream:on('close', expect(function()
+				server:close()
+			end))
+		end, 2))
+	end)
+	server:listen(PORT, '127.0.0.1')
+
+	local socket = net.Socket:new()
+	socket:connect(PORT, '127.0.0.1', function()
+		clientSession = mux.createSession(socket)
+
+		-- two concurrent streams on the same connection
+		local closed = 0
+		for i = 1, 2 do
+			local stream = clientSession:open('echo')
+			local received = 0
+
+			stream:on('data', function(data)
+				received = received + #data
+				if (received == total) then
+					stream:close()
+				end
+			end)
+
+			stream:on('close', expect(function()
+				assert(received == total)
+
+				closed = closed + 1
+				if (closed == 2) then
+					clientSession:destroy()
+				end
+			end))
+
+			for j = 1, 8 do
+				stream:write(chunk)
+			end
+		end
+	end)
+end)
+
+test("mux bridge", function (expect)
+	local chunk = string.rep('0123456789abcdef', 4096) -- 64KB
+	local total = #chunk * 4
+	local echoServer, server
+
+	echoServer = net.createServer(function(connection)
+		connection:on('data', function(data)
+			connection:write(data)
+		end)
+
+		connection:on('end', function()
+			connection:close()
+		end)
+	end)
+	echoServer:listen(PORT + 1, '127.0.0.1')
+
+	-- every stream is forwarded to the echo server
+	server = net.createServer(function(connection)
+		local session = mux.createSession(connection, { isServer = true })
+
+		session:on('stream', function(stream)
+			local upstream = net.Socket:new()
+			upstream:connect(PORT + 1, '127.0.0.1', function()
+				mux.bridge(upstream, stream)
+			end)
+		end)
+	end)
+	server:listen(PORT, '127.0.0.1')
+
+	local socket = net.Socket:new()
+	socket:connect(PORT, '127.0.0.1', function()
+		local session = mux.createSession(socket)
+		local stream = session:open('bridge')
+		local received = 0
+
+		stream:on('data', function(data)
+			received = received + #data
+		end)
+
+		stream:on('close', expect(function()
+			assert(received == total)
+			session:destroy()
+			server:close()
+			echoServer:close()
+		end))
+
+		for i = 1, 4 do
+			stream:write(chunk)
+		end
+		stream:close()
+	end)
+end)
+
+tap.run()
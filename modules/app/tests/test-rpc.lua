@@ -1,4 +1,5 @@
 local rpc   = require('app/rpc')
+local msgpack = require('app/msgpack')
 local tap    = require('ext/tap')
 
 local handler = {
@@ -9,11 +10,47 @@ local handler = {
 		assert(arg2 == 100)
 
 		return 3.14
+	end,
+
+	add = function(self, a, b)
+		return a + b
+	end,
+
+	echo = function(self, value)
+		return value
+	end,
+
+	fail = function(self)
+		error('failed')
 	end
 }
 
 local test = tap.test
 
+test("MessagePack", function ()
+	local value = {
+		name = 'test', count = 100, ratio = 0.5, enabled = true, disabled = false,
+		list = { 1, -1, -100, 255, 65536, -70000, 2^40 // 1, 'x' },
+		text = string.rep('abc', 100), empty = {}
+	}
+
+	local data = msgpack.encode(value)
+	local result, position = msgpack.decode(data)
+	assert(position == #data + 1)
+	assert(result.name == 'test' and result.count == 100 and result.ratio == 0.5)
+	assert(result.enabled == true and result.disabled == false)
+	assert(result.text == value.text)
+	assert(#result.empty == 0)
+
+	for i = 1, #value.list do
+		assert(result.list[i] == value.list[i])
+	end
+
+	assert(msgpack.decode(msgpack.encode(nil)) == nil)
+	assert(msgpack.encode(print) == nil)
+	assert(msgpack.decode(data:sub(1, -2)) == nil)
+end)
+
 test("Lua Remote Call", function ()
 	os.remove('test-rpc')
 
@@ -38,5 +75,126 @@ test("Lua Remote Call", function ()
 
 end)
 
-tap.run()
+test("Lua Remote Call pipelining", function (expect)
+	local server = rpc.server('test-rpc', handler)
+
+	local COUNT = 1000
+	local count = 0
+
+	local function onFinish()
+		local remote = rpc.bind('test-rpc', 'fail', 'unknown')
+		remote.fail(expect(function(err, result)
+			assert(err.code == -32000)
+
+			remote.unknown(expect(function(err, result)
+				assert(err.code == -32601)
+
+				rpc.close()
+				server:close()
+			end))
+		end))
+	end
+
+	-- 所有请求都在同一个连接上发送, 不用等待之前的应答
+	for i = 1, COUNT do
+		rpc.call('test-rpc', 'add', { i, 1 }, function(err, result)
+			assert(not err)
+			assert(result == i + 1)
+
+			count = count + 1
+			if (count == COUNT) then
+				onFinish()
+			end
+		end)
+	end
+
+	assert(rpc.channel('test-rpc').pending == COUNT)
+end)
+
+test("Lua Remote Call msgpack", function (expect)
+	local server = rpc.server('test-rpc', handler)
+	local channel = rpc.channel('test-rpc', { encoding = 'msgpack' })
+
+	local value = { id = 1, tags = { 'a', 'b' }, data = string.rep('\0\1\2', 100) }
+	channel:call('echo', { value }, expect(function(err, result)
+		assert(not err)
+		assert(result.id == 1)
+		assert(result.tags[2] == 'b')
+		assert(result.data == value.data)
+
+		channel:destroy()
+		server:close()
+	end))
+end)
+
+test("Lua Remote Call over HTTP", function (expect)
+	local server = rpc.server('test-rpc', handler)
+
+	rpc.transport = 'http'
+	rpc.call('test-rpc', 'add', { 1, 2 }, expect(function(err, result)
+		rpc.transport = 'channel'
+
+		assert(not err)
+		assert(result == 3)
+		server:close()
+	end))
+end)
+
+test("Lua Remote Call falls back to HTTP", function (expect, uv)
+	local http = require('http')
+	local json = require('json')
+	local fs   = require('fs')
+
+	-- 只支持 HTTP/JSONRPC 的旧版本服务器
+	local path = '/tmp/sock/uv-test-rpc-http.sock'
+	fs.mkdirSync('/tmp/sock/')
+	fs.unlinkSync(path)
 
+	local requests = 0
+	local server = http.createServer(function(request, response)
+		local body = {}
+		request:on('data', function(chunk)
+			body[#body + 1] = chunk
+		end)
+
+		request:on('end', function()
+			requests = requests + 1
+			local message = json.parse(table.concat(body))
+			local data = json.stringify({ jsonrpc = 2.0, id = message.id,
+				result = message.params[1] + message.params[2] })
+			response:setHeader('Content-Type', 'application/json')
+			response:setHeader('Content-Length', #data)
+			response:finish(data)
+		end)
+	end)
+	server:listen(path)
+
+	local connections = 0
+	server:on('connection', function()
+		connections = connections + 1
+	end)
+
+	local results = {}
+	rpc.call('test-rpc-http', 'add', { 1, 2 }, function(err, result)
+		results[1] = result
+
+		-- 之后的调用直接使用 HTTP
+		rpc.call('test-rpc-http', 'add', { 3, 4 }, function(err, result)
+			results[2] = result
+
+			rpc.close()
+			server:close()
+		end)
+	end)
+
+	uv.run()
+
+	assert(results[1] == 3, results[1])
+	assert(results[2] == 7, results[2])
+	assert(requests == 2)
+
+	-- 一次握手失败的连接和两次 HTTP 请求的连接
+	assert(connections == 3, connections)
+end)
+
+tap.run()
@@ -18,6 +18,7 @@ limitations under the License.
 local path 	 = require('path')
 local core 	 = require('core')
 local fs 	 = require('fs')
+local uv 	 = require('luv')
 
 local join = path.join
 
@@ -49,14 +50,28 @@ end
 -------------------------------------------------------------------------------
 -- GPIO
 
+-- GPIO 口
+--
+-- 第一次读写时打开 value 文件并一直保持打开, 之后的读写直接在这个文件描述符上
+-- 调用 pread/pwrite, 不再每次都经过线程池 open/read/close.
+--
+-- watch 通过 uv_poll 监听 value 文件的 POLLPRI 事件 (sysfs 的边沿中断),
+-- 不需要使用定时器轮询.
+
 local GPIO = core.Emitter:extend()
 exports.GPIO = GPIO
 
+-- @param {number} pin GPIO 编号
+-- @param {object} options
+--  - sysFsPath {string} sysfs GPIO 目录, 默认为 '/sys/class/gpio'
 function GPIO:initialize(pin, options)
-	self.sysFsPath 	= '/sys/class/gpio'
-	self.pin 		= tonumber(pin)
-
+	options = options or {}
 
+	self.sysFsPath 	= options.sysFsPath or '/sys/class/gpio'
+	self.pin 		= tonumber(pin)
+	self.fd 		= nil 	-- value 文件描述符
+	self.stopPoll 	= nil 	-- 停止 watch 的边沿中断监听
+	self.value 		= nil 	-- 最后一次读取到的电平
 end
 
 function GPIO:close(callback)
@@ -64,6 +79,9 @@ function GPIO:close(callback)
 		return 
 	end
 
+	self:unwatch()
+	self:_closeValue()
+
 	fs.writeFile(join(self.sysFsPath, 'unexport'), self.pin, callback)
 end
 
@@ -116,16 +134,30 @@ function GPIO:read(callback)
 		callback = function() end
 	end
 
-	local name = 'gpio' .. tostring(self.pin)
-	local filename = join(self.sysFsPath, name, 'value')
-	fs.readFile(filename, function(err, data)
-		if (err) then
-			callback(err)
-			return
-		end
+	local value, err = self:readSync()
+	setImmediate(callback, err, value)
+end
 
-		callback(nil, tonumber(data))
-	end)
+-- 同步读取当前电平
+-- @return value, error
+function GPIO:readSync()
+	local fd, err = self:_openValue()
+	if (not fd) then
+		return nil, err
+	end
+
+	local data
+	data, err = uv.fs_read(fd, 8, 0)
+	if (not data) then
+		return nil, err
+	end
+
+	local value = tonumber(data:match('%d'))
+	if (value) then
+		self.value = value
+	end
+
+	return value
 end
 
 function GPIO:write(value, callback)
@@ -133,6 +165,15 @@ function GPIO:write(value, callback)
 		return 
 	end
 
+	local ret, err = self:writeSync(value)
+	if (callback) then
+		setImmediate(callback, err)
+	end
+end
+
+-- 同步设置输出电平
+-- @return true, error
+function GPIO:writeSync(value)
 	value = tonumber(value)
 	if (value) and (value ~= 0) then
 		value = 1
@@ -140,9 +181,172 @@ function GPIO:write(value, callback)
 		value = 0
 	end
 
+	local fd, err = self:_openValue()
+	if (not fd) then
+		return nil, err
+	end
+
+	local ret
+	ret, err = uv.fs_write(fd, tostring(value), 0)
+	if (not ret) then
+		return nil, err
+	end
+
+	self.value = value
+	return true
+end
+
+-- 监听电平变化
+-- @param {string} edge 'rising', 'falling' 或 'both', 默认为 'both'
+-- @param {object} options 可选
+--  - debounce {number} 消抖时间 (毫秒), 电平稳定这么长时间后才通知, 默认为 0
+-- @param {function} callback function(value), 同时会触发 'change' 事件
+function GPIO:watch(edge, options, callback)
+	if (type(options) == 'function') then
+		callback = options
+		options  = nil
+	end
+
+	options = options or {}
+	edge = edge or 'both'
+	if (edge ~= 'rising') and (edge ~= 'falling') and (edge ~= 'both') then
+		return nil, "Edge must be 'rising', 'falling' or 'both'"
+	end
+
+	self:unwatch()
+
+	local fd, err = self:_openValue()
+	if (not fd) then
+		return nil, err
+	end
+
+	-- 打开内核的边沿中断
+	local edgeFile = join(self.sysFsPath, 'gpio' .. tostring(self.pin), 'edge')
+	local ret
+	ret, err = fs.writeFileSync(edgeFile, edge)
+	if (err) then
+		return nil, err
+	end
+
+	-- 读一次以清除之前的中断状态, 并作为比较的初始值
+	local last = self:readSync()
+	local debounce = tonumber(options.debounce) or 0
+	local timer
+
+	local function notify(value)
+		if (value == nil) then
+			return
+		end
+
+		-- 只监听单个边沿时内核不会通知另一个边沿, 不能和上一次的电平比较
+		local changed = (value ~= last)
+		last = value
+		if (edge == 'both') then
+			if (not changed) then
+				return
+			end
+
+		elseif (edge == 'rising' and value ~= 1) or (edge == 'falling' and value ~= 0) then
+			return
+		end
+
+		if (callback) then
+			callback(value)
+		end
+		self:emit('change', value)
+	end
+
+	self.debounceTimer = nil
+
+	local stopPoll
+	stopPoll, err = self:_startPoll(fd, function(err)
+		if (err) then
+			self:emit('error', err)
+			return
+		end
+
+		if (debounce <= 0) then
+			notify(self:readSync())
+			return
+		end
+
+		-- 抖动期间先把数据读掉 (清除中断状态), 直到电平稳定后再比较
+		self:readSync()
+		if (not timer) then
+			timer = uv.new_timer()
+			self.debounceTimer = timer
+		end
+		uv.timer_start(timer, debounce, 0, function()
+			notify(self:readSync())
+		end)
+	end)
+
+	if (not stopPoll) then
+		return nil, err
+	end
+
+	self.stopPoll = stopPoll
+	return true
+end
+
+-- 停止监听电平变化
+function GPIO:unwatch()
+	if (self.stopPoll) then
+		self.stopPoll()
+		self.stopPoll = nil
+	end
+
+	if (self.debounceTimer) then
+		uv.timer_stop(self.debounceTimer)
+		uv.close(self.debounceTimer)
+		self.debounceTimer = nil
+	end
+end
+
+-- 监听 value 文件的边沿中断, 每次中断时调用 onEvent(err)
+-- @return 停止监听的函数, error
+function GPIO:_startPoll(fd, onEvent)
+	local poll, err = uv.new_poll(fd)
+	if (not poll) then
+		return nil, err
+	end
+
+	-- sysfs 的 value 文件总是可读的, 只有 POLLPRI 表示电平发生了变化
+	uv.poll_start(poll, 'p', onEvent)
+
+	return function()
+		uv.poll_stop(poll)
+		uv.close(poll)
+	end
+end
+
+function GPIO:_openValue()
+	if (self.fd) then
+		return self.fd
+	end
+
 	local name = 'gpio' .. tostring(self.pin)
-	local filename = path.join(self.sysFsPath, name, 'value')
-	fs.writeFile(filename, tostring(value), callback);
+	local filename = join(self.sysFsPath, name, 'value')
+
+	local flags = uv.constants.O_RDWR
+	if (uv.constants.O_NONBLOCK) then
+		flags = flags | uv.constants.O_NONBLOCK
+	end
+
+	local fd, err = uv.fs_open(filename, flags, 438) --[[ 0666 ]]
+	if (not fd) then
+		return nil, err
+	end
+
+	self.fd = fd
+	return fd
+end
+
+function GPIO:_closeValue()
+	if (self.fd) then
+		uv.fs_close(self.fd)
+		self.fd = nil
+	end
 end
 
 -------------------------------------------------------------------------------
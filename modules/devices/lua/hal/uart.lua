@@ -18,10 +18,12 @@ limitations under the License.
 --]]
 
 local fs        = require('fs')
+local uv        = require('luv')
 local bind      = require('util').bind
 
 local Writable  = require('stream').Writable
 local Readable  = require('stream').Readable
+local Duplex    = require('stream').Duplex
 
 local exports = {}
 
@@ -191,6 +193,201 @@ function ReadStream:destroy(err)
     end
 end
 
+-------------------------------------------------------------------------------
+-- UART
+
+-- 串口
+--
+-- 串口设备的文件描述符通过 uv_pipe_open 加入事件循环, 收发数据都不会占用线程池,
+-- 也不会阻塞. 串口参数 (termios) 和分帧由 lsdl.uart 实现:
+-- - delimiter: 遇到分隔符时结束一帧, 比如 '\r\n'
+-- - length: 固定长度的帧
+-- - timeout: 字节间隔超时 (毫秒), 超过这个时间没有收到新数据时结束一帧, 比如 Modbus RTU
+--
+-- 指定了分帧方式时, 'data' 事件每次返回一个完整的帧, 否则返回收到的原始数据.
+
+local luart = nil
+
+local function getUart()
+    if (not luart) then
+        luart = require('lsdl.uart')
+    end
+
+    return luart
+end
+
+local UART = Duplex:extend()
+exports.UART = UART
+
+-- @param {string} path 串口设备名称, 比如 '/dev/ttyS1'
+-- @param {object} options
+--  - baudRate {number} 波特率, 默认为 9600
+--  - dataBits {number} 数据位, 默认为 8
+--  - stopBits {number} 停止位, 默认为 1
+--  - parity {string} 'none', 'odd' 或 'even', 默认为 'none'
+--  - flowControl {boolean} 是否使用 RTS/CTS 硬件流控
+--  - fd {number} 已经打开的文件描述符 (比如伪终端的主设备), 不会修改它的参数
+--  - delimiter {string} 分隔符
+--  - length {number} 固定的帧长度
+--  - timeout {number} 字节间隔超时 (毫秒)
+--  - maxSize {number} 帧的最大长度, 默认为 4096
+function UART:initialize(path, options)
+    Duplex.initialize(self)
+
+    options = options or {}
+
+    self.path       = path
+    self.options    = options
+    self.fd         = nil
+    self._handle    = nil
+    self._reading   = false
+    self._timer     = nil
+    self.timeout    = tonumber(options.timeout)
+
+    local lsdl = getUart()
+
+    local fd, err = options.fd, nil
+    if (not fd) then
+        fd, err = lsdl.open(path, options)
+    end
+
+    if (not fd) then
+        self.destroyed = true
+        setImmediate(function()
+            self:emit('error', err)
+        end)
+        return
+    end
+
+    self.fd = fd
+    self._handle = uv.new_pipe(false)
+    uv.pipe_open(self._handle, fd)
+
+    if (options.delimiter or options.length or self.timeout) then
+        self.framer = lsdl.framer(options)
+    end
+end
+
+-- 修改串口参数
+-- @param {object} options 同 UART:initialize
+function UART:setup(options)
+    if (not self.fd) then
+        return nil, 'closed'
+    end
+
+    return getUart().setup(self.fd, options)
+end
+
+function UART:close(callback)
+    self:destroy(nil, callback)
+end
+
+function UART:destroy(exception, callback)
+    callback = callback or function() end
+    if self.destroyed == true or self._handle == nil then
+        return callback()
+    end
+
+    self.destroyed = true
+    self.readable = false
+    self.writable = false
+
+    if (self._timer) then
+        uv.close(self._timer)
+        self._timer = nil
+    end
+
+    -- 关闭 pipe 时会同时关闭文件描述符
+    self.fd = nil
+    uv.close(self._handle, function()
+        self:emit('close')
+        callback()
+    end)
+
+    if exception then
+        setImmediate(function()
+            self:emit('error', exception)
+        end)
+    end
+end
+
+function UART:pause()
+    Duplex.pause(self)
+    if (not self._handle) or (self.destroyed) then return end
+    self._reading = false
+    uv.read_stop(self._handle)
+end
+
+function UART:resume()
+    Duplex.resume(self)
+    self:_read(0)
+end
+
+function UART:_onData(data)
+    local framer = self.framer
+    if (not framer) then
+        self:push(data)
+        return
+    end
+
+    local frames = framer:push(data)
+    for i = 1, #frames do
+        self:push(frames[i])
+    end
+
+    -- 字节间隔超时
+    if (self.timeout) and (framer:size() > 0) then
+        if (not self._timer) then
+            self._timer = uv.new_timer()
+        end
+
+        uv.timer_start(self._timer, self.timeout, 0, function()
+            local frame = framer:flush()
+            if (frame) then
+                self:push(frame)
+            end
+        end)
+    end
+end
+
+function UART:_read(n)
+    if (self._reading) or (not self._handle) or (self.destroyed) then
+        return
+    end
+
+    self._reading = true
+    uv.read_start(self._handle, function(err, data)
+        if err then
+            return self:destroy(err)
+
+        elseif data then
+            self:_onData(data)
+
+        else
+            self:push(nil)
+        end
+    end)
+end
+
+function UART:_write(data, callback)
+    if (not self._handle) or (self.destroyed) then
+        return callback('closed')
+    end
+
+    uv.write(self._handle, data, function(err)
+        if err then
+            self:destroy(err)
+            return callback(err)
+        end
+        callback()
+    end)
+end
+
+-- 打开一个串口
+function exports.open(path, options)
+    return UART:new(path, options)
+end
+
 function fs.createWriteStream(path, options)
     return WriteStream:new(path, options)
 end
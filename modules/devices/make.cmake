@@ -11,6 +11,8 @@ set(SOURCES
   ${MODULE_DIR}/src/i2c.c
   ${MODULE_DIR}/src/i2c_lua.c
   ${MODULE_DIR}/src/sdl_lua.c
+  ${MODULE_DIR}/src/uart.c
+  ${MODULE_DIR}/src/uart_lua.c
 )
 
 if (WIN32)
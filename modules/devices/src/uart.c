@@ -1,86 +1,272 @@
-#include <errno.h>
-#include <fcntl.h>
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // posix_openpt, cfmakeraw
+#endif
+
 #include <termios.h>
-#include <unistd.h>
 
-static unsigned baud_to_constant(unsigned baudRate)
+#include "common.h"
+#include "uart.h"
+
+static speed_t uart_baud_rate(int baudRate)
+{
+	switch (baudRate) {
+	case 50: 	 return B50;
+	case 75: 	 return B75;
+	case 110: 	 return B110;
+	case 134: 	 return B134;
+	case 150: 	 return B150;
+	case 200: 	 return B200;
+	case 300: 	 return B300;
+	case 600: 	 return B600;
+	case 1200: 	 return B1200;
+	case 1800: 	 return B1800;
+	case 2400: 	 return B2400;
+	case 4800: 	 return B4800;
+	case 9600: 	 return B9600;
+	case 19200:  return B19200;
+	case 38400:  return B38400;
+	case 57600:  return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	}
+
+	return B0;
+}
+
+static int uart_data_bits(int dataBits)
+{
+	switch (dataBits) {
+	case 5: return CS5;
+	case 6: return CS6;
+	case 7: return CS7;
+	case 8: return CS8;
+	}
+
+	return -1;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Name:	  uart_setup 
+// Function:  配置串口为 raw 模式, 读操作不阻塞 (VMIN = 0, VTIME = 0)
+// Return:    0 表示成功, 失败返回 -1 并设置 errno
+//--------------------------------------------------------------------------------------------------
+int uart_setup(int fd, const uart_options_t* options)
+{
+	struct termios tio;
+	if (tcgetattr(fd, &tio) < 0) {
+		return -1;
+	}
+
+	speed_t speed = uart_baud_rate(options->baudRate);
+	int dataBits  = uart_data_bits(options->dataBits);
+	if (speed == B0 || dataBits < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+
+	tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB);
+	tio.c_cflag |= CLOCAL | CREAD | dataBits;
+
+	if (options->stopBits == 2) {
+		tio.c_cflag |= CSTOPB;
+	}
+
+	if (options->parity == UART_PARITY_ODD) {
+		tio.c_cflag |= PARENB | PARODD;
+		tio.c_iflag |= INPCK;
+
+	} else if (options->parity == UART_PARITY_EVEN) {
+		tio.c_cflag |= PARENB;
+		tio.c_iflag |= INPCK;
+	}
+
+#ifdef CRTSCTS
+	tio.c_cflag &= ~CRTSCTS;
+	if (options->flowControl) {
+		tio.c_cflag |= CRTSCTS;
+	}
+#endif
+
+	tio.c_cc[VMIN]  = 0;
+	tio.c_cc[VTIME] = 0;
+
+	tcflush(fd, TCIOFLUSH);
+	return tcsetattr(fd, TCSANOW, &tio);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Name:	  uart_open 
+// Function:  打开并配置串口, 返回的文件描述符是非阻塞的
+// Return:    文件描述符, 失败返回 -1 并设置 errno
+//--------------------------------------------------------------------------------------------------
+int uart_open(const char *deviceName, const uart_options_t* options)
+{
+	if (deviceName == NULL || *deviceName == '\0') {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int fd = open(deviceName, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (uart_setup(fd, options) < 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+
+	return fd;
+}
+
+int uart_close(int fd)
+{
+	if (fd < 0) {
+		return -1;
+	}
+
+	return close(fd);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Name:	  uart_openpty 
+// Function:  创建一对伪终端, 用于在没有串口设备时测试, slaveName 返回从设备的路径
+// Return:    主设备的文件描述符, 失败返回 -1
+//--------------------------------------------------------------------------------------------------
+int uart_openpty(char* slaveName, size_t nameSize)
 {
-    switch (baudRate)
-    {
-    case 50:
-        return B50;
-    case 75:
-        return B75;
-    case 110:
-        return B110;
-    case 134:
-        return B134;
-    case 150:
-        return B150;
-    case 200:
-        return B200;
-    case 300:
-        return B300;
-    case 600:
-        return B600;
-    case 1200:
-        return B1200;
-    case 1800:
-        return B1800;
-    case 2400:
-        return B2400;
-    case 4800:
-        return B4800;
-    case 9600:
-        return B9600;
-    case 19200:
-        return B19200;
-    case 38400:
-        return B38400;
-    case 57600:
-        return B57600;
-    case 115200:
-        return B115200;
-    case 230400:
-        return B230400;
-    }
-    return B0;
+	int fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (grantpt(fd) < 0 || unlockpt(fd) < 0) {
+		goto error;
+	}
+
+	const char* name = ptsname(fd);
+	if (name == NULL || strlen(name) >= nameSize) {
+		goto error;
+	}
+
+	strcpy(slaveName, name);
+	return fd;
+
+error:
+	close(fd);
+	return -1;
 }
 
-static int databits_to_constant(int dataBits)
+///////////////////////////////////////////////////////////////////////////////
+// framer
+
+void uart_framer_init(uart_framer_t* framer)
 {
-    switch (dataBits)
-    {
-    case 8:
-        return CS8;
-    case 7:
-        return CS7;
-    case 6:
-        return CS6;
-    case 5:
-        return CS5;
-    }
-    return -1;
+	memset(framer, 0, sizeof(*framer));
+	framer->maxSize = UART_FRAMER_MAX_SIZE;
 }
 
-int lnode_uart_open()
+void uart_framer_free(uart_framer_t* framer)
 {
-    int fd = open(filename, O_RDWR | O_NOCTTY | O_NDELAY);
-    if (fd < 0)
-    {
-        return false;
-    }
-
-    struct termios options;
-    tcgetattr(fd, &options);
-    options.c_cflag = CLOCAL | CREAD;
-    options.c_cflag |= (tcflag_t)baud_to_constant(uart->baud_rate);
-    options.c_cflag |= (tcflag_t)databits_to_constant(uart->data_bits);
-    options.c_iflag = IGNPAR;
-    options.c_oflag = 0;
-    options.c_lflag = 0;
-    tcflush(fd, TCIFLUSH);
-    tcsetattr(fd, TCSANOW, &options);
-
-    return 0;
+	if (framer->buffer) {
+		free(framer->buffer);
+	}
+
+	framer->buffer 	 = NULL;
+	framer->size 	 = 0;
+	framer->capacity = 0;
+}
+
+int uart_framer_append(uart_framer_t* framer, const char* data, size_t size)
+{
+	size_t required = framer->size + size;
+	if (required > framer->capacity) {
+		size_t capacity = framer->capacity ? framer->capacity : 256;
+		while (capacity < required) {
+			capacity *= 2;
+		}
+
+		char* buffer = realloc(framer->buffer, capacity);
+		if (buffer == NULL) {
+			return -1;
+		}
+
+		framer->buffer   = buffer;
+		framer->capacity = capacity;
+	}
+
+	memcpy(framer->buffer + framer->size, data, size);
+	framer->size = required;
+	return 0;
+}
+
+// 查找缓存中的第一个完整的帧
+// @return 1 表示找到, frameSize 返回这个帧的长度
+int uart_framer_next(uart_framer_t* framer, size_t* frameSize)
+{
+	size_t size = framer->size;
+	if (size == 0) {
+		return 0;
+	}
+
+	if (framer->delimiterSize > 0) {
+		size_t delimiterSize = framer->delimiterSize;
+		const char* buffer = framer->buffer;
+		const char first = framer->delimiter[0];
+
+		size_t i;
+		for (i = 0; i + delimiterSize <= size; i++) {
+			if (buffer[i] != first) {
+				const char* p = memchr(buffer + i, first, size - i);
+				if (p == NULL) {
+					break;
+				}
+				i = p - buffer;
+				if (i + delimiterSize > size) {
+					break;
+				}
+			}
+
+			if (memcmp(buffer + i, framer->delimiter, delimiterSize) == 0) {
+				*frameSize = i + delimiterSize;
+				if (framer->maxSize > 0 && *frameSize > framer->maxSize) {
+					*frameSize = framer->maxSize;
+				}
+				return 1;
+			}
+		}
+
+	} else if (framer->length > 0) {
+		if (size >= framer->length) {
+			*frameSize = framer->length;
+			return 1;
+		}
+
+		return 0;
+	}
+
+	// 超过最大长度, 强制结束一帧
+	if (framer->maxSize > 0 && size >= framer->maxSize) {
+		*frameSize = framer->maxSize;
+		return 1;
+	}
+
+	return 0;
+}
+
+void uart_framer_consume(uart_framer_t* framer, size_t size)
+{
+	if (size >= framer->size) {
+		framer->size = 0;
+		return;
+	}
+
+	memmove(framer->buffer, framer->buffer + size, framer->size - size);
+	framer->size -= size;
 }
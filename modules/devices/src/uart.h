@@ -0,0 +1,54 @@
+#ifndef _VISION_UART_H
+#define _VISION_UART_H
+
+#include "common.h"
+
+//=== Preprocessing directives (#define) 
+
+#define UART_PARITY_NONE	0
+#define UART_PARITY_ODD		1
+#define UART_PARITY_EVEN	2
+
+#define UART_FRAMER_MAX_SIZE	4096
+
+//=== Type definitions
+
+typedef struct uart_options_s
+{
+	int baudRate;	// 9600, 115200, ...
+	int dataBits;	// 5 ~ 8
+	int stopBits;	// 1 or 2
+	int parity;		// UART_PARITY_XXX
+	int flowControl;// 1: RTS/CTS
+} uart_options_t;
+
+// 把串口收到的字节流切分为帧
+// - delimiter: 遇到分隔符时结束一帧 (帧包含分隔符)
+// - length: 每 length 个字节为一帧
+// - 都没有指定时由调用者在字节间隔超时后调用 uart_framer_flush 结束一帧
+typedef struct uart_framer_s
+{
+	char*  buffer;
+	size_t size;
+	size_t capacity;
+	size_t maxSize;		// 缓存的最大长度, 超过时强制结束一帧
+
+	char   delimiter[16];
+	size_t delimiterSize;
+	size_t length;
+} uart_framer_t;
+
+//=== Global function prototypes 
+
+int uart_open     (const char *deviceName, const uart_options_t* options);
+int uart_setup    (int fd, const uart_options_t* options);
+int uart_close    (int fd);
+int uart_openpty  (char* slaveName, size_t nameSize);
+
+void uart_framer_init   (uart_framer_t* framer);
+void uart_framer_free   (uart_framer_t* framer);
+int  uart_framer_append (uart_framer_t* framer, const char* data, size_t size);
+int  uart_framer_next   (uart_framer_t* framer, size_t* frameSize);
+void uart_framer_consume(uart_framer_t* framer, size_t size);
+
+#endif // _VISION_UART_H
@@ -0,0 +1,272 @@
+#include "common.h"
+
+#include "lua.h"
+#include "uart.h"
+#include "lauxlib.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// UART device
+
+static int sdl_uart_error(lua_State* L)
+{
+	lua_pushnil(L);
+	lua_pushstring(L, strerror(errno));
+	return 2;
+}
+
+// options: { baudRate = 9600, dataBits = 8, stopBits = 1, parity = 'none', flowControl = false }
+static void sdl_uart_check_options(lua_State* L, int index, uart_options_t* options)
+{
+	options->baudRate 	 = 9600;
+	options->dataBits 	 = 8;
+	options->stopBits 	 = 1;
+	options->parity 	 = UART_PARITY_NONE;
+	options->flowControl = 0;
+
+	if (lua_isnoneornil(L, index)) {
+		return;
+	}
+
+	luaL_checktype(L, index, LUA_TTABLE);
+
+	lua_getfield(L, index, "baudRate");
+	options->baudRate = luaL_optinteger(L, -1, options->baudRate);
+	lua_pop(L, 1);
+
+	lua_getfield(L, index, "dataBits");
+	options->dataBits = luaL_optinteger(L, -1, options->dataBits);
+	lua_pop(L, 1);
+
+	lua_getfield(L, index, "stopBits");
+	options->stopBits = luaL_optinteger(L, -1, options->stopBits);
+	lua_pop(L, 1);
+
+	lua_getfield(L, index, "parity");
+	const char* parity = luaL_optstring(L, -1, "none");
+	if (strcmp(parity, "odd") == 0 || strcmp(parity, "O") == 0) {
+		options->parity = UART_PARITY_ODD;
+
+	} else if (strcmp(parity, "even") == 0 || strcmp(parity, "E") == 0) {
+		options->parity = UART_PARITY_EVEN;
+	}
+	lua_pop(L, 1);
+
+	lua_getfield(L, index, "flowControl");
+	options->flowControl = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+}
+
+static int sdl_uart_open(lua_State* L)
+{
+	const char* deviceName = luaL_checkstring(L, 1);
+
+	uart_options_t options;
+	sdl_uart_check_options(L, 2, &options);
+
+	int fd = uart_open(deviceName, &options);
+	if (fd < 0) {
+		return sdl_uart_error(L);
+	}
+
+	lua_pushinteger(L, fd);
+	return 1;
+}
+
+static int sdl_uart_setup(lua_State* L)
+{
+	int fd = luaL_checkinteger(L, 1);
+
+	uart_options_t options;
+	sdl_uart_check_options(L, 2, &options);
+
+	if (uart_setup(fd, &options) < 0) {
+		return sdl_uart_error(L);
+	}
+
+	lua_pushinteger(L, 0);
+	return 1;
+}
+
+static int sdl_uart_close(lua_State* L)
+{
+	int fd = luaL_checkinteger(L, 1);
+	lua_pushinteger(L, uart_close(fd));
+	return 1;
+}
+
+static int sdl_uart_openpty(lua_State* L)
+{
+	char slaveName[256];
+	int fd = uart_openpty(slaveName, sizeof(slaveName));
+	if (fd < 0) {
+		return sdl_uart_error(L);
+	}
+
+	lua_pushinteger(L, fd);
+	lua_pushstring(L, slaveName);
+	return 2;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Framer
+
+#define LUV_UART_FRAMER "sdl_uart_framer_t"
+
+static uart_framer_t* sdl_uart_framer_check(lua_State* L, int index)
+{
+	return luaL_checkudata(L, index, LUV_UART_FRAMER);
+}
+
+// framer(options)
+// options: { delimiter = '\r\n', length = 8, maxSize = 4096 }
+static int sdl_uart_framer_new(lua_State* L)
+{
+	uart_framer_t* framer = lua_newuserdata(L, sizeof(*framer));
+	uart_framer_init(framer);
+	luaL_getmetatable(L, LUV_UART_FRAMER);
+	lua_setmetatable(L, -2);
+
+	if (lua_istable(L, 1)) {
+		size_t delimiterSize = 0;
+		lua_getfield(L, 1, "delimiter");
+		const char* delimiter = luaL_optlstring(L, -1, NULL, &delimiterSize);
+		if (delimiter && delimiterSize > 0) {
+			luaL_argcheck(L, delimiterSize <= sizeof(framer->delimiter), 1, "delimiter too long");
+			memcpy(framer->delimiter, delimiter, delimiterSize);
+			framer->delimiterSize = delimiterSize;
+		}
+		lua_pop(L, 1);
+
+		lua_getfield(L, 1, "length");
+		framer->length = luaL_optinteger(L, -1, 0);
+		lua_pop(L, 1);
+
+		lua_getfield(L, 1, "maxSize");
+		framer->maxSize = luaL_optinteger(L, -1, UART_FRAMER_MAX_SIZE);
+		lua_pop(L, 1);
+	}
+
+	return 1;
+}
+
+// 添加收到的数据, 返回其中所有完整的帧 (数组), 不完整的部分继续缓存
+static int sdl_uart_framer_push(lua_State* L)
+{
+	uart_framer_t* framer = sdl_uart_framer_check(L, 1);
+	size_t dataSize = 0;
+	const char* data = luaL_checklstring(L, 2, &dataSize);
+
+	if (uart_framer_append(framer, data, dataSize) < 0) {
+		return luaL_error(L, "not enough memory");
+	}
+
+	lua_newtable(L);
+
+	size_t frameSize = 0;
+	size_t offset = 0;
+	int count = 0;
+
+	// 先找出所有的帧, 最后一次性移除
+	while (offset < framer->size) {
+		uart_framer_t view = *framer;
+		view.buffer += offset;
+		view.size   -= offset;
+		if (!uart_framer_next(&view, &frameSize)) {
+			break;
+		}
+
+		lua_pushlstring(L, framer->buffer + offset, frameSize);
+		lua_rawseti(L, -2, ++count);
+		offset += frameSize;
+	}
+
+	uart_framer_consume(framer, offset);
+	return 1;
+}
+
+// 返回并清空缓存中剩下的数据 (比如字节间隔超时后), 没有数据时返回 nil
+static int sdl_uart_framer_flush(lua_State* L)
+{
+	uart_framer_t* framer = sdl_uart_framer_check(L, 1);
+	if (framer->size == 0) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	lua_pushlstring(L, framer->buffer, framer->size);
+	framer->size = 0;
+	return 1;
+}
+
+static int sdl_uart_framer_size(lua_State* L)
+{
+	uart_framer_t* framer = sdl_uart_framer_check(L, 1);
+	lua_pushinteger(L, framer->size);
+	return 1;
+}
+
+static int sdl_uart_framer_reset(lua_State* L)
+{
+	uart_framer_t* framer = sdl_uart_framer_check(L, 1);
+	framer->size = 0;
+	return 0;
+}
+
+static int sdl_uart_framer_gc(lua_State* L)
+{
+	uart_framer_t* framer = sdl_uart_framer_check(L, 1);
+	uart_framer_free(framer);
+	return 0;
+}
+
+static int sdl_uart_framer_tostring(lua_State* L) 
+{
+	uart_framer_t* framer = sdl_uart_framer_check(L, 1);
+    lua_pushfstring(L, "%s: %p", LUV_UART_FRAMER, framer);
+  	return 1;
+}
+
+static const struct luaL_Reg sdl_uart_framer_methods[] = {
+	{ "flush",	sdl_uart_framer_flush },
+	{ "push",	sdl_uart_framer_push  },
+	{ "reset",	sdl_uart_framer_reset },
+	{ "size",	sdl_uart_framer_size  },
+	{ NULL, NULL },
+};
+
+static int sdl_uart_init(lua_State* L) 
+{
+    luaL_newmetatable(L, LUV_UART_FRAMER);
+
+    luaL_newlib(L, sdl_uart_framer_methods);
+    lua_setfield(L, -2, "__index");
+
+    lua_pushcfunction(L, sdl_uart_framer_gc);
+    lua_setfield(L, -2, "__gc");
+
+    lua_pushcfunction(L, sdl_uart_framer_tostring);
+    lua_setfield(L, -2, "__tostring");   
+
+    lua_pop(L, 1);
+
+    return 0;
+}
+
+static const luaL_Reg lsdl_uart_functions[] = {
+	{ "close",   sdl_uart_close      },
+	{ "framer",  sdl_uart_framer_new },
+	{ "open",    sdl_uart_open       },
+	{ "openpty", sdl_uart_openpty    },
+	{ "setup",   sdl_uart_setup      },
+
+	{ NULL, NULL }
+};
+
+LUALIB_API int luaopen_lsdl_uart(lua_State *L) 
+{
+	luaL_newlib(L, lsdl_uart_functions);
+
+	sdl_uart_init(L);
+
+	return 1;
+}
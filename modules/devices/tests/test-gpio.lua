@@ -0,0 +1,144 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local fs   = require('fs')
+local path = require('path')
+local gpio = require('devices/hal/gpio')
+
+local tap = require('ext/tap')
+local test = tap.test
+
+-- 模拟的 sysfs 目录, value 和 edge 都是普通文件
+local root = path.join(os.tmpdir, 'test-gpio-sysfs')
+
+local function setup()
+    os.execute('rm -rf ' .. root)
+    for _, name in ipairs({ 'gpio5', 'gpio6' }) do
+        fs.mkdirpSync(path.join(root, name))
+        fs.writeFileSync(path.join(root, name, 'value'), '0\n')
+        fs.writeFileSync(path.join(root, name, 'edge'), 'none\n')
+    end
+end
+
+-- 普通文件不能使用 uv_poll, 由测试代替内核触发边沿中断
+local FakeGPIO = gpio.GPIO:extend()
+
+function FakeGPIO:_startPoll(fd, onEvent)
+    self.onEvent = onEvent
+    return function()
+        self.onEvent = nil
+    end
+end
+
+-- 修改 value 文件的电平, 模拟一次边沿中断
+local pin6
+
+local function trigger(value)
+    fs.writeFileSync(path.join(root, 'gpio6', 'value'), value .. '\n')
+    if (pin6.onEvent) then
+        pin6.onEvent()
+    end
+end
+
+test("gpio read and write", function(expect)
+    setup()
+
+    local pin = gpio(5, { sysFsPath = root })
+    assert(pin:readSync() == 0)
+    assert(pin:writeSync(1))
+    assert(pin:readSync() == 1)
+
+    -- value 文件一直保持打开
+    local fd = pin.fd
+    assert(fd)
+
+    -- 普通文件不支持 poll, watch 返回错误
+    local ret, err = pin:watch('both')
+    assert(not ret and err)
+    assert(pin.stopPoll == nil)
+
+    pin:write(0, expect(function(err)
+        assert(not err, err)
+        pin:read(expect(function(err, value)
+            assert(not err, err)
+            assert(value == 0)
+            assert(pin.fd == fd)
+            assert(fs.readFileSync(path.join(root, 'gpio5', 'value')):sub(1, 1) == '0')
+
+            pin:close()
+            assert(pin.fd == nil)
+        end))
+    end))
+end)
+
+test("gpio watch", function(expect)
+    setup()
+
+    local pin = FakeGPIO:new(6, { sysFsPath = root })
+    pin6 = pin
+
+    local values = {}
+    assert(pin:watch('both', function(value)
+        values[#values + 1] = value
+    end))
+    assert(fs.readFileSync(path.join(root, 'gpio6', 'edge')) == 'both')
+
+    trigger(1)
+    setTimeout(20, function() trigger(0) end)
+    setTimeout(40, function() trigger(0) end) -- 电平没有变化, 不会通知
+
+    setTimeout(80, expect(function()
+        assert(#values == 2)
+        assert(values[1] == 1 and values[2] == 0)
+
+        pin:close()
+        assert(pin.onEvent == nil)
+    end))
+end)
+
+test("gpio watch rising with debounce", function(expect)
+    setup()
+
+    local pin = FakeGPIO:new(6, { sysFsPath = root })
+    pin6 = pin
+
+    local values = {}
+    pin:on('change', function(value)
+        values[#values + 1] = value
+    end)
+
+    assert(pin:watch('rising', { debounce = 30 }))
+
+    -- 抖动: 只有最后稳定的电平会被通知
+    trigger(1)
+    setTimeout(5, function() trigger(0) end)
+    setTimeout(10, function() trigger(1) end)
+
+    setTimeout(80, function()
+        trigger(0) -- 下降沿, 不会通知
+    end)
+
+    setTimeout(150, expect(function()
+        assert(#values == 1)
+        assert(values[1] == 1)
+
+        pin:close()
+        os.execute('rm -rf ' .. root)
+    end))
+end)
+
+tap.run()
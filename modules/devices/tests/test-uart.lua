@@ -0,0 +1,134 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+
+-- 通过一对伪终端测试串口, 需要编译 lsdl (BUILD_DEVICES)
+local ok, luart = pcall(require, 'lsdl.uart')
+if (not ok) then
+    print('lsdl.uart not found, skip')
+    return
+end
+
+local uart = require('devices/hal/uart')
+
+local tap = require('ext/tap')
+local test = tap.test
+
+-- 返回串口 (伪终端的从设备) 和另一端 (主设备)
+local function openPair(options)
+    local fd, name = luart.openpty()
+    assert(fd, name)
+
+    local port = uart.open(name, options)
+    local peer = uart.open(nil, { fd = fd })
+    return port, peer
+end
+
+test("uart framer", function()
+    local framer = luart.framer({ delimiter = '\r\n' })
+    local frames = framer:push('ab\r')
+    assert(#frames == 0 and framer:size() == 3)
+
+    frames = framer:push('\ncd\r\nef')
+    assert(#frames == 2)
+    assert(frames[1] == 'ab\r\n' and frames[2] == 'cd\r\n')
+    assert(framer:flush() == 'ef')
+    assert(framer:flush() == nil)
+
+    framer = luart.framer({ length = 4 })
+    frames = framer:push('1234567')
+    assert(#frames == 1 and frames[1] == '1234')
+    frames = framer:push('8\0\0')
+    assert(#frames == 1 and frames[1] == '5678')
+    assert(framer:size() == 2)
+
+    -- 超过最大长度时强制结束
+    framer = luart.framer({ delimiter = '\n', maxSize = 4 })
+    frames = framer:push('abcdef\n')
+    assert(#frames == 2 and frames[1] == 'abcd' and frames[2] == 'ef\n')
+end)
+
+test("uart read and write", function(expect)
+    local port, peer = openPair({ baudRate = 115200 })
+
+    port:on('data', expect(function(data)
+        assert(data == 'hello')
+
+        port:write('world')
+    end))
+
+    peer:on('data', expect(function(data)
+        assert(data == 'world')
+
+        port:close()
+        peer:close()
+    end))
+
+    peer:write('hello')
+end)
+
+test("uart delimiter", function(expect)
+    local port, peer = openPair({ delimiter = '\n' })
+
+    local lines = {}
+    port:on('data', function(line)
+        lines[#lines + 1] = line
+    end)
+
+    peer:write('line1\nli')
+    setTimeout(20, function() peer:write('ne2\nline') end)
+
+    setTimeout(60, expect(function()
+        assert(#lines == 2)
+        assert(lines[1] == 'line1\n' and lines[2] == 'line2\n')
+
+        port:close()
+        peer:close()
+    end))
+end)
+
+test("uart inter-byte timeout", function(expect)
+    local port, peer = openPair({ timeout = 20 })
+
+    local frames = {}
+    port:on('data', function(frame)
+        frames[#frames + 1] = frame
+    end)
+
+    -- 间隔小于超时的数据属于同一帧
+    peer:write('\1\3')
+    setTimeout(5, function() peer:write('\0\0\0\1') end)
+    setTimeout(60, function() peer:write('\2\3') end)
+
+    setTimeout(120, expect(function()
+        assert(#frames == 2)
+        assert(frames[1] == '\1\3\0\0\0\1')
+        assert(frames[2] == '\2\3')
+
+        port:close()
+        peer:close()
+    end))
+end)
+
+test("uart open error", function(expect)
+    local port = uart.open('/dev/not-exists-tty')
+    port:on('error', expect(function(err)
+        assert(err)
+    end))
+end)
+
+tap.run()
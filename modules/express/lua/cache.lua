@@ -0,0 +1,344 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local core  = require('core')
+local fs    = require('fs')
+local path  = require('path')
+local uv    = require('luv')
+local zlib  = require('zlib')
+local mime  = require('express/mime')
+
+-------------------------------------------------------------------------------
+-- 静态文件缓存
+--
+-- 按 LRU 保存小文件的内容, 以及第一次需要时生成的 gzip 压缩后的内容.
+-- 通过 fs_event 监视文件所在的目录, 文件被修改或删除后立即从缓存中删除;
+-- 不支持 fs_event 时每次都通过 stat 比较文件的修改时间和长度.
+
+local exports = {}
+
+local MAX_CACHE_SIZE = 4 * 1024 * 1024
+local MAX_FILE_SIZE  = 512 * 1024
+local MIN_GZIP_SIZE  = 256
+
+local isCompressible = mime.isCompressible
+
+local function getContentType(filename)
+    return mime[filename:lower():match("[^.]*$")] or mime.default
+end
+
+-------------------------------------------------------------------------------
+-- CacheEntry
+
+local CacheEntry = core.Object:extend()
+exports.CacheEntry = CacheEntry
+
+function CacheEntry:initialize(filename, statInfo, data)
+    local mtime = statInfo.mtime.sec
+
+    self.filename = filename
+    self.statInfo = statInfo
+    self.data = data
+    self.size = #data
+    self.mtime = mtime
+    self.contentType = getContentType(filename)
+    self.etag = string.format('"%x-%x"', #data, mtime)
+    self.lastModified = os.date("!%a, %d %b %Y %H:%M:%S GMT", mtime)
+    self.gzip = nil -- gzip 压缩后的内容, false 表示不需要压缩
+    self.newer = nil
+    self.older = nil
+end
+
+-- 返回 gzip 压缩后的内容, 只压缩一次; 不适合压缩时返回 nil
+function CacheEntry:getGzipData()
+    local gzip = self.gzip
+    if (gzip ~= nil) then
+        return gzip or nil
+    end
+
+    gzip = false
+    if (self.size >= MIN_GZIP_SIZE) and isCompressible(self.contentType) then
+        local data = zlib.gzipSync(self.data)
+        if (#data < self.size) then
+            gzip = data
+        end
+    end
+
+    self.gzip = gzip
+    return gzip or nil
+end
+
+function CacheEntry:getMemorySize()
+    return self.size + (self.gzip and #self.gzip or 0)
+end
+
+-------------------------------------------------------------------------------
+-- FileCache
+
+local FileCache = core.Object:extend()
+exports.FileCache = FileCache
+
+-- @param {object} options
+--  - maxSize {number} 缓存的最大长度, 默认为 4M
+--  - maxFileSize {number} 只缓存不超过这个长度的文件, 默认为 512K
+--  - watch {boolean} 是否通过 fs_event 监视文件, 默认为 true
+function FileCache:initialize(options)
+    options = options or {}
+
+    self.maxSize = options.maxSize or MAX_CACHE_SIZE
+    self.maxFileSize = options.maxFileSize or MAX_FILE_SIZE
+    self.watch = (options.watch ~= false)
+
+    self.entries = {}   -- filename: CacheEntry
+    self.newest = nil   -- LRU 链表, 最近使用的在前面
+    self.oldest = nil
+    self.size = 0
+    self.count = 0
+    self.pending = {}   -- filename: { callbacks }, 正在读取的文件
+    self.watchers = {}  -- dirname: { handle, count }
+end
+
+function FileCache:_unlink(entry)
+    local newer, older = entry.newer, entry.older
+    if (newer) then newer.older = older else self.newest = older end
+    if (older) then older.newer = newer else self.oldest = newer end
+    entry.newer = nil
+    entry.older = nil
+end
+
+function FileCache:_pushFront(entry)
+    local newest = self.newest
+    entry.older = newest
+    entry.newer = nil
+    if (newest) then newest.newer = entry else self.oldest = entry end
+    self.newest = entry
+end
+
+function FileCache:_touch(entry)
+    if (self.newest ~= entry) then
+        self:_unlink(entry)
+        self:_pushFront(entry)
+    end
+end
+
+function FileCache:_unwatch(dirname)
+    local watcher = self.watchers[dirname]
+    if (not watcher) then
+        return
+    end
+
+    watcher.count = watcher.count - 1
+    if (watcher.count <= 0) then
+        self.watchers[dirname] = nil
+        if (watcher.handle) then
+            uv.close(watcher.handle)
+        end
+    end
+end
+
+-- 监视文件所在的目录并增加引用计数, 不支持监视时返回 false
+function FileCache:_watch(dirname)
+    local watcher = self.watchers[dirname]
+    if (watcher) then
+        watcher.count = watcher.count + 1
+        return watcher.handle ~= false
+    end
+
+    local handle = self.watch and uv.new_fs_event()
+    if (handle) then
+        local ret = uv.fs_event_start(handle, dirname, {}, function(err, name)
+            if (err) or (not name) then
+                self:_removeDir(dirname)
+                return
+            end
+
+            local filename = path.join(dirname, name)
+            local pending = self.pending[filename]
+            if (pending) then
+                pending.changed = true
+            end
+            self:remove(filename)
+        end)
+
+        if (ret) then
+            uv.unref(handle) -- 不影响事件循环的退出
+        else
+            uv.close(handle)
+            handle = false
+        end
+    end
+
+    self.watchers[dirname] = { handle = handle or false, count = 1 }
+    return handle and true or false
+end
+
+function FileCache:_removeDir(dirname)
+    for filename, entry in pairs(self.entries) do
+        if (entry.dirname == dirname) then
+            self:remove(filename)
+        end
+    end
+
+    for filename, pending in pairs(self.pending) do
+        if (path.dirname(filename) == dirname) then
+            pending.changed = true
+        end
+    end
+end
+
+function FileCache:_add(entry)
+    local size = entry:getMemorySize()
+    if (size > self.maxFileSize) or (size > self.maxSize) then
+        return
+    end
+
+    self:remove(entry.filename)
+
+    local dirname = path.dirname(entry.filename)
+    entry.dirname = dirname
+    entry.watched = self:_watch(dirname)
+
+    self.entries[entry.filename] = entry
+    self.size = self.size + size
+    self.count = self.count + 1
+    self:_pushFront(entry)
+    self:_trim()
+end
+
+-- 删除最久没有使用的文件, 直到不超过 maxSize
+function FileCache:_trim()
+    while (self.size > self.maxSize) and (self.oldest) do
+        self:remove(self.oldest.filename)
+    end
+end
+
+-- 从缓存中删除指定的文件
+function FileCache:remove(filename)
+    local entry = self.entries[filename]
+    if (not entry) then
+        return
+    end
+
+    self.entries[filename] = nil
+    self.size = self.size - entry:getMemorySize()
+    self.count = self.count - 1
+    self:_unlink(entry)
+    self:_unwatch(entry.dirname)
+end
+
+-- 生成 gzip 内容后更新缓存的长度
+function FileCache:getGzipData(entry)
+    if (entry.gzip ~= nil) then
+        return entry.gzip or nil
+    end
+
+    local data = entry:getGzipData()
+    if (data) and (self.entries[entry.filename] == entry) then
+        self.size = self.size + #data
+        self:_trim()
+    end
+
+    return data
+end
+
+-- 读取指定的文件
+-- @param {string} filename
+-- @param {function} callback `function(err, statInfo, entry)`,
+--  文件不适合缓存 (比如目录或大文件) 时 entry 为 nil
+function FileCache:get(filename, callback)
+    local entry = self.entries[filename]
+    if (entry) and (entry.watched) then
+        self:_touch(entry)
+        callback(nil, entry.statInfo, entry)
+        return
+    end
+
+    -- 同一个文件同时只读取一次
+    local pending = self.pending[filename]
+    if (pending) then
+        table.insert(pending, callback)
+        return
+    end
+
+    pending = { callback }
+    self.pending[filename] = pending
+
+    -- 在 stat 之前开始监视, 避免漏掉读取过程中发生的修改
+    local dirname = path.dirname(filename)
+    self:_watch(dirname)
+
+    local function done(err, statInfo, result)
+        self.pending[filename] = nil
+        self:_unwatch(dirname)
+
+        for _, func in ipairs(pending) do
+            func(err, statInfo, result)
+        end
+    end
+
+    fs.stat(filename, function(err, statInfo)
+        if (err) or (statInfo.type ~= 'file') then
+            self:remove(filename)
+            return done(err, statInfo)
+        end
+
+        -- 没有监视时通过修改时间和长度判断文件是否已经改变
+        entry = self.entries[filename]
+        if (entry) and (entry.mtime == statInfo.mtime.sec) and (entry.size == statInfo.size) then
+            self:_touch(entry)
+            return done(nil, entry.statInfo, entry)
+        end
+
+        if (statInfo.size > self.maxFileSize) then
+            self:remove(filename)
+            return done(nil, statInfo)
+        end
+
+        fs.readFile(filename, function(err, data)
+            if (err) or (not data) then
+                return done(err or 'ENOENT: no such file', statInfo)
+            end
+
+            -- 读取过程中文件被修改了, 这次的内容不缓存
+            entry = CacheEntry:new(filename, statInfo, data)
+            if (not pending.changed) then
+                self:_add(entry)
+            end
+            done(nil, statInfo, entry)
+        end)
+    end)
+end
+
+-- 清空缓存并停止监视
+function FileCache:clear()
+    for filename in pairs(self.entries) do
+        self:remove(filename)
+    end
+
+    for dirname, watcher in pairs(self.watchers) do
+        if (watcher.handle) then
+            uv.close(watcher.handle)
+        end
+        self.watchers[dirname] = nil
+    end
+end
+
+function exports.createCache(options)
+    return FileCache:new(options)
+end
+
+return exports
@@ -23,8 +23,10 @@ local url 	= require('url')
 local fs 	= require('fs')
 local path 	= require('path')
 local json  = require('json')
+local zlib  = require('zlib')
 local mime 	= require('express/mime')
-local formdata = require('express/formdata')
+local multipart = require('express/multipart')
+local cache     = require('express/cache')
 
 local querystring  = require('querystring')
 
@@ -34,6 +36,16 @@ local IncomingMessage = http.IncomingMessage
 local exports = { }
 local IncomingCounter = 0
 
+local MAX_BODY_SIZE   = 32 * 1024 * 1024
+local MAX_FIELD_SIZE  = 1024 * 1024
+local MAX_FILE_MEMORY = 8 * 1024 * 1024
+
+local MAX_MIDDLEWARE_CACHE = 256
+
+local COMPRESSION_THRESHOLD = 1024
+
+local uploadCounter = 0
+
 function exports.checkHttpSessions()
     local now = Date.now()
     local httpSessions = exports.httpSessions
@@ -132,92 +144,273 @@ function IncomingMessage:get(field)
     end
 end
 
-function IncomingMessage:readBody(callback)
-    if (self.body ~= nil) then
-        return
+-- 接收 multipart/form-data 格式的消息体
+-- 普通字段保存在 self.body 中, 文件保存在 self.files 中, 上传的文件:
+-- - 指定了 options.onFile 时, 数据直接交给 onFile(file, data), 结束时 data 为 nil
+-- - 指定了 options.uploadDir 时, 边接收边写入到这个目录下的临时文件, file.path 为文件名
+-- - 否则保存在 file.data 中, 所有文件占用的内存不能超过 options.maxFileMemory
+function IncomingMessage:_readMultipart(options, boundary, fail, callback)
+    local parser = multipart.createParser(boundary)
+
+    local maxFieldSize = options.maxFieldSize or MAX_FIELD_SIZE
+    local maxFileMemory = options.maxFileMemory or MAX_FILE_MEMORY
+
+    local body = {}
+    local files = {}
+    local fieldSize = 0
+    local fileMemory = 0
+    local pending = 0 -- 还没有写完的临时文件
+    local ended = false
+    local failed = false
+
+    local function onError(err, statusCode)
+        if (failed) then
+            return
+        end
+
+        failed = true
+
+        -- 删除已经写入的临时文件
+        for _, file in ipairs(files) do
+            if (file.stream) then
+                file.stream:destroy()
+                file.stream = nil
+            end
+
+            if (file.path) then
+                fs.unlink(file.path, function() end)
+            end
+        end
+
+        fail(err, statusCode)
     end
 
-    local contentType = self:get('Content-Type')
-    if (contentType) then
-        local tokens = contentType:split(';')
-        contentType = tokens[1]
+    local function onFinish()
+        if (failed) or (not ended) or (pending > 0) then
+            return
+        end
+
+        self.body = body
+        self.files = files
+        callback(self)
     end
 
-    local sb = StringBuffer:new()
+    parser:on('part', function(part)
+        if (failed) then
+            return
+        end
 
-    self:on('data', function(data)
-        sb:append(data)
+        part.chunks = {}
+
+        if (not part.filename) then
+            return
+        end
+
+        local file = {
+            name = part.name,
+            filename = part.filename,
+            mimetype = part.mimetype,
+            size = 0
+        }
+
+        files[#files + 1] = file
+        part.file = file
+
+        if (options.onFile) or (not options.uploadDir) then
+            return
+        end
+
+        uploadCounter = uploadCounter + 1
+        local name = string.format('upload-%d-%d', os.time(), uploadCounter)
+        file.path = path.join(options.uploadDir, name)
 
-        --console.log('data', contentType)
-        --console.log(#data, data)
+        local stream = fs.createWriteStream(file.path)
+        file.stream = stream
+        pending = pending + 1
+
+        stream:on('error', function(err)
+            onError(err, 500)
+        end)
+
+        stream:on('finish', function()
+            file.stream = nil
+            pending = pending - 1
+            onFinish()
+        end)
+    end)
+
+    parser:on('data', function(part, data)
+        if (failed) then
+            return
+        end
+
+        local file = part.file
+        if (not file) then
+            fieldSize = fieldSize + #data
+            if (fieldSize > maxFieldSize) then
+                return onError('Form field too large', 413)
+            end
+
+            table.insert(part.chunks, data)
+            return
+        end
+
+        file.size = file.size + #data
+
+        if (options.onFile) then
+            options.onFile(file, data)
+
+        elseif (file.stream) then
+            -- 写入磁盘的速度跟不上时暂停接收
+            if (not file.stream:write(data)) then
+                self:pause()
+                file.stream:once('drain', function()
+                    self:resume()
+                end)
+            end
+
+        else
+            fileMemory = fileMemory + #data
+            if (fileMemory > maxFileMemory) then
+                return onError('Uploaded file too large', 413)
+            end
+
+            table.insert(part.chunks, data)
+        end
+    end)
+
+    parser:on('partEnd', function(part)
+        if (failed) then
+            return
+        end
+
+        local file = part.file
+        if (not file) then
+            if (part.name) then
+                body[part.name] = table.concat(part.chunks)
+            end
+
+        elseif (options.onFile) then
+            options.onFile(file, nil)
+
+        elseif (file.stream) then
+            file.stream:finish()
+
+        else
+            file.data = table.concat(part.chunks)
+        end
+
+        part.chunks = nil
+    end)
+
+    parser:on('error', function(err)
+        onError(err, 400)
+    end)
+
+    -- 出错后不再解析剩下的数据
+    self:on('data', function(data)
+        if (not failed) then
+            parser:write(data)
+        end
     end)
 
     self:once('end', function(data)
-        sb:append(data)
+        if (failed) then
+            return
+        end
 
-        local content = sb:toString()
+        parser:write(data)
+        parser:finish()
 
-        if (contentType == 'application/x-www-form-urlencoded') then
-            self.body = querystring.parse(content)
+        ended = true
+        onFinish()
+    end)
 
-        elseif (contentType == 'multipart/form-data') then
-            local FormData = formdata.FormData
-            local parser = FormData:new(#content)
+    return onError
+end
 
-            local body = {}
-            local files = {}
+-- 接收并解析消息体
+-- @param {function} callback function(request, err, statusCode), 出错时 err 不为 nil
+-- @param {object} options
+--  - maxBodySize {number} 消息体的最大长度, 默认为 32M
+--  - maxFieldSize {number} multipart 中所有普通字段的最大长度, 默认为 1M
+--  - maxFileMemory {number} 没有指定 uploadDir 时上传的文件最多占用的内存, 默认为 8M
+--  - uploadDir {string} 上传的文件写入这个目录
+--  - onFile {function} function(file, data), 自己处理上传的文件的数据
+function IncomingMessage:readBody(callback, options)
+    if (self.body ~= nil) then
+        return
+    end
 
-            local headerName = nil
-            local feilds = {}
-            local fieldName = nil
+    options = options or {}
+    local maxBodySize = options.maxBodySize or MAX_BODY_SIZE
 
-            parser:on('file', function(data)
-                -- console.log('file', data, headerName, feilds)
+    local rawContentType = self:get('Content-Type')
+    local contentType = rawContentType
+    if (contentType) then
+        local tokens = contentType:split(';')
+        contentType = tokens[1]
+    end
 
-                if (feilds.filename) then
-                    local file = { data = data }
-                    file.name = feilds.name
-                    file.filename = feilds.filename
-                    file.mimetype = feilds.mimetype
+    local failed = false
+    local onError = nil
 
-                    files[#files + 1] = file
+    local function fail(err, statusCode)
+        if (failed) then
+            return
+        end
 
-                else
-                    body[feilds.name] = data
-                end
+        failed = true
+        callback(self, err, statusCode)
+    end
 
-                headerName = nil
-                feilds = {}
-            end)
+    -- 在接收数据之前检查长度
+    local contentLength = tonumber(self:get('Content-Length'))
+    if (contentLength) and (contentLength > maxBodySize) then
+        return fail('Request entity too large', 413)
+    end
 
-            parser:on('header-name', function(data)
-                -- console.log('header-name', data)
-                headerName = data
-                fieldName = nil
-            end)
+    local received = 0
+    self:on('data', function(data)
+        received = received + #data
+        if (received > maxBodySize) then
+            if (onError) then
+                onError('Request entity too large', 413)
+            else
+                fail('Request entity too large', 413)
+            end
+        end
+    end)
 
-            parser:on('header-value', function(data)
-                -- console.log('header-value', data)
-                if (headerName == 'Content-Type') then
-                    feilds['mimetype'] = data
-                end
-            end)
+    if (contentType == 'multipart/form-data') then
+        local boundary = multipart.getBoundary(rawContentType)
+        if (not boundary) then
+            return fail('Missing multipart boundary', 400)
+        end
+
+        onError = self:_readMultipart(options, boundary, fail, callback)
+        return
+    end
 
-            parser:on('feild-name', function(data)
-                -- console.log('feild-name', data)
-                fieldName = data
-            end)
+    local sb = StringBuffer:new()
+
+    self:on('data', function(data)
+        if (not failed) then
+            sb:append(data)
+        end
+    end)
+
+    self:once('end', function(data)
+        if (failed) then
+            return
+        end
 
-            parser:on('feild-value', function(data)
-                -- console.log('feild-value', fieldName, data)
-                feilds[fieldName] = data
-            end)
+        sb:append(data)
 
-            parser:processData(content)
-            parser = nil
+        local content = sb:toString()
 
-            self.files = files
-            self.body = body
+        if (contentType == 'application/x-www-form-urlencoded') then
+            self.body = querystring.parse(content)
 
         elseif (contentType == 'application/json') then
             self.body = json.parse(content)
@@ -259,14 +452,48 @@ function ServerResponse:get(field)
     end
 end
 
-function ServerResponse:json(data)
-    local text = json.stringify(data)
-    if (not text) then
-        self:sendStatus(500)
-        return
+-- 根据请求的 Accept-Encoding 和内容的类型及长度判断是否需要压缩
+-- @param {string} contentType
+-- @param {number} contentLength 可选, 为 nil 表示长度未知
+-- @return {string} 使用的压缩编码, 不需要压缩时返回 nil
+function ServerResponse:getCompression(contentType, contentLength)
+    local options = self.compression
+    if (not options) or (self.headersSent) or (self.compressor) then
+        return nil
+
+    elseif (not mime.isCompressible(contentType)) then
+        return nil
+
+    elseif (self:getHeader('Content-Encoding')) then
+        return nil
     end
 
-    self:set("Content-Type", "application/json")
+    -- 压不压缩都和 Accept-Encoding 有关
+    self:set('Vary', 'Accept-Encoding')
+
+    local threshold = options.threshold or COMPRESSION_THRESHOLD
+    if (contentLength) and (contentLength < threshold) then
+        return nil
+    end
+
+    return self.acceptEncoding
+end
+
+-- 发送完整的内容, 需要时先压缩再发送
+function ServerResponse:_sendBody(text, contentType)
+    local encoding = self:getCompression(contentType, #text)
+    if (encoding) then
+        local level = self.compression.level
+        if (encoding == 'gzip') then
+            text = zlib.gzipSync(text, level)
+        else
+            text = zlib.deflateSync(text, level)
+        end
+
+        self:set("Content-Encoding", encoding)
+    end
+
+    self:set("Content-Type", contentType)
     self:set("Content-Length", #text)
 
     self:checkSessionId()
@@ -274,6 +501,16 @@ function ServerResponse:json(data)
     self:finish()
 end
 
+function ServerResponse:json(data)
+    local text = json.stringify(data)
+    if (not text) then
+        self:sendStatus(500)
+        return
+    end
+
+    self:_sendBody(text, "application/json")
+end
+
 function ServerResponse:redirect(status, path)
     if (type(status) == 'string') then
         path = status
@@ -291,12 +528,7 @@ function ServerResponse:send(text, contentType)
         return
     end
 
-    self:set("Content-Type", contentType or "text/html")
-    self:set("Content-Length", #text)
-
-    self:checkSessionId()
-    self:write(text)
-    self:finish()
+    self:_sendBody(text, contentType or "text/html")
 end
 
 function ServerResponse:sendFileList(filename, request)
@@ -321,6 +553,59 @@ function ServerResponse:sendFileList(filename, request)
     end)
 end
 
+-- 发送缓存中的文件, 会根据请求头返回 304 或 gzip 压缩后的内容
+-- @param {CacheEntry} entry express/cache 中的文件
+-- @param {IncomingMessage} request
+-- @param {FileCache} fileCache 可选, 用于记录 gzip 内容占用的内存
+function ServerResponse:sendCachedFile(entry, request, fileCache)
+    local headers = request.headers
+    local isHtml = entry.filename:endsWith('.html')
+
+    self:set('ETag', entry.etag)
+    if (not isHtml) then
+        self:set('Last-Modified', entry.lastModified)
+    end
+
+    local match = headers['If-None-Match']
+    if (match) then
+        if (match == '*') or (match:find(entry.etag, 1, true)) then
+            self:sendStatus(304)
+            return
+        end
+
+    elseif (not isHtml) and (headers['If-Modified-Since'] == entry.lastModified) then
+        self:sendStatus(304)
+        return
+    end
+
+    local data = entry.data
+    if (self.compression) and (mime.isCompressible(entry.contentType)) then
+        self:set('Vary', 'Accept-Encoding')
+
+        -- 缓存的文件只有 gzip 格式的压缩数据
+        if (self.acceptEncoding == 'gzip') then
+            local gzip
+            if (fileCache) then
+                gzip = fileCache:getGzipData(entry)
+            else
+                gzip = entry:getGzipData()
+            end
+
+            if (gzip) then
+                data = gzip
+                self:set('Content-Encoding', 'gzip')
+            end
+        end
+    end
+
+    self:set("Content-Type", entry.contentType)
+    self:set("Content-Length", #data)
+
+    self:checkSessionId()
+    self:write(data)
+    self:finish()
+end
+
 function ServerResponse:sendStaticFile(options)
     local pathname = options.pathname
 
@@ -369,8 +654,17 @@ function ServerResponse:sendStatus(statusCode, message)
 end
 
 function ServerResponse:sendStream(stream, contentType, contentLength)
-    self:set("Content-Type",   contentType   or "text/html")
-    self:set("Content-Length", tonumber(contentLength) or nil)
+    contentType = contentType or "text/html"
+    contentLength = tonumber(contentLength)
+
+    -- 边发送边压缩
+    local encoding = self:getCompression(contentType, contentLength)
+    if (encoding) and (self:setCompression(encoding, self.compression)) then
+        contentLength = nil
+    end
+
+    self:set("Content-Type",   contentType)
+    self:set("Content-Length", contentLength)
 
     self:checkSessionId()
     stream:pipe(self)
@@ -407,6 +701,105 @@ function ServerResponse:type(contentType)
     return self:get('Content-Type')
 end
 
+-------------------------------------------------------------------------------
+-- lazy request fields
+
+-- 返回 URL 中的路径部分
+local function _getPathname(href)
+    if (not href) then
+        return nil
+    end
+
+    local pathname = href:match('^[^?#]*')
+    if (pathname:byte(1) ~= 47) then -- '/'
+        -- 完整的 URL, 比如代理请求
+        return url.parse(href).pathname
+    end
+
+    return pathname
+end
+
+-- 去掉多余的 '/', 比如 '/a//b/' => '/a/b'
+local function _normalizePath(pathname)
+    if (pathname:find('//', 1, true)) then
+        pathname = pathname:gsub('//+', '/')
+    end
+
+    if (#pathname > 1) and (pathname:byte(-1) == 47) then -- '/'
+        pathname = pathname:sub(1, -2)
+    end
+
+    if (pathname:byte(1) ~= 47) then
+        pathname = '/' .. pathname
+    end
+
+    return pathname
+end
+
+local lazyFields = {
+    uri = function(request)
+        return url.parse(request.url)
+    end,
+
+    hostname = function(request)
+        return request.uri.hostname
+    end,
+
+    protocol = function(request)
+        return request.uri.protocol or 'http'
+    end,
+
+    query = function(request)
+        return querystring.parse(request.url:match('%?([^#]*)'))
+    end
+}
+
+-- 根据 Accept-Encoding 选择压缩编码, 优先使用 gzip
+local function _getAcceptEncoding(request)
+    local value = request.headers['Accept-Encoding']
+    if (not value) then
+        return nil
+    end
+
+    -- 每种编码是否可以使用, q=0 表示明确拒绝
+    local accepted = {}
+    for name, params in value:lower():gmatch('([^,;%s]+)([^,]*)') do
+        local q = params:match('q%s*=%s*([%d.]+)')
+        accepted[name] = (not q) or (tonumber(q) ~= 0)
+    end
+
+    -- "*" 只代表没有列出的编码, 不能重新启用被明确拒绝的编码
+    for _, name in ipairs({ 'gzip', 'deflate' }) do
+        local value = accepted[name]
+        if (value == nil) then
+            value = accepted['*']
+        end
+
+        if (value) then
+            return name
+        end
+    end
+
+    return nil
+end
+
+-- 在 IncomingMessage 的基础上增加按需解析的字段
+local RequestMeta = {}
+for key, value in pairs(IncomingMessage.meta) do
+    RequestMeta[key] = value
+end
+
+RequestMeta.__index = function(request, key)
+    local getter = lazyFields[key]
+    if (getter) then
+        local value = getter(request)
+        rawset(request, key, value)
+        return value
+    end
+
+    return IncomingMessage[key]
+end
+
 -------------------------------------------------------------------------------
 -- Express
 
@@ -419,9 +812,25 @@ function Express:initialize(options)
     end
 
     self.list 		= {}
+    self.options    = options
     self.root 		= options.root
-    self.routes     = {}
-    self.functions  = {}
+    self.routes     = {} -- 路由表, 见 Express:all
+    self.functions  = {} -- 所有路径都使用的中间件
+    self.prefixed   = {} -- 绑定到指定路径前缀的中间件 { prefix, func }
+    self.middlewareCache = {}
+    self.middlewareCacheSize = 0
+
+    -- 压缩应答, options.compression 为 false 时不压缩
+    local compression = options.compression
+    if (compression ~= false) then
+        self.compression = (type(compression) == 'table') and compression or {}
+    end
+
+    -- 静态文件缓存, options.fileCache 为 false 时不使用缓存
+    local fileCache = options.fileCache
+    if (fileCache ~= false) then
+        self.fileCache = cache.createCache(type(fileCache) == 'table' and fileCache or nil)
+    end
 end
 
 function Express:close()
@@ -429,12 +838,72 @@ function Express:close()
         self.server:close()
         self.server = nil
     end
+
+    if (self.fileCache) then
+        self.fileCache:clear()
+    end
 end
 
-function Express:use(func)
-    table.insert(self.functions, func)
+-- 添加中间件
+-- @param {string} prefix 可选, 只有路径以这个前缀开始的请求才会调用这个中间件
+-- @param {function} func function(request, response), 返回 true 表示已经处理了这个请求
+function Express:use(prefix, func)
+    if (type(prefix) == 'function') then
+        table.insert(self.functions, prefix)
+
+    elseif (prefix) and (func) then
+        prefix = _normalizePath(prefix)
+        if (prefix == '/') then
+            table.insert(self.functions, func)
+        else
+            table.insert(self.prefixed, { prefix = prefix, func = func })
+        end
+    end
+
+    self.middlewareCache = {}
+    self.middlewareCacheSize = 0
 end
 
+-- 返回指定路径需要调用的中间件列表
+function Express:getMiddlewares(pathname)
+    if (#self.prefixed == 0) then
+        return self.functions
+    end
+
+    local list = self.middlewareCache[pathname]
+    if (list) then
+        return list
+    end
+
+    list = {}
+    for _, func in ipairs(self.functions) do
+        table.insert(list, func)
+    end
+
+    for _, item in ipairs(self.prefixed) do
+        local prefix = item.prefix
+        if (pathname == prefix) or (pathname:sub(1, #prefix + 1) == prefix .. '/') then
+            table.insert(list, item.func)
+        end
+    end
+
+    -- 带参数的路径可能有无限多个, 限制缓存的大小
+    if (self.middlewareCacheSize >= MAX_MIDDLEWARE_CACHE) then
+        self.middlewareCache = {}
+        self.middlewareCacheSize = 0
+    end
+
+    self.middlewareCache[pathname] = list
+    self.middlewareCacheSize = self.middlewareCacheSize + 1
+    return list
+end
+
+-- 注册路由
+-- 路由在注册时编译好:
+-- - 不包含参数的路径保存在 static 哈希表中, 一次查表就能找到
+-- - 包含参数 (比如 '/users/:id/posts') 的路径按第一个参数之前的静态前缀
+--   ('/users') 分组保存在 params 哈希表中, 相当于把前缀树中只有一个分支的静态
+--   段合并成一条边. 匹配时从最长的前缀开始查找, 每组中静态段多的模板优先
 function Express:all(method, pathname, handler)
     if (not method) or (not pathname) or (not handler) then
         return
@@ -442,41 +911,51 @@ function Express:all(method, pathname, handler)
 
     local route = self.routes[method]
     if (not route) then
-        route = {}
+        route = { static = {}, params = {}, count = 0 }
         self.routes[method] = route
     end
 
-    local tokens = pathname:split('/')
-    --console.log(tokens)
-
-    for index, item in ipairs(tokens) do
-        --console.log(index, item)
-
-        if (item and item ~= '') then
-            local name = nil
-            if (item:startsWith(':')) then
-                name = item:sub(2)
-                item = '@'
-            end
+    pathname = _normalizePath(pathname)
+    local index = pathname:find('/:', 1, true)
+    if (not index) then
+        route.static[pathname] = handler
+        return
+    end
 
-            -- console.log(index, item)
+    local prefix = pathname:sub(1, index - 1)
+    local rest = pathname:sub(index + 1)
 
-            local subRoute = route[item]
-            if (not subRoute) then
-                subRoute = {}
-                route[item] = subRoute
-            end
+    local list = route.params[prefix]
+    if (not list) then
+        list = {}
+        route.params[prefix] = list
+    end
 
-            if (name) then
-                subRoute['@name'] = name
-            end
+    for _, template in ipairs(list) do
+        if (template.path == rest) then
+            template.handler = handler
+            return
+        end
+    end
 
-            route = subRoute
+    route.count = route.count + 1
+    local template = { path = rest, handler = handler, statics = 0, order = route.count }
+    for item in rest:gmatch('[^/]+') do
+        if (item:byte(1) == 58) then -- ':'
+            table.insert(template, { name = item:sub(2) })
+        else
+            table.insert(template, item)
+            template.statics = template.statics + 1
         end
     end
 
-    route['@handler'] = handler
-    -- console.log(self.routes)
+    table.insert(list, template)
+    table.sort(list, function(a, b)
+        if (a.statics ~= b.statics) then
+            return a.statics > b.statics
+        end
+        return a.order < b.order
+    end)
 end
 
 function Express:get(pathname, handler)
@@ -491,48 +970,93 @@ function Express:getFileName(pathname)
     return path.join(self.root, pathname)
 end
 
-function Express:getHandler(request)
-    local method = request.method
-    local pathname = request.path or ''
-    local handler = nil
+local matchValues = {}
 
-    local route = self.routes[method] or {}
+-- 用 pathname 中从 position 开始的部分匹配 list 中的模板
+local function _matchTemplates(request, list, pathname, position)
+    local length = #pathname
 
-    local tokens = pathname:split('/')
+    for _, template in ipairs(list) do
+        local start = position
+        local count = #template
+        local matched = true
 
-    for index, item in ipairs(tokens) do
-        if (item and item ~= '') then
-            --console.log(index, item)
+        for i = 1, count do
+            if (start > length) then
+                matched = false
+                break
+            end
+
+            local last = pathname:find('/', start, true)
+            local item = pathname:sub(start, (last or length + 1) - 1)
+            local segment = template[i]
+            if (type(segment) == 'string') then
+                if (segment ~= item) then
+                    matched = false
+                    break
+                end
 
-            local subRoute = route[item]
-            if (not subRoute) then
-                subRoute = route['@']
+            else
+                matchValues[i] = item
             end
 
-            route = subRoute
-            if (not route) then
-                break
+            start = (last or length) + 1
+        end
+
+        if (matched) and (start > length) then
+            local params = request.params
+            if (not params) then
+                params = {}
+                request.params = params
             end
 
-            --console.log(route, value)
-            local name = route['@name']
-            if (name) then
-                if (not request.params) then
-                    request.params = {}
+            for i = 1, count do
+                local segment = template[i]
+                if (type(segment) ~= 'string') then
+                    params[segment.name] = matchValues[i]
+                    matchValues[i] = nil
                 end
-
-                request.params[name] = item
             end
+
+            return template.handler
         end
     end
+end
+
+function Express:getHandler(request)
+    local route = self.routes[request.method]
+    if (not route) then
+        return nil
+    end
 
+    -- 静态路径
+    local pathname = request.path or ''
+    local handler = route.static[pathname]
+    if (handler) then
+        return handler
+    end
 
-    if (route) then
-        handler = route['@handler']
+    pathname = _normalizePath(pathname)
+    handler = route.static[pathname]
+    if (handler) or (route.count == 0) then
+        return handler
+    end
+
+    -- 带参数的路径, 从最长的前缀开始
+    local params = route.params
+    for index = #pathname, 1, -1 do
+        if (pathname:byte(index) == 47) then -- '/'
+            local list = params[pathname:sub(1, index - 1)]
+            if (list) then
+                handler = _matchTemplates(request, list, pathname, index + 1)
+                if (handler) then
+                    return handler
+                end
+            end
+        end
     end
 
-    -- console.log(request.params, pathname, handler)
-    return handler
+    return nil
 end
 
 function Express:post(pathname, handler)
@@ -545,7 +1069,7 @@ function Express:handleFileRequest(request, response)
         return response:sendStatus(404)
     end
 
-    fs.stat(filename, function (err, statInfo, ...)
+    local function onStat(err, statInfo, entry)
         if err then
             if err.code == "ENOENT" then
                 response:sendStatus(404, err.message)
@@ -563,11 +1087,11 @@ function Express:handleFileRequest(request, response)
         --console.log(stat.type)
 
         if (statInfo.type ~= 'file') then
-            response:sendFileList(filename, request)
+            self:handleDirectoryRequest(filename, request, response)
             return
 
-        elseif (statInfo.type ~= 'file') then
-            response:sendStatus(404, "Requested url is not a file")
+        elseif (entry) then
+            response:sendCachedFile(entry, request, self.fileCache)
             return
         end
 
@@ -582,6 +1106,29 @@ function Express:handleFileRequest(request, response)
         }
 
         response:sendStaticFile(options)
+    end
+
+    if (self.fileCache) then
+        self.fileCache:get(filename, onStat)
+    else
+        fs.stat(filename, onStat)
+    end
+end
+
+-- 请求的是目录时优先发送缓存中的 index.html
+function Express:handleDirectoryRequest(filename, request, response)
+    if (not self.fileCache) then
+        response:sendFileList(filename, request)
+        return
+    end
+
+    local indexFile = path.join(filename, 'index.html')
+    self.fileCache:get(indexFile, function(err, statInfo, entry)
+        if (entry) then
+            response:sendCachedFile(entry, request, self.fileCache)
+        else
+            response:sendFileList(filename, request)
+        end
     end)
 end
 
@@ -590,18 +1137,19 @@ function Express:handleRequest(request, response)
     local sessionId = request:getSessionId()
     response.sessionId = sessionId
 
-    local uri           = url.parse(request.url)
+    -- uri, hostname, protocol 和 query 在第一次访问时才解析
+    setmetatable(request, RequestMeta)
+    request.path = _getPathname(request.url) or '/'
 
-    request.uri         = uri
-    request.path        = uri.pathname
-    request.hostname    = uri.hostname
-    request.protocol    = uri.protocol or 'http'
-    request.ip          = nil
-    request.query       = querystring.parse(uri.query)
+    if (self.compression) then
+        response.compression = self.compression
+        response.acceptEncoding = _getAcceptEncoding(request)
+    end
 
     -- 中间件
-    for index, func in ipairs(self.functions) do
-        local status, result = pcall(func, request, response)
+    local functions = self:getMiddlewares(request.path)
+    for index = 1, #functions do
+        local status, result = pcall(functions[index], request, response)
         if (status and result) then
             return
         end
@@ -614,12 +1162,17 @@ function Express:handleRequest(request, response)
         return
     end
 
-    request:readBody(function()
+    request:readBody(function(request, err, statusCode)
+        if (err) then
+            response:sendStatus(statusCode or 400, err)
+            return
+        end
+
         local status = pcall(handler, request, response)
         if (not status) then
             response:sendStatus(500)
         end
-    end)
+    end, self.options)
 end
 
 function Express:listen(port, callback)
@@ -199,4 +199,32 @@ local mimes = {
 --mimes.default = "application/octet-stream"
 mimes.default = "text/plain"
 
+-- 除了 text/* 以外适合压缩的类型
+local compressible = {
+  ["application/atom+xml"]      = true,
+  ["application/javascript"]    = true,
+  ["application/json"]          = true,
+  ["application/rss+xml"]       = true,
+  ["application/x-javascript"]  = true,
+  ["application/xhtml+xml"]     = true,
+  ["application/xml"]           = true,
+  ["image/svg+xml"]             = true,
+  ["image/x-icon"]              = true,
+}
+
+-- 指定的类型的内容是否适合压缩, 图片, 视频以及压缩包等已经压缩过的内容不需要再压缩
+function mimes.isCompressible(contentType)
+  if (not contentType) then
+    return false
+  end
+
+  contentType = contentType:match("^%s*([^;%s]+)")
+  if (not contentType) then
+    return false
+  end
+
+  contentType = contentType:lower()
+  return (contentType:sub(1, 5) == "text/") or (compressible[contentType] == true)
+end
+
 return mimes
@@ -0,0 +1,228 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local core = require('core')
+
+-------------------------------------------------------------------------------
+-- 流式 multipart/form-data 解析器
+--
+-- 每收到一块数据就调用 write(), 解析器只缓存还不能确定是否属于分隔符的最后
+-- 几个字节, 以及还没有完整收到的部分头, 内容数据一收到就通过 'data' 事件发出,
+-- 所以上传的文件不需要整个保存在内存中.
+--
+-- 事件:
+-- - 'part' (part) 开始一个新的部分, part 为 { headers, name, filename, mimetype }
+-- - 'data' (part, data) 这个部分的内容数据, 可能会分成多次发出
+-- - 'partEnd' (part) 这个部分结束
+-- - 'end' () 收到了结束分隔符
+-- - 'error' (err)
+
+local exports = {}
+
+local STATE_PREAMBLE = 1 -- 第一个分隔符之前
+local STATE_BOUNDARY = 2 -- 分隔符之后, 判断是 '\r\n' 还是 '--'
+local STATE_HEADERS  = 3
+local STATE_BODY     = 4
+local STATE_END      = 5
+local STATE_ERROR    = 6
+
+local MAX_HEADER_SIZE = 16 * 1024
+
+-- 从 Content-Type 中解析出 boundary
+function exports.getBoundary(contentType)
+    if (not contentType) then
+        return nil
+    end
+
+    local boundary = contentType:match('[Bb][Oo][Uu][Nn][Dd][Aa][Rr][Yy]=([^;]+)')
+    if (not boundary) then
+        return nil
+    end
+
+    boundary = boundary:trim()
+    if (boundary:byte(1) == 34) then -- '"'
+        boundary = boundary:sub(2, -2)
+    end
+
+    return boundary
+end
+
+-- 解析一个部分的头, 比如:
+-- Content-Disposition: form-data; name="file"; filename="a.txt"
+local function parseHeaders(data)
+    local part = { headers = {} }
+
+    for line in data:gmatch('[^\r\n]+') do
+        local name, value = line:match('^([^:]+):%s*(.*)$')
+        if (name) then
+            name = name:trim():lower()
+            part.headers[name] = value
+
+            if (name == 'content-disposition') then
+                for key, quoted, plain in value:gmatch(';%s*([^=;%s]+)%s*=%s*("?)([^;]*)') do
+                    if (quoted == '"') then
+                        plain = plain:gsub('"%s*$', '')
+                    end
+                    part[key:lower()] = plain
+                end
+
+            elseif (name == 'content-type') then
+                part.mimetype = value:trim()
+            end
+        end
+    end
+
+    return part
+end
+
+exports.parseHeaders = parseHeaders
+
+local MultipartParser = core.Emitter:extend()
+exports.MultipartParser = MultipartParser
+
+-- @param {string} boundary Content-Type 中的 boundary 参数
+-- @param {object} options
+--  - maxHeaderSize {number} 每个部分的头的最大长度, 默认为 16K
+function MultipartParser:initialize(boundary, options)
+    options = options or {}
+
+    -- 第一个分隔符前面没有 '\r\n', 所以先在数据前面加上 '\r\n'
+    self.delimiter = '\r\n--' .. boundary
+    self.buffer = '\r\n'
+    self.state = STATE_PREAMBLE
+    self.part = nil
+    self.maxHeaderSize = options.maxHeaderSize or MAX_HEADER_SIZE
+end
+
+function MultipartParser:_error(message)
+    self.state = STATE_ERROR
+    self.buffer = ''
+    self:emit('error', message)
+end
+
+-- 处理收到的一块数据
+function MultipartParser:write(data)
+    if (self.state >= STATE_END) then
+        return
+    end
+
+    if (data) and (#data > 0) then
+        self.buffer = self.buffer .. data
+    end
+
+    local delimiter = self.delimiter
+
+    while (true) do
+        local state = self.state
+        local buffer = self.buffer
+
+        if (state == STATE_PREAMBLE) then
+            local pos = buffer:find(delimiter, 1, true)
+            if (not pos) then
+                -- 只保留可能是分隔符的开始部分的数据
+                if (#buffer >= #delimiter) then
+                    self.buffer = buffer:sub(-(#delimiter - 1))
+                end
+                break
+            end
+
+            self.buffer = buffer:sub(pos + #delimiter)
+            self.state = STATE_BOUNDARY
+
+        elseif (state == STATE_BOUNDARY) then
+            if (#buffer < 2) then
+                break
+            end
+
+            local tail = buffer:sub(1, 2)
+            if (tail == '--') then
+                self.state = STATE_END
+                self.buffer = ''
+                self:emit('end')
+                break
+
+            elseif (tail == '\r\n') then
+                self.buffer = buffer:sub(3)
+                self.state = STATE_HEADERS
+
+            else
+                return self:_error('Invalid multipart boundary')
+            end
+
+        elseif (state == STATE_HEADERS) then
+            local pos, last
+            if (buffer:sub(1, 2) == '\r\n') then
+                pos, last = 1, 2 -- 没有头
+
+            else
+                pos, last = buffer:find('\r\n\r\n', 1, true)
+            end
+
+            if (not pos) then
+                if (#buffer > self.maxHeaderSize) then
+                    return self:_error('Multipart header too large')
+                end
+                break
+            end
+
+            local part = parseHeaders(buffer:sub(1, pos - 1))
+            self.buffer = buffer:sub(last + 1)
+            self.state = STATE_BODY
+            self.part = part
+            self:emit('part', part)
+
+        elseif (state == STATE_BODY) then
+            local part = self.part
+            local pos = buffer:find(delimiter, 1, true)
+            if (pos) then
+                if (pos > 1) then
+                    self:emit('data', part, buffer:sub(1, pos - 1))
+                end
+
+                self.buffer = buffer:sub(pos + #delimiter)
+                self.state = STATE_BOUNDARY
+                self.part = nil
+                self:emit('partEnd', part)
+
+            else
+                -- 末尾的数据可能是下一个分隔符的开始部分, 留到下次再处理
+                local size = #buffer - (#delimiter - 1)
+                if (size > 0) then
+                    self.buffer = buffer:sub(size + 1)
+                    self:emit('data', part, buffer:sub(1, size))
+                end
+                break
+            end
+
+        else
+            break
+        end
+    end
+end
+
+-- 所有数据都已经收到
+function MultipartParser:finish()
+    if (self.state < STATE_END) then
+        self:_error('Unexpected end of multipart data')
+    end
+end
+
+function exports.createParser(boundary, options)
+    return MultipartParser:new(boundary, options)
+end
+
+return exports
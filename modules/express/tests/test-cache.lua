@@ -0,0 +1,187 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local fs        = require('fs')
+local os        = require('os')
+local path      = require('path')
+local http      = require('http')
+local zlib      = require('zlib')
+local express   = require('express')
+local cache     = require('express/cache')
+
+local tap = require('ext/tap')
+local test = tap.test
+
+local HOST = "127.0.0.1"
+local PORT = 10093
+
+local root = path.join(os.tmpdir, 'express-cache-' .. process.pid)
+local SCRIPT = string.rep('function test() { return 100; }\n', 200)
+
+local function setup()
+    fs.mkdirpSync(root)
+    fs.writeFileSync(path.join(root, 'index.html'), '<html>index</html>')
+    fs.writeFileSync(path.join(root, 'app.js'), SCRIPT)
+    fs.writeFileSync(path.join(root, 'logo.png'), string.rep('\0\1\2\3', 100))
+    fs.writeFileSync(path.join(root, 'large.txt'), string.rep('a', 10000))
+end
+
+local function cleanup()
+    for _, name in ipairs(fs.readdirSync(root) or {}) do
+        fs.unlinkSync(path.join(root, name))
+    end
+    fs.rmdirSync(root)
+end
+
+test("file cache", function(expect)
+    setup()
+
+    local fileCache = cache.createCache({ maxSize = 8192, maxFileSize = 8192 })
+    local filename = path.join(root, 'app.js')
+
+    -- 同时读取同一个文件只读取一次
+    local first
+    fileCache:get(filename, expect(function(err, statInfo, entry)
+        assert(not err)
+        assert(entry.data == SCRIPT)
+        assert(entry.contentType == 'application/javascript')
+        first = entry
+    end))
+
+    fileCache:get(filename, expect(function(err, statInfo, entry)
+        assert(entry == first)
+        assert(fileCache.count == 1)
+
+        -- 只压缩一次
+        local gzip = fileCache:getGzipData(entry)
+        assert(zlib.gunzipSync(gzip) == SCRIPT)
+        assert(fileCache:getGzipData(entry) == gzip)
+        assert(fileCache.size == #SCRIPT + #gzip)
+
+        -- 不缓存大文件
+        fileCache:get(path.join(root, 'large.txt'), expect(function(err, statInfo, entry)
+            assert(not err and statInfo.size == 10000)
+            assert(entry == nil)
+
+            -- 超过 maxSize 时删除最久没有使用的文件
+            fileCache:get(path.join(root, 'logo.png'), expect(function(err, statInfo, png)
+                assert(png and png:getGzipData() == nil)
+
+                fileCache:get(path.join(root, 'index.html'), expect(function(err, statInfo, html)
+                    assert(html and fileCache.count == 3)
+
+                    fs.writeFileSync(path.join(root, 'index.html'), string.rep('x', 1500))
+                    setTimeout(100, expect(function()
+                        fileCache:get(path.join(root, 'index.html'), expect(function(err, statInfo, html)
+                            assert(html.size == 1500)
+                            assert(fileCache.entries[filename] == nil)
+                            assert(fileCache.size <= fileCache.maxSize)
+                            fileCache:clear()
+                            assert(fileCache.count == 0 and fileCache.size == 0)
+                            assert(next(fileCache.watchers) == nil)
+                        end))
+                    end))
+                end))
+            end))
+        end))
+    end))
+end)
+
+test("file cache invalidation", function(expect)
+    local fileCache = cache.createCache()
+    local filename = path.join(root, 'app.js')
+
+    fileCache:get(filename, expect(function(err, statInfo, entry)
+        assert(entry.data == SCRIPT)
+        fs.writeFileSync(filename, 'changed')
+
+        -- 修改文件后通过 fs_event 或 stat 发现文件已经改变
+        setTimeout(100, expect(function()
+            fileCache:get(filename, expect(function(err, statInfo, entry)
+                assert(entry.data == 'changed')
+                fs.writeFileSync(filename, SCRIPT)
+                fileCache:clear()
+            end))
+        end))
+    end))
+end)
+
+local function get(pathname, headers, callback)
+    local request = http.request({
+        host = HOST,
+        port = PORT,
+        method = 'GET',
+        path = pathname,
+        headers = headers
+    }, function(response)
+        local chunks = {}
+        response:on('data', function(data)
+            chunks[#chunks + 1] = data
+        end)
+
+        response:on('end', function()
+            callback(response, table.concat(chunks))
+        end)
+    end)
+
+    request:done()
+end
+
+test("express file cache", function(expect)
+    local app = express({ root = root })
+    app:listen(PORT)
+
+    get('/app.js', { { 'Accept-Encoding', 'gzip, deflate' } }, expect(function(response, body)
+        local headers = response.headers
+        assert(response.statusCode == 200)
+        assert(headers['Content-Encoding'] == 'gzip')
+        assert(headers['Vary'] == 'Accept-Encoding')
+        assert(zlib.gunzipSync(body) == SCRIPT)
+
+        local etag = headers['ETag']
+        assert(etag)
+
+        get('/app.js', { { 'If-None-Match', etag } }, expect(function(response, body)
+            assert(response.statusCode == 304, response.statusCode)
+
+            get('/app.js', {}, expect(function(response, body)
+                assert(response.headers['Content-Encoding'] == nil)
+                assert(body == SCRIPT)
+
+                local since = response.headers['Last-Modified']
+                get('/app.js', { { 'If-Modified-Since', since } }, expect(function(response)
+                    assert(response.statusCode == 304)
+
+                    -- 目录使用缓存中的 index.html
+                    get('/', {}, expect(function(response, body)
+                        assert(response.statusCode == 200)
+                        assert(body == string.rep('x', 1500))
+
+                        get('/large.txt', {}, expect(function(response, body)
+                            assert(body == string.rep('a', 10000))
+
+                            app:close()
+                            cleanup()
+                        end))
+                    end))
+                end))
+            end))
+        end))
+    end))
+end)
+
+tap.run()
@@ -0,0 +1,193 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local http      = require('http')
+local json      = require('json')
+local zlib      = require('zlib')
+local express   = require('express')
+local mime      = require('express/mime')
+local Readable  = require('stream').Readable
+
+local tap = require('ext/tap')
+local test = tap.test
+
+local HOST = "127.0.0.1"
+local PORT = 10094
+
+local function createList(count)
+    local list = {}
+    for i = 1, count do
+        list[i] = { id = i, name = 'device-' .. i, online = (i % 2 == 0) }
+    end
+    return list
+end
+
+local function get(pathname, encoding, callback)
+    local headers = {}
+    if (encoding) then
+        headers[1] = { 'Accept-Encoding', encoding }
+    end
+
+    local request = http.request({
+        host = HOST,
+        port = PORT,
+        path = pathname,
+        headers = headers
+    }, function(response)
+        local chunks = {}
+        response:on('data', function(data)
+            chunks[#chunks + 1] = data
+        end)
+
+        response:on('end', function()
+            callback(response, table.concat(chunks))
+        end)
+    end)
+
+    request:done()
+end
+
+test("mime.isCompressible", function()
+    assert(mime.isCompressible('text/html'))
+    assert(mime.isCompressible('application/json; charset=utf-8'))
+    assert(mime.isCompressible('image/svg+xml'))
+    assert(not mime.isCompressible('image/png'))
+    assert(not mime.isCompressible('application/zip'))
+    assert(not mime.isCompressible(nil))
+end)
+
+test("express compression", function(expect)
+    local app = express({ compression = { threshold = 256 } })
+    local LINE = string.rep('stream data ', 10) .. '\n'
+
+    app:get('/list', function(request, response)
+        response:json(createList(100))
+    end)
+
+    app:get('/small', function(request, response)
+        response:json({ ret = 0 })
+    end)
+
+    app:get('/stream', function(request, response)
+        local stream = Readable:new()
+        local count = 0
+        stream._read = function()
+            count = count + 1
+            stream:push((count <= 100) and LINE or nil)
+        end
+
+        response:sendStream(stream, 'text/plain')
+    end)
+
+    app:get('/image', function(request, response)
+        response:send(string.rep('\0', 1024), 'image/png')
+    end)
+
+    app:listen(PORT)
+
+    local text = json.stringify(createList(100))
+
+    get('/list', 'gzip, deflate', expect(function(response, body)
+        local headers = response.headers
+        assert(headers['Content-Encoding'] == 'gzip')
+        assert(headers['Vary'] == 'Accept-Encoding')
+        assert(tonumber(headers['Content-Length']) == #body)
+        assert(#body < #text / 4)
+        assert(zlib.gunzipSync(body) == text)
+
+        get('/list', 'deflate', expect(function(response, body)
+            assert(response.headers['Content-Encoding'] == 'deflate')
+            assert(zlib.inflateSync(body) == text)
+
+            get('/list', 'gzip;q=0, identity', expect(function(response, body)
+                assert(response.headers['Content-Encoding'] == nil)
+                assert(body == text)
+
+                get('/small', 'gzip', expect(function(response, body)
+                    assert(response.headers['Content-Encoding'] == nil)
+                    assert(body == '{"ret":0}')
+
+                    get('/stream', 'gzip', expect(function(response, body)
+                        assert(response.headers['Content-Encoding'] == 'gzip')
+                        assert(response.headers['Transfer-Encoding'] == 'chunked')
+                        assert(zlib.gunzipSync(body) == LINE:rep(100))
+
+                        get('/image', 'gzip', expect(function(response, body)
+                            assert(response.headers['Content-Encoding'] == nil)
+                            assert(#body == 1024)
+                            app:close()
+                        end))
+                    end))
+                end))
+            end))
+        end))
+    end))
+end)
+
+test("express compression of cached static files", function(expect)
+    local fs = require('fs')
+    local root = '/tmp/lnode-express-static'
+    fs.mkdirpSync(root)
+
+    local text = json.stringify(createList(100))
+    fs.writeFileSync(root .. '/list.json', text)
+
+    local app = express({ root = root })
+    app:listen(PORT)
+
+    get('/list.json', 'gzip', expect(function(response, body)
+        assert(response.headers['Content-Encoding'] == 'gzip')
+        assert(zlib.gunzipSync(body) == text)
+
+        -- q=0 表示不接受 gzip
+        get('/list.json', 'gzip;q=0', expect(function(response, body)
+            assert(response.headers['Content-Encoding'] == nil)
+            assert(body == text)
+
+            -- "*" 不会重新启用被拒绝的 gzip
+            get('/list.json', 'gzip;q=0, *', expect(function(response, body)
+                assert(response.headers['Content-Encoding'] == nil)
+                assert(body == text)
+
+                app:close()
+                os.remove(root .. '/list.json')
+            end))
+        end))
+    end))
+end)
+
+test("express compression with Accept-Encoding: *", function(expect)
+    local app = express({ compression = { threshold = 256 } })
+    app:get('/list', function(request, response)
+        response:json(createList(100))
+    end)
+
+    app:listen(PORT)
+
+    local text = json.stringify(createList(100))
+    get('/list', '*', expect(function(response, body)
+        assert(response.headers['Content-Encoding'] == 'gzip')
+
+        get('/list', 'gzip;q=0, *', expect(function(response, body)
+            assert(response.headers['Content-Encoding'] == 'deflate')
+            assert(zlib.inflateSync(body) == text)
+            app:close()
+        end))
+    end))
+end)
+
+tap.run()
@@ -0,0 +1,235 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local fs        = require('fs')
+local os        = require('os')
+local path      = require('path')
+local http      = require('http')
+local express   = require('express')
+local multipart = require('express/multipart')
+
+local tap = require('ext/tap')
+local test = tap.test
+
+local HOST = "127.0.0.1"
+local PORT = 10091
+
+local BOUNDARY = '----WebKitFormBoundarycezqTco6VlXfs9L1'
+
+-- 文件内容中包含分隔符的前面一部分
+local FILE_DATA = string.rep('firmware\r\n--' .. BOUNDARY:sub(1, 10) .. '\0\255', 2000)
+
+local function createBody(fileData)
+    return table.concat({
+        'preamble\r\n',
+        '--', BOUNDARY, '\r\n',
+        'Content-Disposition: form-data; name="version"\r\n\r\n',
+        '1.0.2',
+        '\r\n--', BOUNDARY, '\r\n',
+        'Content-Disposition: form-data; name="file"; filename="image.bin"\r\n',
+        'Content-Type: application/octet-stream\r\n\r\n',
+        fileData,
+        '\r\n--', BOUNDARY, '--\r\n'
+    })
+end
+
+local function parse(body, size)
+    local parser = multipart.createParser(BOUNDARY)
+    local parts = {}
+    local ended = false
+
+    parser:on('part', function(part)
+        part.chunks = {}
+        parts[#parts + 1] = part
+    end)
+
+    parser:on('data', function(part, data)
+        table.insert(part.chunks, data)
+    end)
+
+    parser:on('partEnd', function(part)
+        part.data = table.concat(part.chunks)
+    end)
+
+    parser:on('end', function()
+        ended = true
+    end)
+
+    parser:on('error', function(err)
+        error(err)
+    end)
+
+    for i = 1, #body, size do
+        parser:write(body:sub(i, i + size - 1))
+    end
+    parser:finish()
+
+    assert(ended)
+    return parts, parser
+end
+
+test("multipart parser", function()
+    local body = createBody(FILE_DATA)
+
+    for _, size in ipairs({ 1, 7, #BOUNDARY + 3, 4096, #body }) do
+        local parts, parser = parse(body, size)
+        assert(#parts == 2, size)
+
+        assert(parts[1].name == 'version')
+        assert(parts[1].data == '1.0.2')
+
+        assert(parts[2].name == 'file')
+        assert(parts[2].filename == 'image.bin')
+        assert(parts[2].mimetype == 'application/octet-stream')
+        assert(parts[2].data == FILE_DATA, size)
+
+        -- 只缓存了分隔符长度的数据
+        assert(#parser.buffer == 0)
+    end
+
+    assert(multipart.getBoundary('multipart/form-data; boundary=' .. BOUNDARY) == BOUNDARY)
+    assert(multipart.getBoundary('multipart/form-data; boundary="abc"') == 'abc')
+end)
+
+test("multipart parser errors", function()
+    local parser = multipart.createParser(BOUNDARY)
+    local errors = {}
+    parser:on('error', function(err) errors[#errors + 1] = err end)
+
+    parser:write('--' .. BOUNDARY .. '\r\nContent-Disposition: form-data; name="a"\r\n\r\nabc')
+    parser:finish()
+    assert(errors[1] == 'Unexpected end of multipart data')
+
+    parser = multipart.createParser(BOUNDARY, { maxHeaderSize = 64 })
+    parser:on('error', function(err) errors[#errors + 1] = err end)
+    parser:write('--' .. BOUNDARY .. '\r\n' .. string.rep('x', 100))
+    assert(errors[2] == 'Multipart header too large')
+end)
+
+-- @param {boolean} chunked 不发送 Content-Length
+local function post(body, callback, chunked)
+    local headers = {
+        { 'Content-Type', 'multipart/form-data; boundary=' .. BOUNDARY }
+    }
+
+    if (chunked) then
+        headers[#headers + 1] = { 'Transfer-Encoding', 'chunked' }
+    else
+        headers[#headers + 1] = { 'Content-Length', #body }
+    end
+
+    local request = http.request({
+        host = HOST,
+        port = PORT,
+        method = 'POST',
+        path = '/upload',
+        headers = headers
+    }, function(response)
+        local chunks = {}
+        response:on('data', function(data)
+            chunks[#chunks + 1] = data
+        end)
+
+        response:on('end', function()
+            callback(response.statusCode, table.concat(chunks))
+        end)
+    end)
+
+    -- 分成多次发送
+    for i = 1, #body, 1000 do
+        request:write(body:sub(i, i + 999))
+    end
+    request:finish()
+end
+
+test("express upload to disk", function(expect)
+    local uploadDir = os.tmpdir
+    local app = express({ uploadDir = uploadDir, maxBodySize = 64 * 1024 })
+
+    app:post('/upload', function(request, response)
+        assert(request.body.version == '1.0.2')
+
+        local file = request.files[1]
+        assert(file.name == 'file')
+        assert(file.filename == 'image.bin')
+        assert(file.size == #FILE_DATA)
+        assert(file.data == nil)
+        assert(path.dirname(file.path) == uploadDir)
+        assert(fs.readFileSync(file.path) == FILE_DATA)
+        fs.unlinkSync(file.path)
+
+        response:json({ ret = 0 })
+    end)
+
+    app:listen(PORT)
+
+    post(createBody(FILE_DATA), expect(function(statusCode, body)
+        assert(statusCode == 200, statusCode)
+        assert(body == '{"ret":0}')
+
+        -- 超过了 maxBodySize
+        post(createBody(string.rep(FILE_DATA, 4)), expect(function(statusCode)
+            assert(statusCode == 413, statusCode)
+            app:close()
+        end))
+    end))
+end)
+
+test("express upload error removes files", function(expect, uv)
+    local uploadDir = path.join(os.tmpdir, 'lnode-express-upload-' .. process.pid)
+    fs.mkdirpSync(uploadDir)
+
+    local app = express({ uploadDir = uploadDir, maxBodySize = 64 * 1024 })
+    app:post('/upload', function(request, response)
+        response:json({ ret = 0 })
+    end)
+
+    app:listen(PORT)
+
+    -- 第一个文件接收到一半时超过 maxBodySize, 后面的文件不会再写入
+    local body = table.concat({
+        '--', BOUNDARY, '\r\n',
+        'Content-Disposition: form-data; name="file"; filename="image.bin"\r\n\r\n',
+        string.rep(FILE_DATA, 2),
+        '\r\n--', BOUNDARY, '\r\n',
+        'Content-Disposition: form-data; name="next"; filename="next.bin"\r\n\r\n',
+        'next',
+        '\r\n--', BOUNDARY, '--\r\n'
+    })
+
+    local result, files
+    post(body, function(statusCode)
+        result = statusCode
+
+        -- 等待可能还在写入的临时文件
+        setTimeout(100, function()
+            files = fs.readdirSync(uploadDir)
+            for _, file in ipairs(files) do
+                fs.unlinkSync(path.join(uploadDir, file))
+            end
+
+            fs.rmdirSync(uploadDir)
+            app:close()
+        end)
+    end, true)
+
+    uv.run()
+    assert(result == 413, result)
+    assert(#files == 0, files[1])
+end)
+
+tap.run()
@@ -0,0 +1,162 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local express   = require('express')
+
+local tap = require('ext/tap')
+local test = tap.test
+
+local function newRequest(method, href)
+    return { method = method, path = href:match('^[^?#]*') }
+end
+
+test("express static & param routes", function()
+    local app = express()
+
+    local function handler(name)
+        return function() return name end
+    end
+
+    app:get('/', handler('root'))
+    app:get('/users', handler('users'))
+    app:get('/users/:id', handler('user'))
+    app:get('/users/me', handler('me'))
+    app:get('/users/:id/posts/:post', handler('post'))
+    app:get('/files/:name/raw', handler('raw'))
+    app:get('/files/list/', handler('list'))
+    app:post('/users/:id', handler('update'))
+
+    local function match(method, href)
+        local request = newRequest(method, href)
+        local found = app:getHandler(request)
+        return found and found(), request.params
+    end
+
+    assert(match('GET', '/') == 'root')
+    assert(match('GET', '/users') == 'users')
+    assert(match('GET', '/users/') == 'users')
+    assert(match('GET', '//users') == 'users')
+
+    -- 静态段优先
+    assert(match('GET', '/users/me') == 'me')
+
+    local name, params = match('GET', '/users/100')
+    assert(name == 'user' and params.id == '100')
+
+    name, params = match('GET', '/users/100/posts/7')
+    assert(name == 'post' and params.id == '100' and params.post == '7')
+
+    -- 'list' 静态段不能匹配时回退到参数段
+    name, params = match('GET', '/files/list/raw')
+    assert(name == 'raw' and params.name == 'list')
+    assert(match('GET', '/files/list') == 'list')
+
+    assert(match('POST', '/users/1') == 'update')
+    assert(match('GET', '/users/1/posts') == nil)
+    assert(match('GET', '/none') == nil)
+    assert(match('PUT', '/users') == nil)
+end)
+
+test("express middleware prefix", function()
+    local app = express()
+    local calls = {}
+
+    app:use(function() calls[#calls + 1] = 'all' end)
+    app:use('/api', function() calls[#calls + 1] = 'api' end)
+    app:use('/api/v2/', function() calls[#calls + 1] = 'v2' end)
+
+    local function run(pathname)
+        calls = {}
+        for _, func in ipairs(app:getMiddlewares(pathname)) do
+            func()
+        end
+        return table.concat(calls, ',')
+    end
+
+    assert(run('/index.html') == 'all')
+    assert(run('/api') == 'all,api')
+    assert(run('/api/v2/users') == 'all,api,v2')
+    assert(run('/apis') == 'all')
+
+    -- 缓存
+    assert(app:getMiddlewares('/api/v2/users') == app:getMiddlewares('/api/v2/users'))
+end)
+
+test("express lazy request fields", function(expect)
+    local http = require('http')
+    local app = express()
+
+    app:get('/search/:kind', function(request, response)
+        assert(rawget(request, 'query') == nil)
+        assert(rawget(request, 'uri') == nil)
+
+        assert(request.path == '/search/books')
+        assert(request.params.kind == 'books')
+        assert(request.query.q == 'lua')
+        assert(request.uri.pathname == '/search/books')
+        assert(request.protocol == 'http')
+        assert(request:get('Host'))
+
+        response:send('ok')
+    end)
+
+    app:listen(10092)
+
+    http.get('http://127.0.0.1:10092/search/books?q=lua', function(response)
+        response:on('data', function() end)
+        response:on('end', expect(function()
+            assert(response.statusCode == 200)
+            app:close()
+        end))
+    end)
+end)
+
+-- 200 个路由, 一半是静态路径
+test("express route benchmark", function()
+    local app = express()
+    local handler = function() end
+
+    local paths = {}
+    for i = 1, 100 do
+        local pathname = '/api/v1/module' .. i .. '/status'
+        app:get(pathname, handler)
+        paths[#paths + 1] = pathname
+
+        app:get('/api/v1/module' .. i .. '/items/:id', handler)
+        paths[#paths + 1] = '/api/v1/module' .. i .. '/items/' .. i
+    end
+
+    local COUNT = 100 * 1000
+    local request = { method = 'GET' }
+
+    console.time('express 100K static routes')
+    for i = 1, COUNT do
+        request.path = paths[(i % 100) * 2 + 1]
+        assert(app:getHandler(request))
+    end
+    console.timeEnd('express 100K static routes')
+
+    console.time('express 100K param routes')
+    for i = 1, COUNT do
+        request.path = paths[(i % 100) * 2 + 2]
+        request.params = nil
+        assert(app:getHandler(request))
+    end
+    console.timeEnd('express 100K param routes')
+end)
+
+tap.run()
@@ -0,0 +1,253 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+
+-------------------------------------------------------------------------------
+-- Modbus 协议编解码
+--
+-- PDU: | function (1) | data (N) |
+-- TCP: | transaction id (2) | protocol id (2) | length (2) | unit id (1) | PDU |
+-- RTU: | slave (1) | PDU | CRC16 (2, little endian) |
+
+local exports = {}
+
+exports.READ_COILS                  = 0x01
+exports.READ_DISCRETE_INPUTS        = 0x02
+exports.READ_HOLDING_REGISTERS      = 0x03
+exports.READ_INPUT_REGISTERS        = 0x04
+exports.WRITE_SINGLE_COIL           = 0x05
+exports.WRITE_SINGLE_REGISTER       = 0x06
+exports.WRITE_MULTIPLE_COILS        = 0x0F
+exports.WRITE_MULTIPLE_REGISTERS    = 0x10
+
+exports.MAX_READ_BITS       = 2000
+exports.MAX_READ_REGISTERS  = 125
+exports.MAX_WRITE_BITS      = 1968
+exports.MAX_WRITE_REGISTERS = 123
+
+exports.EXCEPTIONS = {
+    [1] = 'Illegal function',
+    [2] = 'Illegal data address',
+    [3] = 'Illegal data value',
+    [4] = 'Slave device failure',
+    [5] = 'Acknowledge',
+    [6] = 'Slave device busy',
+    [8] = 'Memory parity error',
+    [10] = 'Gateway path unavailable',
+    [11] = 'Gateway target device failed to respond'
+}
+
+local spack   = string.pack
+local sunpack = string.unpack
+local sbyte   = string.byte
+local schar   = string.char
+
+-------------------------------------------------------------------------------
+-- CRC16
+
+local CRC_TABLE = {}
+for i = 0, 255 do
+    local crc = i
+    for _ = 1, 8 do
+        if (crc & 1) ~= 0 then
+            crc = (crc >> 1) ~ 0xA001
+        else
+            crc = crc >> 1
+        end
+    end
+    CRC_TABLE[i] = crc
+end
+
+function exports.crc16(data, first, last)
+    local crc = 0xFFFF
+    for i = first or 1, last or #data do
+        crc = (crc >> 8) ~ CRC_TABLE[(crc ~ sbyte(data, i)) & 0xFF]
+    end
+    return crc
+end
+
+-------------------------------------------------------------------------------
+-- PDU
+
+local function packBits(values)
+    local bytes = {}
+    for i = 1, #values, 8 do
+        local byte = 0
+        for j = 0, 7 do
+            local value = values[i + j]
+            if (value) and (value ~= 0) then
+                byte = byte | (1 << j)
+            end
+        end
+        bytes[#bytes + 1] = schar(byte)
+    end
+    return table.concat(bytes)
+end
+
+-- 编码请求的 PDU
+-- @param {number} fc 功能码
+-- @param {number} address 开始地址
+-- @param {number|table} value 读操作为数量, 写单个线圈/寄存器为值, 写多个为值数组
+function exports.encodeRequest(fc, address, value)
+    if (fc <= exports.READ_INPUT_REGISTERS) then
+        return spack('>BI2I2', fc, address, value)
+
+    elseif (fc == exports.WRITE_SINGLE_COIL) then
+        local state = (value and value ~= 0) and 0xFF00 or 0x0000
+        return spack('>BI2I2', fc, address, state)
+
+    elseif (fc == exports.WRITE_SINGLE_REGISTER) then
+        return spack('>BI2I2', fc, address, value & 0xFFFF)
+
+    elseif (fc == exports.WRITE_MULTIPLE_COILS) then
+        local data = packBits(value)
+        return spack('>BI2I2s1', fc, address, #value, data)
+
+    elseif (fc == exports.WRITE_MULTIPLE_REGISTERS) then
+        local words = {}
+        for i = 1, #value do
+            words[i] = spack('>I2', value[i] & 0xFFFF)
+        end
+        return spack('>BI2I2s1', fc, address, #value, table.concat(words))
+    end
+
+    error('unsupported function code: ' .. tostring(fc))
+end
+
+-- 解码响应的 PDU
+-- @param {string} pdu
+-- @param {number} count 读操作请求的数量
+-- @return 读操作返回值数组, 写操作返回 true; 出错时返回 nil, error, exception code
+function exports.decodeResponse(pdu, count)
+    local fc = sbyte(pdu, 1)
+    if (not fc) then
+        return nil, 'Empty response'
+    end
+
+    if (fc & 0x80) ~= 0 then
+        local code = sbyte(pdu, 2) or 0
+        return nil, 'Modbus exception ' .. code .. ': ' .. (exports.EXCEPTIONS[code] or 'Unknown'), code
+    end
+
+    if (fc == exports.READ_COILS) or (fc == exports.READ_DISCRETE_INPUTS) then
+        local size = sbyte(pdu, 2) or 0
+        if (#pdu < size + 2) or (size * 8 < count) then
+            return nil, 'Invalid response length'
+        end
+
+        local values = {}
+        for i = 0, count - 1 do
+            local byte = sbyte(pdu, 3 + (i >> 3))
+            values[i + 1] = (byte >> (i & 7)) & 1
+        end
+        return values
+
+    elseif (fc == exports.READ_HOLDING_REGISTERS) or (fc == exports.READ_INPUT_REGISTERS) then
+        local size = sbyte(pdu, 2) or 0
+        if (#pdu < size + 2) or (size < count * 2) then
+            return nil, 'Invalid response length'
+        end
+
+        local values = {}
+        for i = 1, count do
+            values[i] = sunpack('>I2', pdu, 1 + i * 2)
+        end
+        return values
+
+    elseif (fc == exports.WRITE_SINGLE_COIL) or (fc == exports.WRITE_SINGLE_REGISTER)
+        or (fc == exports.WRITE_MULTIPLE_COILS) or (fc == exports.WRITE_MULTIPLE_REGISTERS) then
+        if (#pdu < 5) then
+            return nil, 'Invalid response length'
+        end
+        return true
+    end
+
+    return nil, 'Unsupported function code: ' .. fc
+end
+
+-------------------------------------------------------------------------------
+-- TCP (MBAP)
+
+function exports.encodeTcpFrame(transactionId, unitId, pdu)
+    return spack('>I2I2I2B', transactionId, 0, #pdu + 1, unitId) .. pdu
+end
+
+-- 从 buffer 的 position 位置开始解析一个 TCP 帧
+-- @return transactionId, unitId, pdu, nextPosition; 数据不完整时返回 nil
+function exports.decodeTcpFrame(buffer, position)
+    if (#buffer - position + 1 < 7) then
+        return nil
+    end
+
+    local transactionId, _, length, unitId = sunpack('>I2I2I2B', buffer, position)
+    local last = position + 5 + length
+    if (last > #buffer) then
+        return nil
+    end
+
+    return transactionId, unitId, buffer:sub(position + 7, last), last + 1
+end
+
+-------------------------------------------------------------------------------
+-- RTU
+
+function exports.encodeRtuFrame(slave, pdu)
+    local frame = schar(slave) .. pdu
+    return frame .. spack('<I2', exports.crc16(frame))
+end
+
+-- RTU 帧没有长度字段, 只能根据功能码计算响应的长度
+-- @return PDU 的长度, 数据不足以计算时返回 nil
+local function getResponsePduLength(buffer, position)
+    local fc = sbyte(buffer, position + 1)
+    if (not fc) then
+        return nil
+    end
+
+    if (fc & 0x80) ~= 0 then
+        return 2
+
+    elseif (fc <= exports.READ_INPUT_REGISTERS) then
+        local size = sbyte(buffer, position + 2)
+        return size and (size + 2)
+    end
+
+    return 5
+end
+
+-- 从 buffer 的 position 位置开始解析一个 RTU 响应帧
+-- @return slave, pdu, nextPosition; 数据不完整时返回 nil; CRC 错误时返回 false
+function exports.decodeRtuFrame(buffer, position)
+    local length = getResponsePduLength(buffer, position)
+    if (not length) then
+        return nil
+    end
+
+    local last = position + length + 2
+    if (last > #buffer) then
+        return nil
+    end
+
+    local crc = sunpack('<I2', buffer, last - 1)
+    if (crc ~= exports.crc16(buffer, position, last - 2)) then
+        return false
+    end
+
+    return sbyte(buffer, position), buffer:sub(position + 1, last - 2), last + 1
+end
+
+return exports
@@ -0,0 +1,483 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local core  = require('core')
+local net   = require('net')
+local uv    = require('luv')
+
+local codec  = require('modbus/codec')
+local poller = require('modbus/poller')
+
+-------------------------------------------------------------------------------
+-- 异步 Modbus 客户端
+--
+-- 所有请求都在事件循环中完成, 不会阻塞其他 I/O:
+-- - TCP: 使用 net.Socket, 通过事务编号可以同时发送多个请求 (pipelining)
+-- - RTU: 使用 lmodbus 打开并配置串口, 然后通过 uv_poll 异步读取串口数据,
+--   同一时间只能有一个请求
+--
+-- 请求按顺序排队, 每个请求都有超时时间, 可以为每个从机设置不同的超时时间.
+
+local exports = {}
+
+exports.codec = codec
+exports.Poller = poller.Poller
+
+local Client = core.Emitter:extend()
+exports.Client = Client
+
+-- @param {object} options
+--  - host {string} TCP 服务器地址
+--  - port {number} TCP 端口, 默认为 502
+--  - device {string} RTU 串口设备名, 指定时使用 RTU 模式
+--  - baudrate {number} 波特率, 默认为 9600
+--  - parity {string} 校验方式 'N', 'E' 或 'O', 默认为 'N'
+--  - dataBits {number} 数据位, 默认为 8
+--  - stopBits {number} 停止位, 默认为 1
+--  - slave {number} 默认从机地址, 默认为 1
+--  - timeout {number} 默认的响应超时时间 (毫秒), 默认为 1000
+--  - maxInFlight {number} TCP 模式下同时发送的最大请求数, 默认为 8
+function Client:initialize(options)
+    options = options or {}
+
+    self.options     = options
+    self.isRtu       = (options.device ~= nil)
+    self.slave       = options.slave or 1
+    self.timeout     = options.timeout or 1000
+    self.timeouts    = {} -- 每个从机的超时时间
+    self.maxInFlight = self.isRtu and 1 or (options.maxInFlight or 8)
+
+    self.queue          = {} -- 等待发送的请求
+    self.inFlight       = {} -- 已发送的请求, 以事务编号为键
+    self.inFlightCount  = 0
+    self.transactionId  = 0
+    self.buffer         = ''
+    self.position       = 1
+
+    self.stats = { requests = 0, responses = 0, timeouts = 0, errors = 0 }
+end
+
+-- 设置超时时间
+-- @param {number} timeout 毫秒
+-- @param {number} slave 可选, 只设置这个从机的超时时间
+function Client:setTimeout(timeout, slave)
+    if (slave) then
+        self.timeouts[slave] = timeout
+    else
+        self.timeout = timeout
+    end
+end
+
+function Client:close()
+    self.closed = true
+    self:_closeTransport('client closed')
+    self:_failAll(self.queue, 'client closed')
+    self.queue = {}
+end
+
+-------------------------------------------------------------------------------
+-- requests
+
+function Client:readCoils(slave, address, count, callback)
+    return self:request(slave, codec.READ_COILS, address, count, callback)
+end
+
+function Client:readDiscreteInputs(slave, address, count, callback)
+    return self:request(slave, codec.READ_DISCRETE_INPUTS, address, count, callback)
+end
+
+function Client:readHoldingRegisters(slave, address, count, callback)
+    return self:request(slave, codec.READ_HOLDING_REGISTERS, address, count, callback)
+end
+
+function Client:readInputRegisters(slave, address, count, callback)
+    return self:request(slave, codec.READ_INPUT_REGISTERS, address, count, callback)
+end
+
+function Client:writeCoil(slave, address, value, callback)
+    return self:request(slave, codec.WRITE_SINGLE_COIL, address, value, callback)
+end
+
+function Client:writeRegister(slave, address, value, callback)
+    return self:request(slave, codec.WRITE_SINGLE_REGISTER, address, value, callback)
+end
+
+function Client:writeCoils(slave, address, values, callback)
+    return self:request(slave, codec.WRITE_MULTIPLE_COILS, address, values, callback)
+end
+
+function Client:writeRegisters(slave, address, values, callback)
+    return self:request(slave, codec.WRITE_MULTIPLE_REGISTERS, address, values, callback)
+end
+
+Client.readRegisters = Client.readHoldingRegisters
+Client.readBits = Client.readCoils
+
+-- 发送一个请求
+-- @param {number} slave 从机地址, 为 nil 时使用默认地址
+-- @param {number} fc 功能码
+-- @param {number} address 开始地址
+-- @param {number|table} value 读操作为数量, 写操作为值
+-- @param {function} callback function(err, values), 为 nil 时返回 Promise
+function Client:request(slave, fc, address, value, callback)
+    local promise
+    if (not callback) then
+        local Promise = require('promise')
+        promise = Promise.new()
+        callback = function(err, result)
+            if (err) then
+                promise:reject(err)
+            else
+                promise:resolve(result)
+            end
+        end
+    end
+
+    if (self.closed) then
+        callback('client closed')
+        return promise
+    end
+
+    local ok, pdu = pcall(codec.encodeRequest, fc, address, value)
+    if (not ok) then
+        callback(pdu)
+        return promise
+    end
+
+    table.insert(self.queue, {
+        slave = slave or self.slave,
+        pdu = pdu,
+        count = (type(value) == 'number') and value or 0,
+        callback = callback
+    })
+
+    self:_flush()
+    return promise
+end
+
+-------------------------------------------------------------------------------
+-- internal
+
+function Client:_flush()
+    if (not self.connected) then
+        self:_openTransport()
+        return
+    end
+
+    while (self.inFlightCount < self.maxInFlight) and (#self.queue > 0) do
+        local request = table.remove(self.queue, 1)
+        self:_send(request)
+    end
+end
+
+function Client:_send(request)
+    local transactionId = 0
+    local frame
+    if (self.isRtu) then
+        frame = codec.encodeRtuFrame(request.slave, request.pdu)
+    else
+        transactionId = (self.transactionId % 0xFFFF) + 1
+        self.transactionId = transactionId
+        frame = codec.encodeTcpFrame(transactionId, request.slave, request.pdu)
+    end
+
+    self.inFlight[transactionId] = request
+    self.inFlightCount = self.inFlightCount + 1
+    self.stats.requests = self.stats.requests + 1
+
+    local timeout = self.timeouts[request.slave] or self.timeout
+    request.timer = setTimeout(timeout, function()
+        request.timer = nil
+        self.stats.timeouts = self.stats.timeouts + 1
+
+        if (self.isRtu) then
+            -- 丢弃这个请求可能迟到的响应
+            self.buffer = ''
+            self.position = 1
+        end
+
+        self:_complete(transactionId, 'timeout')
+    end)
+
+    self:_write(frame)
+end
+
+function Client:_complete(transactionId, err, result)
+    local request = self.inFlight[transactionId]
+    if (not request) then
+        return
+    end
+
+    self.inFlight[transactionId] = nil
+    self.inFlightCount = self.inFlightCount - 1
+
+    if (request.timer) then
+        clearTimeout(request.timer)
+        request.timer = nil
+    end
+
+    if (err) then
+        self.stats.errors = self.stats.errors + 1
+    end
+
+    request.callback(err, result)
+    self:_flush()
+end
+
+function Client:_onResponse(transactionId, slave, pdu)
+    local request = self.inFlight[transactionId]
+    if (not request) or (request.slave ~= slave) then
+        return
+    end
+
+    self.stats.responses = self.stats.responses + 1
+
+    local result, err = codec.decodeResponse(pdu, request.count)
+    self:_complete(transactionId, err, result)
+end
+
+function Client:_onData(chunk)
+    local buffer = self.buffer
+    local position = self.position
+    if (position > 1) then
+        buffer = buffer:sub(position)
+        position = 1
+    end
+
+    buffer = buffer .. chunk
+
+    while (position <= #buffer) do
+        if (self.isRtu) then
+            local slave, pdu, nextPosition = codec.decodeRtuFrame(buffer, position)
+            if (slave == false) then
+                -- CRC 错误, 丢弃所有数据, 当前的请求会超时
+                buffer = ''
+                position = 1
+                self.stats.errors = self.stats.errors + 1
+                break
+
+            elseif (not slave) then
+                break
+            end
+
+            position = nextPosition
+            self:_onResponse(0, slave, pdu)
+
+        else
+            local transactionId, unitId, pdu, nextPosition = codec.decodeTcpFrame(buffer, position)
+            if (not transactionId) then
+                break
+            end
+
+            position = nextPosition
+            self:_onResponse(transactionId, unitId, pdu)
+        end
+    end
+
+    self.buffer = buffer
+    self.position = position
+end
+
+function Client:_failAll(requests, err)
+    for _, request in pairs(requests) do
+        if (request.timer) then
+            clearTimeout(request.timer)
+            request.timer = nil
+        end
+
+        request.callback(err)
+    end
+end
+
+-- 连接断开, 所有已发送的请求都会失败, 下一个请求会重新连接
+function Client:_onTransportClose(err)
+    if (not self.connected) and (not self.connecting) then
+        return
+    end
+
+    self.connected = false
+    self.connecting = false
+    self.buffer = ''
+    self.position = 1
+
+    local inFlight = self.inFlight
+    self.inFlight = {}
+    self.inFlightCount = 0
+    self:_failAll(inFlight, err or 'connection closed')
+
+    -- 连接失败时排队的请求也会失败, 否则重新连接后继续发送
+    if (err) then
+        local queue = self.queue
+        self.queue = {}
+        self:_failAll(queue, err)
+    end
+
+    self:emit('close', err)
+
+    if (#self.queue > 0) then
+        self:_flush()
+    end
+end
+
+-------------------------------------------------------------------------------
+-- transport
+
+function Client:_openTransport()
+    if (self.connecting) or (self.connected) or (self.closed) then
+        return
+    end
+
+    self.connecting = true
+    if (self.isRtu) then
+        self:_openRtu()
+    else
+        self:_openTcp()
+    end
+end
+
+function Client:_onOpen()
+    self.connecting = false
+    self.connected = true
+    self:emit('connect')
+    self:_flush()
+end
+
+function Client:_openTcp()
+    local options = self.options
+    local socket = net.Socket:new()
+    self.socket = socket
+
+    socket:on('error', function(err)
+        socket:destroy()
+        if (self.socket == socket) then
+            self.socket = nil
+            self:_onTransportClose(err)
+        end
+    end)
+
+    socket:on('close', function()
+        if (self.socket == socket) then
+            self.socket = nil
+            self:_onTransportClose()
+        end
+    end)
+
+    socket:connect(options.port or 502, options.host or '127.0.0.1', function()
+        uv.tcp_nodelay(socket._handle, true)
+        socket:on('data', function(chunk)
+            self:_onData(chunk)
+        end)
+
+        self:_onOpen()
+    end)
+end
+
+function Client:_openRtu()
+    local options = self.options
+    local ok, lmodbus = pcall(require, 'lmodbus')
+    if (not ok) then
+        return self:_onTransportClose('lmodbus not available')
+    end
+
+    -- 只用 libmodbus 打开并配置串口 (termios), 读写都在事件循环中完成
+    local parity = string.byte(options.parity or 'N')
+    local device, err = lmodbus.newRTU(options.device, options.baudrate or 9600,
+        parity, options.dataBits or 8, options.stopBits or 1)
+
+    local ret
+    if (device) then
+        ret, err = device:connect()
+    end
+
+    if (not ret) then
+        if (device) then
+            device:close()
+        end
+        return self:_onTransportClose(err or 'open failed')
+    end
+
+    local fd = device:getFD()
+    local poll = uv.new_poll(fd)
+    self.device = device
+    self.fd = fd
+    self.poll = poll
+
+    uv.poll_start(poll, 'r', function(err)
+        if (err) then
+            self:_closeTransport(err)
+            return
+        end
+
+        local data = uv.fs_read(fd, 512, -1)
+        if (data) and (#data > 0) then
+            self:_onData(data)
+        end
+    end)
+
+    self:_onOpen()
+end
+
+function Client:_write(frame)
+    if (self.socket) then
+        self.socket:write(frame)
+
+    elseif (self.fd) then
+        local ret, err = uv.fs_write(self.fd, frame, -1)
+        if (not ret) then
+            self:_closeTransport(err)
+        end
+    end
+end
+
+function Client:_closeTransport(err)
+    local socket = self.socket
+    if (socket) then
+        self.socket = nil
+        socket:destroy()
+    end
+
+    local poll = self.poll
+    if (poll) then
+        self.poll = nil
+        uv.poll_stop(poll)
+        uv.close(poll)
+    end
+
+    local device = self.device
+    if (device) then
+        self.device = nil
+        self.fd = nil
+        device:close()
+    end
+
+    self:_onTransportClose(err)
+end
+
+-------------------------------------------------------------------------------
+-- exports
+
+-- 创建一个异步 Modbus 客户端, 第一个请求时自动连接
+function exports.createClient(options)
+    return Client:new(options)
+end
+
+-- 创建一个轮询调度器, 参考 modbus/poller
+function exports.createPoller(client, options)
+    return poller.Poller:new(client, options)
+end
+
+return exports
@@ -0,0 +1,292 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local core  = require('core')
+local uv    = require('luv')
+
+local codec = require('modbus/codec')
+
+-------------------------------------------------------------------------------
+-- Modbus 轮询调度器
+--
+-- 应用只需要声明要采集的点 (从机, 类型, 地址, 周期), 调度器会:
+-- - 把同一个从机, 同一种类型, 同一个周期的相邻或相近的地址合并为一个读请求,
+--   每个请求不超过 PDU 允许的最大数量
+-- - 把同一个周期的多个读请求均匀地分散在这个周期内, 避免同时发送
+-- - 只在值发生变化时通知应用
+--
+-- 总线上的事务越少, RTU 总线上能达到的采样率就越高.
+
+local exports = {}
+
+local TYPES = {
+    coil     = { fc = codec.READ_COILS,             max = codec.MAX_READ_BITS },
+    discrete = { fc = codec.READ_DISCRETE_INPUTS,   max = codec.MAX_READ_BITS },
+    holding  = { fc = codec.READ_HOLDING_REGISTERS, max = codec.MAX_READ_REGISTERS },
+    input    = { fc = codec.READ_INPUT_REGISTERS,   max = codec.MAX_READ_REGISTERS }
+}
+
+exports.TYPES = TYPES
+
+local Poller = core.Emitter:extend()
+exports.Poller = Poller
+
+-- @param {Client} client 异步 Modbus 客户端
+-- @param {object} options
+--  - interval {number} 默认的轮询周期 (毫秒), 默认为 1000
+--  - maxGap {number} 两个点之间最多间隔多少个地址时合并为一个请求, 默认为 8
+--  - maxCount {number} 每个请求最多读取的数量, 默认为 PDU 允许的最大数量
+function Poller:initialize(client, options)
+    options = options or {}
+
+    self.client   = client
+    self.interval = options.interval or 1000
+    self.maxGap   = options.maxGap or 8
+    self.maxCount = options.maxCount
+
+    self.points = {} -- 所有采集点
+    self.groups = {} -- 合并后的读请求
+    self.timers = {}
+
+    self.stats = { requests = 0, errors = 0, changes = 0 }
+end
+
+-- 添加一个采集点
+-- @param {object} point
+--  - name {string} 名称, 可选
+--  - slave {number} 从机地址, 默认为客户端的默认从机地址
+--  - type {string} 'holding', 'input', 'coil' 或 'discrete', 默认为 'holding'
+--  - address {number} 地址
+--  - interval {number} 轮询周期 (毫秒)
+-- @param {function} onChange 可选, function(value, oldValue, point)
+-- @return point
+function Poller:add(point, onChange)
+    local pointType = point.type or 'holding'
+    if (not TYPES[pointType]) then
+        error('invalid point type: ' .. tostring(pointType))
+    end
+
+    point.type = pointType
+    point.slave = point.slave or self.client.slave
+    point.interval = point.interval or self.interval
+    point.onChange = onChange or point.onChange
+
+    table.insert(self.points, point)
+    self:_reschedule()
+    return point
+end
+
+function Poller:remove(point)
+    for i = 1, #self.points do
+        if (self.points[i] == point) then
+            table.remove(self.points, i)
+            self:_reschedule()
+            return true
+        end
+    end
+
+    return false
+end
+
+function Poller:start()
+    if (self.started) then
+        return
+    end
+
+    self.started = true
+    self.generation = (self.generation or 0) + 1
+    self.groups = exports.coalesce(self.points, self.maxGap, self.maxCount)
+
+    -- 同一个周期的请求均匀分布在这个周期内
+    local byInterval = {}
+    for _, group in ipairs(self.groups) do
+        local list = byInterval[group.interval]
+        if (not list) then
+            list = {}
+            byInterval[group.interval] = list
+        end
+        table.insert(list, group)
+    end
+
+    for interval, list in pairs(byInterval) do
+        for index, group in ipairs(list) do
+            local offset = math.floor(interval * (index - 1) / #list)
+            self:_schedule(group, offset)
+        end
+    end
+end
+
+function Poller:stop()
+    self.started = false
+
+    for timer in pairs(self.timers) do
+        clearTimeout(timer)
+    end
+
+    self.timers = {}
+end
+
+-- 立即读取所有的点一次
+function Poller:poll()
+    for _, group in ipairs(self.groups) do
+        self:_read(group)
+    end
+end
+
+-------------------------------------------------------------------------------
+-- internal
+
+function Poller:_reschedule()
+    if (self.started) then
+        self:stop()
+        self:start()
+    end
+end
+
+function Poller:_schedule(group, delay)
+    local generation = self.generation
+
+    local timer
+    timer = setTimeout(delay, function()
+        self.timers[timer] = nil
+        if (generation ~= self.generation) or (not self.started) then
+            return
+        end
+
+        local startTime = uv.now()
+        self:_read(group, function()
+            -- 调度器已经停止或者重新分组了
+            if (generation ~= self.generation) or (not self.started) then
+                return
+            end
+
+            -- 下一个周期从这次开始读的时间算起
+            local elapsed = uv.now() - startTime
+            self:_schedule(group, math.max(0, group.interval - elapsed))
+        end)
+    end)
+
+    self.timers[timer] = true
+end
+
+function Poller:_read(group, callback)
+    -- 上一个请求还没有完成时跳过这一次
+    if (group.pending) then
+        if (callback) then callback() end
+        return
+    end
+
+    group.pending = true
+    self.stats.requests = self.stats.requests + 1
+
+    self.client:request(group.slave, group.fc, group.address, group.count, function(err, values)
+        group.pending = false
+
+        if (err) then
+            self.stats.errors = self.stats.errors + 1
+            self:emit('error', err, group)
+
+        else
+            self:_update(group, values)
+        end
+
+        if (callback) then callback() end
+    end)
+end
+
+function Poller:_update(group, values)
+    for _, point in ipairs(group.points) do
+        local value = values[point.address - group.address + 1]
+        local oldValue = point.value
+        if (value ~= oldValue) then
+            point.value = value
+            self.stats.changes = self.stats.changes + 1
+
+            if (point.onChange) then
+                point.onChange(value, oldValue, point)
+            end
+
+            self:emit('change', point, value, oldValue)
+        end
+    end
+end
+
+-------------------------------------------------------------------------------
+-- exports
+
+-- 把采集点合并为尽量少的读请求
+-- @param {array} points 采集点
+-- @param {number} maxGap 两个点之间最多间隔多少个地址时合并
+-- @param {number} maxCount 可选, 每个请求最多读取的数量
+-- @return {array} groups, 每个 group 为 { slave, fc, interval, address, count, points }
+function exports.coalesce(points, maxGap, maxCount)
+    maxGap = maxGap or 0
+
+    -- 按从机, 类型和周期分组
+    local buckets = {}
+    local keys = {}
+    for _, point in ipairs(points) do
+        local key = point.slave .. ':' .. point.type .. ':' .. point.interval
+        local bucket = buckets[key]
+        if (not bucket) then
+            bucket = {}
+            buckets[key] = bucket
+            table.insert(keys, key)
+        end
+        table.insert(bucket, point)
+    end
+
+    local groups = {}
+    for _, key in ipairs(keys) do
+        local bucket = buckets[key]
+        table.sort(bucket, function(a, b) return a.address < b.address end)
+
+        local first = bucket[1]
+        local info = TYPES[first.type]
+        local limit = math.min(maxCount or info.max, info.max)
+
+        local group
+        for _, point in ipairs(bucket) do
+            local last = group and (group.address + group.count - 1)
+            if (group) and (point.address - last - 1 <= maxGap)
+                and (point.address - group.address + 1 <= limit) then
+                group.count = math.max(group.count, point.address - group.address + 1)
+                table.insert(group.points, point)
+
+            else
+                group = {
+                    slave = first.slave,
+                    fc = info.fc,
+                    interval = first.interval,
+                    address = point.address,
+                    count = 1,
+                    points = { point }
+                }
+                table.insert(groups, group)
+            end
+        end
+    end
+
+    return groups
+end
+
+-- 创建一个轮询调度器
+function exports.createPoller(client, options)
+    return Poller:new(client, options)
+end
+
+return exports
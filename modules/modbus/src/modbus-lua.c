@@ -134,6 +134,34 @@ static int lmodbus_error(lua_State *L, int status)
     return 2;
 }
 
+// 创建 RTU 上下文, 不像 `new` 那样根据端口号判断类型, 所以支持任意波特率
+static int lmodbus_new_rtu(lua_State *L)
+{
+    const char *device = luaL_checkstring(L, 1);
+    int baud = (int)luaL_optinteger(L, 2, 9600);
+    char parity = (char)luaL_optinteger(L, 3, 'N'); // N: 78, O: 79, E: 69
+    int data_bit = (int)luaL_optinteger(L, 4, 8);
+    int stop_bit = (int)luaL_optinteger(L, 5, 1);
+
+    modbus_t *modbus = modbus_new_rtu(device, baud, parity, data_bit, stop_bit);
+    if (modbus == NULL)
+    {
+        return lmodbus_error(L, errno);
+    }
+
+    l_modbus_t *self = (l_modbus_t *)lua_newuserdata(L, sizeof(l_modbus_t));
+    luaL_getmetatable(L, LUV_MODBUS);
+    lua_setmetatable(L, -2);
+
+    self->modbus = modbus;
+    self->mb_mapping = NULL;
+    self->use_backend = RTU;
+    self->fd = -1;
+
+    uv_mutex_init(&self->lock);
+    return 1;
+}
+
 static int lmodbus_connect(lua_State *L)
 {
     l_modbus_t *self = lmodbus_check(L, 1);
@@ -554,6 +582,7 @@ static const struct luaL_Reg modbus_func[] = {
 static const struct luaL_Reg modbus_lib[] = {
     {"version", lmodbus_version},
     {"new", lmodbus_new},
+    {"newRTU", lmodbus_new_rtu},
     {NULL, NULL},
 };
 
@@ -0,0 +1,420 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local net    = require('net')
+local thread = require('thread')
+local modbus = require('modbus')
+
+local codec = modbus.codec
+
+local HOST = "127.0.0.1"
+local PORT = 10502
+
+-- lmodbus.new 根据端口号判断类型, 小于 9600 时为 TCP
+local LMODBUS_PORT = 5502
+
+-- 需要编译 lmodbus, RTU 测试还需要 lsdl (BUILD_DEVICES) 创建伪终端
+local _, lmodbus = pcall(require, 'lmodbus')
+local _, luart = pcall(require, 'lsdl.uart')
+if (type(lmodbus) ~= 'table') then lmodbus = nil end
+if (type(luart) ~= 'table') then luart = nil end
+
+local tap = require('ext/tap')
+local test = tap.test
+
+-- 一个简单的 Modbus TCP 从机, 地址 1 的响应会延迟, 用来测试乱序的响应,
+-- 地址 9 不会响应, 地址 8 会关闭连接
+local function createSlave(registers)
+    local server = net.createServer(function(connection)
+        local buffer = ''
+        connection:on('data', function(chunk)
+            buffer = buffer .. chunk
+
+            while true do
+                local tid, unit, pdu, nextPosition = codec.decodeTcpFrame(buffer, 1)
+                if (not tid) then
+                    break
+                end
+                buffer = buffer:sub(nextPosition)
+
+                local fc, address, count = string.unpack('>BI2I2', pdu)
+                local response
+                if (fc == codec.READ_HOLDING_REGISTERS) then
+                    if (address + count > #registers) then
+                        response = string.char(fc | 0x80, 2)
+                    else
+                        local words = {}
+                        for i = 1, count do
+                            words[i] = string.pack('>I2', registers[address + i])
+                        end
+                        response = string.pack('>Bs1', fc, table.concat(words))
+                    end
+
+                elseif (fc == codec.WRITE_SINGLE_REGISTER) then
+                    registers[address + 1] = count
+                    response = pdu
+
+                else
+                    response = string.char(fc | 0x80, 1)
+                end
+
+                local frame = codec.encodeTcpFrame(tid, unit, response)
+                if (unit == 8) then
+                    connection:destroy()
+                    return
+
+                elseif (unit == 1) then
+                    setTimeout(50, function() connection:write(frame) end)
+                elseif (unit ~= 9) then
+                    connection:write(frame)
+                end
+            end
+        end)
+
+        connection:on('end', function()
+            connection:destroy()
+        end)
+    end)
+
+    server:listen(PORT, HOST)
+    return server
+end
+
+-- 在线程中运行 libmodbus 的从机 (mapping), 和上面的从机不同, 它不使用 codec,
+-- 可以检查客户端的报文和 libmodbus 是否兼容
+local function startMappingServer()
+    return thread.start(function(host, port)
+        local lmodbus = require('lmodbus')
+        local server = lmodbus.new(host, port)
+        server:newMapping(0, 100)
+        for i = 0, 99 do
+            server:setMapping(1, i, i * 10)
+        end
+
+        -- 等待一个连接, 直到连接断开
+        server:listen()
+        while (server:receive()) do end
+        server:close()
+    end, HOST, LMODBUS_PORT)
+end
+
+-- 等待线程中的从机开始监听
+local function waitForServer(client, callback, retries)
+    retries = retries or 0
+    client:readHoldingRegisters(nil, 0, 1, function(err)
+        if (err) and (retries < 50) then
+            setTimeout(20, function()
+                waitForServer(client, callback, retries + 1)
+            end)
+            return
+        end
+
+        callback(err)
+    end)
+end
+
+test("modbus codec", function()
+    -- 01 03 00 00 00 0A C5 CD
+    local frame = codec.encodeRtuFrame(1, codec.encodeRequest(codec.READ_HOLDING_REGISTERS, 0, 10))
+    assert(frame == '\x01\x03\x00\x00\x00\x0A\xC5\xCD')
+
+    local response = '\x01\x03\x04\x00\x01\x00\x02'
+    response = response .. string.pack('<I2', codec.crc16(response))
+
+    -- 不完整的帧
+    assert(codec.decodeRtuFrame(response:sub(1, 5), 1) == nil)
+
+    local slave, pdu, nextPosition = codec.decodeRtuFrame(response, 1)
+    assert(slave == 1)
+    assert(nextPosition == #response + 1)
+
+    local values = codec.decodeResponse(pdu, 2)
+    assert(values[1] == 1 and values[2] == 2)
+
+    -- CRC 错误
+    assert(codec.decodeRtuFrame(response:sub(1, -2) .. '\0', 1) == false)
+
+    local bits = codec.decodeResponse('\x01\x01\x05', 3)
+    assert(bits[1] == 1 and bits[2] == 0 and bits[3] == 1)
+
+    local _, err, code = codec.decodeResponse('\x83\x02', 1)
+    assert(err and code == 2)
+end)
+
+test("modbus tcp pipelining", function(expect)
+    local registers = {}
+    for i = 1, 100 do registers[i] = i * 10 end
+
+    local server = createSlave(registers)
+    local client = modbus.createClient({ host = HOST, port = PORT })
+
+    -- 从机 1 的响应较慢, 从机 2 的请求不用等待它
+    local order = {}
+    client:readHoldingRegisters(1, 0, 4, expect(function(err, values)
+        assert(not err, err)
+        assert(values[1] == 10 and values[4] == 40)
+        order[#order + 1] = 1
+
+        assert(order[1] == 2)
+        assert(client.stats.requests == 2)
+
+        client:close()
+        server:close()
+    end))
+
+    client:readHoldingRegisters(2, 10, 2, expect(function(err, values)
+        assert(not err, err)
+        assert(values[1] == 110 and values[2] == 120)
+        order[#order + 1] = 2
+    end))
+end)
+
+test("modbus write, exception and timeout", function(expect)
+    local registers = { 0, 0, 0 }
+    local server = createSlave(registers)
+    local client = modbus.createClient({ host = HOST, port = PORT, slave = 2 })
+    client:setTimeout(100, 9)
+
+    client:writeRegister(nil, 1, 1234, expect(function(err, result)
+        assert(not err, err)
+        assert(result == true)
+        assert(registers[2] == 1234)
+    end))
+
+    client:readHoldingRegisters(nil, 2, 10, expect(function(err, values)
+        assert(not values)
+        assert(err:find('exception 2'))
+    end))
+
+    -- 从机 9 不会响应
+    client:readHoldingRegisters(9, 0, 1, expect(function(err)
+        assert(err == 'timeout')
+        assert(client.stats.timeouts == 1)
+
+        client:close()
+        server:close()
+    end))
+end)
+
+test("modbus reconnect after the slave closes", function(expect)
+    local registers = { 7 }
+    local server = createSlave(registers)
+    local client = modbus.createClient({ host = HOST, port = PORT, slave = 2, maxInFlight = 1 })
+
+    -- 已发送的请求失败, 排队的请求在重新连接后发送
+    client:readHoldingRegisters(8, 0, 1, expect(function(err)
+        assert(err == 'connection closed')
+    end))
+
+    client:readHoldingRegisters(nil, 0, 1, expect(function(err, values)
+        assert(not err, err)
+        assert(values[1] == 7)
+
+        client:close()
+        server:close()
+    end))
+end)
+
+test("modbus tcp with libmodbus slave", function(expect)
+    if (not lmodbus) then
+        print('lmodbus not found, skip')
+        return
+    end
+
+    local server = startMappingServer()
+    local client = modbus.createClient({ host = HOST, port = LMODBUS_PORT })
+
+    waitForServer(client, expect(function(err)
+        assert(not err, err)
+
+        -- libmodbus 每次只处理一个请求, 同时发送的请求会依次响应
+        client:readHoldingRegisters(nil, 0, 4, expect(function(err, values)
+            assert(not err, err)
+            assert(values[1] == 0 and values[4] == 30)
+        end))
+
+        client:writeRegister(nil, 5, 1234, expect(function(err, result)
+            assert(not err, err)
+            assert(result == true)
+        end))
+
+        client:readHoldingRegisters(nil, 4, 2, expect(function(err, values)
+            assert(not err, err)
+            assert(values[1] == 40 and values[2] == 1234)
+        end))
+
+        client:readHoldingRegisters(nil, 98, 10, expect(function(err, values)
+            assert(not values)
+            assert(err:find('exception 2'))
+
+            client:close()
+            setTimeout(10, function()
+                server:join()
+            end)
+        end))
+    end))
+end)
+
+test("modbus rtu over a pty", function(expect)
+    if (not lmodbus) or (not luart) then
+        print('lmodbus or lsdl.uart not found, skip')
+        return
+    end
+
+    local uart = require('devices/hal/uart')
+
+    local fd, name = luart.openpty()
+    assert(fd, name)
+
+    -- 另一端 (主设备) 用固定的报文模拟从机 2
+    local READ_REQUEST  = '\x02\x03\x00\x00\x00\x01\x84\x39'
+    local READ_RESPONSE = '\x02\x03\x02\x00\x07\xBD\x86'
+    local WRITE_REQUEST = '\x02\x06\x00\x01\x12\x34\xD5\x4E'
+
+    local peer = uart.open(nil, { fd = fd })
+    local requests = {}
+    local buffer = ''
+    peer:on('data', function(data)
+        buffer = buffer .. data
+
+        -- 这两种请求都是 8 个字节
+        while (#buffer >= 8) do
+            local request = buffer:sub(1, 8)
+            buffer = buffer:sub(9)
+            requests[#requests + 1] = request
+
+            if (#requests == 1) then
+                -- CRC 错误的响应
+                peer:write(READ_RESPONSE:sub(1, -2) .. '\0')
+
+            elseif (request == READ_REQUEST) then
+                -- 响应分两次到达
+                peer:write(READ_RESPONSE:sub(1, 3))
+                setTimeout(20, function()
+                    peer:write(READ_RESPONSE:sub(4))
+                end)
+
+            else
+                -- 写单个寄存器的响应和请求相同
+                peer:write(request)
+            end
+        end
+    end)
+
+    local client = modbus.createClient({ device = name, slave = 2, timeout = 200 })
+
+    -- CRC 错误时丢弃收到的数据, 这个请求超时, 下一个请求不受影响
+    client:readHoldingRegisters(nil, 0, 1, expect(function(err)
+        assert(err == 'timeout')
+        assert(client.stats.timeouts == 1 and client.stats.errors == 2)
+    end))
+
+    client:readHoldingRegisters(nil, 0, 1, expect(function(err, values)
+        assert(not err, err)
+        assert(values[1] == 7)
+    end))
+
+    client:writeRegister(nil, 1, 0x1234, expect(function(err, result)
+        assert(not err, err)
+        assert(result == true)
+        assert(requests[1] == READ_REQUEST and requests[3] == WRITE_REQUEST)
+
+        peer:close()
+        client:close()
+    end))
+end)
+
+test("modbus promise", function(expect)
+    local registers = { 7 }
+    local server = createSlave(registers)
+    local client = modbus.createClient({ host = HOST, port = PORT, slave = 2 })
+
+    client:readHoldingRegisters(nil, 0, 1):next(expect(function(values)
+        assert(values[1] == 7)
+        client:close()
+        server:close()
+    end))
+end)
+
+test("modbus poller coalesce", function()
+    local points = {
+        { slave = 1, type = 'holding', address = 5, interval = 100 },
+        { slave = 1, type = 'holding', address = 0, interval = 100 },
+        { slave = 1, type = 'holding', address = 2, interval = 100 },
+        { slave = 1, type = 'holding', address = 40, interval = 100 },
+        { slave = 1, type = 'holding', address = 200, interval = 100 },
+        { slave = 1, type = 'holding', address = 320, interval = 100 },
+        { slave = 1, type = 'coil', address = 1, interval = 100 },
+        { slave = 2, type = 'holding', address = 1, interval = 100 }
+    }
+
+    local coalesce = require('modbus/poller').coalesce
+    local groups = coalesce(points, 8)
+
+    -- [0..5], [40], [200], [320], coil [1], slave 2 [1]
+    assert(#groups == 6)
+    assert(groups[1].address == 0 and groups[1].count == 6 and #groups[1].points == 3)
+    assert(groups[2].address == 40 and groups[2].count == 1)
+
+    -- 不超过 PDU 允许的最大数量
+    groups = coalesce(points, 1000)
+    assert(groups[1].address == 0 and groups[1].count == 41)
+    assert(groups[2].address == 200 and groups[2].count == 121)
+end)
+
+test("modbus poller", function(expect)
+    local registers = {}
+    for i = 1, 50 do registers[i] = i end
+
+    local server = createSlave(registers)
+    local client = modbus.createClient({ host = HOST, port = PORT, slave = 2 })
+    local poller = modbus.createPoller(client, { interval = 50 })
+
+    local changes = {}
+    poller:on('change', function(point, value)
+        changes[#changes + 1] = point.name .. '=' .. value
+    end)
+
+    poller:add({ name = 'a', address = 0 })
+    poller:add({ name = 'b', address = 3 })
+    poller:add({ name = 'c', address = 7 }, expect(function(value, oldValue)
+        assert(value == 8 and oldValue == nil)
+    end))
+
+    poller:start()
+    assert(#poller.groups == 1)
+
+    setTimeout(120, function()
+        -- 三个点只需要一个请求, 没有变化的值不会再通知
+        assert(#changes == 3)
+        assert(poller.stats.requests >= 2)
+
+        registers[4] = 100
+    end)
+
+    setTimeout(240, expect(function()
+        assert(#changes == 4)
+        assert(changes[4] == 'b=100')
+        assert(poller.stats.requests == client.stats.requests)
+
+        poller:stop()
+        client:close()
+        server:close()
+    end))
+end)
+
+tap.run()
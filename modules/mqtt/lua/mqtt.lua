@@ -17,6 +17,7 @@ limitations under the License.
 --]]
 local core  = require('core')
 local uv    = require('luv')
+local dns   = require('dns')
 
 local packet = require('mqtt/packet')
 local Packet = packet.Packet
@@ -385,24 +386,29 @@ function MQTTSocket:_onStartConnect()
     end
 
     -- #4. query dns
+    -- 端口也可以是服务名称 (比如 'mqtt'), 通过 dns.lookupPort 解析
     local hostname  = self.options.hostname
-    local port      = self.options.port
-    local options   = { socktype = "stream" }
-    uv.getaddrinfo(hostname, port, options, function(err, res)
+    dns.lookupPort(self.options.port, function(err, port)
         if err then
             self:_onFailedEvent('query dns failed: ' .. tostring(err))
+            return
+        end
 
-        elseif (not self.clientSocket) then
-            self:_onFailedEvent('query dns failed: invalid socket')
+        dns.lookup(hostname, function(err, address)
+            if err then
+                self:_onFailedEvent('query dns failed: ' .. tostring(err))
 
-        elseif (not res) or (not res[1]) then
-            self:_onFailedEvent('query dns failed: invalid response')
+            elseif (not self.clientSocket) then
+                self:_onFailedEvent('query dns failed: invalid socket')
 
-        else
-            local dest = res[1]
-            self.state.address = { dest.addr, dest.port }
-            self.clientSocket:connect(dest.addr, dest.port, _onConnectCallback)
-        end
+            elseif (not address) then
+                self:_onFailedEvent('query dns failed: invalid response')
+
+            else
+                self.state.address = { address, port }
+                self.clientSocket:connect(address, port, _onConnectCallback)
+            end
+        end)
     end)
 
     return 0
@@ -0,0 +1,736 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local core   = require('core')
+local net    = require('net')
+local path   = require('path')
+local thread = require('thread')
+
+-------------------------------------------------------------------------------
+-- 异步 SQLite 数据库
+--
+-- 所有的 SQL 语句都在一个单独的工作线程中执行, 这个线程有自己的数据库连接,
+-- 慢的写入或者 VACUUM 不会阻塞主线程的网络 I/O.
+--
+-- - 主线程和工作线程之间通过本地管道通信, 每个消息为 4 字节长度 + 二进制编码的值
+-- - 工作线程按 SQL 文本缓存预编译的语句 (LRU), 重复执行时不需要重新编译
+-- - 查询结果为打包的数组: 所有行的值按顺序放在同一个数组中, 而不是每行一个表
+--
+-- 注意: 工作线程和主线程在不同的虚拟机中运行, 参数和结果只能是 nil, 布尔值,
+-- 数字, 字符串和由这些值组成的表.
+
+local exports = {}
+
+exports.settings = {
+    cacheSize = 32 -- 每个连接最多缓存的预编译语句数
+}
+
+-------------------------------------------------------------------------------
+-- 消息编码
+
+local spack   = string.pack
+local sunpack = string.unpack
+local mtype   = math.type
+
+local function encodeValue(value, parts)
+    local valueType = type(value)
+    if (value == nil) then
+        parts[#parts + 1] = 'N'
+
+    elseif (valueType == 'boolean') then
+        parts[#parts + 1] = value and 'T' or 'F'
+
+    elseif (valueType == 'number') then
+        if (mtype(value) == 'integer') then
+            parts[#parts + 1] = spack('>c1i8', 'I', value)
+        else
+            parts[#parts + 1] = spack('>c1d', 'D', value)
+        end
+
+    elseif (valueType == 'string') then
+        parts[#parts + 1] = spack('>c1s4', 'S', value)
+
+    elseif (valueType == 'table') then
+        -- 数组部分只由 value.n 决定 (可以包含 nil), 没有 n 的表的整数键
+        -- 都按普通键值对编码, 因为有空洞时 #value 是不确定的
+        local count = value.n or 0
+        parts[#parts + 1] = spack('>c1I4', 'A', count)
+        for i = 1, count do
+            encodeValue(value[i], parts)
+        end
+
+        local keys = {}
+        for key in pairs(value) do
+            if (mtype(key) ~= 'integer') or (key < 1) or (key > count) then
+                keys[#keys + 1] = key
+            end
+        end
+
+        parts[#parts + 1] = spack('>I4', #keys)
+        for _, key in ipairs(keys) do
+            encodeValue(key, parts)
+            encodeValue(value[key], parts)
+        end
+
+    else
+        error('unsupported value type: ' .. valueType)
+    end
+end
+
+local function decodeValue(data, position)
+    local tag = sunpack('c1', data, position)
+    position = position + 1
+
+    if (tag == 'N') then
+        return nil, position
+
+    elseif (tag == 'T') then
+        return true, position
+
+    elseif (tag == 'F') then
+        return false, position
+
+    elseif (tag == 'I') then
+        return sunpack('>i8', data, position)
+
+    elseif (tag == 'D') then
+        return sunpack('>d', data, position)
+
+    elseif (tag == 'S') then
+        return sunpack('>s4', data, position)
+
+    elseif (tag == 'A') then
+        local count
+        count, position = sunpack('>I4', data, position)
+
+        local value = {}
+        for i = 1, count do
+            value[i], position = decodeValue(data, position)
+        end
+
+        local keys
+        keys, position = sunpack('>I4', data, position)
+        for _ = 1, keys do
+            local key
+            key, position = decodeValue(data, position)
+            value[key], position = decodeValue(data, position)
+        end
+
+        return value, position
+    end
+
+    error('invalid message')
+end
+
+-- 编码一个消息, 返回 4 字节长度 + 内容
+function exports.encode(message)
+    local parts = {}
+    encodeValue(message, parts)
+
+    local data = table.concat(parts)
+    return spack('>s4', data)
+end
+
+-- 解析 buffer 中 position 位置开始的一个消息
+-- @return message, nextPosition; 数据不完整时返回 nil
+function exports.decode(buffer, position)
+    if (#buffer - position + 1 < 4) then
+        return nil
+    end
+
+    local length = sunpack('>I4', buffer, position)
+    if (#buffer - position + 1 < length + 4) then
+        return nil
+    end
+
+    local message = decodeValue(buffer, position + 4)
+    return message, position + 4 + length
+end
+
+local function readMessages(socket, onMessage)
+    local buffer = ''
+
+    socket:on('data', function(chunk)
+        buffer = buffer .. chunk
+
+        local position = 1
+        while true do
+            local message, nextPosition = exports.decode(buffer, position)
+            if (not nextPosition) then
+                break
+            end
+
+            position = nextPosition
+            onMessage(message)
+        end
+
+        if (position > 1) then
+            buffer = buffer:sub(position)
+        end
+    end)
+end
+
+-------------------------------------------------------------------------------
+-- Database
+
+local Database = core.Emitter:extend()
+exports.Database = Database
+
+local nextDatabaseId = 1
+
+-- @param {string} filename 数据库文件名, ':memory:' 表示内存数据库
+-- @param {object} options
+--  - cacheSize {number} 最多缓存的预编译语句数
+--  - busyTimeout {number} 数据库被锁定时的等待时间 (毫秒)
+function Database:initialize(filename, options)
+    options = options or {}
+
+    self.filename  = filename
+    self.callbacks = {}
+    self.pending   = {} -- 工作线程连接之前的请求
+    self.requestId = 0
+
+    local name = 'lnode-sqlite-' .. process.pid .. '-' .. nextDatabaseId
+    nextDatabaseId = nextDatabaseId + 1
+
+    local ipcPath
+    if (os.platform() == 'win32') then
+        ipcPath = '\\\\.\\pipe\\' .. name
+    else
+        ipcPath = path.join(os.tmpdir, name .. '.sock')
+        os.remove(ipcPath)
+    end
+
+    self.ipcPath = ipcPath
+
+    -- 只接受工作线程的一个连接
+    local server
+    server = net.createServer(function(socket)
+        server:close()
+        self.server = nil
+        self:_setSocket(socket)
+    end)
+
+    server:on('error', function(err)
+        self:_onClose(err)
+    end)
+
+    server:listen(ipcPath)
+    self.server = server
+
+    local cacheSize = options.cacheSize or exports.settings.cacheSize
+    self.thread = thread.start(exports._workerEntry, ipcPath, filename,
+        cacheSize, options.busyTimeout or 0)
+end
+
+-- 执行一个或多个 SQL 语句, 不返回结果
+-- @param {string} sql
+-- @param {function} callback function(err)
+function Database:exec(sql, callback)
+    return self:_request('exec', sql, nil, callback)
+end
+
+-- 执行一个查询语句
+-- @param {string} sql
+-- @param {table} params 可选, 参数数组, 或者以参数名 (不含 ':', '$' 或 '@') 为键的表
+-- @param {function} callback function(err, result)
+--  result 为 { columns = 列名数组, values = 所有行的值, count = 行数 },
+--  第 i 行第 j 列的值为 values[(i - 1) * #columns + j]
+function Database:query(sql, params, callback)
+    if (type(params) == 'function') then
+        callback, params = params, nil
+    end
+
+    return self:_request('query', sql, params, callback)
+end
+
+-- 执行一个修改数据的语句
+-- @param {function} callback function(err, result)
+--  result 为 { changes = 修改的行数, lastInsertRowid = 最后插入的行 ID }
+function Database:run(sql, params, callback)
+    if (type(params) == 'function') then
+        callback, params = params, nil
+    end
+
+    return self:_request('run', sql, params, callback)
+end
+
+-- 在一个事务中用多组参数执行同一个语句, 出错时回滚整个事务
+-- @param {string} sql
+-- @param {table} rows 参数数组的数组
+-- @param {function} callback function(err, result)
+--  result 为 { changes = 修改的总行数 }
+function Database:executeMany(sql, rows, callback)
+    return self:_request('executeMany', sql, rows, callback)
+end
+
+-- 返回工作线程中语句缓存的统计信息
+function Database:getStats(callback)
+    return self:_request('stats', nil, nil, callback)
+end
+
+-- 关闭数据库连接, 工作线程会在完成所有请求后退出
+function Database:close(callback)
+    if (self.closing) then
+        if (callback) then callback() end
+        return
+    end
+
+    local result = self:_request('close', nil, nil, callback)
+    self.closing = true
+    return result
+end
+
+-- 将查询结果展开为每行一个表, 以列名为键
+function exports.toRows(result)
+    local rows = {}
+    local columns = result.columns
+    local columnCount = #columns
+    local values = result.values
+
+    for i = 1, result.count do
+        local row = {}
+        local offset = (i - 1) * columnCount
+        for j = 1, columnCount do
+            row[columns[j]] = values[offset + j]
+        end
+        rows[i] = row
+    end
+
+    return rows
+end
+
+function Database:_request(op, sql, params, callback)
+    local promise
+    if (not callback) then
+        local Promise = require('promise')
+        promise = Promise.new()
+        callback = function(err, result)
+            if (err) then
+                promise:reject(err)
+            else
+                promise:resolve(result)
+            end
+        end
+    end
+
+    if (self.closing) or (self.closed) then
+        callback('database closed')
+        return promise
+    end
+
+    self.requestId = self.requestId + 1
+    local id = self.requestId
+    self.callbacks[id] = callback
+
+    local ok, message = pcall(exports.encode, table.pack(id, op, sql, params))
+    if (not ok) then
+        self.callbacks[id] = nil
+        callback(message)
+        return promise
+    end
+
+    if (self.socket) then
+        self.socket:write(message)
+    else
+        table.insert(self.pending, message)
+    end
+
+    return promise
+end
+
+function Database:_setSocket(socket)
+    self.socket = socket
+
+    readMessages(socket, function(message)
+        local id, err, result = message[1], message[2], message[3]
+        local callback = self.callbacks[id]
+        self.callbacks[id] = nil
+
+        if (callback) then
+            callback(err, result)
+        end
+    end)
+
+    socket:on('error', function(err)
+        self:_onClose(err)
+    end)
+
+    socket:on('close', function()
+        self:_onClose()
+    end)
+
+    for _, message in ipairs(self.pending) do
+        socket:write(message)
+    end
+
+    self.pending = {}
+end
+
+function Database:_onClose(err)
+    if (self.closed) then
+        return
+    end
+
+    self.closed = true
+
+    if (self.server) then
+        self.server:close()
+        self.server = nil
+    end
+
+    if (self.socket) then
+        self.socket:destroy()
+        self.socket = nil
+    end
+
+    if (os.platform() ~= 'win32') then
+        os.remove(self.ipcPath)
+    end
+
+    local callbacks = self.callbacks
+    self.callbacks = {}
+    for _, callback in pairs(callbacks) do
+        callback(err or 'database closed')
+    end
+
+    self:emit('close', err)
+end
+
+-------------------------------------------------------------------------------
+-- worker
+
+-- 工作线程的入口, 这个函数会被 string.dump, 所以不能使用任何 upvalue
+function exports._workerEntry(ipcPath, filename, cacheSize, busyTimeout)
+    require('sqlite/async')._startWorker(ipcPath, filename, cacheSize, busyTimeout)
+end
+
+-- 预编译语句的 LRU 缓存
+local StatementCache = core.Object:extend()
+
+function StatementCache:initialize(api, handle, size)
+    self.api     = api
+    self.handle  = handle
+    self.size    = size
+    self.entries = {}
+    self.count   = 0
+    self.tick    = 0
+    self.stats   = { hits = 0, misses = 0, evictions = 0 }
+end
+
+function StatementCache:get(sql)
+    local api = self.api
+    self.tick = self.tick + 1
+
+    local entry = self.entries[sql]
+    if (entry) then
+        entry.tick = self.tick
+        self.stats.hits = self.stats.hits + 1
+        return entry
+    end
+
+    self.stats.misses = self.stats.misses + 1
+
+    local status, stmt, remaining = api.prepare(self.handle, sql)
+    if (status ~= 0) then
+        return nil, api.errmsg(self.handle)
+    end
+
+    if (remaining) and (remaining:find('%S')) then
+        api.finalize(stmt)
+        return nil, 'only one statement is allowed'
+    end
+
+    -- 参数名 (去掉 ':', '$' 或 '@' 前缀) 只在编译时计算一次
+    local names = {}
+    for index = 1, api.bind_parameter_count(stmt) do
+        names[index] = api.bind_parameter_name_x(stmt, index) or false
+    end
+
+    if (self.count >= self.size) then
+        self:_evict()
+    end
+
+    entry = { stmt = stmt, names = names, tick = self.tick }
+    self.entries[sql] = entry
+    self.count = self.count + 1
+    return entry
+end
+
+function StatementCache:_evict()
+    local oldestSql, oldest
+    for sql, entry in pairs(self.entries) do
+        if (not oldest) or (entry.tick < oldest.tick) then
+            oldestSql, oldest = sql, entry
+        end
+    end
+
+    if (oldest) then
+        self.api.finalize(oldest.stmt)
+        self.entries[oldestSql] = nil
+        self.count = self.count - 1
+        self.stats.evictions = self.stats.evictions + 1
+    end
+end
+
+function StatementCache:clear()
+    for _, entry in pairs(self.entries) do
+        self.api.finalize(entry.stmt)
+    end
+
+    self.entries = {}
+    self.count = 0
+end
+
+function exports._startWorker(ipcPath, filename, cacheSize, busyTimeout)
+    local lsqlite = require('lsqlite')
+    local api, ERR = lsqlite.api, lsqlite.errors
+
+    -- 线程参数中的数字都会变为浮点数
+    cacheSize = math.tointeger(cacheSize) or exports.settings.cacheSize
+    busyTimeout = math.tointeger(busyTimeout) or 0
+
+    local openError
+    local status, handle = api.open(filename)
+    if (status ~= ERR.OK) then
+        openError = api.errmsg(handle) or 'open failed'
+        api.close(handle)
+        handle = nil
+
+    elseif (busyTimeout > 0) then
+        api.busy_timeout(handle, busyTimeout)
+    end
+
+    local cache = handle and StatementCache:new(api, handle, cacheSize)
+
+    local function lastError()
+        return api.errmsg(handle) or 'unknown error'
+    end
+
+    local function bind(entry, params)
+        local stmt = entry.stmt
+        api.reset(stmt)
+
+        local names = entry.names
+        for index = 1, #names do
+            local value
+            if (params) then
+                value = params[index]
+                if (value == nil) and (names[index]) then
+                    value = params[names[index]]
+                end
+            end
+
+            if (api.bind(stmt, index, value) ~= ERR.OK) then
+                return nil, lastError()
+            end
+        end
+
+        return stmt
+    end
+
+    -- 执行到结束, 返回 nil 或错误信息
+    local function step(stmt)
+        while true do
+            local ret = api.step(stmt)
+            if (ret == ERR.DONE) then
+                api.reset(stmt)
+                return nil
+
+            elseif (ret ~= ERR.ROW) then
+                local err = lastError()
+                api.reset(stmt)
+                return err
+            end
+        end
+    end
+
+    local operations = {}
+
+    function operations.exec(sql)
+        if (api.exec(handle, sql) ~= ERR.OK) then
+            return lastError()
+        end
+    end
+
+    function operations.query(sql, params)
+        local entry, err = cache:get(sql)
+        local stmt = entry and bind(entry, params)
+        if (not stmt) then
+            return err or lastError()
+        end
+
+        local columnCount = api.column_count(stmt)
+        local columns = {}
+        for i = 1, columnCount do
+            columns[i] = api.column_name(stmt, i - 1)
+        end
+
+        local values = {}
+        local index = 0
+        local count = 0
+
+        while true do
+            local ret = api.step(stmt)
+            if (ret == ERR.ROW) then
+                for i = 0, columnCount - 1 do
+                    index = index + 1
+                    values[index] = api.column(stmt, i)
+                end
+                count = count + 1
+
+            elseif (ret == ERR.DONE) then
+                break
+
+            else
+                err = lastError()
+                api.reset(stmt)
+                return err
+            end
+        end
+
+        api.reset(stmt)
+        values.n = index
+        return nil, { columns = columns, values = values, count = count }
+    end
+
+    function operations.run(sql, params)
+        local entry, err = cache:get(sql)
+        local stmt = entry and bind(entry, params)
+        if (not stmt) then
+            return err or lastError()
+        end
+
+        err = step(stmt)
+        if (err) then
+            return err
+        end
+
+        return nil, {
+            changes = api.changes(handle),
+            lastInsertRowid = api.last_insert_rowid(handle)
+        }
+    end
+
+    function operations.executeMany(sql, rows)
+        local entry, err = cache:get(sql)
+        if (not entry) then
+            return err
+        end
+
+        if (api.exec(handle, 'BEGIN') ~= ERR.OK) then
+            return lastError()
+        end
+
+        local changes = 0
+        for _, row in ipairs(rows or {}) do
+            local stmt
+            stmt, err = bind(entry, row)
+            err = err or (stmt and step(stmt))
+            if (err) then
+                api.exec(handle, 'ROLLBACK')
+                return err
+            end
+
+            changes = changes + api.changes(handle)
+        end
+
+        if (api.exec(handle, 'COMMIT') ~= ERR.OK) then
+            err = lastError()
+            api.exec(handle, 'ROLLBACK')
+            return err
+        end
+
+        return nil, { changes = changes }
+    end
+
+    function operations.stats()
+        local stats = { cached = cache.count, size = cache.size }
+        for key, value in pairs(cache.stats) do
+            stats[key] = value
+        end
+        return nil, stats
+    end
+
+    local socket = net.Socket:new()
+    socket:on('error', function(err)
+        console.log('sqlite: ipc error', err)
+    end)
+
+    local function closeDatabase()
+        if (handle) then
+            cache:clear()
+            api.close(handle)
+            handle = nil
+        end
+    end
+
+    -- 主线程关闭了连接 (close() 也会发出 'end' 事件, 这时还有数据没有发送完)
+    socket:on('end', function()
+        if (not socket._readableState.endEmitted) then
+            return
+        end
+
+        closeDatabase()
+        socket:destroy()
+    end)
+
+    local function onMessage(message)
+        local id, op, sql, params = message[1], message[2], message[3], message[4]
+
+        if (op == 'close') then
+            closeDatabase()
+            socket:write(exports.encode(table.pack(id)))
+            socket:close(function()
+                socket:destroy()
+            end)
+            return
+        end
+
+        local err, result
+        local operation = operations[op]
+        if (openError) or (not handle) then
+            err = openError or 'database closed'
+
+        elseif (not operation) then
+            err = 'unknown operation: ' .. tostring(op)
+
+        else
+            local ok
+            ok, err, result = pcall(operation, sql, params)
+            if (not ok) then
+                result = nil
+            end
+        end
+
+        socket:write(exports.encode(table.pack(id, err, result)))
+    end
+
+    socket:connect(ipcPath, function()
+        readMessages(socket, onMessage)
+    end)
+end
+
+-------------------------------------------------------------------------------
+-- exports
+
+-- 打开一个异步数据库
+function exports.open(filename, options)
+    return Database:new(filename, options)
+end
+
+return exports
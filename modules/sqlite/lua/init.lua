@@ -165,6 +165,11 @@ function sqlite3.open_memory()
   return sqlite3.open(":memory:")
 end
 
+-- Open a database on a dedicated worker thread, see sqlite/async
+function sqlite3.open_async(filename, options)
+  return require("sqlite/async").open(filename, options)
+end
+
 local function db_call_user_func(context, func, num_values, values)
   -- Don't use table.insert() because of nils in lua-5.1
   local arg = { }
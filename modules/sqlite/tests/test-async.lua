@@ -0,0 +1,120 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local async  = require('sqlite/async')
+
+-- 数据库测试需要编译 lsqlite (BUILD_SQLITE)
+local hasSqlite = pcall(require, 'lsqlite')
+
+local tap = require('ext/tap')
+local test = tap.test
+
+test("async encode", function()
+    local message = { 1, 'query', nil, { 'a', nil, 3.5, true, n = 4, name = 'x' } }
+    local data = async.encode(message) .. async.encode({ 2 })
+
+    local result, position = async.decode(data, 1)
+    assert(result[1] == 1 and result[2] == 'query' and result[3] == nil)
+    assert(math.type(result[1]) == 'integer')
+
+    local params = result[4]
+    assert(params.n == 4 and params[1] == 'a' and params[2] == nil)
+    assert(params[3] == 3.5 and params[4] == true and params.name == 'x')
+
+    result = async.decode(data, position)
+    assert(result[1] == 2)
+
+    -- 不完整的消息
+    assert(async.decode(data:sub(1, 10), 1) == nil)
+end)
+
+test("async encode with nil holes", function()
+    -- 没有 n 的表, 整数键按键值对编码, 不依赖 # 运算符
+    local data = async.encode({ 3, nil, { 'a' } }) .. async.encode(table.pack(4, nil, nil, 'x'))
+
+    local result, position = async.decode(data, 1)
+    assert(result[1] == 3 and result[2] == nil and result[3][1] == 'a')
+    assert(result.n == nil)
+
+    result = async.decode(data, position)
+    assert(result.n == 4 and result[1] == 4 and result[4] == 'x')
+end)
+
+test("async database", function(expect)
+    if (not hasSqlite) then
+        print('lsqlite not found, skip')
+        return
+    end
+
+    local sqlite = require('sqlite')
+    local db = sqlite.open_async(':memory:', { cacheSize = 2 })
+
+    db:exec('CREATE TABLE points (id INTEGER PRIMARY KEY, name TEXT, value REAL)')
+
+    local rows = {}
+    for i = 1, 100 do
+        rows[i] = { 'p' .. i, i * 0.5 }
+    end
+
+    db:executeMany('INSERT INTO points (name, value) VALUES (?, ?)', rows, expect(function(err, result)
+        assert(not err, err)
+        assert(result.changes == 100)
+    end))
+
+    -- 出错时回滚整个事务
+    db:executeMany('INSERT INTO points (id, name) VALUES (?, ?)', { { 1000, 'a' }, { 1000, 'b' } }, expect(function(err)
+        assert(err)
+    end))
+
+    db:run('INSERT INTO points (name, value) VALUES (:name, :value)', { name = 'x', value = 1 }, expect(function(err, result)
+        assert(not err, err)
+        assert(result.changes == 1 and result.lastInsertRowid == 101)
+    end))
+
+    db:query('SELECT name, value FROM points WHERE id <= ? ORDER BY id', { 3 }, expect(function(err, result)
+        assert(not err, err)
+        assert(result.count == 3)
+        assert(result.columns[1] == 'name' and result.columns[2] == 'value')
+        assert(result.values[1] == 'p1' and result.values[6] == 1.5)
+
+        local list = async.toRows(result)
+        assert(list[2].name == 'p2')
+    end))
+
+    db:query('SELECT COUNT(*) AS count FROM points', expect(function(err, result)
+        assert(not err, err)
+        assert(result.values[1] == 101)
+    end))
+
+    db:query('SELECT * FROM missing', expect(function(err)
+        assert(err)
+    end))
+
+    db:getStats(expect(function(err, stats)
+        assert(stats.cached == 2)
+        assert(stats.evictions > 0)
+    end))
+
+    db:close(expect(function(err)
+        assert(not err)
+        db:query('SELECT 1', expect(function(err)
+            assert(err == 'database closed')
+        end))
+    end))
+end)
+
+tap.run()
@@ -0,0 +1,384 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+
+-------------------------------------------------------------------------------
+-- 时间序列数据块的编解码 (Gorilla 压缩)
+--
+-- 时间戳 (毫秒) 使用 delta-of-delta 编码:
+--  - 第一个时间戳保存在块头中, 第二个保存与第一个的差值 (64 位)
+--  - 之后保存 dod = (t[n] - t[n-1]) - (t[n-1] - t[n-2]):
+--    '0'                    dod == 0
+--    '10'   + 7 位有符号数
+--    '110'  + 9 位有符号数
+--    '1110' + 12 位有符号数
+--    '1111' + 64 位
+--
+-- 值 (双精度浮点数) 使用 XOR 编码:
+--  - 第一个值保存 64 位
+--  - 之后保存与前一个值的 XOR:
+--    '0'                     XOR 为 0 (值没有变化)
+--    '10' + 有效位           前导零和末尾零不少于前一次, 使用前一次的有效位范围
+--    '11' + 5 位前导零个数 + 6 位有效位长度 + 有效位
+--
+-- 块的格式:
+--  | length (4) | name (1 + N) | count (4) | first time (8) | last time (8) | bits |
+
+local exports = {}
+
+local spack   = string.pack
+local sunpack = string.unpack
+local schar   = string.char
+local sbyte   = string.byte
+
+-------------------------------------------------------------------------------
+-- BitWriter
+
+local BitWriter = {}
+BitWriter.__index = BitWriter
+
+function BitWriter.new()
+    return setmetatable({ bytes = {}, current = 0, used = 0 }, BitWriter)
+end
+
+-- 写入 value 的低 count 位, 高位在前
+function BitWriter:write(value, count)
+    local bytes = self.bytes
+    local current, used = self.current, self.used
+
+    while (count > 0) do
+        local take = 8 - used
+        if (take > count) then
+            take = count
+        end
+
+        local bits = (value >> (count - take)) & ((1 << take) - 1)
+        current = (current << take) | bits
+        used = used + take
+        count = count - take
+
+        if (used == 8) then
+            bytes[#bytes + 1] = current
+            current, used = 0, 0
+        end
+    end
+
+    self.current, self.used = current, used
+end
+
+function BitWriter:toString()
+    local bytes = self.bytes
+    local parts = {}
+    for i = 1, #bytes, 4096 do
+        parts[#parts + 1] = schar(table.unpack(bytes, i, math.min(i + 4095, #bytes)))
+    end
+
+    if (self.used > 0) then
+        parts[#parts + 1] = schar(self.current << (8 - self.used))
+    end
+
+    return table.concat(parts)
+end
+
+-------------------------------------------------------------------------------
+-- BitReader
+
+local BitReader = {}
+BitReader.__index = BitReader
+
+function BitReader.new(data, position)
+    return setmetatable({ data = data, position = position or 1, current = 0, left = 0 }, BitReader)
+end
+
+function BitReader:read(count)
+    local value = 0
+    local data = self.data
+    local current, left, position = self.current, self.left, self.position
+
+    while (count > 0) do
+        if (left == 0) then
+            current = sbyte(data, position) or 0
+            position = position + 1
+            left = 8
+        end
+
+        local take = left
+        if (take > count) then
+            take = count
+        end
+
+        local bits = (current >> (left - take)) & ((1 << take) - 1)
+        value = (value << take) | bits
+        left = left - take
+        count = count - take
+    end
+
+    self.current, self.left, self.position = current, left, position
+    return value
+end
+
+-------------------------------------------------------------------------------
+-- helpers
+
+local function toBits(value)
+    return sunpack('<i8', spack('<d', value))
+end
+
+local function fromBits(bits)
+    return sunpack('<d', spack('<i8', bits))
+end
+
+local function leadingZeros(value)
+    if (value == 0) then
+        return 64
+    end
+
+    local count = 0
+    while (value & 0x8000000000000000) == 0 do
+        value = value << 1
+        count = count + 1
+    end
+    return count
+end
+
+local function trailingZeros(value)
+    if (value == 0) then
+        return 64
+    end
+
+    local count = 0
+    while (value & 1) == 0 do
+        value = value >> 1
+        count = count + 1
+    end
+    return count
+end
+
+-- 把 count 位的有符号数还原
+local function signExtend(value, count)
+    local sign = 1 << (count - 1)
+    if (value & sign) ~= 0 then
+        return value - (1 << count)
+    end
+    return value
+end
+
+local DOD_BUCKETS = {
+    { prefix = 0x2, prefixBits = 2, bits = 7 },
+    { prefix = 0x6, prefixBits = 3, bits = 9 },
+    { prefix = 0xE, prefixBits = 4, bits = 12 }
+}
+
+-------------------------------------------------------------------------------
+-- chunk
+
+-- 编码一个数据块
+-- @param {string} name 序列名称
+-- @param {number[]} times 时间戳 (毫秒, 整数), 必须是递增的
+-- @param {number[]} values 值
+-- @param {number} first 可选, 开始的位置
+-- @param {number} last 可选, 结束的位置
+-- @return {string} 编码后的块, 包括 4 字节长度
+function exports.encodeChunk(name, times, values, first, last)
+    first = first or 1
+    last = last or #times
+
+    local writer = BitWriter.new()
+    local count = last - first + 1
+
+    local previousTime = math.tointeger(times[first])
+    local previousDelta = 0
+    local previousBits = toBits(values[first] + 0.0)
+    local previousLeading, previousTrailing = -1, 0
+
+    writer:write(previousBits, 64)
+
+    for i = first + 1, last do
+        -- time
+        local time = math.tointeger(times[i])
+        local delta = time - previousTime
+        if (i == first + 1) then
+            writer:write(delta, 64)
+
+        else
+            local dod = delta - previousDelta
+            if (dod == 0) then
+                writer:write(0, 1)
+
+            else
+                local written = false
+                for _, bucket in ipairs(DOD_BUCKETS) do
+                    local limit = 1 << (bucket.bits - 1)
+                    if (dod >= -limit) and (dod < limit) then
+                        writer:write(bucket.prefix, bucket.prefixBits)
+                        writer:write(dod, bucket.bits)
+                        written = true
+                        break
+                    end
+                end
+
+                if (not written) then
+                    writer:write(0xF, 4)
+                    writer:write(dod, 64)
+                end
+            end
+        end
+
+        previousTime, previousDelta = time, delta
+
+        -- value
+        local bits = toBits(values[i] + 0.0)
+        local xor = bits ~ previousBits
+        if (xor == 0) then
+            writer:write(0, 1)
+
+        else
+            local leading = leadingZeros(xor)
+            local trailing = trailingZeros(xor)
+            if (leading > 31) then
+                leading = 31
+            end
+
+            if (previousLeading >= 0) and (leading >= previousLeading) and (trailing >= previousTrailing) then
+                writer:write(0x2, 2)
+                writer:write(xor >> previousTrailing, 64 - previousLeading - previousTrailing)
+
+            else
+                local significant = 64 - leading - trailing
+                writer:write(0x3, 2)
+                writer:write(leading, 5)
+                writer:write(significant & 0x3F, 6) -- 64 保存为 0
+                writer:write(xor >> trailing, significant)
+                previousLeading, previousTrailing = leading, trailing
+            end
+        end
+
+        previousBits = bits
+    end
+
+    local header = spack('>s1I4i8i8', name, count,
+        math.tointeger(times[first]), math.tointeger(times[last]))
+    local body = header .. writer:toString()
+    return spack('>s4', body)
+end
+
+-- 块头的最大长度: 4 字节长度, 名称 (1 + 255), count, firstTime, lastTime
+exports.MAX_HEADER_SIZE = 4 + 256 + 4 + 8 + 8
+
+-- 读取块头
+-- @return header, nextPosition; 数据不完整时返回 nil
+--  header 为 { name, count, firstTime, lastTime, position, length }
+function exports.decodeHeader(data, position)
+    if (#data - position + 1 < 4) then
+        return nil
+    end
+
+    local length = sunpack('>I4', data, position)
+    if (#data - position + 1 < length + 4) then
+        return nil
+    end
+
+    return exports.parseHeader(data, position)
+end
+
+-- 只解析块头, 不要求 data 包含整个块, 用于打开时只读取块头建立索引
+-- @return header, nextPosition; 块头不完整时返回 nil
+function exports.parseHeader(data, position)
+    local available = #data - position + 1
+    if (available < 5) or (available < 4 + 1 + data:byte(position + 4) + 20) then
+        return nil
+    end
+
+    local length = sunpack('>I4', data, position)
+    local name, count, firstTime, lastTime, bitsPosition = sunpack('>s1I4i8i8', data, position + 4)
+    local header = {
+        name = name,
+        count = count,
+        firstTime = firstTime,
+        lastTime = lastTime,
+        position = position,
+        length = length + 4,
+        bitsPosition = bitsPosition - position + 1
+    }
+
+    return header, position + 4 + length
+end
+
+-- 解码一个块
+-- @param {string} data 包含这个块的数据
+-- @param {number} position 块在 data 中的位置
+-- @param {function} callback function(time, value), 按时间顺序调用
+-- @return header
+function exports.decodeChunk(data, position, callback)
+    local header = exports.decodeHeader(data, position)
+    if (not header) then
+        return nil
+    end
+
+    local reader = BitReader.new(data, position + header.bitsPosition - 1)
+    local time = header.firstTime
+    local delta = 0
+    local bits = reader:read(64)
+    local leading, trailing = 0, 0
+
+    callback(time, fromBits(bits))
+
+    for i = 2, header.count do
+        if (i == 2) then
+            delta = reader:read(64)
+
+        elseif (reader:read(1) == 1) then
+            local dod
+            if (reader:read(1) == 0) then
+                dod = signExtend(reader:read(7), 7)
+            elseif (reader:read(1) == 0) then
+                dod = signExtend(reader:read(9), 9)
+            elseif (reader:read(1) == 0) then
+                dod = signExtend(reader:read(12), 12)
+            else
+                dod = reader:read(64)
+            end
+
+            delta = delta + dod
+        end
+
+        time = time + delta
+
+        if (reader:read(1) == 1) then
+            if (reader:read(1) == 1) then
+                leading = reader:read(5)
+                local significant = reader:read(6)
+                if (significant == 0) then
+                    significant = 64
+                end
+                trailing = 64 - leading - significant
+            end
+
+            local xor = reader:read(64 - leading - trailing) << trailing
+            bits = bits ~ xor
+        end
+
+        callback(time, fromBits(bits))
+    end
+
+    return header
+end
+
+exports.BitWriter = BitWriter
+exports.BitReader = BitReader
+
+return exports
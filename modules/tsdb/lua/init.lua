@@ -0,0 +1,539 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local core  = require('core')
+local fs    = require('fs')
+local path  = require('path')
+local uv    = require('luv')
+
+local codec = require('tsdb/codec')
+
+-------------------------------------------------------------------------------
+-- 嵌入式时间序列存储
+--
+-- 用来保存传感器的采集数据, 代替逐行写入 sqlite:
+-- - 写入的数据先缓存在内存中, 每隔 flushInterval 或者缓存的点数达到 chunkSize
+--   时, 把每个序列压缩为一个数据块 (参考 tsdb/codec), 追加到当天的数据文件中
+-- - 数据文件只追加不修改, 按天分文件 (YYYYMMDD.tsd), 过期的文件整个删除
+-- - 打开时扫描块头建立索引, 查询时只读取时间范围内的数据块
+-- - 查询可以按时间段降采样, 每段返回最小值, 最大值, 平均值
+--
+-- 对闪存来说, 批量追加压缩后的数据块比逐行写入数据库的写放大小得多.
+
+local exports = {}
+
+local FILE_EXT = '.tsd'
+local DAY = 24 * 3600 * 1000
+
+local Store = core.Emitter:extend()
+exports.Store = Store
+
+-- @param {string} dirname 数据文件所在的目录
+-- @param {object} options
+--  - flushInterval {number} 写入文件的间隔 (毫秒), 默认为 10000
+--  - chunkSize {number} 每个序列缓存多少个点后立即写入文件, 默认为 1024
+--  - retention {number} 数据保留的天数, 默认为 0 表示一直保留
+function Store:initialize(dirname, options)
+    options = options or {}
+
+    self.dirname       = dirname
+    self.flushInterval = options.flushInterval or 10000
+    self.chunkSize     = options.chunkSize or 1024
+    self.retention     = options.retention or 0
+
+    self.buffers  = {} -- 每个序列还没有写入文件的数据 { times, values }
+    self.index    = {} -- 每个序列的数据块 { file, position, length, firstTime, lastTime }
+    self.fileSizes = {}
+    self.flushing = false
+    self.flushQueue = {} -- 等待写入文件的数据块
+
+    self.stats = { points = 0, chunks = 0, bytes = 0 }
+
+    fs.mkdirpSync(dirname)
+    self:_loadIndex()
+    self:_removeExpiredFiles()
+
+    local timer = uv.new_timer()
+    uv.timer_start(timer, self.flushInterval, self.flushInterval, function()
+        self:flush()
+    end)
+    uv.unref(timer)
+    self.timer = timer
+end
+
+-- 写入一个点
+-- @param {string} name 序列名称
+-- @param {number} value 值
+-- @param {number} time 可选, 时间戳 (毫秒), 默认为当前时间
+function Store:write(name, value, time)
+    time = math.tointeger(time or Date.now()) or math.floor(time)
+
+    local buffer = self.buffers[name]
+    if (not buffer) then
+        buffer = { times = {}, values = {} }
+        self.buffers[name] = buffer
+    end
+
+    -- 时间必须是递增的, 乱序的点在这个块写入后再开始新块
+    local count = #buffer.times
+    if (count > 0) and (time < buffer.times[count]) then
+        self:_flushSeries(name)
+        return self:write(name, value, time)
+    end
+
+    buffer.times[count + 1] = time
+    buffer.values[count + 1] = value
+    self.stats.points = self.stats.points + 1
+
+    if (count + 1 >= self.chunkSize) then
+        self:_flushSeries(name)
+    end
+end
+
+-- 写入多个序列的值
+-- @param {object} values 以序列名称为键, 值为值的表
+-- @param {number} time 可选, 时间戳 (毫秒)
+function Store:writeAll(values, time)
+    time = time or Date.now()
+    for name, value in pairs(values) do
+        self:write(name, value, time)
+    end
+end
+
+-- 把所有缓存的数据写入文件
+-- @param {function} callback 可选, function(err) 写入完成后调用
+function Store:flush(callback)
+    for name in pairs(self.buffers) do
+        self:_flushSeries(name)
+    end
+
+    self:_enqueue(nil, callback)
+end
+
+-- 返回所有的序列名称
+function Store:getSeries()
+    local names = {}
+    local seen = {}
+    for _, list in ipairs({ self.index, self.buffers }) do
+        for name in pairs(list) do
+            if (not seen[name]) then
+                seen[name] = true
+                names[#names + 1] = name
+            end
+        end
+    end
+
+    table.sort(names)
+    return names
+end
+
+-- 查询一个序列
+-- @param {string} name 序列名称
+-- @param {object} options
+--  - from {number} 开始时间 (毫秒), 默认为 0
+--  - to {number} 结束时间 (毫秒), 默认为当前时间
+--  - bucket {number} 降采样的时间段长度 (毫秒), 为 nil 时返回原始数据
+-- @param {function} callback function(err, result)
+--  原始数据: { name, from, to, points = { {time, value}, ... } }
+--  降采样:   { name, from, to, bucket, points = { {time, min, max, avg, count}, ... } }
+function Store:query(name, options, callback)
+    if (type(options) == 'function') then
+        callback, options = options, nil
+    end
+
+    options = options or {}
+    local from = options.from or 0
+    local to = options.to or Date.now()
+    local bucket = options.bucket
+
+    local aggregator = exports.createAggregator(from, bucket)
+    local function add(time, value)
+        if (time >= from) and (time <= to) then
+            aggregator.add(time, value)
+        end
+    end
+
+    local chunks = {}
+    for _, chunk in ipairs(self.index[name] or {}) do
+        if (chunk.lastTime >= from) and (chunk.firstTime <= to) then
+            chunks[#chunks + 1] = chunk
+        end
+    end
+
+    -- 还没有写入文件的数据块和缓存中的数据
+    for _, entry in ipairs(self.flushQueue) do
+        local item = entry.item
+        if (item) and (item.name == name) then
+            codec.decodeChunk(item.data, 1, add)
+        end
+    end
+
+    local buffer = self.buffers[name]
+    if (buffer) then
+        for i = 1, #buffer.times do
+            add(buffer.times[i], buffer.values[i])
+        end
+    end
+
+    self:_readChunks(chunks, add, function(err)
+        if (err) then
+            return callback(err)
+        end
+
+        callback(nil, {
+            name = name,
+            from = from,
+            to = to,
+            bucket = bucket,
+            points = aggregator.finish()
+        })
+    end)
+end
+
+function Store:close(callback)
+    if (self.timer) then
+        uv.close(self.timer)
+        self.timer = nil
+    end
+
+    self:flush(callback)
+end
+
+-------------------------------------------------------------------------------
+-- internal
+
+function Store:_getFilename(time)
+    return path.join(self.dirname, os.date('!%Y%m%d', time // 1000) .. FILE_EXT)
+end
+
+-- 打开时扫描所有的数据文件, 只读取块头建立索引
+function Store:_loadIndex()
+    local files = fs.readdirSync(self.dirname) or {}
+    table.sort(files)
+
+    for _, file in ipairs(files) do
+        if (file:endsWith(FILE_EXT)) then
+            local filename = path.join(self.dirname, file)
+            self.fileSizes[filename] = self:_loadFileIndex(filename)
+        end
+    end
+end
+
+-- 每个块只读取开头的块头, 然后根据块的长度跳到下一个块, 不读取块的数据
+-- @return {number} 有效数据的长度
+function Store:_loadFileIndex(filename)
+    local fd = fs.openSync(filename, 'r+')
+    if (not fd) then
+        return 0
+    end
+
+    local statInfo = fs.fstatSync(fd)
+    local fileSize = (statInfo and statInfo.size) or 0
+
+    local position = 0
+    while (position < fileSize) do
+        local size = math.min(codec.MAX_HEADER_SIZE, fileSize - position)
+        local data = fs.readSync(fd, size, position) or ''
+        local header = codec.parseHeader(data, 1)
+        if (not header) or (position + header.length > fileSize) then
+            break
+        end
+
+        self:_addToIndex(header.name, {
+            file = filename,
+            position = position,
+            length = header.length,
+            count = header.count,
+            firstTime = header.firstTime,
+            lastTime = header.lastTime
+        })
+        position = position + header.length
+    end
+
+    -- 删除最后一个不完整的块 (比如写入时断电)
+    if (position < fileSize) then
+        fs.ftruncateSync(fd, position)
+    end
+
+    fs.closeSync(fd)
+
+    return position
+end
+
+function Store:_addToIndex(name, chunk)
+    local list = self.index[name]
+    if (not list) then
+        list = {}
+        self.index[name] = list
+    end
+
+    list[#list + 1] = chunk
+    self.stats.chunks = self.stats.chunks + 1
+end
+
+function Store:_removeExpiredFiles()
+    if (self.retention <= 0) then
+        return
+    end
+
+    local expired = self:_getFilename(Date.now() - self.retention * DAY)
+    for filename in pairs(self.fileSizes) do
+        if (filename < expired) then
+            fs.unlink(filename, function() end)
+            self.fileSizes[filename] = nil
+        end
+    end
+
+    for name, list in pairs(self.index) do
+        local kept = {}
+        for _, chunk in ipairs(list) do
+            if (chunk.file >= expired) then
+                kept[#kept + 1] = chunk
+            end
+        end
+        self.index[name] = (#kept > 0) and kept or nil
+    end
+end
+
+-- 把一个序列缓存的数据编码为数据块, 同一天的点放在同一个文件中
+function Store:_flushSeries(name)
+    local buffer = self.buffers[name]
+    if (not buffer) or (#buffer.times == 0) then
+        return
+    end
+
+    self.buffers[name] = nil
+
+    local times, values = buffer.times, buffer.values
+    local first = 1
+    while (first <= #times) do
+        local filename = self:_getFilename(times[first])
+        local last = first
+        while (last < #times) and (self:_getFilename(times[last + 1]) == filename) do
+            last = last + 1
+        end
+
+        local data = codec.encodeChunk(name, times, values, first, last)
+        self:_enqueue({
+            name = name,
+            file = filename,
+            data = data,
+            count = last - first + 1,
+            firstTime = times[first],
+            lastTime = times[last]
+        })
+
+        first = last + 1
+    end
+end
+
+-- 所有的写入操作按顺序进行, 这样才能知道每个块在文件中的位置
+function Store:_enqueue(item, callback)
+    table.insert(self.flushQueue, { item = item, callback = callback })
+    self:_processQueue()
+end
+
+function Store:_processQueue()
+    if (self.flushing) then
+        return
+    end
+
+    local entry = self.flushQueue[1]
+    if (not entry) then
+        return
+    end
+
+    local item = entry.item
+    if (not item) then
+        table.remove(self.flushQueue, 1)
+        if (entry.callback) then entry.callback() end
+        return self:_processQueue()
+    end
+
+    -- 写入完成之前这个块还留在队列中, 查询时可以读到
+    self.flushing = true
+    fs.appendFile(item.file, item.data, function(err)
+        self.flushing = false
+        table.remove(self.flushQueue, 1)
+
+        if (err) then
+            self:emit('error', err)
+
+        else
+            local size = self.fileSizes[item.file] or 0
+            self.fileSizes[item.file] = size + #item.data
+            self.stats.bytes = self.stats.bytes + #item.data
+
+            self:_addToIndex(item.name, {
+                file = item.file,
+                position = size,
+                length = #item.data,
+                count = item.count,
+                firstTime = item.firstTime,
+                lastTime = item.lastTime
+            })
+
+            -- 新的一天, 删除过期的文件
+            if (size == 0) then
+                self:_removeExpiredFiles()
+            end
+        end
+
+        if (entry.callback) then entry.callback(err) end
+        self:_processQueue()
+    end)
+end
+
+-- 按顺序读取并解码数据块, 同一个文件只打开一次
+function Store:_readChunks(chunks, onPoint, callback)
+    local index = 0
+    local fd, openFile
+
+    local function finish(err)
+        if (fd) then
+            fs.close(fd, function() end)
+            fd = nil
+        end
+        callback(err)
+    end
+
+    local function nextChunk()
+        index = index + 1
+        local chunk = chunks[index]
+        if (not chunk) then
+            return finish()
+        end
+
+        local function readChunk()
+            fs.read(fd, chunk.length, chunk.position, function(err, data)
+                if (err) then
+                    return finish(err)
+                end
+
+                if (data) and (#data == chunk.length) then
+                    codec.decodeChunk(data, 1, onPoint)
+                end
+
+                nextChunk()
+            end)
+        end
+
+        if (openFile == chunk.file) then
+            return readChunk()
+        end
+
+        if (fd) then
+            fs.close(fd, function() end)
+            fd = nil
+        end
+
+        fs.open(chunk.file, 'r', function(err, newFd)
+            if (err) then
+                return finish(err)
+            end
+
+            fd, openFile = newFd, chunk.file
+            readChunk()
+        end)
+    end
+
+    nextChunk()
+end
+
+-------------------------------------------------------------------------------
+-- exports
+
+-- 创建一个降采样聚合器
+-- @param {number} from 开始时间
+-- @param {number} bucket 时间段长度, 为 nil 时不降采样
+function exports.createAggregator(from, bucket)
+    local points = {}
+    local aggregator = {}
+
+    if (not bucket) or (bucket <= 0) then
+        function aggregator.add(time, value)
+            points[#points + 1] = { time, value }
+        end
+
+        function aggregator.finish()
+            table.sort(points, function(a, b) return a[1] < b[1] end)
+            return points
+        end
+
+        return aggregator
+    end
+
+    local buckets = {}
+    function aggregator.add(time, value)
+        local key = (time - from) // bucket
+        local item = buckets[key]
+        if (not item) then
+            buckets[key] = { from + key * bucket, value, value, value, 1 }
+            return
+        end
+
+        if (value < item[2]) then item[2] = value end
+        if (value > item[3]) then item[3] = value end
+        item[4] = item[4] + value
+        item[5] = item[5] + 1
+    end
+
+    function aggregator.finish()
+        for _, item in pairs(buckets) do
+            item[4] = item[4] / item[5]
+            points[#points + 1] = item
+        end
+
+        table.sort(points, function(a, b) return a[1] < b[1] end)
+        return points
+    end
+
+    return aggregator
+end
+
+-- 创建一个 express 路由处理函数, 以 JSON 格式返回查询结果, 可以直接用于 Web 界面:
+-- GET ?name=temperature&from=...&to=...&bucket=60000
+function exports.createQueryHandler(store)
+    return function(request, response)
+        local query = request.query or {}
+        local name = query.name
+        if (not name) then
+            return response:json({ code = 400, error = 'name is required' })
+        end
+
+        store:query(name, {
+            from = tonumber(query.from),
+            to = tonumber(query.to),
+            bucket = tonumber(query.bucket)
+        }, function(err, result)
+            if (err) then
+                return response:json({ code = 500, error = tostring(err) })
+            end
+
+            response:json(result)
+        end)
+    end
+end
+
+-- 打开一个时间序列存储
+function exports.open(dirname, options)
+    return Store:new(dirname, options)
+end
+
+exports.codec = codec
+
+return exports
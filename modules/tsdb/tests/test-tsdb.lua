@@ -0,0 +1,121 @@
+--[[
+
+Copyright 2016 The Node.lua Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS-IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+--]]
+local fs   = require('fs')
+local path = require('path')
+local tsdb = require('tsdb')
+
+local codec = tsdb.codec
+
+local tap = require('ext/tap')
+local test = tap.test
+
+local dirname = path.join(os.tmpdir, 'lnode-test-tsdb-' .. process.pid)
+
+local function removeAll()
+    for _, file in ipairs(fs.readdirSync(dirname) or {}) do
+        fs.unlinkSync(path.join(dirname, file))
+    end
+    fs.rmdirSync(dirname)
+end
+
+test("tsdb codec", function()
+    local times, values = {}, {}
+    local time = 1500000000000
+    for i = 1, 1000 do
+        -- 大部分间隔为 1 秒, 偶尔有抖动和很大的间隔
+        time = time + 1000 + ((i % 7 == 0) and 13 or 0) + ((i % 100 == 0) and 86400000 or 0)
+        times[i] = time
+        values[i] = (i % 10 == 0) and (20 + i / 1000) or 21.5
+    end
+    values[500] = -1e300
+    values[501] = 1e-300
+
+    local data = codec.encodeChunk('temperature', times, values)
+
+    -- 压缩后每个点远小于 16 字节
+    assert(#data < 1000 * 4, #data)
+
+    local index = 0
+    local header = codec.decodeChunk(data, 1, function(t, v)
+        index = index + 1
+        assert(t == times[index], index)
+        assert(v == values[index], index)
+    end)
+
+    assert(index == 1000)
+    assert(header.name == 'temperature' and header.count == 1000)
+    assert(header.firstTime == times[1] and header.lastTime == times[1000])
+
+    -- 不完整的块
+    assert(codec.decodeHeader(data:sub(1, -2), 1) == nil)
+
+    -- 只有块头
+    header = codec.parseHeader(data:sub(1, codec.MAX_HEADER_SIZE), 1)
+    assert(header.name == 'temperature' and header.length == #data)
+    assert(codec.parseHeader(data:sub(1, 20), 1) == nil)
+end)
+
+test("tsdb store", function(expect)
+    local store = tsdb.open(dirname, { chunkSize = 50 })
+    local start = 1500000000000
+
+    for i = 0, 119 do
+        store:write('humidity', i, start + i * 1000)
+    end
+    store:write('temperature', 25.5, start)
+
+    -- 50 个点一个块, 已经写入了 2 个块, 剩下的还在缓存中
+    store:query('humidity', { from = start, to = start + 200000, bucket = 60000 }, expect(function(err, result)
+        assert(not err, err)
+        assert(#result.points == 2)
+
+        local first = result.points[1]
+        assert(first[1] == start)
+        assert(first[2] == 0 and first[3] == 59 and first[4] == 29.5 and first[5] == 60)
+
+        store:close(expect(function(err)
+            assert(not err, err)
+
+            -- 模拟写入时断电, 文件最后有一个不完整的块
+            local filename
+            for _, file in ipairs(fs.readdirSync(dirname)) do
+                filename = dirname .. '/' .. file
+            end
+
+            local size = fs.statSync(filename).size
+            local chunk = codec.encodeChunk('humidity', { start }, { 1 })
+            fs.appendFileSync(filename, chunk:sub(1, -3))
+
+            -- 重新打开后从文件中读取
+            store = tsdb.open(dirname)
+            assert(#store:getSeries() == 2)
+            assert(fs.statSync(filename).size == size)
+
+            store:query('humidity', { from = start + 10000, to = start + 19999 }, expect(function(err, result)
+                assert(not err, err)
+                assert(#result.points == 10)
+                assert(result.points[1][1] == start + 10000 and result.points[1][2] == 10)
+
+                store:close()
+                removeAll()
+            end))
+        end))
+    end))
+end)
+
+tap.run()